@@ -32,6 +32,7 @@
 ****************************************************************************/
 
 #include "benchmarkcontext.h"
+#include "mockserver.h"
 #include "testfsusage.h"
 #if defined(Q_OS_LINUX)
 #include "testmalloc.h"
@@ -59,6 +60,8 @@ class BenchmarkContextPrivate
 {
 public:
     bool xml;
+    const MockServer *server;
+    int roundTrips;
     qint64 qmfUsage;
     QTime time;
 #ifdef HAVE_TICK_COUNTER
@@ -66,10 +69,12 @@ public:
 #endif
 };
 
-BenchmarkContext::BenchmarkContext(bool xml)
+BenchmarkContext::BenchmarkContext(bool xml, const MockServer *server)
     : d(new BenchmarkContextPrivate)
 {
     d->xml = xml;
+    d->server = server;
+    d->roundTrips = server ? server->roundTrips() : 0;
     d->qmfUsage = TestFsUsage::usage(QMail::dataPath());
 
 #ifdef HAVE_TICK_COUNTER
@@ -163,6 +168,7 @@ BenchmarkContext::~BenchmarkContext()
         quint64 cycles = quint64(elapsed(newTicks,d->ticks));
 #endif
         qint64 diskUsage = (newQmfUsage - d->qmfUsage) / 1000;
+        int roundTrips = d->server ? (d->server->roundTrips() - d->roundTrips) : -1;
         if (d->xml) {
             if (!RUNNING_ON_VALGRIND) {
                 fprintf(stdout, "<BenchmarkResult metric=\"kilobytes heap usage\" tag=\"%s\" value=\"%d\" iterations=\"1\"/>\n", QTest::currentDataTag(), heapUsageTotal);
@@ -174,6 +180,9 @@ BenchmarkContext::~BenchmarkContext()
             // `milliseconds walltime' would be better, but keep `walltime' for benchlib
             // compatibility
             fprintf(stdout, "<BenchmarkResult metric=\"walltime\" tag=\"%s\" value=\"%d\" iterations=\"1\"/>\n", QTest::currentDataTag(), ms);
+            if (roundTrips != -1) {
+                fprintf(stdout, "<BenchmarkResult metric=\"round trips\" tag=\"%s\" value=\"%d\" iterations=\"1\"/>\n", QTest::currentDataTag(), roundTrips);
+            }
             fflush(stdout);
         }
         else {
@@ -185,6 +194,9 @@ BenchmarkContext::~BenchmarkContext()
             qWarning("Cycles: %llu", cycles);
 #endif
             qWarning() << "Execution time:" << ms << "ms";
+            if (roundTrips != -1) {
+                qWarning() << "Protocol round trips:" << roundTrips;
+            }
         }
     }
 
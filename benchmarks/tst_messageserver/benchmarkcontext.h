@@ -37,10 +37,17 @@
 #include <QtGlobal>
 
 class BenchmarkContextPrivate;
+class MockServer;
+
+/*
+    Measures time, peak heap and disk usage for its lifetime.  When given a
+    stand-in server, the number of protocol round trips it answered during
+    that time is reported as well.
+*/
 class BenchmarkContext
 {
 public:
-    BenchmarkContext(bool xml = false);
+    BenchmarkContext(bool xml = false, const MockServer *server = 0);
     ~BenchmarkContext();
 
 private:
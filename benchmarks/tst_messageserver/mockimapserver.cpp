@@ -0,0 +1,1275 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "mockimapserver.h"
+
+#include <QDebug>
+#include <QLocale>
+#include <QRegExp>
+#include <QVector>
+
+namespace {
+
+typedef QPair<quint32, quint32> RangePair;
+typedef QList<RangePair> RangeList;
+
+RangeList parseSet(const QByteArray &set, quint32 star)
+{
+    RangeList ranges;
+    foreach (const QByteArray &element, set.split(',')) {
+        int colon = element.indexOf(':');
+        QByteArray first(colon == -1 ? element : element.left(colon));
+        QByteArray last(colon == -1 ? element : element.mid(colon + 1));
+
+        quint32 low = (first == "*") ? star : first.toUInt();
+        quint32 high = (last == "*") ? star : last.toUInt();
+        if (low > high)
+            qSwap(low, high);
+        ranges.append(qMakePair(low, high));
+    }
+    return ranges;
+}
+
+bool inRanges(const RangeList &ranges, quint32 value)
+{
+    for (RangeList::const_iterator it = ranges.begin(); it != ranges.end(); ++it) {
+        if (value >= it->first && value <= it->second)
+            return true;
+    }
+    return false;
+}
+
+// Formats an ascending list of values as an IMAP sequence set
+QByteArray compactSet(const QList<quint32> &values)
+{
+    QByteArray result;
+    int i = 0;
+    while (i < values.count()) {
+        int j = i;
+        while ((j + 1) < values.count() && values.at(j + 1) == values.at(j) + 1)
+            ++j;
+
+        if (!result.isEmpty())
+            result += ',';
+        result += QByteArray::number(values.at(i));
+        if (j > i)
+            result += ':' + QByteArray::number(values.at(j));
+        i = j + 1;
+    }
+    return result;
+}
+
+QByteArray joined(const QList<QByteArray> &list, char separator)
+{
+    QByteArray result;
+    foreach (const QByteArray &item, list) {
+        if (!result.isEmpty())
+            result += separator;
+        result += item;
+    }
+    return result;
+}
+
+QByteArray tagged(const QByteArray &tag, const char *status, const QByteArray &text)
+{
+    return tag + ' ' + status + ' ' + text + "\r\n";
+}
+
+QByteArray literal(const QByteArray &data)
+{
+    return '{' + QByteArray::number(data.size()) + "}\r\n" + data;
+}
+
+QByteArray quoted(const QString &text)
+{
+    QByteArray result(text.toUtf8());
+    result.replace('\\', "\\\\");
+    result.replace('"', "\\\"");
+    return '"' + result + '"';
+}
+
+QByteArray imapDate(const QDateTime &dateTime)
+{
+    return QLocale::c().toString(dateTime.toUTC(), QLatin1String("dd-MMM-yyyy hh:mm:ss")).toLatin1() + " +0000";
+}
+
+bool hasFlag(const QStringList &flags, const QString &flag)
+{
+    return flags.contains(flag, Qt::CaseInsensitive);
+}
+
+bool containsNoCase(const QByteArray &haystack, const QByteArray &needle)
+{
+    const int length = needle.size();
+    const int last = haystack.size() - length;
+    for (int i = 0; i <= last; ++i) {
+        int j = 0;
+        while (j < length && QChar::toLower(ushort(uchar(haystack.at(i + j)))) == QChar::toLower(ushort(uchar(needle.at(j)))))
+            ++j;
+        if (j == length)
+            return true;
+    }
+    return false;
+}
+
+QByteArray headerField(const QByteArray &header, const QByteArray &name)
+{
+    QByteArray result;
+    bool inField = false;
+    foreach (const QByteArray &line, header.split('\n')) {
+        if (!line.isEmpty() && (line.at(0) == ' ' || line.at(0) == '\t')) {
+            if (inField)
+                result += line.trimmed();
+            continue;
+        }
+
+        int colon = line.indexOf(':');
+        inField = (colon != -1) && (line.left(colon).trimmed().toUpper() == name.toUpper());
+        if (inField)
+            result += line.mid(colon + 1).trimmed();
+    }
+    return result;
+}
+
+QByteArray headerFields(const QByteArray &header, const QStringList &names, bool exclude)
+{
+    QByteArray result;
+    bool include = false;
+    foreach (QByteArray line, header.split('\n')) {
+        if (line.endsWith('\r'))
+            line.chop(1);
+        if (line.isEmpty())
+            continue;
+
+        if (line.at(0) != ' ' && line.at(0) != '\t') {
+            int colon = line.indexOf(':');
+            QString name(QString::fromLatin1(line.left(colon).trimmed()));
+            include = (colon != -1) && (names.contains(name, Qt::CaseInsensitive) != exclude);
+        }
+        if (include)
+            result += line + "\r\n";
+    }
+    return result + "\r\n";
+}
+
+int lowerBound(const QList<MockMessage> &messages, quint32 uid)
+{
+    int low = 0;
+    int high = messages.count();
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (messages.at(mid).uid < uid)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+}
+
+
+MockImapServer::MockImapServer(QObject *parent)
+    : MockServer(parent),
+      _capabilities("IMAP4rev1 LITERAL+ UIDPLUS MOVE IDLE NAMESPACE ENABLE CONDSTORE QRESYNC"),
+      _nextUidValidity(1001)
+{
+    addMailbox(QLatin1String("INBOX"));
+}
+
+MockImapServer::~MockImapServer()
+{
+    qDeleteAll(_mailboxes);
+}
+
+MockMailbox *MockImapServer::mailbox(const QString &name) const
+{
+    foreach (MockMailbox *mailbox, _mailboxes) {
+        if (mailbox->name == name)
+            return mailbox;
+        if ((mailbox->name == QLatin1String("INBOX")) && (name.compare(QLatin1String("INBOX"), Qt::CaseInsensitive) == 0))
+            return mailbox;
+    }
+    return 0;
+}
+
+MockMailbox *MockImapServer::addMailbox(const QString &name)
+{
+    if (MockMailbox *existing = mailbox(name))
+        return existing;
+
+    MockMailbox *mailbox = new MockMailbox;
+    mailbox->name = name;
+    mailbox->uidValidity = _nextUidValidity++;
+    _mailboxes.append(mailbox);
+    return mailbox;
+}
+
+bool MockImapServer::removeMailbox(const QString &name)
+{
+    MockMailbox *existing = mailbox(name);
+    if (!existing)
+        return false;
+
+    _mailboxes.removeAll(existing);
+    delete existing;
+    return true;
+}
+
+bool MockImapServer::renameMailbox(const QString &name, const QString &newName)
+{
+    MockMailbox *existing = mailbox(name);
+    if (!existing || mailbox(newName))
+        return false;
+
+    existing->name = newName;
+    return true;
+}
+
+QStringList MockImapServer::mailboxNames() const
+{
+    QStringList names;
+    foreach (MockMailbox *mailbox, _mailboxes)
+        names.append(mailbox->name);
+    return names;
+}
+
+/*
+    Adds a message to a mailbox as if it had arrived from outside, notifying
+    any session that has the mailbox selected and is idling.
+*/
+void MockImapServer::deliver(const QString &name, const QByteArray &data)
+{
+    MockMailbox *target = mailbox(name);
+    if (!target) {
+        qWarning() << "MockImapServer: no such mailbox" << name;
+        return;
+    }
+
+    target->append(data);
+    changed(target->name);
+}
+
+/*
+    Reports a change made directly to a mailbox, such as a flag set through
+    MockMailbox, to any session that is idling and monitoring the mailbox.
+*/
+void MockImapServer::changed(const QString &name)
+{
+    emit mailboxChanged(name);
+}
+
+void MockImapServer::setCapabilities(const QByteArray &capabilities)
+{
+    _capabilities = capabilities;
+}
+
+MockSession *MockImapServer::createSession(QTcpSocket *socket)
+{
+    return new MockImapSession(this, socket);
+}
+
+
+MockImapSession::MockImapSession(MockImapServer *server, QTcpSocket *socket)
+    : MockSession(server, socket),
+      _authenticated(false),
+      _readOnly(false),
+      _condstore(false),
+      _qresync(false),
+      _knownExists(0)
+{
+    connect(server, SIGNAL(mailboxChanged(QString)), this, SLOT(mailboxChanged(QString)));
+}
+
+void MockImapSession::start()
+{
+    send("* OK [CAPABILITY " + imapServer()->capabilities() + "] IMAP4rev1 benchmark server ready\r\n");
+}
+
+MockImapServer *MockImapSession::imapServer() const
+{
+    return static_cast<MockImapServer*>(server());
+}
+
+MockMailbox *MockImapSession::selected() const
+{
+    if (_selected.isEmpty())
+        return 0;
+    return imapServer()->mailbox(_selected);
+}
+
+void MockImapSession::processLine(const QByteArray &line)
+{
+    if (!_idleTag.isEmpty()) {
+        if (line.trimmed().toUpper() == "DONE") {
+            server()->countRoundTrip(line);
+            send(tagged(_idleTag, "OK", "IDLE terminated"));
+            _idleTag.clear();
+        }
+        return;
+    }
+
+    _pending += line;
+
+    // A line ending in {n} or {n+} is followed by n bytes of literal data
+    if (line.endsWith('}')) {
+        int open = line.lastIndexOf('{');
+        if (open != -1) {
+            QByteArray length(line.mid(open + 1, line.size() - open - 2));
+            bool nonSynchronizing = length.endsWith('+');
+            if (nonSynchronizing)
+                length.chop(1);
+
+            bool ok = false;
+            int size = length.toInt(&ok);
+            if (ok) {
+                _pending.chop(line.size() - open);
+                _pending += "{#" + QByteArray::number(_literals.count()) + '}';
+                if (!nonSynchronizing) {
+                    server()->countRoundTrip("+");
+                    send("+ Ready for literal data\r\n");
+                }
+                expectLiteral(size);
+                return;
+            }
+        }
+    }
+
+    QByteArray command(_pending);
+    _pending.clear();
+    execute(command);
+    _literals.clear();
+}
+
+void MockImapSession::processLiteral(const QByteArray &data)
+{
+    _literals.append(data);
+}
+
+void MockImapSession::mailboxChanged(const QString &name)
+{
+    if (_idleTag.isEmpty())
+        return;
+
+    if (name == _selected) {
+        reportExists();
+    } else if (_notifyMailboxes.contains(name)) {
+        // Changes to other mailboxes are reported by their status, as NOTIFY requires
+        reportStatus(imapServer()->mailbox(name));
+    }
+}
+
+void MockImapSession::reportExists()
+{
+    MockMailbox *mailbox = selected();
+    if (mailbox && (mailbox->messages.count() > _knownExists)) {
+        _knownExists = mailbox->messages.count();
+        send("* " + QByteArray::number(_knownExists) + " EXISTS\r\n");
+    }
+}
+
+void MockImapSession::execute(const QByteArray &line)
+{
+    int space = line.indexOf(' ');
+    if (space <= 0) {
+        send("* BAD Missing command\r\n");
+        return;
+    }
+
+    const QByteArray tag(line.left(space));
+    QByteArray rest(line.mid(space + 1));
+
+    space = rest.indexOf(' ');
+    QByteArray command((space == -1 ? rest : rest.left(space)).toUpper());
+    QByteArray arguments(space == -1 ? QByteArray() : rest.mid(space + 1));
+
+    bool uid = false;
+    if (command == "UID") {
+        uid = true;
+        space = arguments.indexOf(' ');
+        command = (space == -1 ? arguments : arguments.left(space)).toUpper();
+        arguments = (space == -1 ? QByteArray() : arguments.mid(space + 1));
+    }
+
+    server()->countRoundTrip(line);
+    if (scripted(uid ? "UID " + command : command, tag))
+        return;
+
+    const QList<QByteArray> args(tokenize(arguments));
+
+    if (command == "CAPABILITY") {
+        send("* CAPABILITY " + imapServer()->capabilities() + "\r\n");
+        send(tagged(tag, "OK", "CAPABILITY completed"));
+    } else if (command == "NOOP" || command == "CHECK") {
+        reportExists();
+        send(tagged(tag, "OK", command + " completed"));
+    } else if (command == "LOGOUT") {
+        send("* BYE Logging out\r\n");
+        send(tagged(tag, "OK", "LOGOUT completed"));
+        close();
+    } else if (command == "LOGIN") {
+        login(tag, args);
+    } else if (!_authenticated) {
+        send(tagged(tag, "NO", "Not authenticated"));
+    } else if (command == "LIST" || command == "LSUB") {
+        list(tag, command, args);
+    } else if (command == "NAMESPACE") {
+        send("* NAMESPACE ((\"\" \"/\")) NIL NIL\r\n");
+        send(tagged(tag, "OK", "NAMESPACE completed"));
+    } else if (command == "ENABLE") {
+        enable(tag, args);
+    } else if (command == "STATUS") {
+        status(tag, args);
+    } else if (command == "NOTIFY") {
+        notify(tag, args);
+    } else if (command == "SELECT" || command == "EXAMINE") {
+        select(tag, args, command == "EXAMINE");
+    } else if (command == "CREATE") {
+        QString name(QString::fromUtf8(args.value(0)));
+        if (imapServer()->mailbox(name)) {
+            send(tagged(tag, "NO", "[ALREADYEXISTS] Mailbox exists"));
+        } else {
+            imapServer()->addMailbox(name);
+            send(tagged(tag, "OK", "CREATE completed"));
+        }
+    } else if (command == "DELETE") {
+        QString name(QString::fromUtf8(args.value(0)));
+        if ((name.compare(QLatin1String("INBOX"), Qt::CaseInsensitive) == 0) || !imapServer()->removeMailbox(name)) {
+            send(tagged(tag, "NO", "[NONEXISTENT] Cannot delete mailbox"));
+        } else {
+            if (name == _selected)
+                _selected.clear();
+            send(tagged(tag, "OK", "DELETE completed"));
+        }
+    } else if (command == "RENAME") {
+        if (!imapServer()->renameMailbox(QString::fromUtf8(args.value(0)), QString::fromUtf8(args.value(1)))) {
+            send(tagged(tag, "NO", "Cannot rename mailbox"));
+        } else {
+            send(tagged(tag, "OK", "RENAME completed"));
+        }
+    } else if (command == "SUBSCRIBE" || command == "UNSUBSCRIBE") {
+        send(tagged(tag, "OK", command + " completed"));
+    } else if (command == "APPEND") {
+        append(tag, args);
+    } else if (command == "IDLE") {
+        _idleTag = tag;
+        send("+ idling\r\n");
+        reportExists();
+    } else if (!selected()) {
+        send(tagged(tag, "BAD", "No mailbox selected"));
+    } else if (command == "FETCH") {
+        fetch(tag, args, uid);
+    } else if (command == "STORE") {
+        store(tag, args, uid);
+    } else if (command == "COPY" || command == "MOVE") {
+        copy(tag, args, uid, command == "MOVE");
+    } else if (command == "SEARCH") {
+        search(tag, args, uid);
+    } else if (command == "EXPUNGE") {
+        expunge(tag, args, uid);
+    } else if (command == "CLOSE" || command == "UNSELECT") {
+        if (command == "CLOSE" && !_readOnly) {
+            QList<int> deleted;
+            MockMailbox *mailbox = selected();
+            for (int i = 0; i < mailbox->messages.count(); ++i) {
+                if (hasFlag(mailbox->messages.at(i).flags, QLatin1String("\\Deleted")))
+                    deleted.append(i);
+            }
+            expungeIndexes(deleted, false);
+        }
+        _selected.clear();
+        send(tagged(tag, "OK", command + " completed"));
+    } else {
+        send(tagged(tag, "BAD", "Unsupported command " + command));
+    }
+}
+
+void MockImapSession::login(const QByteArray &tag, const QList<QByteArray> &args)
+{
+    if ((QString::fromUtf8(args.value(0)) == server()->user()) && (QString::fromUtf8(args.value(1)) == server()->password())) {
+        _authenticated = true;
+        send(tagged(tag, "OK", "[CAPABILITY " + imapServer()->capabilities() + "] LOGIN completed"));
+    } else {
+        send(tagged(tag, "NO", "[AUTHENTICATIONFAILED] Invalid credentials"));
+    }
+}
+
+void MockImapSession::list(const QByteArray &tag, const QByteArray &command, const QList<QByteArray> &args)
+{
+    QString pattern(QString::fromUtf8(args.value(0) + args.value(1)));
+    if (args.value(1).isEmpty()) {
+        send("* " + command + " (\\Noselect) \"/\" \"\"\r\n");
+        send(tagged(tag, "OK", command + " completed"));
+        return;
+    }
+
+    QString expression;
+    foreach (const QChar &c, pattern) {
+        if (c == QLatin1Char('*'))
+            expression += QLatin1String(".*");
+        else if (c == QLatin1Char('%'))
+            expression += QLatin1String("[^/]*");
+        else
+            expression += QRegExp::escape(QString(c));
+    }
+    QRegExp matcher(expression);
+
+    const QStringList names(imapServer()->mailboxNames());
+    foreach (const QString &name, names) {
+        if (!matcher.exactMatch(name))
+            continue;
+
+        bool children = false;
+        foreach (const QString &other, names) {
+            if (other.startsWith(name + QLatin1Char('/'))) {
+                children = true;
+                break;
+            }
+        }
+        send("* " + command + (children ? " (\\HasChildren)" : " (\\HasNoChildren)") + " \"/\" " + quoted(name) + "\r\n");
+    }
+    send(tagged(tag, "OK", command + " completed"));
+}
+
+void MockImapSession::status(const QByteArray &tag, const QList<QByteArray> &args)
+{
+    MockMailbox *mailbox = imapServer()->mailbox(QString::fromUtf8(args.value(0)));
+    if (!mailbox) {
+        send(tagged(tag, "NO", "[NONEXISTENT] No such mailbox"));
+        return;
+    }
+
+    QList<QByteArray> values;
+    foreach (const QByteArray &item, listItems(args.value(1))) {
+        QByteArray name(item.toUpper());
+        if (name == "MESSAGES") {
+            values << name + ' ' + QByteArray::number(mailbox->messages.count());
+        } else if (name == "RECENT") {
+            values << name + " 0";
+        } else if (name == "UIDNEXT") {
+            values << name + ' ' + QByteArray::number(mailbox->uidNext);
+        } else if (name == "UIDVALIDITY") {
+            values << name + ' ' + QByteArray::number(mailbox->uidValidity);
+        } else if (name == "HIGHESTMODSEQ") {
+            values << name + ' ' + QByteArray::number(mailbox->highestModSeq);
+        } else if (name == "UNSEEN") {
+            int unseen = 0;
+            foreach (const MockMessage &message, mailbox->messages) {
+                if (!hasFlag(message.flags, QLatin1String("\\Seen")))
+                    ++unseen;
+            }
+            values << name + ' ' + QByteArray::number(unseen);
+        }
+    }
+
+    send("* STATUS " + quoted(mailbox->name) + " (" + joined(values, ' ') + ")\r\n");
+    send(tagged(tag, "OK", "STATUS completed"));
+}
+
+void MockImapSession::notify(const QByteArray &tag, const QList<QByteArray> &args)
+{
+    const QByteArray operation(args.value(0).toUpper());
+    if (operation == "NONE") {
+        _notifyMailboxes.clear();
+        send(tagged(tag, "OK", "NOTIFY completed"));
+        return;
+    } else if (operation != "SET") {
+        send(tagged(tag, "BAD", "Unsupported NOTIFY operation"));
+        return;
+    }
+
+    int index = 1;
+    const bool reportInitial = (args.value(index).toUpper() == "STATUS");
+    if (reportInitial)
+        ++index;
+
+    // Only the mailboxes filter is supported; every event is reported for the mailboxes listed
+    QStringList names;
+    for ( ; index < args.count(); ++index) {
+        const QList<QByteArray> group(listItems(args.at(index)));
+        if (group.value(0).toUpper() != "MAILBOXES") {
+            send(tagged(tag, "BAD", "Unsupported NOTIFY filter"));
+            return;
+        }
+        foreach (const QByteArray &name, listItems(group.value(1))) {
+            if (MockMailbox *mailbox = imapServer()->mailbox(QString::fromUtf8(name)))
+                names.append(mailbox->name);
+        }
+    }
+
+    _notifyMailboxes = names;
+    if (reportInitial) {
+        foreach (const QString &name, _notifyMailboxes)
+            reportStatus(imapServer()->mailbox(name));
+    }
+    send(tagged(tag, "OK", "NOTIFY completed"));
+}
+
+void MockImapSession::reportStatus(const MockMailbox *mailbox)
+{
+    if (!mailbox)
+        return;
+
+    QByteArray values("MESSAGES " + QByteArray::number(mailbox->messages.count()) +
+                      " UIDNEXT " + QByteArray::number(mailbox->uidNext) +
+                      " UIDVALIDITY " + QByteArray::number(mailbox->uidValidity));
+    if (_condstore)
+        values += " HIGHESTMODSEQ " + QByteArray::number(mailbox->highestModSeq);
+
+    send("* STATUS " + quoted(mailbox->name) + " (" + values + ")\r\n");
+}
+
+void MockImapSession::select(const QByteArray &tag, const QList<QByteArray> &args, bool readOnly)
+{
+    MockMailbox *mailbox = imapServer()->mailbox(QString::fromUtf8(args.value(0)));
+    if (!mailbox) {
+        _selected.clear();
+        send(tagged(tag, "NO", "[NONEXISTENT] No such mailbox"));
+        return;
+    }
+
+    _selected = mailbox->name;
+    _readOnly = readOnly;
+    _knownExists = mailbox->messages.count();
+
+    QList<QByteArray> resync;
+    const QList<QByteArray> parameters(listItems(args.value(1)));
+    for (int i = 0; i < parameters.count(); ++i) {
+        QByteArray name(parameters.at(i).toUpper());
+        if (name == "CONDSTORE") {
+            _condstore = true;
+        } else if (name == "QRESYNC") {
+            _condstore = true;
+            resync = listItems(parameters.value(++i));
+        }
+    }
+
+    send("* FLAGS (\\Answered \\Flagged \\Deleted \\Seen \\Draft)\r\n");
+    send("* OK [PERMANENTFLAGS (\\Answered \\Flagged \\Deleted \\Seen \\Draft \\*)] Flags permitted\r\n");
+    send("* " + QByteArray::number(mailbox->messages.count()) + " EXISTS\r\n");
+    send("* 0 RECENT\r\n");
+    send("* OK [UIDVALIDITY " + QByteArray::number(mailbox->uidValidity) + "] UIDs valid\r\n");
+    send("* OK [UIDNEXT " + QByteArray::number(mailbox->uidNext) + "] Predicted next UID\r\n");
+    send("* OK [HIGHESTMODSEQ " + QByteArray::number(mailbox->highestModSeq) + "] Highest\r\n");
+
+    if ((resync.count() >= 2) && (resync.at(0).toUInt() == mailbox->uidValidity)) {
+        const quint64 modSeq = resync.at(1).toULongLong();
+        const RangeList known(parseSet(resync.value(2), mailbox->uidNext));
+
+        QList<quint32> vanished;
+        for (int i = 0; i < mailbox->expunged.count(); ++i) {
+            const QPair<quint32, quint64> &entry(mailbox->expunged.at(i));
+            if ((entry.second > modSeq) && (known.isEmpty() || inRanges(known, entry.first)))
+                vanished.append(entry.first);
+        }
+        if (!vanished.isEmpty()) {
+            qSort(vanished);
+            send("* VANISHED (EARLIER) " + compactSet(vanished) + "\r\n");
+        }
+
+        for (int i = 0; i < mailbox->messages.count(); ++i) {
+            const MockMessage &message(mailbox->messages.at(i));
+            if (message.modSeq > modSeq) {
+                send("* " + QByteArray::number(i + 1) + " FETCH ("
+                     + fetchItem(message, "UID") + ' ' + fetchItem(message, "FLAGS") + ' ' + fetchItem(message, "MODSEQ") + ")\r\n");
+            }
+        }
+    }
+
+    send(tagged(tag, "OK", readOnly ? "[READ-ONLY] EXAMINE completed" : "[READ-WRITE] SELECT completed"));
+}
+
+void MockImapSession::enable(const QByteArray &tag, const QList<QByteArray> &args)
+{
+    QList<QByteArray> enabled;
+    foreach (const QByteArray &extension, args) {
+        QByteArray name(extension.toUpper());
+        if (name == "CONDSTORE") {
+            _condstore = true;
+            enabled << name;
+        } else if (name == "QRESYNC") {
+            _condstore = true;
+            _qresync = true;
+            enabled << name;
+        }
+    }
+
+    send("* ENABLED " + joined(enabled, ' ') + "\r\n");
+    send(tagged(tag, "OK", "ENABLE completed"));
+}
+
+void MockImapSession::append(const QByteArray &tag, const QList<QByteArray> &args)
+{
+    MockMailbox *mailbox = imapServer()->mailbox(QString::fromUtf8(args.value(0)));
+    if (!mailbox) {
+        send(tagged(tag, "NO", "[TRYCREATE] No such mailbox"));
+        return;
+    }
+    if (args.count() < 2) {
+        send(tagged(tag, "BAD", "Missing message data"));
+        return;
+    }
+
+    QStringList flags;
+    if (args.at(1).startsWith('(')) {
+        foreach (const QByteArray &flag, listItems(args.at(1)))
+            flags.append(QString::fromLatin1(flag));
+    }
+
+    MockMessage &message(mailbox->append(args.last(), flags));
+    send(tagged(tag, "OK", "[APPENDUID " + QByteArray::number(mailbox->uidValidity) + ' ' + QByteArray::number(message.uid) + "] APPEND completed"));
+
+    if (mailbox->name == _selected)
+        reportExists();
+    emit imapServer()->mailboxChanged(mailbox->name);
+}
+
+QByteArray MockImapSession::fetchItem(const MockMessage &message, const QByteArray &item) const
+{
+    const QByteArray name(item.toUpper());
+
+    if (name == "UID") {
+        return "UID " + QByteArray::number(message.uid);
+    } else if (name == "FLAGS") {
+        return "FLAGS (" + message.flags.join(QLatin1String(" ")).toLatin1() + ')';
+    } else if (name == "INTERNALDATE") {
+        return "INTERNALDATE \"" + imapDate(message.internalDate) + '"';
+    } else if (name == "RFC822.SIZE") {
+        return "RFC822.SIZE " + QByteArray::number(message.data.size());
+    } else if (name == "MODSEQ") {
+        return "MODSEQ (" + QByteArray::number(message.modSeq) + ')';
+    } else if (name == "BODYSTRUCTURE" || name == "BODY") {
+        const QByteArray body(message.body());
+        return name + " (\"TEXT\" \"PLAIN\" (\"CHARSET\" \"US-ASCII\") NIL NIL \"7BIT\" "
+                    + QByteArray::number(body.size()) + ' ' + QByteArray::number(body.count('\n'))
+                    + (name == "BODY" ? ")" : " NIL NIL NIL NIL)");
+    } else if (name == "RFC822") {
+        return "RFC822 " + literal(message.data);
+    } else if (name == "RFC822.HEADER") {
+        return "RFC822.HEADER " + literal(message.header());
+    } else if (name == "RFC822.TEXT") {
+        return "RFC822.TEXT " + literal(message.body());
+    } else if (name.startsWith("BODY[") || name.startsWith("BODY.PEEK[")) {
+        const int open = name.indexOf('[');
+        const int close = name.lastIndexOf(']');
+        if (close < open)
+            return QByteArray();
+
+        const QByteArray section(name.mid(open + 1, close - open - 1));
+        QByteArray content;
+        if (section.isEmpty()) {
+            content = message.data;
+        } else if (section == "HEADER") {
+            content = message.header();
+        } else if (section == "TEXT" || section == "1" || section == "1.TEXT") {
+            content = message.body();
+        } else if (section == "1.MIME") {
+            content = "Content-Type: text/plain; charset=us-ascii\r\nContent-Transfer-Encoding: 7bit\r\n\r\n";
+        } else if (section.startsWith("HEADER.FIELDS")) {
+            QStringList names;
+            foreach (const QByteArray &field, listItems(section.mid(section.indexOf('('))))
+                names.append(QString::fromLatin1(field));
+            content = headerFields(message.header(), names, section.startsWith("HEADER.FIELDS.NOT"));
+        }
+
+        QByteArray label("BODY[" + section + ']');
+        const QByteArray partial(name.mid(close + 1));
+        if (partial.startsWith('<') && partial.endsWith('>')) {
+            const QList<QByteArray> range(partial.mid(1, partial.size() - 2).split('.'));
+            const int start = range.value(0).toInt();
+            content = content.mid(start, range.count() > 1 ? range.at(1).toInt() : -1);
+            label += '<' + QByteArray::number(start) + '>';
+        }
+        return label + ' ' + literal(content);
+    }
+
+    return QByteArray();
+}
+
+void MockImapSession::fetch(const QByteArray &tag, const QList<QByteArray> &args, bool uid)
+{
+    MockMailbox *mailbox = selected();
+
+    QList<QByteArray> items;
+    const QByteArray specification(args.value(1));
+    if (specification.startsWith('('))
+        items = listItems(specification);
+    else
+        items << specification;
+
+    QList<QByteArray> expanded;
+    foreach (const QByteArray &item, items) {
+        const QByteArray name(item.toUpper());
+        if (name == "ALL" || name == "FAST" || name == "FULL") {
+            expanded << "FLAGS" << "INTERNALDATE" << "RFC822.SIZE";
+            if (name == "FULL")
+                expanded << "BODY";
+        } else {
+            expanded << item;
+        }
+    }
+
+    qint64 changedSince = -1;
+    bool reportVanished = false;
+    const QList<QByteArray> modifiers(listItems(args.value(2)));
+    for (int i = 0; i < modifiers.count(); ++i) {
+        const QByteArray name(modifiers.at(i).toUpper());
+        if (name == "CHANGEDSINCE") {
+            changedSince = modifiers.value(++i).toLongLong();
+            _condstore = true;
+        } else if (name == "VANISHED") {
+            reportVanished = true;
+        }
+    }
+
+    if (reportVanished && uid && _qresync && (changedSince >= 0)) {
+        const RangeList ranges(parseSet(args.value(0), mailbox->uidNext));
+        QList<quint32> vanished;
+        for (int i = 0; i < mailbox->expunged.count(); ++i) {
+            const QPair<quint32, quint64> &entry(mailbox->expunged.at(i));
+            if ((entry.second > quint64(changedSince)) && inRanges(ranges, entry.first))
+                vanished.append(entry.first);
+        }
+        if (!vanished.isEmpty()) {
+            qSort(vanished);
+            send("* VANISHED (EARLIER) " + compactSet(vanished) + "\r\n");
+        }
+    }
+
+    bool includesFlags = false;
+    bool includesModSeq = false;
+    bool marksSeen = false;
+    foreach (const QByteArray &item, expanded) {
+        const QByteArray name(item.toUpper());
+        includesFlags |= (name == "FLAGS");
+        includesModSeq |= (name == "MODSEQ");
+        marksSeen |= (name.startsWith("BODY[") || name == "RFC822" || name == "RFC822.TEXT");
+    }
+
+    foreach (int index, resolve(args.value(0), uid)) {
+        MockMessage &message(mailbox->messages[index]);
+        if ((changedSince >= 0) && (message.modSeq <= quint64(changedSince)))
+            continue;
+
+        bool flagsChanged = false;
+        if (marksSeen && !_readOnly && !hasFlag(message.flags, QLatin1String("\\Seen"))) {
+            mailbox->setFlag(index, QLatin1String("\\Seen"));
+            flagsChanged = true;
+        }
+
+        QList<QByteArray> parts;
+        if (uid)
+            parts << fetchItem(message, "UID");
+        foreach (const QByteArray &item, expanded) {
+            if (uid && item.toUpper() == "UID")
+                continue;
+            const QByteArray part(fetchItem(message, item));
+            if (!part.isEmpty())
+                parts << part;
+        }
+        if (flagsChanged && !includesFlags)
+            parts << fetchItem(message, "FLAGS");
+        if (_condstore && !includesModSeq)
+            parts << fetchItem(message, "MODSEQ");
+
+        send("* " + QByteArray::number(index + 1) + " FETCH (" + joined(parts, ' ') + ")\r\n");
+    }
+
+    send(tagged(tag, "OK", uid ? "UID FETCH completed" : "FETCH completed"));
+}
+
+void MockImapSession::store(const QByteArray &tag, const QList<QByteArray> &args, bool uid)
+{
+    MockMailbox *mailbox = selected();
+    if (_readOnly) {
+        send(tagged(tag, "NO", "Mailbox is read-only"));
+        return;
+    }
+
+    int position = 1;
+    qint64 unchangedSince = -1;
+    if (args.value(position).startsWith('(')) {
+        const QList<QByteArray> modifiers(listItems(args.at(position++)));
+        if (modifiers.value(0).toUpper() == "UNCHANGEDSINCE") {
+            unchangedSince = modifiers.value(1).toLongLong();
+            _condstore = true;
+        }
+    }
+
+    const QByteArray operation(args.value(position++).toUpper());
+    if (!operation.contains("FLAGS")) {
+        send(tagged(tag, "BAD", "Invalid STORE operation"));
+        return;
+    }
+    const char mode = operation.startsWith('+') ? '+' : (operation.startsWith('-') ? '-' : '=');
+    const bool silent = operation.endsWith(".SILENT");
+
+    QStringList flags;
+    for ( ; position < args.count(); ++position) {
+        foreach (const QByteArray &flag, listItems(args.at(position)))
+            flags.append(QString::fromLatin1(flag));
+    }
+
+    QList<quint32> modified;
+    foreach (int index, resolve(args.value(0), uid)) {
+        MockMessage &message(mailbox->messages[index]);
+        if ((unchangedSince >= 0) && (message.modSeq > quint64(unchangedSince))) {
+            modified.append(uid ? message.uid : quint32(index + 1));
+            continue;
+        }
+
+        QStringList updated(mode == '=' ? flags : message.flags);
+        if (mode == '+') {
+            foreach (const QString &flag, flags) {
+                if (!hasFlag(updated, flag))
+                    updated.append(flag);
+            }
+        } else if (mode == '-') {
+            foreach (const QString &flag, flags) {
+                for (int i = updated.count() - 1; i >= 0; --i) {
+                    if (updated.at(i).compare(flag, Qt::CaseInsensitive) == 0)
+                        updated.removeAt(i);
+                }
+            }
+        }
+
+        const bool changed = (updated != message.flags);
+        if (changed) {
+            message.flags = updated;
+            message.modSeq = ++mailbox->highestModSeq;
+        }
+
+        if (!silent || (changed && _condstore)) {
+            QList<QByteArray> parts;
+            if (uid)
+                parts << fetchItem(message, "UID");
+            if (!silent)
+                parts << fetchItem(message, "FLAGS");
+            if (_condstore)
+                parts << fetchItem(message, "MODSEQ");
+            send("* " + QByteArray::number(index + 1) + " FETCH (" + joined(parts, ' ') + ")\r\n");
+        }
+    }
+
+    if (modified.isEmpty())
+        send(tagged(tag, "OK", uid ? "UID STORE completed" : "STORE completed"));
+    else
+        send(tagged(tag, "OK", "[MODIFIED " + compactSet(modified) + "] Conditional STORE failed"));
+}
+
+void MockImapSession::copy(const QByteArray &tag, const QList<QByteArray> &args, bool uid, bool move)
+{
+    MockMailbox *mailbox = selected();
+    MockMailbox *target = imapServer()->mailbox(QString::fromUtf8(args.value(1)));
+    if (!target) {
+        send(tagged(tag, "NO", "[TRYCREATE] No such mailbox"));
+        return;
+    }
+    if (move && _readOnly) {
+        send(tagged(tag, "NO", "Mailbox is read-only"));
+        return;
+    }
+
+    const QList<int> indexes(resolve(args.value(0), uid));
+
+    QList<MockMessage> originals;
+    foreach (int index, indexes)
+        originals.append(mailbox->messages.at(index));
+
+    QList<quint32> sourceUids;
+    QList<quint32> targetUids;
+    foreach (const MockMessage &original, originals) {
+        MockMessage &copied(target->append(original.data, original.flags));
+        copied.internalDate = original.internalDate;
+        sourceUids.append(original.uid);
+        targetUids.append(copied.uid);
+    }
+
+    QByteArray code;
+    if (!originals.isEmpty())
+        code = "[COPYUID " + QByteArray::number(target->uidValidity) + ' ' + compactSet(sourceUids) + ' ' + compactSet(targetUids) + "] ";
+
+    if (move) {
+        if (!code.isEmpty())
+            send("* OK " + code + "Moved\r\n");
+        expungeIndexes(indexes, true);
+        send(tagged(tag, "OK", "MOVE completed"));
+    } else {
+        send(tagged(tag, "OK", code + "COPY completed"));
+    }
+
+    if (!originals.isEmpty())
+        emit imapServer()->mailboxChanged(target->name);
+}
+
+bool MockImapSession::matches(const QList<QByteArray> &keys, int *position, int index) const
+{
+    const MockMessage &message(selected()->messages.at(index));
+    const QByteArray key(keys.value((*position)++));
+    const QByteArray name(key.toUpper());
+
+    if (name.startsWith('(')) {
+        const QList<QByteArray> inner(listItems(key));
+        int innerPosition = 0;
+        bool result = true;
+        while (innerPosition < inner.count())
+            result &= matches(inner, &innerPosition, index);
+        return result;
+    } else if (name == "NOT") {
+        return !matches(keys, position, index);
+    } else if (name == "OR") {
+        const bool first = matches(keys, position, index);
+        const bool second = matches(keys, position, index);
+        return first || second;
+    } else if (name == "ALL" || name == "OLD") {
+        return true;
+    } else if (name == "RECENT" || name == "NEW") {
+        return false;
+    }
+
+    static const char *const flagKeys[] = { "SEEN", "ANSWERED", "DELETED", "FLAGGED", "DRAFT" };
+    for (unsigned i = 0; i < sizeof(flagKeys) / sizeof(flagKeys[0]); ++i) {
+        const QByteArray flagKey(flagKeys[i]);
+        if (name == flagKey || name == "UN" + flagKey) {
+            const QString flag(QLatin1Char('\\') + QString::fromLatin1(flagKey.left(1) + flagKey.mid(1).toLower()));
+            return hasFlag(message.flags, flag) == (name == flagKey);
+        }
+    }
+
+    if (name == "KEYWORD" || name == "UNKEYWORD") {
+        return hasFlag(message.flags, QString::fromLatin1(keys.value((*position)++))) == (name == "KEYWORD");
+    } else if (name == "BODY") {
+        return containsNoCase(message.body(), keys.value((*position)++));
+    } else if (name == "TEXT") {
+        return containsNoCase(message.data, keys.value((*position)++));
+    } else if (name == "SUBJECT" || name == "FROM" || name == "TO" || name == "CC" || name == "BCC") {
+        return containsNoCase(headerField(message.header(), name), keys.value((*position)++));
+    } else if (name == "HEADER") {
+        const QByteArray field(keys.value((*position)++));
+        return containsNoCase(headerField(message.header(), field), keys.value((*position)++));
+    } else if (name == "LARGER") {
+        return message.data.size() > keys.value((*position)++).toInt();
+    } else if (name == "SMALLER") {
+        return message.data.size() < keys.value((*position)++).toInt();
+    } else if (name == "SINCE" || name == "BEFORE" || name == "ON"
+               || name == "SENTSINCE" || name == "SENTBEFORE" || name == "SENTON") {
+        const QDate date(QLocale::c().toDate(QString::fromLatin1(keys.value((*position)++)), QLatin1String("d-MMM-yyyy")));
+        const QDate internal(message.internalDate.toUTC().date());
+        if (name.endsWith("SINCE"))
+            return internal >= date;
+        if (name.endsWith("BEFORE"))
+            return internal < date;
+        return internal == date;
+    } else if (name == "UID") {
+        const quint32 last = selected()->messages.isEmpty() ? 0 : selected()->messages.last().uid;
+        return inRanges(parseSet(keys.value((*position)++), last), message.uid);
+    } else if (name == "MODSEQ") {
+        // Skip the optional entry name and type
+        QByteArray value(keys.value((*position)++));
+        if (!value.isEmpty() && !QChar::isDigit(ushort(uchar(value.at(0))))) {
+            ++(*position);
+            value = keys.value((*position)++);
+        }
+        return message.modSeq >= value.toULongLong();
+    } else if (!name.isEmpty() && (name.at(0) == '*' || QChar::isDigit(ushort(uchar(name.at(0)))))) {
+        return inRanges(parseSet(name, selected()->messages.count()), quint32(index + 1));
+    }
+
+    qWarning() << "MockImapSession: unsupported search key" << key;
+    return true;
+}
+
+void MockImapSession::search(const QByteArray &tag, const QList<QByteArray> &args, bool uid)
+{
+    MockMailbox *mailbox = selected();
+
+    QList<QByteArray> keys(args);
+    if (!keys.isEmpty() && keys.first().toUpper() == "RETURN")
+        keys = keys.mid(2);
+    if (!keys.isEmpty() && keys.first().toUpper() == "CHARSET")
+        keys = keys.mid(2);
+
+    QByteArray response("* SEARCH");
+    for (int index = 0; index < mailbox->messages.count(); ++index) {
+        int position = 0;
+        bool match = true;
+        while (match && (position < keys.count()))
+            match = matches(keys, &position, index);
+
+        if (match)
+            response += ' ' + QByteArray::number(uid ? mailbox->messages.at(index).uid : quint32(index + 1));
+    }
+
+    send(response + "\r\n");
+    send(tagged(tag, "OK", uid ? "UID SEARCH completed" : "SEARCH completed"));
+}
+
+void MockImapSession::expunge(const QByteArray &tag, const QList<QByteArray> &args, bool uid)
+{
+    MockMailbox *mailbox = selected();
+    if (_readOnly) {
+        send(tagged(tag, "NO", "Mailbox is read-only"));
+        return;
+    }
+
+    QList<int> deleted;
+    const RangeList ranges(uid ? parseSet(args.value(0), mailbox->uidNext) : RangeList());
+    for (int i = 0; i < mailbox->messages.count(); ++i) {
+        const MockMessage &message(mailbox->messages.at(i));
+        if (hasFlag(message.flags, QLatin1String("\\Deleted")) && (!uid || inRanges(ranges, message.uid)))
+            deleted.append(i);
+    }
+
+    expungeIndexes(deleted, true);
+    send(tagged(tag, "OK", uid ? "UID EXPUNGE completed" : "EXPUNGE completed"));
+}
+
+void MockImapSession::expungeIndexes(QList<int> indexes, bool report)
+{
+    MockMailbox *mailbox = selected();
+
+    // Remove from the end so that each reported sequence number is valid
+    // at the point it is sent
+    QList<quint32> vanished;
+    for (int i = indexes.count() - 1; i >= 0; --i) {
+        const int index = indexes.at(i);
+        const quint32 uid = mailbox->remove(index);
+
+        if (report) {
+            if (_qresync)
+                vanished.prepend(uid);
+            else
+                send("* " + QByteArray::number(index + 1) + " EXPUNGE\r\n");
+        }
+    }
+    _knownExists -= indexes.count();
+
+    if (!vanished.isEmpty())
+        send("* VANISHED " + compactSet(vanished) + "\r\n");
+}
+
+QList<int> MockImapSession::resolve(const QByteArray &set, bool uid) const
+{
+    const MockMailbox *mailbox = selected();
+    const int count = mailbox->messages.count();
+
+    QList<int> indexes;
+    if (count == 0)
+        return indexes;
+
+    QVector<bool> marked(count, false);
+    if (uid) {
+        foreach (const RangePair &range, parseSet(set, mailbox->messages.last().uid)) {
+            for (int index = lowerBound(mailbox->messages, range.first);
+                 (index < count) && (mailbox->messages.at(index).uid <= range.second); ++index)
+                marked[index] = true;
+        }
+    } else {
+        foreach (const RangePair &range, parseSet(set, quint32(count))) {
+            const int last = qMin<quint32>(range.second, count);
+            for (int index = qMax<quint32>(range.first, 1); index <= last; ++index)
+                marked[index - 1] = true;
+        }
+    }
+
+    for (int index = 0; index < count; ++index) {
+        if (marked.at(index))
+            indexes.append(index);
+    }
+    return indexes;
+}
+
+QList<QByteArray> MockImapSession::tokenize(const QByteArray &args) const
+{
+    QList<QByteArray> tokens;
+
+    const int length = args.size();
+    int i = 0;
+    while (i < length) {
+        if (args.at(i) == ' ') {
+            ++i;
+            continue;
+        }
+
+        if (args.at(i) == '"') {
+            QByteArray token;
+            for (++i; (i < length) && (args.at(i) != '"'); ++i) {
+                if ((args.at(i) == '\\') && ((i + 1) < length))
+                    ++i;
+                token += args.at(i);
+            }
+            ++i;
+            tokens.append(token);
+            continue;
+        }
+
+        // Atoms, including parenthesised lists and bracketed sections,
+        // extend to the next space at nesting depth zero
+        const int start = i;
+        int depth = 0;
+        bool inQuotes = false;
+        for ( ; i < length; ++i) {
+            const char c = args.at(i);
+            if (inQuotes) {
+                if (c == '\\')
+                    ++i;
+                else if (c == '"')
+                    inQuotes = false;
+            } else if (c == '"') {
+                inQuotes = true;
+            } else if (c == '(' || c == '[') {
+                ++depth;
+            } else if (c == ')' || c == ']') {
+                --depth;
+            } else if (c == ' ' && depth <= 0) {
+                break;
+            }
+        }
+
+        QByteArray token(args.mid(start, i - start));
+        if (token.startsWith("{#") && token.endsWith('}'))
+            token = _literals.value(token.mid(2, token.size() - 3).toInt());
+        tokens.append(token);
+    }
+
+    return tokens;
+}
+
+QList<QByteArray> MockImapSession::listItems(const QByteArray &token) const
+{
+    if (token.startsWith('(') && token.endsWith(')'))
+        return tokenize(token.mid(1, token.size() - 2));
+    if (token.isEmpty())
+        return QList<QByteArray>();
+    return QList<QByteArray>() << token;
+}
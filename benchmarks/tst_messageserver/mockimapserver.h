@@ -0,0 +1,133 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef MOCKIMAPSERVER_H
+#define MOCKIMAPSERVER_H
+
+#include "mockserver.h"
+
+/*
+    An IMAP4rev1 stand-in supporting the extensions the IMAP client makes use
+    of: LITERAL+, UIDPLUS, MOVE, IDLE, ENABLE, CONDSTORE and QRESYNC.  NOTIFY
+    is supported for the mailboxes filter, but not advertised by default.
+*/
+class MockImapServer : public MockServer
+{
+    Q_OBJECT
+
+public:
+    MockImapServer(QObject *parent = 0);
+    virtual ~MockImapServer();
+
+    MockMailbox *mailbox(const QString &name) const;
+    MockMailbox *addMailbox(const QString &name);
+    bool removeMailbox(const QString &name);
+    bool renameMailbox(const QString &name, const QString &newName);
+    QStringList mailboxNames() const;
+
+    void deliver(const QString &name, const QByteArray &data);
+    void changed(const QString &name);
+
+    void setCapabilities(const QByteArray &capabilities);
+    QByteArray capabilities() const { return _capabilities; }
+
+signals:
+    void mailboxChanged(const QString &name);
+
+protected:
+    virtual MockSession *createSession(QTcpSocket *socket);
+
+private:
+    QList<MockMailbox*> _mailboxes;
+    QByteArray _capabilities;
+    quint32 _nextUidValidity;
+};
+
+class MockImapSession : public MockSession
+{
+    Q_OBJECT
+
+public:
+    MockImapSession(MockImapServer *server, QTcpSocket *socket);
+
+    virtual void start();
+
+protected:
+    virtual void processLine(const QByteArray &line);
+    virtual void processLiteral(const QByteArray &data);
+
+private slots:
+    void mailboxChanged(const QString &name);
+
+private:
+    void execute(const QByteArray &line);
+
+    void login(const QByteArray &tag, const QList<QByteArray> &args);
+    void list(const QByteArray &tag, const QByteArray &command, const QList<QByteArray> &args);
+    void status(const QByteArray &tag, const QList<QByteArray> &args);
+    void notify(const QByteArray &tag, const QList<QByteArray> &args);
+    void select(const QByteArray &tag, const QList<QByteArray> &args, bool readOnly);
+    void enable(const QByteArray &tag, const QList<QByteArray> &args);
+    void append(const QByteArray &tag, const QList<QByteArray> &args);
+    void fetch(const QByteArray &tag, const QList<QByteArray> &args, bool uid);
+    void store(const QByteArray &tag, const QList<QByteArray> &args, bool uid);
+    void copy(const QByteArray &tag, const QList<QByteArray> &args, bool uid, bool move);
+    void search(const QByteArray &tag, const QList<QByteArray> &args, bool uid);
+    void expunge(const QByteArray &tag, const QList<QByteArray> &args, bool uid);
+
+    QByteArray fetchItem(const MockMessage &message, const QByteArray &item) const;
+    bool matches(const QList<QByteArray> &keys, int *position, int index) const;
+    QList<int> resolve(const QByteArray &set, bool uid) const;
+    void expungeIndexes(QList<int> indexes, bool report);
+    void reportExists();
+    void reportStatus(const MockMailbox *mailbox);
+
+    QList<QByteArray> tokenize(const QByteArray &args) const;
+    QList<QByteArray> listItems(const QByteArray &token) const;
+
+    MockImapServer *imapServer() const;
+    MockMailbox *selected() const;
+
+    QByteArray _pending;
+    QList<QByteArray> _literals;
+    bool _authenticated;
+    bool _readOnly;
+    bool _condstore;
+    bool _qresync;
+    QString _selected;
+    int _knownExists;
+    QByteArray _idleTag;
+    QStringList _notifyMailboxes;
+};
+
+#endif
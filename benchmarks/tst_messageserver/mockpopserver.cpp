@@ -0,0 +1,205 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "mockpopserver.h"
+
+namespace {
+
+QByteArray dotStuffed(const QByteArray &data)
+{
+    QByteArray result;
+    result.reserve(data.size() + 16);
+    foreach (QByteArray line, data.split('\n')) {
+        if (line.endsWith('\r'))
+            line.chop(1);
+        if (line.startsWith('.'))
+            result += '.';
+        result += line + "\r\n";
+    }
+
+    // split() yields a trailing empty element for CRLF terminated data
+    if (data.endsWith('\n'))
+        result.chop(2);
+    return result;
+}
+
+}
+
+MockPopServer::MockPopServer(QObject *parent)
+    : MockServer(parent)
+{
+    _maildrop.name = QLatin1String("maildrop");
+}
+
+MockSession *MockPopServer::createSession(QTcpSocket *socket)
+{
+    return new MockPopSession(this, socket);
+}
+
+
+MockPopSession::MockPopSession(MockPopServer *server, QTcpSocket *socket)
+    : MockSession(server, socket),
+      _authenticated(false)
+{
+}
+
+void MockPopSession::start()
+{
+    send("+OK POP3 benchmark server ready\r\n");
+}
+
+MockMailbox *MockPopSession::maildrop() const
+{
+    return static_cast<MockPopServer*>(server())->maildrop();
+}
+
+int MockPopSession::messageIndex(const QByteArray &number) const
+{
+    bool ok = false;
+    int index = number.toInt(&ok) - 1;
+    if (!ok || index < 0 || index >= maildrop()->messages.count() || _deleted.contains(index))
+        return -1;
+    return index;
+}
+
+void MockPopSession::listing(const QByteArray &argument, bool uids)
+{
+    const QList<MockMessage> &messages(maildrop()->messages);
+
+    if (!argument.isEmpty()) {
+        int index = messageIndex(argument);
+        if (index == -1) {
+            send("-ERR No such message\r\n");
+        } else {
+            send("+OK " + QByteArray::number(index + 1) + ' '
+                 + (uids ? "benchmark-" + QByteArray::number(messages.at(index).uid) : QByteArray::number(messages.at(index).data.size())) + "\r\n");
+        }
+        return;
+    }
+
+    QByteArray response("+OK\r\n");
+    for (int index = 0; index < messages.count(); ++index) {
+        if (_deleted.contains(index))
+            continue;
+        response += QByteArray::number(index + 1) + ' '
+                    + (uids ? "benchmark-" + QByteArray::number(messages.at(index).uid) : QByteArray::number(messages.at(index).data.size())) + "\r\n";
+    }
+    send(response + ".\r\n");
+}
+
+void MockPopSession::processLine(const QByteArray &line)
+{
+    server()->countRoundTrip(line);
+
+    const int space = line.indexOf(' ');
+    const QByteArray command((space == -1 ? line : line.left(space)).toUpper());
+    const QList<QByteArray> args((space == -1 ? QByteArray() : line.mid(space + 1)).split(' '));
+
+    if (scripted(command))
+        return;
+
+    if (command == "CAPA") {
+        send("+OK Capability list follows\r\nUSER\r\nUIDL\r\nTOP\r\n.\r\n");
+    } else if (command == "QUIT") {
+        if (_authenticated) {
+            // Deletions are committed when the session ends normally
+            QList<int> deleted(_deleted.toList());
+            qSort(deleted);
+            for (int i = deleted.count() - 1; i >= 0; --i)
+                maildrop()->messages.removeAt(deleted.at(i));
+            _deleted.clear();
+        }
+        send("+OK Bye\r\n");
+        close();
+    } else if (command == "USER") {
+        _user = QString::fromUtf8(args.value(0));
+        send("+OK\r\n");
+    } else if (command == "PASS") {
+        if ((_user == server()->user()) && (QString::fromUtf8(line.mid(space + 1)) == server()->password())) {
+            _authenticated = true;
+            send("+OK Maildrop ready\r\n");
+        } else {
+            send("-ERR Invalid credentials\r\n");
+        }
+    } else if (!_authenticated) {
+        send("-ERR Not authenticated\r\n");
+    } else if (command == "STAT") {
+        int count = 0;
+        qint64 size = 0;
+        for (int index = 0; index < maildrop()->messages.count(); ++index) {
+            if (!_deleted.contains(index)) {
+                ++count;
+                size += maildrop()->messages.at(index).data.size();
+            }
+        }
+        send("+OK " + QByteArray::number(count) + ' ' + QByteArray::number(size) + "\r\n");
+    } else if (command == "LIST" || command == "UIDL") {
+        listing(args.value(0), command == "UIDL");
+    } else if (command == "RETR" || command == "TOP") {
+        int index = messageIndex(args.value(0));
+        if (index == -1) {
+            send("-ERR No such message\r\n");
+            return;
+        }
+
+        const MockMessage &message(maildrop()->messages.at(index));
+        QByteArray content(message.data);
+        if (command == "TOP") {
+            const int lines = args.value(1).toInt();
+            QByteArray body(message.body());
+            int end = 0;
+            for (int i = 0; (i < lines) && (end != -1); ++i) {
+                end = body.indexOf('\n', end);
+                if (end != -1)
+                    ++end;
+            }
+            content = message.header() + (end == -1 ? body : body.left(end));
+        }
+        send("+OK " + QByteArray::number(content.size()) + " octets\r\n" + dotStuffed(content) + ".\r\n");
+    } else if (command == "DELE") {
+        int index = messageIndex(args.value(0));
+        if (index == -1) {
+            send("-ERR No such message\r\n");
+        } else {
+            _deleted.insert(index);
+            send("+OK Message deleted\r\n");
+        }
+    } else if (command == "NOOP") {
+        send("+OK\r\n");
+    } else if (command == "RSET") {
+        _deleted.clear();
+        send("+OK\r\n");
+    } else {
+        send("-ERR Unsupported command\r\n");
+    }
+}
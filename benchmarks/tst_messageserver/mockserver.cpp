@@ -0,0 +1,337 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "mockserver.h"
+
+#include <QDebug>
+#include <QHostAddress>
+#include <QLocale>
+#include <QTcpSocket>
+#include <QTimer>
+
+QByteArray MockMessage::header() const
+{
+    int index = data.indexOf("\r\n\r\n");
+    if (index == -1)
+        return data;
+    return data.left(index + 4);
+}
+
+QByteArray MockMessage::body() const
+{
+    int index = data.indexOf("\r\n\r\n");
+    if (index == -1)
+        return QByteArray();
+    return data.mid(index + 4);
+}
+
+MockMessage &MockMailbox::append(const QByteArray &data, const QStringList &flags)
+{
+    MockMessage message;
+    message.uid = uidNext++;
+    message.modSeq = ++highestModSeq;
+    message.flags = flags;
+    message.internalDate = QDateTime::currentDateTime();
+    message.data = data;
+
+    messages.append(message);
+    return messages.last();
+}
+
+void MockMailbox::setFlag(int index, const QString &flag, bool set)
+{
+    MockMessage &message(messages[index]);
+    if (message.flags.contains(flag, Qt::CaseInsensitive) == set)
+        return;
+
+    if (set)
+        message.flags.append(flag);
+    else
+        message.flags.removeAll(flag);
+    message.modSeq = ++highestModSeq;
+}
+
+// Removes a message, recording the expunge for QRESYNC clients
+quint32 MockMailbox::remove(int index)
+{
+    const quint32 uid = messages.at(index).uid;
+    messages.removeAt(index);
+    expunged.append(qMakePair(uid, ++highestModSeq));
+    return uid;
+}
+
+int MockMailbox::indexOfUid(quint32 uid) const
+{
+    int low = 0;
+    int high = messages.count() - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        quint32 value = messages.at(mid).uid;
+        if (value == uid)
+            return mid;
+        if (value < uid)
+            low = mid + 1;
+        else
+            high = mid - 1;
+    }
+    return -1;
+}
+
+
+MockSession::MockSession(MockServer *server, QTcpSocket *socket)
+    : QObject(server),
+      _server(server),
+      _socket(socket),
+      _literalLength(-1),
+      _closing(false),
+      _linkFree(0),
+      _flushTimer(new QTimer(this))
+{
+    _socket->setParent(this);
+    _flushTimer->setSingleShot(true);
+    _clock.start();
+
+    connect(_socket, SIGNAL(readyRead()), this, SLOT(readyRead()));
+    connect(_socket, SIGNAL(disconnected()), this, SLOT(deleteLater()));
+    connect(_flushTimer, SIGNAL(timeout()), this, SLOT(flush()));
+}
+
+MockSession::~MockSession()
+{
+}
+
+void MockSession::processLiteral(const QByteArray &)
+{
+    qWarning() << "MockSession: unexpected literal data";
+}
+
+void MockSession::send(const QByteArray &data)
+{
+    _server->countBytesSent(data.size());
+
+    const int latency = _server->latency();
+    const int bandwidth = _server->bandwidth();
+    if (latency == 0 && bandwidth == 0 && _output.isEmpty()) {
+        _socket->write(data);
+        return;
+    }
+
+    // Data written in one burst shares a single latency penalty; the link
+    // then stays busy for as long as the configured bandwidth requires
+    const qint64 now = _clock.elapsed();
+    qint64 due = qMax(_linkFree, now + latency);
+    if (bandwidth > 0)
+        due += (qint64(data.size()) * 1000) / bandwidth;
+    _linkFree = due;
+
+    _output.append(qMakePair(due, data));
+    if (!_flushTimer->isActive())
+        _flushTimer->start(int(qMax<qint64>(0, _output.first().first - now)));
+}
+
+void MockSession::flush()
+{
+    const qint64 now = _clock.elapsed();
+    while (!_output.isEmpty() && _output.first().first <= now)
+        _socket->write(_output.takeFirst().second);
+
+    if (!_output.isEmpty()) {
+        _flushTimer->start(int(_output.first().first - now));
+    } else if (_closing) {
+        _socket->disconnectFromHost();
+    }
+}
+
+void MockSession::expectLiteral(int length)
+{
+    _literalLength = length;
+}
+
+void MockSession::close()
+{
+    _closing = true;
+    if (_output.isEmpty())
+        _socket->disconnectFromHost();
+}
+
+bool MockSession::scripted(const QByteArray &command, const QByteArray &tag)
+{
+    QByteArray response;
+    if (!_server->scriptedResponse(command, &response))
+        return false;
+
+    response.replace("%TAG%", tag);
+    send(response);
+    return true;
+}
+
+void MockSession::readyRead()
+{
+    _input.append(_socket->readAll());
+
+    while (!_closing) {
+        if (_literalLength >= 0) {
+            if (_input.size() < _literalLength)
+                break;
+
+            QByteArray data(_input.left(_literalLength));
+            _input.remove(0, _literalLength);
+            _literalLength = -1;
+            processLiteral(data);
+        } else {
+            int index = _input.indexOf('\n');
+            if (index == -1)
+                break;
+
+            QByteArray line(_input.left(index));
+            _input.remove(0, index + 1);
+            if (line.endsWith('\r'))
+                line.chop(1);
+            processLine(line);
+        }
+    }
+}
+
+
+MockServer::MockServer(QObject *parent)
+    : QTcpServer(parent),
+      _user(QLatin1String("benchmark")),
+      _password(QLatin1String("benchmark")),
+      _latency(0),
+      _bandwidth(0),
+      _roundTrips(0),
+      _bytesSent(0)
+{
+}
+
+MockServer::~MockServer()
+{
+}
+
+bool MockServer::listen()
+{
+    return QTcpServer::listen(QHostAddress::LocalHost, 0);
+}
+
+void MockServer::setCredentials(const QString &user, const QString &password)
+{
+    _user = user;
+    _password = password;
+}
+
+void MockServer::setLatency(int milliseconds)
+{
+    _latency = qMax(0, milliseconds);
+}
+
+void MockServer::setBandwidth(int bytesPerSecond)
+{
+    _bandwidth = qMax(0, bytesPerSecond);
+}
+
+void MockServer::setScriptedResponse(const QByteArray &command, const QByteArray &response)
+{
+    _scripted.insert(command.toUpper(), response);
+}
+
+void MockServer::clearScriptedResponses()
+{
+    _scripted.clear();
+}
+
+bool MockServer::scriptedResponse(const QByteArray &command, QByteArray *response) const
+{
+    QHash<QByteArray, QByteArray>::const_iterator it = _scripted.find(command.toUpper());
+    if (it == _scripted.end())
+        return false;
+
+    *response = it.value();
+    return true;
+}
+
+void MockServer::countRoundTrip(const QByteArray &command)
+{
+    ++_roundTrips;
+    emit commandReceived(command);
+}
+
+void MockServer::incomingConnection(qintptr descriptor)
+{
+    QTcpSocket *socket = new QTcpSocket;
+    if (!socket->setSocketDescriptor(descriptor)) {
+        qWarning() << "MockServer: unable to accept connection:" << socket->errorString();
+        delete socket;
+        return;
+    }
+
+    MockSession *session = createSession(socket);
+    session->start();
+}
+
+/*
+    Generates a plain text message of roughly bodySize bytes.  Every tenth
+    message mentions "needle" so that search workloads have a predictable
+    number of hits.
+*/
+QByteArray MockServer::generateMessage(int index, int bodySize)
+{
+    const QByteArray number(QByteArray::number(index));
+    const QDateTime date(QDateTime(QDate(2015, 1, 1), QTime(0, 0), Qt::UTC).addSecs(index * 60));
+
+    QByteArray message;
+    message.reserve(bodySize + 512);
+    message += "From: Sender " + number + " <sender" + number + "@example.org>\r\n";
+    message += "To: Benchmark <benchmark@example.org>\r\n";
+    message += "Subject: Benchmark message " + number + "\r\n";
+    message += "Date: " + QLocale::c().toString(date, QLatin1String("ddd, dd MMM yyyy hh:mm:ss")).toLatin1() + " +0000\r\n";
+    message += "Message-ID: <" + number + ".benchmark@example.org>\r\n";
+    message += "MIME-Version: 1.0\r\n";
+    message += "Content-Type: text/plain; charset=us-ascii\r\n";
+    message += "Content-Transfer-Encoding: 7bit\r\n";
+    message += "\r\n";
+
+    const int start = message.size();
+    if (index % 10 == 0)
+        message += "This message contains the needle.\r\n";
+
+    for (int line = 0; (message.size() - start) < bodySize; ++line)
+        message += "Line " + QByteArray::number(line) + " of benchmark message " + number + ", padded out with some filler text.\r\n";
+
+    return message;
+}
+
+void MockServer::populate(MockMailbox *mailbox, int count, int bodySize)
+{
+    for (int i = 0; i < count; ++i)
+        mailbox->append(generateMessage(i, bodySize));
+}
@@ -0,0 +1,194 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef MOCKSERVER_H
+#define MOCKSERVER_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QStringList>
+#include <QTcpServer>
+
+class QTcpSocket;
+class QTimer;
+
+/*
+    Messages and mailboxes held by the stand-in servers.  Messages are kept
+    in ascending UID order, which is the order the servers assign them in.
+*/
+struct MockMessage
+{
+    MockMessage() : uid(0), modSeq(1) {}
+
+    quint32 uid;
+    quint64 modSeq;
+    QStringList flags;
+    QDateTime internalDate;
+    QByteArray data;
+
+    QByteArray header() const;
+    QByteArray body() const;
+};
+
+struct MockMailbox
+{
+    MockMailbox() : uidValidity(1), uidNext(1), highestModSeq(1) {}
+
+    QString name;
+    quint32 uidValidity;
+    quint32 uidNext;
+    quint64 highestModSeq;
+    QList<MockMessage> messages;
+    QList<QPair<quint32, quint64> > expunged;
+
+    MockMessage &append(const QByteArray &data, const QStringList &flags = QStringList());
+    void setFlag(int index, const QString &flag, bool set = true);
+    quint32 remove(int index);
+    int indexOfUid(quint32 uid) const;
+};
+
+class MockServer;
+
+/*
+    A single client connection.  Input is split into CRLF terminated lines
+    and handed to processLine(); a session may instead request a literal of
+    a known length, which is delivered whole to processLiteral().  Output is
+    queued and released according to the latency and bandwidth configured
+    on the owning server.
+*/
+class MockSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    MockSession(MockServer *server, QTcpSocket *socket);
+    virtual ~MockSession();
+
+    virtual void start() = 0;
+
+protected:
+    virtual void processLine(const QByteArray &line) = 0;
+    virtual void processLiteral(const QByteArray &data);
+
+    void send(const QByteArray &data);
+    void expectLiteral(int length);
+    void close();
+
+    bool scripted(const QByteArray &command, const QByteArray &tag = QByteArray());
+
+    MockServer *server() const { return _server; }
+
+private slots:
+    void readyRead();
+    void flush();
+
+private:
+    MockServer *_server;
+    QTcpSocket *_socket;
+    QByteArray _input;
+    int _literalLength;
+    bool _closing;
+
+    QElapsedTimer _clock;
+    qint64 _linkFree;
+    QList<QPair<qint64, QByteArray> > _output;
+    QTimer *_flushTimer;
+};
+
+/*
+    Base class for the in-process protocol servers used by the benchmarks.
+    The server listens on an ephemeral loopback port, optionally delays and
+    throttles its output to model a remote link, and counts every client
+    request it answers so that protocol efficiency can be reported alongside
+    time and memory.
+
+    Responses may be scripted per command: a scripted response replaces the
+    built-in behaviour for that command, with "%TAG%" replaced by the tag of
+    the request for tagged protocols.
+*/
+class MockServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    MockServer(QObject *parent = 0);
+    virtual ~MockServer();
+
+    bool listen();
+
+    void setCredentials(const QString &user, const QString &password);
+    QString user() const { return _user; }
+    QString password() const { return _password; }
+
+    void setLatency(int milliseconds);
+    int latency() const { return _latency; }
+
+    void setBandwidth(int bytesPerSecond);
+    int bandwidth() const { return _bandwidth; }
+
+    void setScriptedResponse(const QByteArray &command, const QByteArray &response);
+    void clearScriptedResponses();
+    bool scriptedResponse(const QByteArray &command, QByteArray *response) const;
+
+    int roundTrips() const { return _roundTrips; }
+    void resetRoundTrips() { _roundTrips = 0; }
+    void countRoundTrip(const QByteArray &command);
+
+    qint64 bytesSent() const { return _bytesSent; }
+    void countBytesSent(qint64 bytes) { _bytesSent += bytes; }
+
+    static QByteArray generateMessage(int index, int bodySize);
+    static void populate(MockMailbox *mailbox, int count, int bodySize);
+
+signals:
+    void commandReceived(const QByteArray &command);
+
+protected:
+    virtual MockSession *createSession(QTcpSocket *socket) = 0;
+    virtual void incomingConnection(qintptr descriptor);
+
+private:
+    QString _user;
+    QString _password;
+    int _latency;
+    int _bandwidth;
+    int _roundTrips;
+    qint64 _bytesSent;
+    QHash<QByteArray, QByteArray> _scripted;
+};
+
+#endif
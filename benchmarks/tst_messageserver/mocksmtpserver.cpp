@@ -0,0 +1,126 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "mocksmtpserver.h"
+
+MockSmtpServer::MockSmtpServer(QObject *parent)
+    : MockServer(parent),
+      _receivedCount(0),
+      _receivedBytes(0)
+{
+}
+
+void MockSmtpServer::received(const QByteArray &message)
+{
+    ++_receivedCount;
+    _receivedBytes += message.size();
+    _lastMessage = message;
+}
+
+MockSession *MockSmtpServer::createSession(QTcpSocket *socket)
+{
+    return new MockSmtpSession(this, socket);
+}
+
+
+MockSmtpSession::MockSmtpSession(MockSmtpServer *server, QTcpSocket *socket)
+    : MockSession(server, socket),
+      _inData(false)
+{
+}
+
+void MockSmtpSession::start()
+{
+    send("220 localhost ESMTP benchmark server ready\r\n");
+}
+
+void MockSmtpSession::processLine(const QByteArray &line)
+{
+    if (_inData) {
+        if (line == ".") {
+            server()->countRoundTrip(line);
+            static_cast<MockSmtpServer*>(server())->received(_data);
+            _data.clear();
+            _inData = false;
+            send("250 OK Message accepted\r\n");
+        } else {
+            _data += (line.startsWith('.') ? line.mid(1) : line) + "\r\n";
+        }
+        return;
+    }
+
+    server()->countRoundTrip(line);
+
+    const int space = line.indexOf(' ');
+    const QByteArray command((space == -1 ? line : line.left(space)).toUpper());
+    const QByteArray argument(space == -1 ? QByteArray() : line.mid(space + 1));
+
+    if (scripted(command))
+        return;
+
+    if (command == "EHLO") {
+        send("250-localhost\r\n250-8BITMIME\r\n250 SIZE\r\n");
+    } else if (command == "HELO") {
+        send("250 localhost\r\n");
+    } else if (command == "MAIL") {
+        _from = argument;
+        _recipients.clear();
+        send("250 OK\r\n");
+    } else if (command == "RCPT") {
+        if (_from.isEmpty()) {
+            send("503 Need MAIL command\r\n");
+        } else {
+            _recipients.append(argument);
+            send("250 OK\r\n");
+        }
+    } else if (command == "DATA") {
+        if (_recipients.isEmpty()) {
+            send("503 Need RCPT command\r\n");
+        } else {
+            _inData = true;
+            _data.clear();
+            send("354 End data with <CR><LF>.<CR><LF>\r\n");
+        }
+    } else if (command == "RSET") {
+        _from.clear();
+        _recipients.clear();
+        send("250 OK\r\n");
+    } else if (command == "NOOP") {
+        send("250 OK\r\n");
+    } else if (command == "QUIT") {
+        send("221 Bye\r\n");
+        close();
+    } else {
+        send("502 Command not implemented\r\n");
+    }
+}
@@ -0,0 +1,85 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef MOCKSMTPSERVER_H
+#define MOCKSMTPSERVER_H
+
+#include "mockserver.h"
+
+/*
+    An ESMTP stand-in that accepts every message it is given.  Only the
+    count and size of received messages are retained, so that the server
+    does not distort the heap usage of transmission benchmarks.
+*/
+class MockSmtpServer : public MockServer
+{
+    Q_OBJECT
+
+public:
+    MockSmtpServer(QObject *parent = 0);
+
+    int receivedCount() const { return _receivedCount; }
+    qint64 receivedBytes() const { return _receivedBytes; }
+    QByteArray lastMessage() const { return _lastMessage; }
+
+    void received(const QByteArray &message);
+
+protected:
+    virtual MockSession *createSession(QTcpSocket *socket);
+
+private:
+    int _receivedCount;
+    qint64 _receivedBytes;
+    QByteArray _lastMessage;
+};
+
+class MockSmtpSession : public MockSession
+{
+    Q_OBJECT
+
+public:
+    MockSmtpSession(MockSmtpServer *server, QTcpSocket *socket);
+
+    virtual void start();
+
+protected:
+    virtual void processLine(const QByteArray &line);
+
+private:
+    bool _inData;
+    QByteArray _data;
+    QByteArray _from;
+    QList<QByteArray> _recipients;
+};
+
+#endif
@@ -32,12 +32,18 @@
 ****************************************************************************/
 
 #include "benchmarkcontext.h"
+#include "mockimapserver.h"
+#include "mockpopserver.h"
+#include "mocksmtpserver.h"
 #include "qscopedconnection.h"
 #include <imapconfiguration.h>
+#include <popconfiguration.h>
+#include <smtpconfiguration.h>
 #include <messageserver.h>
 #include <qmailnamespace.h>
 #include <qmailserviceaction.h>
 #include <qmailstore.h>
+#include <QSignalSpy>
 #include <QTest>
 #include <QtCore>
 #ifdef Q_OS_WIN
@@ -60,17 +66,16 @@
 #endif
 
 /*
-    This file is $TROLLTECH_INTERNAL$
-    It contains information about internal mail accounts.
+    All protocol traffic is served by in-process stand-in servers populated
+    with generated messages, so results do not depend on the network or on
+    the state of any external mail account.  The stand-ins can add latency
+    and limit bandwidth to model a remote link, and count the round trips
+    made by each workload.
 */
 
 class tst_MessageServer;
 typedef void (tst_MessageServer::*TestFunction)();
 
-typedef QList<QByteArray> TestMail;
-typedef QList<TestMail>   TestMailList;
-Q_DECLARE_METATYPE(TestMailList)
-
 class tst_MessageServer : public QObject
 {
     Q_OBJECT
@@ -91,6 +96,42 @@ private slots:
     void replaceMessages();
     void replaceMessages_data();
 
+    void synchronizeImap();
+    void synchronizeImap_data();
+
+    void resynchronizeImap();
+    void resynchronizeImap_data();
+
+    void fetchImap();
+    void fetchImap_data();
+
+    void searchImap();
+    void searchImap_data();
+
+    void moveImap();
+    void moveImap_data();
+
+    void flagImap();
+    void flagImap_data();
+
+    void condstoreImap();
+    void condstoreImap_data();
+
+    void notifyEnableRejected();
+    void notifyEnableRejected_data();
+
+    void notifyImap();
+    void notifyImap_data();
+
+    void retrievalPop();
+    void retrievalPop_data();
+
+    void sendSmtp();
+    void sendSmtp_data();
+
+    void storeProfile();
+    void storeProfile_data();
+
 protected slots:
     void onActivityChanged(QMailServiceAction::Activity);
     void onProgressChanged(uint,uint);
@@ -99,10 +140,31 @@ private:
     void completeRetrievalImap_impl();
     void removeMessages_impl();
     void replaceMessages_impl();
-
-    void compareMessages(QMailMessageIdList const&, TestMailList const&);
+    void synchronizeImap_impl();
+    void resynchronizeImap_impl();
+    void fetchImap_impl();
+    void searchImap_impl();
+    void moveImap_impl();
+    void flagImap_impl();
+    void condstoreImap_impl();
+    void notifyEnableRejected_impl();
+    void notifyImap_impl();
+    void retrievalPop_impl();
+    void sendSmtp_impl();
+    void storeProfile_impl();
+
+    void workload_data();
+    void smallWorkload_data();
+    void addRow(char const*, int, int, int = 0, int = 0);
+
+    MockImapServer* startImapServer();
+    void startServer(MockServer*);
+    void prepareImapAccount(QMailAccount*, MockImapServer*, int);
+    void checkImapFolder(QMailFolderId const&, int, int);
+
+    void compareMessages(QMailMessageIdList const&, int);
     void waitForActivity(QMailServiceAction*, QMailServiceAction::Activity, int);
-    void addAccount(QMailAccount*, QString const&, QString const&, QString const&, QString const&, int);
+    void addAccount(QMailAccount*, QString const&, MockServer const*);
     void removePath(QString const&);
     void runInChildProcess(TestFunction);
     void runInCallgrind(QString const&);
@@ -110,22 +172,42 @@ private:
     QEventLoop*                  m_loop;
     QTimer*                      m_timer;
     QMailServiceAction::Activity m_expectedState;
-    QString                      m_imapServer;
     bool                         m_xml;
 };
 
-void tst_MessageServer::initTestCase()
+/* Count the commands of the given name among those a mock server received. */
+static int countCommands(QSignalSpy const& spy, QByteArray const& command)
 {
-    QProcess proc;
-    proc.start("hostname -d");
-    QVERIFY(proc.waitForStarted());
-    QVERIFY(proc.waitForFinished());
-    QByteArray out = proc.readAll();
-    if (out.contains("nokia"))
-        m_imapServer = "mail-nokia.trolltech.com.au";
-    else
-        m_imapServer = "mail.trolltech.com.au";
+    int count = 0;
+    foreach (QList<QVariant> const& args, spy) {
+        QList<QByteArray> words(args.at(0).toByteArray().trimmed().split(' '));
+        if (words.count() > 2 && words.at(1).toUpper() == "UID")
+            words.removeAt(1);
+        if (words.count() > 1 && words.at(1).toUpper() == command)
+            ++count;
+    }
+    return count;
+}
+
+/* Count the commands a mock server received which contain the given text. */
+static int countContaining(QSignalSpy const& spy, QByteArray const& text)
+{
+    int count = 0;
+    foreach (QList<QVariant> const& args, spy) {
+        if (args.at(0).toByteArray().contains(text))
+            ++count;
+    }
+    return count;
+}
+
+/* Valgrind slows things down quite a lot. */
+static int maxTime(int messages)
+{
+    return RUNNING_ON_VALGRIND ? qMax(60000, 2000*messages) : qMax(60000, 20*messages);
+}
 
+void tst_MessageServer::initTestCase()
+{
     m_xml = false;
     foreach (QString const& arg, QCoreApplication::arguments()) {
         if (arg == QLatin1String("-xml") || arg == QLatin1String("-lightxml")) {
@@ -336,32 +418,81 @@ void tst_MessageServer::runInChildProcess(TestFunction fn)
 #endif
 }
 
+/*
+    Starts a stand-in IMAP server holding the generated messages for the
+    current test row in its INBOX, plus an empty Archive folder.
+    The messages are generated before any BenchmarkContext is created so
+    that they do not count towards the measured heap usage.
+*/
+MockImapServer* tst_MessageServer::startImapServer()
+{
+    QFETCH(int, messages);
+    QFETCH(int, bodySize);
+
+    MockImapServer* server = new MockImapServer;
+    MockServer::populate(server->mailbox(QLatin1String("INBOX")), messages, bodySize);
+    server->addMailbox(QLatin1String("Archive"));
+
+    startServer(server);
+    return server;
+}
+
+void tst_MessageServer::startServer(MockServer* server)
+{
+    QFETCH(int, latency);
+    QFETCH(int, bandwidth);
+
+    server->setLatency(latency);
+    server->setBandwidth(bandwidth);
+    if (!server->listen()) {
+        QFAIL(qPrintable(QString("Stand-in server failed to listen: %1").arg(server->errorString())));
+    }
+}
+
+/* Create an IMAP account and synchronize it, outside of any measurement. */
+void tst_MessageServer::prepareImapAccount(QMailAccount* account, MockImapServer* server, int messages)
+{
+    addAccount(account, "imap4", server);
+    if (QTest::currentTestFailed()) return;
+
+    QMailRetrievalAction retrieve;
+    retrieve.synchronizeAll(account->id());
+    waitForActivity(&retrieve, QMailServiceAction::Successful, maxTime(messages));
+    if (QTest::currentTestFailed()) return;
+
+    QCOMPARE(QMailStore::instance()->countMessages(), messages);
+}
+
+/* List the messages of an IMAP folder, flags included, holding at least the given minimum. */
+void tst_MessageServer::checkImapFolder(QMailFolderId const& folderId, int minimum, int messages)
+{
+    QMailRetrievalAction retrieve;
+    retrieve.retrieveMessageList(QMailFolder(folderId).parentAccountId(), folderId, minimum);
+    waitForActivity(&retrieve, QMailServiceAction::Successful, maxTime(messages));
+}
+
 /* Test full retrieval of all messages from a specific account */
 void tst_MessageServer::completeRetrievalImap_impl()
 {
     static const char service[] = "imap4";
 
-    QFETCH(QString, user);
-    QFETCH(QString, password);
-    QFETCH(QString, server);
-    QFETCH(int,     port);
-    QFETCH(TestMailList,mails);
+    QFETCH(int, messages);
+
+    MockImapServer* server = startImapServer();
+    if (QTest::currentTestFailed()) return;
 
     QMailMessageIdList fetched;
-    /* Valgrind slows things down quite a lot. */
-    static const int MAXTIME =
-        RUNNING_ON_VALGRIND ? qMax(60000, 2000*mails.count()) :
-        60000;
+    const int MAXTIME = maxTime(messages);
 
     QMailStore* ms = 0;
     {
-        BenchmarkContext ctx(m_xml);
+        BenchmarkContext ctx(m_xml, server);
 
         new MessageServer;
         ms = QMailStore::instance();
 
         QMailAccount account;
-        addAccount(&account, service, user, password, server, port);
+        addAccount(&account, service, server);
         if (QTest::currentTestFailed()) return;
 
         /* Get message count for this account */
@@ -372,17 +503,17 @@ void tst_MessageServer::completeRetrievalImap_impl()
         if (QTest::currentTestFailed()) return;
 
         /* Ensure we have all the messages we expect */
-        QCOMPARE(ms->countMessages(), mails.count());
+        QCOMPARE(ms->countMessages(), messages);
 
         /* OK, now download the entire message bodies. */
         fetched = ms->queryMessages();
-        QCOMPARE(fetched.count(), mails.count());
+        QCOMPARE(fetched.count(), messages);
         retrieve.retrieveMessages(fetched, QMailRetrievalAction::Content);
         waitForActivity(&retrieve, QMailServiceAction::Successful, MAXTIME);
         if (QTest::currentTestFailed()) return;
     }
 
-    compareMessages(fetched, mails);
+    compareMessages(fetched, messages);
 }
 
 void tst_MessageServer::waitForActivity(QMailServiceAction* action, QMailServiceAction::Activity state, int timeout)
@@ -412,223 +543,169 @@ void tst_MessageServer::waitForActivity(QMailServiceAction* action, QMailService
     QVERIFY2(!timed_out, qPrintable(QString("%1 timed out").arg(QString::fromLatin1(action->metaObject()->className()))));
 }
 
-void tst_MessageServer::addAccount(QMailAccount* account, QString const& service, QString const& user, QString const& password, QString const& server, int port)
+void tst_MessageServer::addAccount(QMailAccount* account, QString const& service, MockServer const* server)
 {
-    if (service != QLatin1String("imap4")) {
-        QFAIL(qPrintable(QString("Unknown service type %1").arg(service)));
-    }
-
     account->setMessageType(QMailMessageMetaData::Email);
-    account->setStatus(QMailAccount::CanRetrieve, true);
-    account->setStatus(QMailAccount::MessageSource, true);
     account->setStatus(QMailAccount::Enabled, true);
 
     QMailAccountConfiguration config;
     config.addServiceConfiguration(service);
 
-    ImapConfigurationEditor imap(&config);
-    imap.setVersion(100);
-    imap.setType(QMailServiceConfiguration::Source);
-    imap.setMailUserName(user);
-    imap.setMailPassword(password);
-    imap.setMailServer(server);
-    imap.setMailPort(port);
-    imap.setAutoDownload(false);
-    imap.setDeleteMail(false);
-    imap.setMaxMailSize(0);
+    QString const host(QLatin1String("127.0.0.1"));
+
+    if (service == QLatin1String("imap4")) {
+        account->setStatus(QMailAccount::CanRetrieve, true);
+        account->setStatus(QMailAccount::MessageSource, true);
+
+        ImapConfigurationEditor imap(&config);
+        imap.setVersion(100);
+        imap.setType(QMailServiceConfiguration::Source);
+        imap.setMailUserName(server->user());
+        imap.setMailPassword(server->password());
+        imap.setMailServer(host);
+        imap.setMailPort(server->serverPort());
+        imap.setAutoDownload(false);
+        imap.setDeleteMail(false);
+        imap.setMaxMailSize(0);
+    } else if (service == QLatin1String("pop3")) {
+        account->setStatus(QMailAccount::CanRetrieve, true);
+        account->setStatus(QMailAccount::MessageSource, true);
+
+        PopConfigurationEditor pop(&config);
+        pop.setVersion(100);
+        pop.setType(QMailServiceConfiguration::Source);
+        pop.setMailUserName(server->user());
+        pop.setMailPassword(server->password());
+        pop.setMailServer(host);
+        pop.setMailPort(server->serverPort());
+        pop.setAutoDownload(false);
+        pop.setDeleteMail(false);
+        pop.setMaxMailSize(0);
+    } else if (service == QLatin1String("smtp")) {
+        account->setStatus(QMailAccount::CanTransmit, true);
+        account->setStatus(QMailAccount::MessageSink, true);
+        account->setFromAddress(QMailAddress(QLatin1String("benchmark@example.org")));
+
+        SmtpConfigurationEditor smtp(&config);
+        smtp.setVersion(100);
+        smtp.setType(QMailServiceConfiguration::Sink);
+        smtp.setEmailAddress(QLatin1String("benchmark@example.org"));
+        smtp.setSmtpServer(host);
+        smtp.setSmtpPort(server->serverPort());
+    } else {
+        QFAIL(qPrintable(QString("Unknown service type %1").arg(service)));
+    }
 
     QVERIFY(QMailStore::instance()->addAccount(account, &config));
 }
 
-void tst_MessageServer::compareMessages(QMailMessageIdList const& actual, TestMailList const& expected)
+void tst_MessageServer::compareMessages(QMailMessageIdList const& actual, int expected)
 {
     /*
         Go through the fetched messages and make sure they are what we expect.
         Note that this should be outside of BenchmarkContext sections so we don't count the
         memory/time used to do this.
     */
+    QCOMPARE(actual.count(), expected);
+
     QMailStore* ms = QMailStore::instance();
     for (int i = 0; i < actual.count(); ++i) {
         QByteArray act = ms->message(actual.at(i)).toRfc2822();
         QVERIFY(act.size() > 0);
-        foreach (QByteArray const& exp, expected.at(i)) {
-            QVERIFY2(act.contains(exp), qPrintable(QString("Message was expected to contain this string, but didn't: %1\nMessage: %2").arg(QString::fromLatin1(exp)).arg(QString::fromLatin1(act))));
-        }
-#ifdef LEARN
-        if (!exp.at(i).count()) {
-            foreach (QByteArray const& line, actual.split('\n'))
-                qDebug() << line.constData(); // not compiled by default
-        }
-#endif
+        QVERIFY2(act.contains("Subject: Benchmark message "), qPrintable(QString("Message was not generated by the stand-in server: %1").arg(QString::fromLatin1(act.left(1000)))));
+        QVERIFY2(act.contains(" of benchmark message "), qPrintable(QString("Message body was not retrieved: %1").arg(QString::fromLatin1(act.left(1000)))));
     }
 }
 
+void tst_MessageServer::addRow(char const* name, int messages, int bodySize, int latency, int bandwidth)
+{
+    QTest::newRow(name) << messages << bodySize << latency << bandwidth;
+}
+
 void tst_MessageServer::completeRetrievalImap_data()
 {
-    QTest::addColumn<QString>     ("user");
-    QTest::addColumn<QString>     ("password");
-    QTest::addColumn<QString>     ("server");
-    QTest::addColumn<int>         ("port");
-    QTest::addColumn<TestMailList>("mails");
+    QTest::addColumn<int>("messages");
+    QTest::addColumn<int>("bodySize");
+    QTest::addColumn<int>("latency");
+    QTest::addColumn<int>("bandwidth");
 
     /*
         Note - this testdata is deliberately _not_ strictly in order from smallest
         to largest, because if it were, resource leaks between tests might be hidden.
     */
+    addRow("small_messages--200",  200,  1000);
+    addRow("small_messages--1000", 1000, 1000);
+    addRow("small_messages--100",  100,  1000);
+    addRow("big_messages",         3,    4*1000*1000);
+    addRow("small_messages--500",  500,  1000);
+    addRow("small_messages--2000", 2000, 1000);
 
-    TestMailList list;
-
-    list.clear();
-    for (int i = 0; i < 200; ++i)
-        list << TestMail();
-    QTest::newRow("small_messages--200")
-        << QString::fromLatin1("mailtst31")
-        << QString::fromLatin1("testme31")
-        << m_imapServer
-        << 143
-        << list
-    ;
-
-    list.clear();
-    for (int i = 0; i < 1000; ++i)
-        list << TestMail();
-    QTest::newRow("small_messages--1000")
-        << QString::fromLatin1("mailtst33")
-        << QString::fromLatin1("testme33")
-        << m_imapServer
-        << 143
-        << list
-    ;
-    list.clear();
-    for (int i = 0; i < 100; ++i)
-        list << TestMail();
-    QTest::newRow("small_messages--100")
-        << QString::fromLatin1("mailtst30")
-        << QString::fromLatin1("testme30")
-        << m_imapServer
-        << 143
-        << list
-    ;
-
-    QTest::newRow("big_messages")
-        << QString::fromLatin1("mailtst37")
-        << QString::fromLatin1("testme37")
-        << m_imapServer
-        << 143
-        << (TestMailList()
-            << (TestMail()
-                << QByteArray("Subject: 4MB+ test file")
-                << QByteArray("o+ZmfhB18O/FYfHMEspiVR3/nRPYBXfnCyLURiIRyM0Lx7bXk9MtpRPEnL01xiAkeBobLd/e2ZKb")
-                << QByteArray("YMSd7zfs2xNPsCNwj76/73/Vx9SSJ//1RIyxewgR//4u5IpwoSEWMp5+")
-            )
-            << (TestMail()
-                << QByteArray("Subject: 20,000 Leagues Under the Sea")
-                << QByteArray("I went to the central staircase which opened on to the platform,")
-                << QByteArray("from Ceylon to Sydney, touching at King George's Point and Melbourne.")
-                << QByteArray("274     2  occurred                occurred")
-            )
-            << (TestMail()
-                << QByteArray("Subject: Fwd:3: Message with multiple attachments")
-                << QByteArray("SUsTXEe2aBGuTYOxhAH0og014xzV2R147zXEdIH1robUCKcaYTgmZ96lMWSGXN6sq+KmpMKIAx8V")
-                << QByteArray("Content-Type: image/png; name=snapshot2.png")
-                << QByteArray("RsySH338IAAGE+jk306+9ONT2nhj5rNnp44+f/S1s2888fijVl/5zE/PVO+pnvq7U0f+6ggrHH56")
-                << QByteArray("Content-Type: image/jpeg; name=snapshot11.jpg")
-                << QByteArray("CUAAAAAAPWYXQrHZ0+CZDhdCsdnT4JlGwAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA")
-            )
-        )
-    ;
-
-    list.clear();
-    for (int i = 0; i < 500; ++i)
-        list << TestMail();
-    QTest::newRow("small_messages--500")
-        << QString::fromLatin1("mailtst32")
-        << QString::fromLatin1("testme32")
-        << m_imapServer
-        << 143
-        << list
-    ;
-
-    list.clear();
-    for (int i = 0; i < 2000; ++i)
-        list << TestMail();
-    QTest::newRow("small_messages--2000")
-        << QString::fromLatin1("mailtst34")
-        << QString::fromLatin1("testme34")
-        << m_imapServer
-        << 143
-        << list
-    ;
+    /* 50ms each way and 1MB/s, roughly a mobile link */
+    addRow("slow_link--100",       100,  1000, 50, 1000*1000);
 
 #if VERY_PATIENT_TESTER
-    list.clear();
-    for (int i = 0; i < 5000; ++i)
-        list << TestMail();
-    QTest::newRow("small_messages--5000")
-        << QString::fromLatin1("mailtst35")
-        << QString::fromLatin1("testme35")
-        << m_imapServer
-        << 143
-        << list
-    ;
-
-    list.clear();
-    for (int i = 0; i < 10000; ++i)
-        list << TestMail();
-    QTest::newRow("small_messages--10000")
-        << QString::fromLatin1("mailtst36")
-        << QString::fromLatin1("testme36")
-        << m_imapServer
-        << 143
-        << list
-    ;
+    addRow("small_messages--5000",  5000,  1000);
+    addRow("small_messages--10000", 10000, 1000);
 #endif
 }
 
+/*
+    Data for the per-protocol workloads.  The largest mailbox takes a long
+    time to process, so is only run by the very patient.
+*/
+void tst_MessageServer::workload_data()
+{
+    QTest::addColumn<int>("messages");
+    QTest::addColumn<int>("bodySize");
+    QTest::addColumn<int>("latency");
+    QTest::addColumn<int>("bandwidth");
+
+    addRow("messages--1000",  1000,  2000);
+    addRow("messages--10000", 10000, 2000);
+    addRow("slow_link--1000", 1000,  2000, 50, 1000*1000);
+
+#if VERY_PATIENT_TESTER
+    addRow("messages--100000", 100000, 2000);
+#endif
+}
+
+/* Data for the behavioural tests, which need only a few messages. */
+void tst_MessageServer::smallWorkload_data()
+{
+    QTest::addColumn<int>("messages");
+    QTest::addColumn<int>("bodySize");
+    QTest::addColumn<int>("latency");
+    QTest::addColumn<int>("bandwidth");
+
+    addRow("messages--100", 100, 1000);
+}
+
 void tst_MessageServer::removeMessages()
 { runInChildProcess(&tst_MessageServer::removeMessages_impl); }
 
 void tst_MessageServer::removeMessages_impl()
 {
-    static const char service[] = "imap4";
+    QFETCH(int, messages);
 
-    QFETCH(QString, user);
-    QFETCH(QString, password);
-    QFETCH(QString, server);
-    QFETCH(int,     port);
-    QFETCH(TestMailList,mails);
-
-    QMailMessageIdList fetched;
-    /* Valgrind slows things down quite a lot. */
-    static const int MAXTIME =
-        RUNNING_ON_VALGRIND ? qMax(60000, 2000*mails.count()) :
-        60000;
+    MockImapServer* server = startImapServer();
+    if (QTest::currentTestFailed()) return;
 
     new MessageServer;
     QMailStore* ms = QMailStore::instance();
 
     QMailAccount account;
-    addAccount(&account, service, user, password, server, port);
+    prepareImapAccount(&account, server, messages);
     if (QTest::currentTestFailed()) return;
 
-    /* Get message count for this account */
-    QMailRetrievalAction retrieve;
-
-    retrieve.synchronizeAll(account.id());
-    waitForActivity(&retrieve, QMailServiceAction::Successful, MAXTIME);
-    if (QTest::currentTestFailed()) return;
-
-    /* Ensure we have all the messages we expect */
-    QCOMPARE(ms->countMessages(), mails.count());
-
     /* OK, now download the entire message bodies. */
-    fetched = ms->queryMessages();
-    QCOMPARE(fetched.count(), mails.count());
+    QMailRetrievalAction retrieve;
+    QMailMessageIdList fetched = ms->queryMessages();
+    QCOMPARE(fetched.count(), messages);
     retrieve.retrieveMessages(fetched, QMailRetrievalAction::Content);
-    waitForActivity(&retrieve, QMailServiceAction::Successful, MAXTIME);
+    waitForActivity(&retrieve, QMailServiceAction::Successful, maxTime(messages));
     if (QTest::currentTestFailed()) return;
 
-    compareMessages(fetched, mails);
+    compareMessages(fetched, messages);
     if (QTest::currentTestFailed()) return;
 
     {
@@ -653,50 +730,34 @@ void tst_MessageServer::replaceMessages()
 */
 void tst_MessageServer::replaceMessages_impl()
 {
-    static const char service[] = "imap4";
+    QFETCH(int, messages);
 
-    QFETCH(QString, user);
-    QFETCH(QString, password);
-    QFETCH(QString, server);
-    QFETCH(int,     port);
-    QFETCH(TestMailList,mails);
+    MockImapServer* server = startImapServer();
+    if (QTest::currentTestFailed()) return;
 
-    QMailMessageIdList fetched;
-    /* Valgrind slows things down quite a lot. */
-    static const int MAXTIME =
-        RUNNING_ON_VALGRIND ? qMax(60000, 2000*mails.count()) :
-        60000;
+    const int MAXTIME = maxTime(messages);
 
     new MessageServer;
     QMailStore* ms = QMailStore::instance();
 
     QMailAccount account;
-    addAccount(&account, service, user, password, server, port);
-    if (QTest::currentTestFailed()) return;
-
-    /* Get message count for this account */
-    QMailRetrievalAction retrieve;
-
-    retrieve.synchronizeAll(account.id());
-    waitForActivity(&retrieve, QMailServiceAction::Successful, MAXTIME);
+    prepareImapAccount(&account, server, messages);
     if (QTest::currentTestFailed()) return;
 
-    /* Ensure we have all the messages we expect */
-    QCOMPARE(ms->countMessages(), mails.count());
-
     /* OK, now download the entire message bodies. */
-    fetched = ms->queryMessages();
-    QCOMPARE(fetched.count(), mails.count());
+    QMailRetrievalAction retrieve;
+    QMailMessageIdList fetched = ms->queryMessages();
+    QCOMPARE(fetched.count(), messages);
     retrieve.retrieveMessages(fetched, QMailRetrievalAction::Content);
     waitForActivity(&retrieve, QMailServiceAction::Successful, MAXTIME);
     if (QTest::currentTestFailed()) return;
 
-    compareMessages(fetched, mails);
+    compareMessages(fetched, messages);
     if (QTest::currentTestFailed()) return;
 
     {
         /* Remove the messages. */
-        BenchmarkContext ctx(m_xml);
+        BenchmarkContext ctx(m_xml, server);
         QVERIFY(ms->removeMessages(QMailMessageKey(), QMailStore::NoRemovalRecord));
         QCOMPARE(ms->queryMessages().count(), 0);
 
@@ -706,22 +767,643 @@ void tst_MessageServer::replaceMessages_impl()
         if (QTest::currentTestFailed()) return;
 
         /* Ensure we have all the messages we expect */
-        QCOMPARE(ms->countMessages(), mails.count());
+        QCOMPARE(ms->countMessages(), messages);
 
         /* OK, now download the entire message bodies. */
         fetched = ms->queryMessages();
-        QCOMPARE(fetched.count(), mails.count());
+        QCOMPARE(fetched.count(), messages);
         retrieve.retrieveMessages(fetched, QMailRetrievalAction::Content);
         waitForActivity(&retrieve, QMailServiceAction::Successful, MAXTIME);
         if (QTest::currentTestFailed()) return;
     }
 
-    compareMessages(fetched, mails);
+    compareMessages(fetched, messages);
 }
 
 void tst_MessageServer::replaceMessages_data()
 { completeRetrievalImap_data(); }
 
+void tst_MessageServer::synchronizeImap()
+{ runInChildProcess(&tst_MessageServer::synchronizeImap_impl); }
+
+/* Test the initial synchronization of a large folder, headers only */
+void tst_MessageServer::synchronizeImap_impl()
+{
+    QFETCH(int, messages);
+
+    MockImapServer* server = startImapServer();
+    if (QTest::currentTestFailed()) return;
+
+    new MessageServer;
+    QMailStore* ms = QMailStore::instance();
+
+    QMailAccount account;
+    addAccount(&account, "imap4", server);
+    if (QTest::currentTestFailed()) return;
+
+    QMailRetrievalAction retrieve;
+    {
+        BenchmarkContext ctx(m_xml, server);
+        retrieve.synchronizeAll(account.id());
+        waitForActivity(&retrieve, QMailServiceAction::Successful, maxTime(messages));
+        if (QTest::currentTestFailed()) return;
+    }
+
+    QCOMPARE(ms->countMessages(), messages);
+}
+
+void tst_MessageServer::synchronizeImap_data()
+{ workload_data(); }
+
+void tst_MessageServer::resynchronizeImap()
+{ runInChildProcess(&tst_MessageServer::resynchronizeImap_impl); }
+
+/*
+    Test an incremental synchronization after the server has changed the
+    flags of a tenth of the messages, expunged a fiftieth and received a
+    hundredth as many new messages.  With CONDSTORE and QRESYNC only the
+    changes should need to cross the wire.
+*/
+void tst_MessageServer::resynchronizeImap_impl()
+{
+    QFETCH(int, messages);
+    QFETCH(int, bodySize);
+
+    MockImapServer* server = startImapServer();
+    if (QTest::currentTestFailed()) return;
+
+    new MessageServer;
+    QMailStore* ms = QMailStore::instance();
+
+    QMailAccount account;
+    prepareImapAccount(&account, server, messages);
+    if (QTest::currentTestFailed()) return;
+
+    MockMailbox* inbox = server->mailbox(QLatin1String("INBOX"));
+    for (int i = 0; i < inbox->messages.count(); i += 10)
+        inbox->setFlag(i, QLatin1String("\\Seen"));
+    for (int i = inbox->messages.count() - 1; i >= 0; i -= 50)
+        inbox->remove(i);
+    for (int i = 0; i < messages / 100; ++i)
+        server->deliver(inbox->name, MockServer::generateMessage(messages + i, bodySize));
+    const int expected = inbox->messages.count();
+
+    QMailRetrievalAction retrieve;
+    {
+        BenchmarkContext ctx(m_xml, server);
+        retrieve.synchronizeAll(account.id());
+        waitForActivity(&retrieve, QMailServiceAction::Successful, maxTime(messages));
+        if (QTest::currentTestFailed()) return;
+    }
+
+    QCOMPARE(ms->countMessages(), expected);
+}
+
+void tst_MessageServer::resynchronizeImap_data()
+{ workload_data(); }
+
+void tst_MessageServer::fetchImap()
+{ runInChildProcess(&tst_MessageServer::fetchImap_impl); }
+
+/* Test retrieval of the content of every message in an already synchronized folder */
+void tst_MessageServer::fetchImap_impl()
+{
+    QFETCH(int, messages);
+
+    MockImapServer* server = startImapServer();
+    if (QTest::currentTestFailed()) return;
+
+    new MessageServer;
+    QMailStore* ms = QMailStore::instance();
+
+    QMailAccount account;
+    prepareImapAccount(&account, server, messages);
+    if (QTest::currentTestFailed()) return;
+
+    QMailMessageIdList fetched = ms->queryMessages();
+    QMailRetrievalAction retrieve;
+    {
+        BenchmarkContext ctx(m_xml, server);
+        retrieve.retrieveMessages(fetched, QMailRetrievalAction::Content);
+        waitForActivity(&retrieve, QMailServiceAction::Successful, maxTime(messages));
+        if (QTest::currentTestFailed()) return;
+    }
+
+    compareMessages(fetched, messages);
+}
+
+void tst_MessageServer::fetchImap_data()
+{ workload_data(); }
+
+void tst_MessageServer::searchImap()
+{ runInChildProcess(&tst_MessageServer::searchImap_impl); }
+
+/* Test a server-side body search; every tenth generated message matches */
+void tst_MessageServer::searchImap_impl()
+{
+    QFETCH(int, messages);
+
+    MockImapServer* server = startImapServer();
+    if (QTest::currentTestFailed()) return;
+
+    new MessageServer;
+
+    QMailAccount account;
+    prepareImapAccount(&account, server, messages);
+    if (QTest::currentTestFailed()) return;
+
+    QMailSearchAction search;
+    {
+        BenchmarkContext ctx(m_xml, server);
+        search.searchMessages(QMailMessageKey::parentAccountId(account.id()), QLatin1String("needle"), QMailSearchAction::Remote);
+        waitForActivity(&search, QMailServiceAction::Successful, maxTime(messages));
+        if (QTest::currentTestFailed()) return;
+    }
+}
+
+void tst_MessageServer::searchImap_data()
+{ workload_data(); }
+
+void tst_MessageServer::moveImap()
+{ runInChildProcess(&tst_MessageServer::moveImap_impl); }
+
+/* Test moving every message of a folder to another folder on the server */
+void tst_MessageServer::moveImap_impl()
+{
+    QFETCH(int, messages);
+
+    MockImapServer* server = startImapServer();
+    if (QTest::currentTestFailed()) return;
+
+    new MessageServer;
+    QMailStore* ms = QMailStore::instance();
+
+    QMailAccount account;
+    prepareImapAccount(&account, server, messages);
+    if (QTest::currentTestFailed()) return;
+
+    QMailFolderIdList archive = ms->queryFolders(QMailFolderKey::parentAccountId(account.id())
+                                                 & QMailFolderKey::path(QLatin1String("Archive")));
+    QCOMPARE(archive.count(), 1);
+
+    QMailMessageIdList ids = ms->queryMessages(QMailMessageKey::parentAccountId(account.id()));
+    QMailStorageAction storage;
+    {
+        BenchmarkContext ctx(m_xml, server);
+        storage.onlineMoveMessages(ids, archive.first());
+        waitForActivity(&storage, QMailServiceAction::Successful, maxTime(messages));
+        if (QTest::currentTestFailed()) return;
+    }
+
+    QCOMPARE(server->mailbox(QLatin1String("INBOX"))->messages.count(), 0);
+    QCOMPARE(server->mailbox(QLatin1String("Archive"))->messages.count(), messages);
+}
+
+void tst_MessageServer::moveImap_data()
+{ workload_data(); }
+
+void tst_MessageServer::flagImap()
+{ runInChildProcess(&tst_MessageServer::flagImap_impl); }
+
+/* Test flagging every message locally and exporting the change to the server */
+void tst_MessageServer::flagImap_impl()
+{
+    QFETCH(int, messages);
+
+    MockImapServer* server = startImapServer();
+    if (QTest::currentTestFailed()) return;
+
+    new MessageServer;
+    QMailStore* ms = QMailStore::instance();
+
+    QMailAccount account;
+    prepareImapAccount(&account, server, messages);
+    if (QTest::currentTestFailed()) return;
+
+    QMailMessageIdList ids = ms->queryMessages(QMailMessageKey::parentAccountId(account.id()));
+    QMailStorageAction storage;
+    QMailRetrievalAction retrieve;
+    {
+        BenchmarkContext ctx(m_xml, server);
+        storage.flagMessages(ids, QMailMessage::Important, 0);
+        waitForActivity(&storage, QMailServiceAction::Successful, maxTime(messages));
+        if (QTest::currentTestFailed()) return;
+
+        retrieve.exportUpdates(account.id());
+        waitForActivity(&retrieve, QMailServiceAction::Successful, maxTime(messages));
+        if (QTest::currentTestFailed()) return;
+    }
+
+    foreach (MockMessage const& message, server->mailbox(QLatin1String("INBOX"))->messages) {
+        QVERIFY(message.flags.contains(QLatin1String("\\Flagged"), Qt::CaseInsensitive));
+    }
+}
+
+void tst_MessageServer::flagImap_data()
+{ workload_data(); }
+
+void tst_MessageServer::condstoreImap()
+{ runInChildProcess(&tst_MessageServer::condstoreImap_impl); }
+
+/*
+    Test the listing of a folder on a server offering CONDSTORE without
+    QRESYNC.  Once the flags have been listed in full, only the changes
+    since then should be fetched; an expunge, a mod-sequence that went
+    backwards or a new UIDVALIDITY require the full listing again.
+*/
+void tst_MessageServer::condstoreImap_impl()
+{
+    QFETCH(int, messages);
+
+    MockImapServer* server = startImapServer();
+    if (QTest::currentTestFailed()) return;
+
+    QByteArray capabilities(server->capabilities());
+    capabilities.replace(" QRESYNC", "");
+    server->setCapabilities(capabilities);
+
+    new MessageServer;
+    QMailStore* ms = QMailStore::instance();
+
+    QMailAccount account;
+    prepareImapAccount(&account, server, messages);
+    if (QTest::currentTestFailed()) return;
+
+    QMailFolderIdList folderIds(ms->queryFolders(QMailFolderKey::parentAccountId(account.id())
+                                                 & QMailFolderKey::path(QLatin1String("INBOX"))));
+    QCOMPARE(folderIds.count(), 1);
+    const QMailFolderId inboxId(folderIds.first());
+    const QMailMessageKey inboxKey(QMailMessageKey::parentFolderId(inboxId));
+    MockMailbox* inbox = server->mailbox(QLatin1String("INBOX"));
+
+    QSignalSpy commands(server, SIGNAL(commandReceived(QByteArray)));
+
+    /* The first check lists every flag and records the folder's mod-sequence */
+    checkImapFolder(inboxId, 1, messages);
+    if (QTest::currentTestFailed()) return;
+    QCOMPARE(countContaining(commands, "CHANGEDSINCE"), 0);
+
+    /* Nothing changed, so nothing is fetched */
+    commands.clear();
+    checkImapFolder(inboxId, 1, messages);
+    if (QTest::currentTestFailed()) return;
+    QCOMPARE(countCommands(commands, "FETCH"), 0);
+
+    /* Only the changed messages are reported, and their flags applied */
+    int seen = 0;
+    for (int i = 0; i < inbox->messages.count(); i += 10, ++seen)
+        inbox->setFlag(i, QLatin1String("\\Seen"));
+    commands.clear();
+    checkImapFolder(inboxId, 1, messages);
+    if (QTest::currentTestFailed()) return;
+    QCOMPARE(countContaining(commands, "CHANGEDSINCE"), 1);
+    QCOMPARE(ms->countMessages(inboxKey & QMailMessageKey::status(QMailMessage::Read)), seen);
+
+    /* CHANGEDSINCE does not report expunges, so they are found by the full listing */
+    inbox->remove(inbox->messages.count() / 2);
+    commands.clear();
+    checkImapFolder(inboxId, 1, messages);
+    if (QTest::currentTestFailed()) return;
+    QCOMPARE(ms->countMessages(inboxKey), inbox->messages.count());
+    QCOMPARE(countCommands(commands, "FETCH"), 2);
+
+    /* A mod-sequence lower than the recorded one can't be relied upon */
+    for (int i = 0; i < inbox->messages.count(); ++i)
+        inbox->messages[i].modSeq = 1;
+    inbox->highestModSeq = 1;
+    inbox->setFlag(1, QLatin1String("\\Flagged"));
+    commands.clear();
+    checkImapFolder(inboxId, 1, messages);
+    if (QTest::currentTestFailed()) return;
+    QCOMPARE(countContaining(commands, "CHANGEDSINCE"), 0);
+    QCOMPARE(ms->countMessages(inboxKey & QMailMessageKey::status(QMailMessage::Important)), 1);
+
+    /* A new UIDVALIDITY discards what is held, and the folder is listed afresh */
+    inbox->uidValidity += 1;
+    commands.clear();
+    checkImapFolder(inboxId, inbox->messages.count(), messages);
+    if (QTest::currentTestFailed()) return;
+    QCOMPARE(countContaining(commands, "CHANGEDSINCE"), 0);
+    QCOMPARE(ms->countMessages(inboxKey), inbox->messages.count());
+
+    /* The mod-sequence recorded by that listing is used again */
+    commands.clear();
+    checkImapFolder(inboxId, 1, messages);
+    if (QTest::currentTestFailed()) return;
+    QCOMPARE(countCommands(commands, "FETCH"), 0);
+}
+
+void tst_MessageServer::condstoreImap_data()
+{ smallWorkload_data(); }
+
+void tst_MessageServer::notifyEnableRejected()
+{ runInChildProcess(&tst_MessageServer::notifyEnableRejected_impl); }
+
+/*
+    Test that push email falls back to IDLE on each folder when the server
+    advertises NOTIFY but refuses to enable CONDSTORE, instead of retrying
+    the NOTIFY connection over and over.
+*/
+void tst_MessageServer::notifyEnableRejected_impl()
+{
+    QFETCH(int, messages);
+
+    MockImapServer* server = startImapServer();
+    if (QTest::currentTestFailed()) return;
+
+    /* Without QRESYNC only the NOTIFY connection asks to enable CONDSTORE */
+    QByteArray capabilities(server->capabilities());
+    capabilities.replace(" QRESYNC", " NOTIFY");
+    server->setCapabilities(capabilities);
+    server->setScriptedResponse("ENABLE", "%TAG% NO [CANNOT] CONDSTORE is unavailable\r\n");
+
+    new MessageServer;
+
+    QMailAccount account;
+    prepareImapAccount(&account, server, messages);
+    if (QTest::currentTestFailed()) return;
+
+    QSignalSpy commands(server, SIGNAL(commandReceived(QByteArray)));
+
+    QMailAccountConfiguration config(account.id());
+    {
+        ImapConfigurationEditor imap(&config);
+        imap.setPushEnabled(true);
+        imap.setPushFolders(QStringList() << QLatin1String("INBOX"));
+    }
+    QVERIFY(QMailStore::instance()->updateAccount(&account, &config));
+
+    QTRY_VERIFY_WITH_TIMEOUT(countCommands(commands, "IDLE") > 0, maxTime(messages));
+
+    QCOMPARE(countCommands(commands, "ENABLE"), 1);
+    QCOMPARE(countCommands(commands, "NOTIFY"), 0);
+    QVERIFY(countCommands(commands, "SELECT") + countCommands(commands, "EXAMINE") > 0);
+}
+
+void tst_MessageServer::notifyEnableRejected_data()
+{ smallWorkload_data(); }
+
+void tst_MessageServer::notifyImap()
+{ runInChildProcess(&tst_MessageServer::notifyImap_impl); }
+
+/*
+    Test push email over a NOTIFY connection.  An unsolicited STATUS for a
+    monitored mailbox reporting a new UIDNEXT or MESSAGES should retrieve the
+    new mail, and one reporting only a new HIGHESTMODSEQ should check flags.
+*/
+void tst_MessageServer::notifyImap_impl()
+{
+    QFETCH(int, messages);
+
+    MockImapServer* server = startImapServer();
+    if (QTest::currentTestFailed()) return;
+
+    /* Without QRESYNC only the NOTIFY connection enables CONDSTORE */
+    QByteArray capabilities(server->capabilities());
+    capabilities.replace(" QRESYNC", " NOTIFY");
+    server->setCapabilities(capabilities);
+
+    new MessageServer;
+    QMailStore* ms = QMailStore::instance();
+
+    QMailAccount account;
+    prepareImapAccount(&account, server, messages);
+    if (QTest::currentTestFailed()) return;
+
+    QMailFolderIdList folderIds(ms->queryFolders(QMailFolderKey::parentAccountId(account.id())
+                                                 & QMailFolderKey::path(QLatin1String("INBOX"))));
+    QCOMPARE(folderIds.count(), 1);
+    const QMailMessageKey inboxKey(QMailMessageKey::parentFolderId(folderIds.first()));
+    MockMailbox* inbox = server->mailbox(QLatin1String("INBOX"));
+
+    QSignalSpy commands(server, SIGNAL(commandReceived(QByteArray)));
+
+    QMailAccountConfiguration config(account.id());
+    {
+        ImapConfigurationEditor imap(&config);
+        imap.setPushEnabled(true);
+        imap.setPushFolders(QStringList() << QLatin1String("INBOX"));
+    }
+    QVERIFY(ms->updateAccount(&account, &config));
+
+    QTRY_VERIFY_WITH_TIMEOUT(countCommands(commands, "NOTIFY") > 0 && countCommands(commands, "IDLE") > 0,
+                             maxTime(messages));
+    QCOMPARE(countCommands(commands, "ENABLE"), 1);
+
+    /* New mail raises UIDNEXT and MESSAGES, and is retrieved */
+    const int count = ms->countMessages(inboxKey);
+    commands.clear();
+    server->deliver(inbox->name, MockServer::generateMessage(messages, 1024));
+    QTRY_COMPARE_WITH_TIMEOUT(ms->countMessages(inboxKey), count + 1, maxTime(messages));
+    QVERIFY(countCommands(commands, "FETCH") > 0);
+
+    /* A flag change raises only HIGHESTMODSEQ, and the flags are checked */
+    int index = 0;
+    while (inbox->messages.at(index).flags.contains(QLatin1String("\\Seen"), Qt::CaseInsensitive))
+        ++index;
+    const QMailMessageKey readKey(inboxKey & QMailMessageKey::status(QMailMessage::Read));
+    const int read = ms->countMessages(readKey);
+    commands.clear();
+    inbox->setFlag(index, QLatin1String("\\Seen"));
+    server->changed(inbox->name);
+    QTRY_COMPARE_WITH_TIMEOUT(ms->countMessages(readKey), read + 1, maxTime(messages));
+    QVERIFY(countCommands(commands, "FETCH") > 0);
+    QCOMPARE(ms->countMessages(inboxKey), count + 1);
+}
+
+void tst_MessageServer::notifyImap_data()
+{ smallWorkload_data(); }
+
+void tst_MessageServer::retrievalPop()
+{ runInChildProcess(&tst_MessageServer::retrievalPop_impl); }
+
+/* Test retrieval of a complete POP maildrop */
+void tst_MessageServer::retrievalPop_impl()
+{
+    QFETCH(int, messages);
+    QFETCH(int, bodySize);
+
+    MockPopServer* server = new MockPopServer;
+    MockServer::populate(server->maildrop(), messages, bodySize);
+    startServer(server);
+    if (QTest::currentTestFailed()) return;
+
+    new MessageServer;
+    QMailStore* ms = QMailStore::instance();
+
+    QMailAccount account;
+    addAccount(&account, "pop3", server);
+    if (QTest::currentTestFailed()) return;
+
+    QMailRetrievalAction retrieve;
+    {
+        BenchmarkContext ctx(m_xml, server);
+        retrieve.synchronizeAll(account.id());
+        waitForActivity(&retrieve, QMailServiceAction::Successful, maxTime(messages));
+        if (QTest::currentTestFailed()) return;
+    }
+
+    QCOMPARE(ms->countMessages(), messages);
+}
+
+void tst_MessageServer::retrievalPop_data()
+{ workload_data(); }
+
+void tst_MessageServer::sendSmtp()
+{ runInChildProcess(&tst_MessageServer::sendSmtp_impl); }
+
+/* Test transmission of a full outbox */
+void tst_MessageServer::sendSmtp_impl()
+{
+    QFETCH(int, messages);
+    QFETCH(int, bodySize);
+
+    MockSmtpServer* server = new MockSmtpServer;
+    startServer(server);
+    if (QTest::currentTestFailed()) return;
+
+    new MessageServer;
+    QMailStore* ms = QMailStore::instance();
+
+    QMailAccount account;
+    addAccount(&account, "smtp", server);
+    if (QTest::currentTestFailed()) return;
+
+    /* Fill the outbox in batches, outside of the measurement */
+    static const int batchSize = 1000;
+    for (int first = 0; first < messages; first += batchSize) {
+        QList<QMailMessage> batch;
+        for (int i = first; i < qMin(messages, first + batchSize); ++i) {
+            QByteArray data(MockServer::generateMessage(i, bodySize));
+
+            QMailMessage message;
+            message.setMessageType(QMailMessage::Email);
+            message.setParentAccountId(account.id());
+            message.setParentFolderId(QMailFolderId(QMailFolder::LocalStorageFolderId));
+            message.setFrom(QMailAddress(QLatin1String("benchmark@example.org")));
+            message.setTo(QMailAddress(QLatin1String("recipient@example.org")));
+            message.setSubject(QString::fromLatin1("Benchmark message %1").arg(i));
+            message.setBody(QMailMessageBody::fromData(QString::fromLatin1(data.mid(data.indexOf("\r\n\r\n") + 4)),
+                                                       QMailMessageContentType("text/plain; charset=us-ascii"),
+                                                       QMailMessageBody::SevenBit));
+            message.setStatus(QMailMessage::Outgoing | QMailMessage::Outbox | QMailMessage::LocalOnly, true);
+            batch.append(message);
+        }
+
+        QList<QMailMessage*> pointers;
+        for (int i = 0; i < batch.count(); ++i)
+            pointers.append(&batch[i]);
+        QVERIFY(ms->addMessages(pointers));
+    }
+
+    QMailTransmitAction transmit;
+    {
+        BenchmarkContext ctx(m_xml, server);
+        transmit.transmitMessages(account.id());
+        waitForActivity(&transmit, QMailServiceAction::Successful, maxTime(messages));
+        if (QTest::currentTestFailed()) return;
+    }
+
+    QCOMPARE(server->receivedCount(), messages);
+}
+
+void tst_MessageServer::sendSmtp_data()
+{ workload_data(); }
+
+void tst_MessageServer::storeProfile()
+{ runInChildProcess(&tst_MessageServer::storeProfile_impl); }
+
+/*
+    Measures the latency of the first query made after the store has been
+    idle, and the throughput of the queries a message list makes while
+    scrolling, using the profile recommended for each process role.
+    Connection lifetimes are shortened so that the idle period elapses
+    within the test.
+*/
+void tst_MessageServer::storeProfile_impl()
+{
+    QFETCH(int, role);
+    QFETCH(int, messages);
+
+    QMailStore* ms = QMailStore::instance();
+
+    QMailStore::StoreProfile profile(QMailStore::roleProfile(static_cast<QMailStore::ProcessRole>(role)));
+    if (profile.connectionLifetime > 0)
+        profile.connectionLifetime = 200;
+    ms->setStoreProfile(profile);
+
+    QMailAccount account;
+    account.setName(QLatin1String("Store profile"));
+    QVERIFY(ms->addAccount(&account, 0));
+
+    static const int batchSize = 1000;
+    for (int first = 0; first < messages; first += batchSize) {
+        QList<QMailMessageMetaData> batch;
+        for (int i = first; i < qMin(messages, first + batchSize); ++i) {
+            QMailMessageMetaData message;
+            message.setMessageType(QMailMessage::Email);
+            message.setParentAccountId(account.id());
+            message.setParentFolderId(QMailFolderId(QMailFolder::LocalStorageFolderId));
+            message.setFrom(QMailAddress(QString::fromLatin1("sender%1@example.org").arg(i)));
+            message.setRecipients(QMailAddress(QLatin1String("benchmark@example.org")));
+            message.setSubject(QString::fromLatin1("Benchmark message %1").arg(i));
+            message.setDate(QMailTimeStamp(QDateTime::currentDateTime().addSecs(-60 * i)));
+            message.setStatus(QMailMessage::Incoming, true);
+            batch.append(message);
+        }
+
+        QList<QMailMessageMetaData*> pointers;
+        for (int i = 0; i < batch.count(); ++i)
+            pointers.append(&batch[i]);
+        QVERIFY(ms->addMessages(pointers));
+    }
+
+    const QMailMessageKey key(QMailMessageKey::parentAccountId(account.id()));
+    const QMailMessageSortKey sortKey(QMailMessageSortKey::timeStamp(Qt::DescendingOrder));
+    const QMailMessageKey::Properties properties(QMailMessageKey::Id | QMailMessageKey::Sender | QMailMessageKey::Subject |
+                                                 QMailMessageKey::TimeStamp | QMailMessageKey::Status);
+    static const int pageSize = 50;
+
+    // Let the store become idle
+    QTest::qWait(500);
+
+    QElapsedTimer timer;
+    timer.start();
+    QMailMessageIdList page(ms->queryMessages(key, sortKey, pageSize));
+    QCOMPARE(ms->messagesMetaData(QMailMessageKey::id(page), properties).count(), page.count());
+    const qint64 firstQuery = timer.nsecsElapsed() / 1000;
+
+    int queries = 0;
+    timer.start();
+    while (timer.elapsed() < 2000) {
+        const int offset = (queries * pageSize) % qMax(1, messages - pageSize);
+        page = ms->queryMessages(key, sortKey, pageSize, offset);
+        ms->messagesMetaData(QMailMessageKey::id(page), properties);
+        ++queries;
+    }
+    const int throughput = int((qint64(queries) * 1000) / qMax<qint64>(1, timer.elapsed()));
+
+    if (m_xml) {
+        fprintf(stdout, "<BenchmarkResult metric=\"microseconds first query\" tag=\"%s\" value=\"%lld\" iterations=\"1\"/>\n", QTest::currentDataTag(), firstQuery);
+        fprintf(stdout, "<BenchmarkResult metric=\"pages per second\" tag=\"%s\" value=\"%d\" iterations=\"1\"/>\n", QTest::currentDataTag(), throughput);
+        fflush(stdout);
+    } else {
+        qWarning() << "First query after idle (us):" << firstQuery;
+        qWarning() << "Steady state pages per second:" << throughput;
+    }
+}
+
+void tst_MessageServer::storeProfile_data()
+{
+    QTest::addColumn<int>("role");
+    QTest::addColumn<int>("messages");
+
+    QTest::newRow("default--10000")       << int(QMailStore::DefaultRole)       << 10000;
+    QTest::newRow("messageserver--10000") << int(QMailStore::MessageServerRole) << 10000;
+    QTest::newRow("client--10000")        << int(QMailStore::ClientRole)        << 10000;
+    QTest::newRow("batch--10000")         << int(QMailStore::BatchRole)         << 10000;
+}
+
 
 void tst_MessageServer::onActivityChanged(QMailServiceAction::Activity a)
 {
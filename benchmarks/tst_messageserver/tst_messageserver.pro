@@ -1,6 +1,6 @@
 TEMPLATE = app
 CONFIG += unittest
-QT += testlib widgets qmfclient qmfclient-private qmfmessageserver
+QT += testlib widgets network qmfclient qmfclient-private qmfmessageserver
 TARGET = tst_messageserver
 target.path += $$QMF_INSTALL_ROOT/tests5
 
@@ -17,30 +17,52 @@ DEFINES += PLUGIN_STATIC_LINK
 }
 
 IMAP_PLUGIN=$$BASE/src/plugins/messageservices/imap/
+POP_PLUGIN=$$BASE/src/plugins/messageservices/pop/
+SMTP_PLUGIN=$$BASE/src/plugins/messageservices/smtp/
 MESSAGE_SERVER=$$BASE/src/tools/messageserver
 
 INCLUDEPATH += . 3rdparty \
                  $$IMAP_PLUGIN \
+                 $$POP_PLUGIN \
+                 $$SMTP_PLUGIN \
                  $$MESSAGE_SERVER 
 
 HEADERS += benchmarkcontext.h \
+           mockserver.h \
+           mockimapserver.h \
+           mockpopserver.h \
+           mocksmtpserver.h \
            qscopedconnection.h \
            testfsusage.h \
            $$IMAP_PLUGIN/imapconfiguration.h \
+           $$POP_PLUGIN/popconfiguration.h \
+           $$SMTP_PLUGIN/smtpconfiguration.h \
            $$MESSAGE_SERVER/mailmessageclient.h \
            $$MESSAGE_SERVER/messageserver.h \
            $$MESSAGE_SERVER/servicehandler.h \
+           $$MESSAGE_SERVER/requestjournal.h \
+           $$MESSAGE_SERVER/requestscheduler.h \
+           $$MESSAGE_SERVER/mailboxtransfer.h \
            $$MESSAGE_SERVER/newcountnotifier.h
 
 SOURCES += benchmarkcontext.cpp \
+           mockserver.cpp \
+           mockimapserver.cpp \
+           mockpopserver.cpp \
+           mocksmtpserver.cpp \
            qscopedconnection.cpp \
            testfsusage.cpp \
            tst_messageserver.cpp \
            $$IMAP_PLUGIN/imapconfiguration.cpp \
+           $$POP_PLUGIN/popconfiguration.cpp \
+           $$SMTP_PLUGIN/smtpconfiguration.cpp \
            $$MESSAGE_SERVER/mailmessageclient.cpp \
            $$MESSAGE_SERVER/messageserver.cpp \
            $$MESSAGE_SERVER/prepareaccounts.cpp \
            $$MESSAGE_SERVER/servicehandler.cpp \
+           $$MESSAGE_SERVER/requestjournal.cpp \
+           $$MESSAGE_SERVER/requestscheduler.cpp \
+           $$MESSAGE_SERVER/mailboxtransfer.cpp \
            $$MESSAGE_SERVER/newcountnotifier.cpp
 
 linux {
@@ -66,7 +66,9 @@ enum QMailServerRequestType
     CancelSearchRequestType,
     ListActionsRequestType,
     ProtocolRequestRequestType,
-    MoveFolderRequestType
+    MoveFolderRequestType,
+    ImportMailboxRequestType,
+    ExportMailboxRequestType
 };
 
 typedef quint64 QMailActionId;
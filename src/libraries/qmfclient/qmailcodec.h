@@ -74,6 +74,8 @@ public:
     static QString decodeModifiedUtf7(const QString &text);
 
 protected:
+    friend class QMailMessageBodyPrivate;
+
     // Helper functions to convert stream chunks
     virtual void encodeChunk(QDataStream& out, const unsigned char* in, int length, bool finalChunk) = 0;
     virtual void decodeChunk(QDataStream& out, const char* in, int length, bool finalChunk) = 0;
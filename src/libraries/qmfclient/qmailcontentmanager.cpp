@@ -476,3 +476,25 @@ QMailContentManager::ManagerRole QMailContentManager::role() const
     return StorageRole;
 }
 
+
+/*!
+    \class QMailConcurrentRemovalInterface
+
+    \brief The QMailConcurrentRemovalInterface class marks content managers whose content may be removed concurrently.
+    \ingroup messaginglibrary
+
+    A QMailContentManager implementation that also derives from QMailConcurrentRemovalInterface
+    declares that its remove() functions may be called from threads other than the one that created
+    it, concurrently with each other and with its other functions.
+
+    The mail store removes the content of deleted messages on a pool of worker threads when every
+    content manager derives from this class; otherwise the content is removed in batches on the thread
+    of the mail store, between the events it processes.
+*/
+
+/*!
+    Destroys the interface.
+*/
+QMailConcurrentRemovalInterface::~QMailConcurrentRemovalInterface()
+{
+}
@@ -123,5 +123,12 @@ public:
     virtual ManagerRole role() const;
 };
 
+
+class QMF_EXPORT QMailConcurrentRemovalInterface
+{
+public:
+    virtual ~QMailConcurrentRemovalInterface();
+};
+
 #endif
 
@@ -0,0 +1,190 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qmailcontentpurger_p.h"
+#include "qmailcontentmanager.h"
+#include "locks_p.h"
+
+#include <QDebug>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+
+namespace {
+
+// Small enough that completed removals are recorded promptly, and large enough
+// that each content manager resolves its directories once for many files
+const int purgeBatchSize = 256;
+
+// Removal is bound by the file system rather than the processor
+const int maximumPurgeThreads = 4;
+
+void removeBatch(QMailContentPurgeBatch *batch)
+{
+    batch->removed = true;
+
+    foreach (QMailContentManager *manager, batch->managers) {
+        // Content that does not exist has nothing left to remove; other failures are retried by maintenance
+        if (manager->remove(batch->identifiers) == QMailStore::ContentNotRemoved) {
+            qWarning() << "Unable to remove expired message contents for" << batch->identifiers.count() << "messages";
+            batch->removed = false;
+        }
+    }
+}
+
+}
+
+class QMailContentPurgeTask : public QRunnable
+{
+public:
+    QMailContentPurgeTask(QMailContentPurger *purger, const QMailContentPurgeBatch &batch)
+        : purger(purger),
+          batch(batch)
+    {
+    }
+
+    void run()
+    {
+        removeBatch(&batch);
+        purger->batchRemoved(batch);
+    }
+
+private:
+    QMailContentPurger *purger;
+    QMailContentPurgeBatch batch;
+};
+
+
+QMailContentPurger::QMailContentPurger(ProcessMutex *contentMutex, QObject *parent)
+    : QObject(parent),
+      contentMutex(contentMutex),
+      completedCount(0),
+      totalCount(0)
+{
+    pool.setMaxThreadCount(qBound(1, QThread::idealThreadCount(), maximumPurgeThreads));
+}
+
+QMailContentPurger::~QMailContentPurger()
+{
+    // Content whose removal is not reported remains recorded as obsolete, and is removed by maintenance
+    pool.clear();
+    pool.waitForDone();
+}
+
+void QMailContentPurger::purge(const QList<QMailContentManager*> &managers, const QStringList &identifiers, const QVariantList &rowIds)
+{
+    Q_ASSERT(identifiers.count() == rowIds.count());
+
+    bool concurrent(true);
+    foreach (QMailContentManager *manager, managers) {
+        if (!dynamic_cast<QMailConcurrentRemovalInterface*>(manager))
+            concurrent = false;
+    }
+
+    for (int i = 0; i < identifiers.count(); i += purgeBatchSize) {
+        QMailContentPurgeBatch batch;
+        batch.managers = managers;
+        batch.identifiers = identifiers.mid(i, purgeBatchSize);
+        batch.rowIds = rowIds.mid(i, purgeBatchSize);
+
+        totalCount += batch.identifiers.count();
+
+        if (concurrent) {
+            pool.start(new QMailContentPurgeTask(this, batch));
+        } else {
+            serial.append(batch);
+            if (serial.count() == 1)
+                QMetaObject::invokeMethod(this, "purgeSerialBatch", Qt::QueuedConnection);
+        }
+    }
+}
+
+bool QMailContentPurger::isActive() const
+{
+    return (totalCount > 0);
+}
+
+void QMailContentPurger::purgeSerialBatch()
+{
+    if (serial.isEmpty())
+        return;
+
+    QMailContentPurgeBatch batch(serial.takeFirst());
+
+    contentMutex->lock();
+    removeBatch(&batch);
+    contentMutex->unlock();
+
+    batchRemoved(batch);
+
+    if (!serial.isEmpty())
+        QMetaObject::invokeMethod(this, "purgeSerialBatch", Qt::QueuedConnection);
+}
+
+// Called from the thread that removed the batch
+void QMailContentPurger::batchRemoved(const QMailContentPurgeBatch &batch)
+{
+    QMutexLocker locker(&mutex);
+
+    completed.append(batch);
+    if (completed.count() == 1)
+        QMetaObject::invokeMethod(this, "completeBatches", Qt::QueuedConnection);
+}
+
+void QMailContentPurger::completeBatches()
+{
+    QList<QMailContentPurgeBatch> batches;
+    {
+        QMutexLocker locker(&mutex);
+        batches = completed;
+        completed.clear();
+    }
+
+    QVariantList rowIds;
+    foreach (const QMailContentPurgeBatch &batch, batches) {
+        completedCount += batch.identifiers.count();
+        if (batch.removed)
+            rowIds += batch.rowIds;
+    }
+
+    if (!rowIds.isEmpty())
+        emit contentPurged(rowIds);
+
+    emit progressChanged(completedCount, totalCount);
+
+    if (completedCount == totalCount) {
+        completedCount = 0;
+        totalCount = 0;
+    }
+}
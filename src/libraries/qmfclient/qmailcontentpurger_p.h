@@ -0,0 +1,113 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QMAILCONTENTPURGER_P_H
+#define QMAILCONTENTPURGER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Extended API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVariantList>
+
+class QMailContentManager;
+class ProcessMutex;
+
+// A group of content identifiers removed together, with the rows of the
+// obsoletefiles table that record them
+struct QMailContentPurgeBatch
+{
+    QList<QMailContentManager*> managers;
+    QStringList identifiers;
+    QVariantList rowIds;
+    bool removed;
+
+    QMailContentPurgeBatch() : removed(false) {}
+};
+
+// Removes the content of deleted messages after the deletion has been committed,
+// so that the deletion itself does not wait for the file system.  Batches whose
+// content managers permit concurrent removal are removed on a pool of worker
+// threads; the remainder are removed on this thread, one batch per event, while
+// holding the content manager mutex.
+class QMailContentPurger : public QObject
+{
+    Q_OBJECT
+
+public:
+    QMailContentPurger(ProcessMutex *contentMutex, QObject *parent = Q_NULLPTR);
+    ~QMailContentPurger();
+
+    void purge(const QList<QMailContentManager*> &managers, const QStringList &identifiers, const QVariantList &rowIds);
+
+    bool isActive() const;
+
+signals:
+    void contentPurged(const QVariantList &rowIds);
+    void progressChanged(int completed, int total);
+
+private slots:
+    void purgeSerialBatch();
+    void completeBatches();
+
+private:
+    friend class QMailContentPurgeTask;
+
+    void batchRemoved(const QMailContentPurgeBatch &batch);
+
+    ProcessMutex *contentMutex;
+
+    QThreadPool pool;
+    QList<QMailContentPurgeBatch> serial;
+
+    QMutex mutex;
+    QList<QMailContentPurgeBatch> completed;
+
+    int completedCount;
+    int totalCount;
+};
+
+#endif
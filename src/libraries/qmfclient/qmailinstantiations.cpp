@@ -96,5 +96,7 @@ Q_IMPLEMENT_USER_METATYPE_ENUM(QMailServiceAction::Status::ErrorCode)
 Q_IMPLEMENT_USER_METATYPE_ENUM(QMailRetrievalAction::RetrievalSpecification)
 
 Q_IMPLEMENT_USER_METATYPE_ENUM(QMailSearchAction::SearchSpecification)
+
+Q_IMPLEMENT_USER_METATYPE_ENUM(QMailStorageAction::MailboxFormat)
 #endif
 
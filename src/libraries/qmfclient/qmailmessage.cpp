@@ -3525,6 +3525,313 @@ bool QMailMessageBodyPrivate::toStream(QTextStream& out) const
     return false;
 }
 
+namespace {
+
+// Accumulates a bounded plain text preview from text supplied in arbitrary
+// chunks.  When markup is being processed, tags, comments and the content of
+// non-displayed elements are discarded, character entities are resolved and
+// whitespace is simplified; processing state is retained between chunks so
+// that constructs may span chunk boundaries.
+class PreviewExtractor
+{
+public:
+    PreviewExtractor(int maxLength, bool markup);
+
+    void append(const QString &text);
+
+    bool isComplete() const { return _preview.length() >= _maxLength; }
+    QString preview() const;
+
+private:
+    enum State { Text, Tag, Comment, Entity };
+
+    void appendText(QChar c);
+    void tagCompleted();
+    void entityCompleted(bool terminated);
+
+    const int _maxLength;
+    const bool _markup;
+    State _state;
+    QString _preview;
+    bool _pendingSpace;
+
+    QString _tagName;
+    bool _tagClosing;
+    bool _tagNameComplete;
+    QChar _tagQuote;
+    QChar _tagPrevious;
+    int _commentDashes;
+
+    QString _skipElement;
+    QString _entity;
+};
+
+PreviewExtractor::PreviewExtractor(int maxLength, bool markup)
+    : _maxLength(maxLength),
+      _markup(markup),
+      _state(Text),
+      _pendingSpace(false),
+      _tagClosing(false),
+      _tagNameComplete(false),
+      _commentDashes(0)
+{
+    _preview.reserve(maxLength);
+}
+
+void PreviewExtractor::append(const QString &text)
+{
+    if (!_markup) {
+        _preview.append(text.left(_maxLength - _preview.length()));
+        return;
+    }
+
+    for (int i = 0; (i < text.length()) && !isComplete(); ++i) {
+        const QChar c(text.at(i));
+
+        switch (_state) {
+        case Text:
+            if (c == QLatin1Char('<')) {
+                _state = Tag;
+                _tagName.clear();
+                _tagClosing = false;
+                _tagNameComplete = false;
+                _tagQuote = QChar();
+                _tagPrevious = QChar();
+            } else if (c == QLatin1Char('&')) {
+                _state = Entity;
+                _entity.clear();
+            } else {
+                appendText(c);
+            }
+            break;
+
+        case Tag:
+            if (!_tagQuote.isNull()) {
+                if (c == _tagQuote)
+                    _tagQuote = QChar();
+            } else if (c == QLatin1Char('>')) {
+                tagCompleted();
+                _state = Text;
+            } else if (!_tagNameComplete) {
+                if (_tagName.isEmpty() && c.isSpace()) {
+                    // Permit whitespace preceding the element name
+                } else if (_tagName.isEmpty() && !_tagClosing && c == QLatin1Char('/')) {
+                    _tagClosing = true;
+                } else if (c.isLetterOrNumber() || c == QLatin1Char('!') || c == QLatin1Char('-')) {
+                    _tagName.append(c.toLower());
+                    if (_tagName == QLatin1String("!--")) {
+                        _state = Comment;
+                        _commentDashes = 0;
+                    } else if (_tagName.length() > 16) {
+                        // Not an element we have any interest in
+                        _tagNameComplete = true;
+                    }
+                } else {
+                    _tagNameComplete = true;
+                }
+            } else if ((c == QLatin1Char('"') || c == QLatin1Char('\'')) && _tagPrevious == QLatin1Char('=')) {
+                _tagQuote = c;
+            }
+            if (!c.isSpace())
+                _tagPrevious = c;
+            break;
+
+        case Comment:
+            if (c == QLatin1Char('>') && _commentDashes >= 2) {
+                _state = Text;
+            } else if (c == QLatin1Char('-')) {
+                ++_commentDashes;
+            } else {
+                _commentDashes = 0;
+            }
+            break;
+
+        case Entity:
+            if (c == QLatin1Char(';')) {
+                entityCompleted(true);
+            } else if ((c.isLetterOrNumber() || (_entity.isEmpty() && c == QLatin1Char('#'))) && _entity.length() < 8) {
+                _entity.append(c);
+            } else {
+                entityCompleted(false);
+                // Reprocess this character as ordinary content
+                --i;
+            }
+            break;
+        }
+    }
+}
+
+QString PreviewExtractor::preview() const
+{
+    if (!_markup)
+        return _preview;
+
+    if (_state == Entity) {
+        // The input ended within an unterminated entity, whose text is retained
+        PreviewExtractor flushed(*this);
+        flushed.entityCompleted(false);
+        return flushed.preview();
+    }
+
+    QString result(_preview.left(_maxLength));
+    while (!result.isEmpty() && result.at(result.length() - 1).isSpace())
+        result.chop(1);
+    return result;
+}
+
+void PreviewExtractor::appendText(QChar c)
+{
+    if (!_skipElement.isEmpty())
+        return;
+
+    if (c.isSpace()) {
+        _pendingSpace = true;
+    } else {
+        if (_pendingSpace && !_preview.isEmpty())
+            _preview.append(QLatin1Char(' '));
+        _pendingSpace = false;
+        _preview.append(c);
+    }
+}
+
+void PreviewExtractor::tagCompleted()
+{
+    static const char *const hiddenElements[] = { "style", "head", "form", "script" };
+    static const char *const blockElements[] = { "br", "p", "div", "li", "tr", "td", "th", "table", "blockquote",
+                                                 "h1", "h2", "h3", "h4", "h5", "h6" };
+
+    if (!_skipElement.isEmpty()) {
+        if (_tagClosing && _tagName == _skipElement)
+            _skipElement.clear();
+        return;
+    }
+
+    if (!_tagClosing && _tagPrevious != QLatin1Char('/')) {
+        for (uint i = 0; i < sizeof(hiddenElements) / sizeof(hiddenElements[0]); ++i) {
+            if (_tagName == QLatin1String(hiddenElements[i])) {
+                _skipElement = _tagName;
+                return;
+            }
+        }
+    }
+
+    // Separate the text of block-level elements
+    for (uint i = 0; i < sizeof(blockElements) / sizeof(blockElements[0]); ++i) {
+        if (_tagName == QLatin1String(blockElements[i])) {
+            _pendingSpace = true;
+            break;
+        }
+    }
+}
+
+void PreviewExtractor::entityCompleted(bool terminated)
+{
+    _state = Text;
+
+    if (terminated) {
+        QChar replacement;
+        if (_entity.startsWith(QLatin1Char('#'))) {
+            bool ok = false;
+            uint code = 0;
+            if (_entity.length() > 1 && (_entity.at(1) == QLatin1Char('x') || _entity.at(1) == QLatin1Char('X'))) {
+                code = _entity.mid(2).toUInt(&ok, 16);
+            } else {
+                code = _entity.mid(1).toUInt(&ok, 10);
+            }
+            if (ok && code != 0 && code <= 0xffff)
+                replacement = QChar(code);
+        } else {
+            const QString name(_entity.toLower());
+            if (name == QLatin1String("quot")) {
+                replacement = QLatin1Char('"');
+            } else if (name == QLatin1String("nbsp")) {
+                replacement = QLatin1Char(' ');
+            } else if (name == QLatin1String("amp")) {
+                replacement = QLatin1Char('&');
+            } else if (name == QLatin1String("lt")) {
+                replacement = QLatin1Char('<');
+            } else if (name == QLatin1String("gt")) {
+                replacement = QLatin1Char('>');
+            } else if (name == QLatin1String("apos")) {
+                replacement = QLatin1Char('\'');
+            }
+        }
+
+        if (!replacement.isNull()) {
+            appendText(replacement);
+            return;
+        }
+    }
+
+    // Not an entity we can resolve; retain the original text
+    appendText(QLatin1Char('&'));
+    for (int i = 0; i < _entity.length(); ++i)
+        appendText(_entity.at(i));
+    if (terminated)
+        appendText(QLatin1Char(';'));
+}
+
+}
+
+// Decodes only as much of the body as is required to fill the preview
+QString QMailMessageBodyPrivate::preview(int maxLength, bool markup) const
+{
+    PreviewExtractor extractor(maxLength, markup);
+
+    QByteArray charset = _type.charset();
+    if (charset.isEmpty() || insensitiveIndexOf("ascii", charset) != -1) {
+        // We'll assume the text is plain ASCII, to be extracted to Latin-1
+        charset = "ISO-8859-1";
+    }
+
+    if (!_encoded && !_filename.isEmpty() && unicodeConvertingCharset(charset)) {
+        // The data is already in unicode format
+        QTextStream* in = _bodyData.textStream();
+        in->setCodec(charset);
+        while (!in->atEnd() && !extractor.isComplete())
+            extractor.append(in->read(QMailCodec::ChunkCharacters));
+        delete in;
+
+        return extractor.preview();
+    }
+
+    // If our data is not encoded, we don't need to decode
+    QMailCodec* codec = codecForEncoding(_encoded ? _encoding : QMailMessageBody::Binary, _type);
+    if (!codec)
+        return QString();
+
+    QTextCodec* textCodec = QMailCodec::codecForName(charset);
+    if (!textCodec)
+        textCodec = QMailCodec::codecForName("UTF-8");
+    QTextDecoder* decoder = textCodec->makeDecoder();
+
+    QDataStream* in = _bodyData.dataStream();
+    char* buffer = new char[QMailCodec::ChunkCharacters];
+    QByteArray decoded;
+    while (!in->atEnd() && !extractor.isComplete()) {
+        int length = in->readRawData(buffer, QMailCodec::ChunkCharacters);
+        if (length <= 0)
+            break;
+        if (in->status() == QDataStream::ReadPastEnd) {
+            // work around QTBUG-69474
+            in->resetStatus();
+        }
+
+        decoded.clear();
+        {
+            QDataStream out(&decoded, QIODevice::WriteOnly);
+            codec->decodeChunk(out, buffer, length, in->atEnd());
+        }
+        extractor.append(decoder->toUnicode(decoded));
+    }
+    delete [] buffer;
+    delete in;
+    delete decoder;
+    delete codec;
+
+    return extractor.preview();
+}
+
 QMailMessageContentType QMailMessageBodyPrivate::contentType() const
 {
     return _type;
@@ -8714,50 +9021,19 @@ static void setMessagePriorityFromHeaderFields(QMailMessage *mail)
     return; // Normal Priority
 }
 
+#ifdef USE_HTML_PARSER
 static QString htmlToPlainText(const QString &html)
 {
-#ifdef USE_HTML_PARSER
     QTextDocument doc;
     doc.setHtml(html);
     return doc.toPlainText();
-#else
-    QString plainText = html;
-    plainText.remove(QRegExp(QLatin1String("<\\s*(style|head|form|script)[^<]*<\\s*/\\s*\\1\\s*>"), Qt::CaseInsensitive));
-    plainText.remove(QRegExp(QLatin1String("<(.)[^>]*>")));
-    plainText.replace(QLatin1String("&quot;"), QLatin1String("\""), Qt::CaseInsensitive);
-    plainText.replace(QLatin1String("&nbsp;"), QLatin1String(" "), Qt::CaseInsensitive);
-    plainText.replace(QLatin1String("&amp;"), QLatin1String("&"), Qt::CaseInsensitive);
-    plainText.replace(QLatin1String("&lt;"), QLatin1String("<"), Qt::CaseInsensitive);
-    plainText.replace(QLatin1String("&gt;"), QLatin1String(">"), Qt::CaseInsensitive);
-
-    // now replace stuff like "&#1084;"
-    int pos = 0;
-    while (true) {
-        pos = plainText.indexOf(QLatin1String("&#"), pos);
-        if (pos < 0)
-            break;
-        int semicolon = plainText.indexOf(';', pos+2);
-        if (semicolon < 0) {
-            ++pos;
-            continue;
-        }
-        int code = (plainText.mid(pos+2, semicolon-pos-2)).toInt();
-        if (code == 0) {
-            ++pos;
-            continue;
-        }
-        plainText.replace(pos, semicolon-pos+1, QChar(code));
-    }
-
-    return plainText.simplified();
-#endif
 }
+#endif
 
 /*! \internal */
 void QMailMessage::refreshPreview()
 {
     const int maxPreviewLength = 280;
-    // TODO: don't load entire body into memory
     QMailMessagePartContainer *htmlPart= findHtmlContainer();
     QMailMessagePartContainer *plainTextPart= findPlainTextContainer();
 
@@ -8765,11 +9041,16 @@ void QMailMessage::refreshPreview()
         plainTextPart=Q_NULLPTR;
 
     if ( plainTextPart && plainTextPart->hasBody()) {
-        QString plainText = plainTextPart->body().data();
-        metaDataImpl()->setPreview(plainText.left(maxPreviewLength));
+        const QMailMessageBody body(plainTextPart->body());
+        metaDataImpl()->setPreview(body.impl<const QMailMessageBodyPrivate>()->preview(maxPreviewLength, false));
     } else if (htmlPart && ( multipartType() == MultipartRelated || htmlPart->hasBody())) {
+#ifdef USE_HTML_PARSER
         QString markup = htmlPart->body().data();
         metaDataImpl()->setPreview(htmlToPlainText(markup).left(maxPreviewLength));
+#else
+        const QMailMessageBody body(htmlPart->body());
+        metaDataImpl()->setPreview(body.impl<const QMailMessageBodyPrivate>()->preview(maxPreviewLength, true));
+#endif
     }
 
     partContainerImpl()->setPreviewDirty(false);
@@ -134,6 +134,8 @@ public:
     bool toStream(QDataStream& out, QMailMessageBody::EncodingFormat format) const;
     bool toStream(QTextStream& out) const;
 
+    QString preview(int maxLength, bool markup) const;
+
     QMailMessageBody::TransferEncoding transferEncoding() const;
     QMailMessageContentType contentType() const;
 
@@ -0,0 +1,546 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qmailmessagekeymatcher_p.h"
+#include "qmailstore.h"
+#include "qmailstoreimplementation_p.h"
+#include <QSet>
+#include <algorithm>
+
+/*!
+    \class QMailMessageKeyMatcher
+    \internal
+
+    QMailMessageKeyMatcher evaluates a QMailMessageKey against QMailMessageMetaData
+    held in memory, reproducing the result the store's SQL query would produce for the
+    same key.  It is used to filter message change notifications against the keys of
+    message sets and models, which otherwise requires a database query per key.
+
+    Key arguments that depend on other tables (sub-keys, ancestor folders, conversations
+    and custom fields) or on the database representation of a value (timestamps) cannot
+    be evaluated in memory; keys containing them are not local, and filter() delegates
+    to the store.
+*/
+
+namespace {
+
+ushort foldCase(QChar c)
+{
+    // SQLite case folding applies to ASCII characters only
+    ushort u = c.unicode();
+    return ((u >= 'A') && (u <= 'Z')) ? (u + ('a' - 'A')) : u;
+}
+
+int compareNoCase(const QString &lhs, const QString &rhs)
+{
+    const int length = qMin(lhs.length(), rhs.length());
+    for (int i = 0; i < length; ++i) {
+        ushort l = foldCase(lhs.at(i));
+        ushort r = foldCase(rhs.at(i));
+        if (l != r)
+            return (l < r ? -1 : 1);
+    }
+
+    return lhs.length() - rhs.length();
+}
+
+// Equivalent to the SQLite LIKE operator without an ESCAPE clause
+bool likeMatch(const QString &value, const QString &pattern)
+{
+    const int valueLength = value.length();
+    const int patternLength = pattern.length();
+
+    int v = 0;
+    int p = 0;
+    int wildcard = -1;
+    int resume = 0;
+
+    while (v < valueLength) {
+        if ((p < patternLength) && (pattern.at(p) == QLatin1Char('%'))) {
+            wildcard = p++;
+            resume = v;
+        } else if ((p < patternLength) && ((pattern.at(p) == QLatin1Char('_')) || (foldCase(pattern.at(p)) == foldCase(value.at(v))))) {
+            ++p;
+            ++v;
+        } else if (wildcard != -1) {
+            p = wildcard + 1;
+            v = ++resume;
+        } else {
+            return false;
+        }
+    }
+
+    while ((p < patternLength) && (pattern.at(p) == QLatin1Char('%')))
+        ++p;
+
+    return (p == patternLength);
+}
+
+QString escape(const QString &original, const QChar &escapee, const QChar &escaper = QLatin1Char('\\'))
+{
+    QString result(original);
+    return result.replace(escapee, QString(escaper) + escapee);
+}
+
+QString contentUri(const QMailMessageMetaData &metaData)
+{
+    if (metaData.contentScheme().isEmpty())
+        return QString();
+
+    return escape(metaData.contentScheme(), QLatin1Char(':')) + QLatin1Char(':') + escape(metaData.contentIdentifier(), QLatin1Char(':'));
+}
+
+QString minimalString(const QString &s)
+{
+    // Phone numbers are compared by their trailing digits, as in the store
+    QMailAddress address(s);
+    if (address.isPhoneNumber()) {
+        static const int significantDigits = 8;
+
+        QString minimal(address.minimalPhoneNumber());
+        int extraneous = minimal.length() - significantDigits;
+        if (extraneous > 0)
+            minimal.remove(0, extraneous);
+
+        return minimal;
+    }
+
+    return s;
+}
+
+QString submatchString(const QString &s, QMailKey::Comparator op, bool valueMinimalised)
+{
+    if (!s.isEmpty()) {
+        if (((op == QMailKey::Includes) || (op == QMailKey::Excludes)) || (((op == QMailKey::Equal) || (op == QMailKey::NotEqual)) && valueMinimalised))
+            return QLatin1Char('%') + s + QLatin1Char('%');
+    } else if ((op == QMailKey::Includes) || (op == QMailKey::Excludes)) {
+        return QString(QLatin1Char('%'));
+    }
+
+    return s;
+}
+
+bool relationOperator(QMailKey::Comparator op)
+{
+    return ((op == QMailKey::LessThan) || (op == QMailKey::LessThanEqual) ||
+            (op == QMailKey::GreaterThan) || (op == QMailKey::GreaterThanEqual));
+}
+
+bool relationHolds(QMailKey::Comparator op, int comparison)
+{
+    switch (op) {
+    case QMailKey::LessThan:
+        return (comparison < 0);
+    case QMailKey::LessThanEqual:
+        return (comparison <= 0);
+    case QMailKey::GreaterThan:
+        return (comparison > 0);
+    case QMailKey::GreaterThanEqual:
+        return (comparison >= 0);
+    default:
+        break;
+    }
+
+    return false;
+}
+
+template<typename IdType>
+bool appendIds(const QVariantList &valueList, QVector<qint64> *numbers)
+{
+    foreach (const QVariant &value, valueList) {
+        if (!value.canConvert<IdType>())
+            return false;
+        numbers->append(static_cast<qint64>(value.value<IdType>().toULongLong()));
+    }
+
+    return true;
+}
+
+bool appendIntegers(const QVariantList &valueList, QVector<qint64> *numbers)
+{
+    foreach (const QVariant &value, valueList)
+        numbers->append(value.toLongLong());
+
+    return true;
+}
+
+qint64 numericValue(QMailMessageKey::Property property, const QMailMessageMetaData &metaData)
+{
+    switch (property) {
+    case QMailMessageKey::Id:
+        return metaData.id().toULongLong();
+    case QMailMessageKey::Type:
+        return static_cast<int>(metaData.messageType());
+    case QMailMessageKey::ParentFolderId:
+        return metaData.parentFolderId().toULongLong();
+    case QMailMessageKey::PreviousParentFolderId:
+        return metaData.previousParentFolderId().toULongLong();
+    case QMailMessageKey::RestoreFolderId:
+        return metaData.restoreFolderId().toULongLong();
+    case QMailMessageKey::ParentAccountId:
+        return metaData.parentAccountId().toULongLong();
+    case QMailMessageKey::InResponseTo:
+        return metaData.inResponseTo().toULongLong();
+    case QMailMessageKey::ParentThreadId:
+        return metaData.parentThreadId().toULongLong();
+    case QMailMessageKey::Status:
+        // The UnloadedData flag has no persistent value
+        return (metaData.status() & ~QMailMessage::UnloadedData);
+    case QMailMessageKey::Size:
+        return metaData.size();
+    case QMailMessageKey::ContentType:
+        return static_cast<int>(metaData.content());
+    case QMailMessageKey::ResponseType:
+        return static_cast<int>(metaData.responseType());
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+QString stringValue(QMailMessageKey::Property property, const QMailMessageMetaData &metaData)
+{
+    switch (property) {
+    case QMailMessageKey::Sender:
+        return metaData.from().toString();
+    case QMailMessageKey::Recipients:
+        return QMailAddress::toStringList(metaData.recipients()).join(QLatin1String(","));
+    case QMailMessageKey::Subject:
+        return metaData.subject();
+    case QMailMessageKey::Preview:
+        return metaData.preview();
+    case QMailMessageKey::ServerUid:
+        return metaData.serverUid();
+    case QMailMessageKey::CopyServerUid:
+        return metaData.copyServerUid();
+    case QMailMessageKey::ListId:
+        return metaData.listId();
+    case QMailMessageKey::RfcId:
+        return metaData.rfcId();
+    case QMailMessageKey::ContentScheme:
+    case QMailMessageKey::ContentIdentifier:
+        return contentUri(metaData);
+    default:
+        break;
+    }
+
+    return QString();
+}
+
+}
+
+QMailMessageKeyMatcher::QMailMessageKeyMatcher(const QMailMessageKey &key)
+    : _key(key),
+      _local(true)
+{
+    compile(key);
+}
+
+/*!
+    Returns the key evaluated by this matcher.
+*/
+QMailMessageKey QMailMessageKeyMatcher::key() const
+{
+    return _key;
+}
+
+/*!
+    Returns true if the key can be evaluated entirely from message metadata.
+*/
+bool QMailMessageKeyMatcher::isLocal() const
+{
+    return _local;
+}
+
+/*!
+    Returns true if \a metaData is selected by the key.  If the key is not local, 
+    false is returned.
+*/
+bool QMailMessageKeyMatcher::matches(const QMailMessageMetaData &metaData) const
+{
+    if (!_local)
+        return false;
+
+    if (_nodes.isEmpty())
+        return true;
+
+    // Rows for which the clause evaluates to NULL are not selected
+    return (evaluate(_nodes.first(), metaData) == True);
+}
+
+/*!
+    Returns the members of \a ids that are selected by the key, in their original order.
+
+    Messages whose metadata is cached by the store are evaluated in memory; the remainder
+    are resolved by a store query restricted to those identifiers.
+*/
+QMailMessageIdList QMailMessageKeyMatcher::filter(const QMailMessageIdList &ids) const
+{
+    if (ids.isEmpty())
+        return ids;
+
+    QMailStore *store = QMailStore::instance();
+    if (!_local)
+        return store->queryMessages(_key & QMailMessageKey::id(ids));
+
+    QSet<QMailMessageId> selected;
+    QMailMessageIdList uncached;
+
+    foreach (const QMailMessageId &id, ids) {
+        QMailMessageMetaData metaData;
+        if (store->d->cachedMessageMetaData(id, &metaData)) {
+            if (matches(metaData))
+                selected.insert(id);
+        } else {
+            uncached.append(id);
+        }
+    }
+
+    if (!uncached.isEmpty()) {
+        foreach (const QMailMessageId &id, store->queryMessages(_key & QMailMessageKey::id(uncached)))
+            selected.insert(id);
+    }
+
+    QMailMessageIdList result;
+    foreach (const QMailMessageId &id, ids) {
+        if (selected.contains(id))
+            result.append(id);
+    }
+
+    return result;
+}
+
+int QMailMessageKeyMatcher::compile(const QMailMessageKey &key)
+{
+    // Mirror the where clause construction: empty keys (and sub-keys) produce no clause
+    if (key.isEmpty())
+        return -1;
+
+    Node node;
+    node.combiner = key.combiner();
+    node.negated = key.isNegated();
+
+    foreach (const QMailMessageKey::ArgumentType &arg, key.arguments()) {
+        Term term;
+        if (!compileTerm(arg, &term))
+            _local = false;
+
+        node.terms.append(term);
+    }
+
+    const int index = _nodes.count();
+    _nodes.append(node);
+
+    foreach (const QMailMessageKey &subKey, key.subKeys()) {
+        int child = compile(subKey);
+        if (child != -1)
+            _nodes[index].children.append(child);
+    }
+
+    return index;
+}
+
+bool QMailMessageKeyMatcher::compileTerm(const QMailMessageKey::ArgumentType &arg, Term *term) const
+{
+    term->property = arg.property;
+    term->op = arg.op;
+    term->multiple = (arg.valueList.count() > 1);
+    term->pattern = false;
+    term->noCase = false;
+
+    if (arg.valueList.isEmpty() || (arg.op == QMailKey::Present) || (arg.op == QMailKey::Absent))
+        return false;
+
+    // Relations are only meaningful against a single value
+    if (term->multiple && relationOperator(arg.op))
+        return false;
+
+    switch (arg.property) {
+    case QMailMessageKey::Id:
+    case QMailMessageKey::InResponseTo:
+        return appendIds<QMailMessageId>(arg.valueList, &term->numbers);
+
+    case QMailMessageKey::ParentFolderId:
+    case QMailMessageKey::PreviousParentFolderId:
+    case QMailMessageKey::RestoreFolderId:
+        return appendIds<QMailFolderId>(arg.valueList, &term->numbers);
+
+    case QMailMessageKey::ParentAccountId:
+        return appendIds<QMailAccountId>(arg.valueList, &term->numbers);
+
+    case QMailMessageKey::ParentThreadId:
+        return appendIds<QMailThreadId>(arg.valueList, &term->numbers);
+
+    case QMailMessageKey::Type:
+        return appendIntegers(arg.valueList, &term->numbers);
+
+    case QMailMessageKey::Status:
+        // Only a single status value is bound by the store
+        if (term->multiple)
+            return false;
+        term->numbers.append(arg.valueList.first().value<quint64>() & ~QMailMessage::UnloadedData);
+        return true;
+
+    case QMailMessageKey::Size:
+    case QMailMessageKey::ContentType:
+    case QMailMessageKey::ResponseType:
+        // A single-valued Includes is an SQL LIKE against an integer column
+        if (!term->multiple && ((arg.op == QMailKey::Includes) || (arg.op == QMailKey::Excludes)))
+            return false;
+        return appendIntegers(arg.valueList, &term->numbers);
+
+    case QMailMessageKey::Sender:
+    case QMailMessageKey::Subject:
+    case QMailMessageKey::Preview:
+    case QMailMessageKey::ServerUid:
+    case QMailMessageKey::CopyServerUid:
+    case QMailMessageKey::ListId:
+    case QMailMessageKey::RfcId:
+        term->pattern = (arg.property == QMailMessageKey::Sender);
+        term->noCase = ((arg.property == QMailMessageKey::Sender) || (arg.property == QMailMessageKey::Subject));
+        if (term->multiple) {
+            // Multiple values are an exact IN comparison
+            foreach (const QVariant &value, arg.valueList)
+                term->strings.append(value.toString());
+        } else {
+            term->strings.append(submatchString(arg.valueList.first().toString(), arg.op, false));
+        }
+        return true;
+
+    case QMailMessageKey::Recipients:
+        if (term->multiple)
+            return false;
+        term->pattern = true;
+        term->noCase = true;
+        term->strings.append(submatchString(minimalString(arg.valueList.first().toString()), arg.op, true));
+        return true;
+
+    case QMailMessageKey::ContentScheme:
+    case QMailMessageKey::ContentIdentifier:
+        if (term->multiple)
+            return false;
+        term->pattern = true;
+        {
+            // Both elements are matched against the combined content URI
+            QString value(escape(arg.valueList.first().toString(), QLatin1Char(':')));
+            if ((arg.op == QMailKey::Includes) || (arg.op == QMailKey::Excludes)) {
+                value.prepend(QLatin1Char('%')).append(QLatin1Char('%'));
+            } else if ((arg.op == QMailKey::Equal) || (arg.op == QMailKey::NotEqual)) {
+                if (arg.property == QMailMessageKey::ContentScheme) {
+                    value.append(QLatin1String(":%"));
+                } else {
+                    value.prepend(QLatin1String("%:"));
+                }
+            }
+            term->strings.append(value);
+        }
+        return true;
+
+    case QMailMessageKey::TimeStamp:
+    case QMailMessageKey::ReceptionTimeStamp:
+    case QMailMessageKey::AncestorFolderIds:
+    case QMailMessageKey::Conversation:
+    case QMailMessageKey::Custom:
+        break;
+    }
+
+    return false;
+}
+
+QMailMessageKeyMatcher::Truth QMailMessageKeyMatcher::evaluate(const Node &node, const QMailMessageMetaData &metaData) const
+{
+    // Three-valued logic, as for an SQL where clause
+    const bool disjunction = (node.combiner == QMailKey::Or);
+    Truth result = (disjunction ? False : True);
+
+    QList<Truth> items;
+    foreach (const Term &term, node.terms)
+        items.append(evaluate(term, metaData));
+    foreach (int child, node.children)
+        items.append(evaluate(_nodes.at(child), metaData));
+
+    foreach (Truth item, items) {
+        if (disjunction ? (item == True) : (item == False)) {
+            result = item;
+            break;
+        } else if (item == Unknown) {
+            result = Unknown;
+        }
+    }
+
+    if (node.negated && !items.isEmpty() && (result != Unknown))
+        result = (result == True ? False : True);
+
+    return result;
+}
+
+QMailMessageKeyMatcher::Truth QMailMessageKeyMatcher::evaluate(const Term &term, const QMailMessageMetaData &metaData) const
+{
+    const bool inverted = ((term.op == QMailKey::NotEqual) || (term.op == QMailKey::Excludes));
+    bool result = false;
+
+    if (!term.numbers.isEmpty()) {
+        const qint64 value = numericValue(term.property, metaData);
+        const bool bitwise = ((term.property == QMailMessageKey::Type) || (term.property == QMailMessageKey::Status));
+
+        if (term.multiple) {
+            result = std::find(term.numbers.constBegin(), term.numbers.constEnd(), value) != term.numbers.constEnd();
+        } else if (relationOperator(term.op)) {
+            const qint64 operand = term.numbers.first();
+            return (relationHolds(term.op, (value < operand ? -1 : (value > operand ? 1 : 0))) ? True : False);
+        } else if (bitwise && ((term.op == QMailKey::Includes) || (term.op == QMailKey::Excludes))) {
+            result = ((value & term.numbers.first()) != 0);
+        } else {
+            // A single-valued Includes on an identifier is equality
+            result = (value == term.numbers.first());
+        }
+    } else {
+        const QString value = stringValue(term.property, metaData);
+        if (value.isNull())
+            return Unknown;
+
+        if (term.multiple) {
+            result = term.strings.contains(value);
+        } else if (relationOperator(term.op)) {
+            const QString &operand = term.strings.first();
+            return (relationHolds(term.op, term.noCase ? compareNoCase(value, operand) : value.compare(operand)) ? True : False);
+        } else if (term.pattern || (term.op == QMailKey::Includes) || (term.op == QMailKey::Excludes)) {
+            result = likeMatch(value, term.strings.first());
+        } else {
+            result = (term.noCase ? (compareNoCase(value, term.strings.first()) == 0) : (value == term.strings.first()));
+        }
+    }
+
+    return ((result != inverted) ? True : False);
+}
@@ -0,0 +1,99 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QMAILMESSAGEKEYMATCHER_P_H
+#define QMAILMESSAGEKEYMATCHER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "qmailmessagekey.h"
+#include "qmailmessage.h"
+#include <QStringList>
+#include <QVector>
+
+// Evaluates a QMailMessageKey against message metadata held in memory, so that
+// change notifications can be filtered without a database round trip
+class QMF_EXPORT QMailMessageKeyMatcher
+{
+public:
+    explicit QMailMessageKeyMatcher(const QMailMessageKey &key);
+
+    QMailMessageKey key() const;
+    bool isLocal() const;
+
+    bool matches(const QMailMessageMetaData &metaData) const;
+    QMailMessageIdList filter(const QMailMessageIdList &ids) const;
+
+private:
+    enum Truth { False, True, Unknown };
+
+    struct Term
+    {
+        QMailMessageKey::Property property;
+        QMailKey::Comparator op;
+        bool multiple;
+        bool pattern;
+        bool noCase;
+        QVector<qint64> numbers;
+        QStringList strings;
+    };
+
+    struct Node
+    {
+        QMailKey::Combiner combiner;
+        bool negated;
+        QList<Term> terms;
+        QList<int> children;
+    };
+
+    int compile(const QMailMessageKey &key);
+    bool compileTerm(const QMailMessageKey::ArgumentType &arg, Term *term) const;
+
+    Truth evaluate(const Node &node, const QMailMessageMetaData &metaData) const;
+    Truth evaluate(const Term &term, const QMailMessageMetaData &metaData) const;
+
+    QMailMessageKey _key;
+    QVector<Node> _nodes;
+    bool _local;
+};
+
+#endif
@@ -34,6 +34,7 @@
 #include "qmailmessagelistmodel.h"
 #include "qmailnamespace.h"
 #include "qmailstore.h"
+#include "qmailmessagekeymatcher_p.h"
 #include <QtAlgorithms>
 
 
@@ -99,6 +100,7 @@ private:
     mutable bool _initialised;
     mutable bool _needSynchronize;
     uint _limit;
+    mutable QByteArray _continuation;
 };
 
 
@@ -158,6 +160,22 @@ void QMailMessageListModelPrivate::setLimit(uint limit)
             _limit = limit;
             QMailMessageIdList idsToRemove = _idList.mid(limit);
             removeMessages(idsToRemove);
+        } else if (!_continuation.isEmpty() && (_idList.count() == static_cast<int>(_limit))) {
+            // The list is unchanged since it was last filled; fetch only the rows that follow it
+            QByteArray continuation(_continuation);
+            QMailMessageIdList idsToAppend(QMailStore::instance()->queryMessagePage(_key, _sortKey, limit - _limit, &continuation));
+            _limit = limit;
+
+            if (!idsToAppend.isEmpty()) {
+                int row = _idList.count();
+                _model.emitBeginInsertRows(QModelIndex(), row, row + idsToAppend.count() - 1);
+                foreach (const QMailMessageId &id, idsToAppend) {
+                    insertItemAt(row, QModelIndex(), id);
+                    ++row;
+                }
+                _model.emitEndInsertRows();
+            }
+            _continuation = continuation;
         } else {
             _limit = limit;
             QMailMessageIdList idsToAppend;
@@ -315,10 +333,16 @@ bool QMailMessageListModelPrivate::addMessages(const QMailMessageIdList &ids)
     // those we have now been informed of) because the database content may have changed between
     // when this event was recorded and when we're processing the signal.
 
-    QMailMessageKey idKey(QMailMessageKey::id(_idList + ids));
+    const QMailMessageIdList matchingIds(QMailMessageKeyMatcher(_key).filter(ids));
+    if (matchingIds.isEmpty()) {
+        // None of the new messages belong to our display set
+        return true;
+    }
+
+    QMailMessageKey idKey(QMailMessageKey::id(_idList + matchingIds));
     const QMailMessageIdList newIdsList(QMailStore::instance()->queryMessages(_key & idKey, _sortKey, _limit));
 
-    return appendMessages(ids, newIdsList);
+    return appendMessages(matchingIds, newIdsList);
 }
 
 bool QMailMessageListModelPrivate::appendMessages(const QMailMessageIdList &idsToAppend, const QMailMessageIdList &newIdsList)
@@ -399,6 +423,19 @@ bool QMailMessageListModelPrivate::updateMessages(const QMailMessageIdList &ids)
     QList<int> removeIndices;
     QList<int> updateIndices;
 
+    bool present(false);
+    foreach (const QMailMessageId &id, ids) {
+        if (indexOf(id) != -1) {
+            present = true;
+            break;
+        }
+    }
+
+    if (!present && QMailMessageKeyMatcher(_key).filter(ids).isEmpty()) {
+        // None of these messages are displayed, and none should be
+        return true;
+    }
+
     // Find the updated positions for our messages
     QMailMessageKey idKey(QMailMessageKey::id((_idList.toSet() + ids.toSet()).toList()));
     QMailMessageIdList newIds(QMailStore::instance()->queryMessages(_key & idKey, _sortKey, _limit));
@@ -542,6 +579,8 @@ bool QMailMessageListModelPrivate::removeMessages(const QMailMessageIdList &ids)
 
 void QMailMessageListModelPrivate::insertItemAt(int row, const QModelIndex &parentIndex, const QMailMessageId &id)
 {
+    _continuation.clear();
+
     _idList.insert(row, id);
     _itemIndex.insert(id, row);
 
@@ -556,6 +595,8 @@ void QMailMessageListModelPrivate::insertItemAt(int row, const QModelIndex &pare
 
 void QMailMessageListModelPrivate::removeItemAt(int row, const QModelIndex &parentIndex)
 {
+    _continuation.clear();
+
     QMailMessageId id(_idList.at(row));
     _checkedIds.remove(id);
     _itemIndex.remove(id);
@@ -578,7 +619,12 @@ void QMailMessageListModelPrivate::init() const
         _checkedIds.clear();
 
         int index = 0;
-        _idList = QMailStore::instance()->queryMessages(_key, _sortKey, _limit);
+        _continuation.clear();
+        if (_limit) {
+            _idList = QMailStore::instance()->queryMessagePage(_key, _sortKey, _limit, &_continuation);
+        } else {
+            _idList = QMailStore::instance()->queryMessages(_key, _sortKey);
+        }
         foreach (const QMailMessageId &id, _idList) {
             _itemIndex.insert(id, index);
             ++index;
@@ -202,8 +202,14 @@ QVariant QMailMessageModelBase::data(const QModelIndex& index, int role) const
         break;
     }
 
-    // Otherwise, load the message data
-    return data(QMailMessageMetaData(id), role);
+    // Otherwise, load the message data; the properties displayed may be
+    // available from the shared cache without loading the complete record
+    static const QMailMessageKey::Properties displayedProperties(QMailMessageKey::Id | QMailMessageKey::Type |
+                                                                 QMailMessageKey::Sender | QMailMessageKey::Recipients |
+                                                                 QMailMessageKey::Subject | QMailMessageKey::TimeStamp |
+                                                                 QMailMessageKey::Status | QMailMessageKey::Size);
+
+    return data(QMailStore::instance()->messageMetaData(id, displayedProperties), role);
 }
 
 /*! \internal */
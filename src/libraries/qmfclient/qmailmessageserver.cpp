@@ -89,6 +89,8 @@ signals:
     void moveToFolder(quint64, const QMailMessageIdList& ids, const QMailFolderId& folderId);
     void flagMessages(quint64, const QMailMessageIdList& ids, quint64 setMask, quint64 unsetMask);
     void restoreToPreviousFolder(quint64, const QMailMessageKey& key);
+    void importMailbox(quint64, const QString &path, QMailStorageAction::MailboxFormat format, const QMailFolderId &folderId);
+    void exportMailbox(quint64, const QMailMessageKey &key, const QString &path, QMailStorageAction::MailboxFormat format);
     void onlineCreateFolder(quint64, const QString &name, const QMailAccountId &accountId, const QMailFolderId &parentId);
     void onlineRenameFolder(quint64, const QMailFolderId &folderId, const QString &name);
     void onlineDeleteFolder(quint64, const QMailFolderId &folderId);
@@ -195,6 +197,10 @@ QMailMessageServerPrivate::QMailMessageServerPrivate(QMailMessageServer* parent)
                adaptor, MESSAGE(flagMessages(quint64, QMailMessageIdList, quint64, quint64)));
     connectIpc(this, SIGNAL(restoreToPreviousFolder(quint64, QMailMessageKey)),
                adaptor, MESSAGE(restoreToPreviousFolder(quint64, QMailMessageKey)));
+    connectIpc(this, SIGNAL(importMailbox(quint64, QString, QMailStorageAction::MailboxFormat, QMailFolderId)),
+               adaptor, MESSAGE(importMailbox(quint64, QString, QMailStorageAction::MailboxFormat, QMailFolderId)));
+    connectIpc(this, SIGNAL(exportMailbox(quint64, QMailMessageKey, QString, QMailStorageAction::MailboxFormat)),
+               adaptor, MESSAGE(exportMailbox(quint64, QMailMessageKey, QString, QMailStorageAction::MailboxFormat)));
     connectIpc(this, SIGNAL(searchMessages(quint64, QMailMessageKey, QString, QMailSearchAction::SearchSpecification, QMailMessageSortKey)),
                adaptor, MESSAGE(searchMessages(quint64, QMailMessageKey, QString, QMailSearchAction::SearchSpecification, QMailMessageSortKey)));
     connectIpc(this, SIGNAL(searchMessages(quint64, QMailMessageKey, QString, QMailSearchAction::SearchSpecification, quint64, QMailMessageSortKey)),
@@ -1135,6 +1141,32 @@ void QMailMessageServer::restoreToPreviousFolder(quint64 action, const QMailMess
     emit d->restoreToPreviousFolder(action, key);
 }
 
+/*!
+    Requests that the MessageServer import every message in the mailbox at \a path,
+    stored in the format \a format, into the folder identified by \a folderId.
+
+    The request has the identifier \a action.
+
+    \sa QMailStorageAction::importMailbox(), messagesAdded()
+*/
+void QMailMessageServer::importMailbox(quint64 action, const QString &path, QMailStorageAction::MailboxFormat format, const QMailFolderId &folderId)
+{
+    emit d->importMailbox(action, path, format, folderId);
+}
+
+/*!
+    Requests that the MessageServer write every message matching \a key to the mailbox
+    at \a path, in the format \a format.
+
+    The request has the identifier \a action.
+
+    \sa QMailStorageAction::exportMailbox()
+*/
+void QMailMessageServer::exportMailbox(quint64 action, const QMailMessageKey &key, const QString &path, QMailStorageAction::MailboxFormat format)
+{
+    emit d->exportMailbox(action, key, path, format);
+}
+
 /*!
     Requests that the MessageServer search for messages that meet the criteria encoded
     in \a filter.  If \a bodyText is non-empty, messages containing the specified text 
@@ -149,6 +149,8 @@ public Q_SLOTS:
     void moveToFolder(quint64, const QMailMessageIdList& ids, const QMailFolderId& folderId);
     void flagMessages(quint64, const QMailMessageIdList& ids, quint64 setMask, quint64 unsetMask);
     void restoreToPreviousFolder(quint64, const QMailMessageKey& key);
+    void importMailbox(quint64, const QString &path, QMailStorageAction::MailboxFormat format, const QMailFolderId &folderId);
+    void exportMailbox(quint64, const QMailMessageKey &key, const QString &path, QMailStorageAction::MailboxFormat format);
     void cancelTransfer(quint64);
 
     void onlineDeleteMessages(quint64, const QMailMessageIdList& mailList, QMailStore::MessageRemovalOption);
@@ -32,6 +32,7 @@
 ****************************************************************************/
 
 #include "qmailmessageset_p.h"
+#include "qmailmessagekeymatcher_p.h"
 
 #include "qmailaccount.h"
 #include "qmailfolder.h"
@@ -954,8 +955,7 @@ void QMailFilterMessageSet::messagesAdded(const QMailMessageIdList &ids)
     QMailMessageKey key(messageKey());
     if (!key.isNonMatching()) {
         // See if any of these messages match our filter
-        QMailMessageKey idFilter(QMailMessageKey::id(ids));
-        QMailMessageIdList matchingIds = QMailStore::instance()->queryMessages(key & idFilter);
+        QMailMessageIdList matchingIds = QMailMessageKeyMatcher(key).filter(ids);
         if (!matchingIds.isEmpty()) {
             // Our filtered message set has changed
             impl(this)->_messageIds.unite(QSet<QMailMessageId>::fromList(matchingIds));
@@ -989,8 +989,7 @@ void QMailFilterMessageSet::messagesUpdated(const QMailMessageIdList &ids)
         QSet<QMailMessageId> updatedIds = QSet<QMailMessageId>::fromList(ids);
 
         // Find which of the updated messages should be in our set
-        QMailMessageKey idFilter(QMailMessageKey::id(ids));
-        QSet<QMailMessageId> matchingIds = QSet<QMailMessageId>::fromList(QMailStore::instance()->queryMessages(key & idFilter));
+        QSet<QMailMessageId> matchingIds = QSet<QMailMessageId>::fromList(QMailMessageKeyMatcher(key).filter(ids));
 
         QSet<QMailMessageId> presentIds = updatedIds;
         QSet<QMailMessageId> absentIds = updatedIds;
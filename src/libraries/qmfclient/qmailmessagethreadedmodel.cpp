@@ -33,6 +33,7 @@
 
 #include "qmailmessagethreadedmodel.h"
 #include "qmailstore.h"
+#include "qmailmessagekeymatcher_p.h"
 #include "qmailnamespace.h"
 #include <QCache>
 #include <QtAlgorithms>
@@ -195,6 +196,8 @@ void QMailMessageThreadedModelPrivate::setLimit(uint limit)
         } else {
             _limit = limit;
             QMailMessageIdList idsToAppend;
+
+            QMailStore::instance()->beginReadSnapshot();
             QMailMessageIdList newIdsList(QMailStore::instance()->queryMessages(_key, _sortKey, _limit));
 
             foreach (const QMailMessageId &id, newIdsList) {
@@ -203,6 +206,7 @@ void QMailMessageThreadedModelPrivate::setLimit(uint limit)
                 }
             }
             appendMessages(idsToAppend, newIdsList);
+            QMailStore::instance()->endReadSnapshot();
         }
     }
 }
@@ -367,10 +371,22 @@ bool QMailMessageThreadedModelPrivate::addMessages(const QMailMessageIdList &ids
     // those we have now been informed of) because the database content may have changed between
     // when this event was recorded and when we're processing the signal.
 
-    QMailMessageKey idKey(QMailMessageKey::id(_currentIds + ids));
+    const QMailMessageIdList matchingIds(QMailMessageKeyMatcher(_key).filter(ids));
+    if (matchingIds.isEmpty()) {
+        // None of the new messages belong to our display set
+        return true;
+    }
+
+    // The display set and the conversations it contains must be found in the same state
+    QMailStore::instance()->beginReadSnapshot();
+
+    QMailMessageKey idKey(QMailMessageKey::id(_currentIds + matchingIds));
     const QMailMessageIdList newIdsList(QMailStore::instance()->queryMessages(_key & idKey, _sortKey, _limit));
 
-    return appendMessages(ids, newIdsList);
+    const bool appended(appendMessages(matchingIds, newIdsList));
+    QMailStore::instance()->endReadSnapshot();
+
+    return appended;
 }
 
 bool QMailMessageThreadedModelPrivate::appendMessages(const QMailMessageIdList &idsToAppend, const QMailMessageIdList &newIdsList)
@@ -519,7 +535,11 @@ bool QMailMessageThreadedModelPrivate::processMessagesUpdated(const QMailMessage
     }
 
     // Find if and where these messages should be added/removed/updated
-    if (!updateMessages(ids)) {
+    QMailStore::instance()->beginReadSnapshot();
+    const bool updated(updateMessages(ids));
+    QMailStore::instance()->endReadSnapshot();
+
+    if (!updated) {
         return false;
     }
 
@@ -530,6 +550,19 @@ bool QMailMessageThreadedModelPrivate::updateMessages(const QMailMessageIdList &
 {
     QSet<QMailMessageId> existingIds(_currentIds.toSet());
 
+    bool present(false);
+    foreach (const QMailMessageId &id, ids) {
+        if (existingIds.contains(id)) {
+            present = true;
+            break;
+        }
+    }
+
+    if (!present && QMailMessageKeyMatcher(_key).filter(ids).isEmpty()) {
+        // None of these messages are displayed, and none should be
+        return true;
+    }
+
     QMailMessageKey idKey(QMailMessageKey::id((existingIds + ids.toSet()).toList()));
     QMailMessageIdList newIds(QMailStore::instance()->queryMessages(_key & idKey, _sortKey, _limit));
 
@@ -809,6 +842,10 @@ void QMailMessageThreadedModelPrivate::init() const
         _messageItem.clear();
         _currentIds.clear();
 
+        // Both queries must see the same state of the store, or the tree built from
+        // them may refer to messages that are not present in the other
+        QMailStore::instance()->beginReadSnapshot();
+
         // Find all messages involved in conversations with the messages to show, along with their predecessor ID
         QMailMessageKey conversationKey(QMailMessageKey::conversation(_key));
         QMailMessageKey::Properties props(QMailMessageKey::Id | QMailMessageKey::InResponseTo);
@@ -820,6 +857,8 @@ void QMailMessageThreadedModelPrivate::init() const
 
         // Now find all the messages we're going to show, in order
         const QMailMessageIdList ids = QMailStore::instance()->queryMessages(_key, _sortKey, _limit);
+        QMailStore::instance()->endReadSnapshot();
+
         QHash<QMailMessageId, int> idIndexMap;
         idIndexMap.reserve(ids.count());
         int i;
@@ -1657,6 +1657,23 @@ void QMailStorageActionPrivate::restoreToPreviousFolder(const QMailMessageKey& k
     emitChanges();
 }
 
+void QMailStorageActionPrivate::importMailbox(const QString &path, QMailStorageAction::MailboxFormat format, const QMailFolderId &folderId)
+{
+    _ids.clear();
+    _addedOrUpdatedIds.clear();
+
+    _server->importMailbox(newAction(), path, format, folderId);
+    emitChanges();
+}
+
+void QMailStorageActionPrivate::exportMailbox(const QMailMessageKey &key, const QString &path, QMailStorageAction::MailboxFormat format)
+{
+    _ids.clear();
+
+    _server->exportMailbox(newAction(), key, path, format);
+    emitChanges();
+}
+
 void QMailStorageActionPrivate::onlineCreateFolder(const QString &name, const QMailAccountId &accountId, const QMailFolderId &parentId)
 {
     _server->onlineCreateFolder(newAction(), name, accountId, parentId);
@@ -1760,6 +1777,15 @@ void QMailStorageActionPrivate::storageActionCompleted(quint64 action)
     \internal
 */
 
+/*!
+    \enum QMailStorageAction::MailboxFormat
+
+    This enum type specifies the format of a mailbox imported or exported by the message server.
+
+    \value MboxFormat      A single file holding every message, in the mboxrd variant of the mbox format.
+    \value MaildirFormat   A Maildir directory, holding each message in a separate file.
+*/
+
 /*!
     Constructs a new transmit action object with the supplied \a parent.
 */
@@ -1984,6 +2010,41 @@ void QMailStorageAction::restoreToPreviousFolder(const QMailMessageKey& key)
     emit impl(this)->restoreToPreviousFolder(key);
 }
 
+/*!
+    Requests that the message server import every message in the mailbox at \a path,
+    which is stored in the format \a format, into the folder identified by \a folderId.
+
+    The mailbox is read incrementally, and the messages are added to the mail store
+    in large batches; the identifiers of the messages added are reported as each
+    batch is stored.  Progress is reported in kilobytes of the mailbox for
+    MboxFormat, and in messages for MaildirFormat.
+
+    If an import is interrupted, repeating the request continues from the last
+    batch stored.  Likewise, importing the same mailbox into the same folder again
+    adds only the messages appended to the mailbox since the earlier import.
+
+    \sa messagesAdded(), exportMailbox()
+*/
+void QMailStorageAction::importMailbox(const QString &path, QMailStorageAction::MailboxFormat format, const QMailFolderId &folderId)
+{
+    impl(this)->importMailbox(path, format, folderId);
+}
+
+/*!
+    Requests that the message server write every message matching \a key to the
+    mailbox at \a path, in the format \a format.  Messages are appended to an
+    existing mbox mailbox, and a Maildir mailbox is created if it does not exist.
+
+    Progress is reported in messages.  If an export is interrupted, repeating the
+    request continues after the last batch written.
+
+    \sa importMailbox()
+*/
+void QMailStorageAction::exportMailbox(const QMailMessageKey &key, const QString &path, QMailStorageAction::MailboxFormat format)
+{
+    impl(this)->exportMailbox(key, path, format);
+}
+
 /*!
     Requests that the message server create a new folder named \a name, created in the
     account identified by \a accountId.
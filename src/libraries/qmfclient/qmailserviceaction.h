@@ -223,6 +223,11 @@ class QMF_EXPORT QMailStorageAction : public QMailServiceAction
 public:
     typedef QMailStorageActionPrivate ImplementationType;
 
+    enum MailboxFormat {
+        MboxFormat = 0,
+        MaildirFormat
+    };
+
     QMailStorageAction(QObject *parent = Q_NULLPTR);
     ~QMailStorageAction();
 
@@ -252,6 +257,9 @@ public Q_SLOTS:
     void moveToFolder(const QMailMessageIdList& ids, const QMailFolderId& folderId);
     void flagMessages(const QMailMessageIdList& ids, quint64 setMask, quint64 unsetMask);
     void restoreToPreviousFolder(const QMailMessageKey& key);
+
+    void importMailbox(const QString &path, QMailStorageAction::MailboxFormat format, const QMailFolderId &folderId);
+    void exportMailbox(const QMailMessageKey &key, const QString &path, QMailStorageAction::MailboxFormat format);
 };
 
 
@@ -365,4 +373,6 @@ Q_DECLARE_USER_METATYPE_ENUM(QMailRetrievalAction::RetrievalSpecification)
 
 Q_DECLARE_USER_METATYPE_ENUM(QMailSearchAction::SearchSpecification)
 
+Q_DECLARE_USER_METATYPE_ENUM(QMailStorageAction::MailboxFormat)
+
 #endif
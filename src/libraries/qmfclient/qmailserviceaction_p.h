@@ -265,6 +265,8 @@ public:
     void moveToFolder(const QMailMessageIdList& ids, const QMailFolderId& folderId);
     void flagMessages(const QMailMessageIdList& ids, quint64 setMask, quint64 unsetMask);
     void restoreToPreviousFolder(const QMailMessageKey& key);
+    void importMailbox(const QString &path, QMailStorageAction::MailboxFormat format, const QMailFolderId &folderId);
+    void exportMailbox(const QMailMessageKey &key, const QString &path, QMailStorageAction::MailboxFormat format);
 
     void onlineCreateFolder(const QString &name, const QMailAccountId &accountId, const QMailFolderId &parentId);
     void onlineRenameFolder(const QMailFolderId &id, const QString &name);
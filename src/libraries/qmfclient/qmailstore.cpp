@@ -33,8 +33,101 @@
 
 #include "qmailstore.h"
 #include "qmailstore_p.h"
+#include "qmailstoreworker_p.h"
+#include "qmailnamespace.h"
 #include <QThreadStorage>
 
+namespace {
+
+class QueryMessagesRequest : public QMailStoreAsyncResult<QMailMessageIdList>
+{
+public:
+    QueryMessagesRequest(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, uint limit, uint offset)
+        : key(key), sortKey(sortKey), limit(limit), offset(offset) {}
+
+protected:
+    virtual QMailMessageIdList run(QMailStore *store) { return store->queryMessages(key, sortKey, limit, offset); }
+
+private:
+    QMailMessageKey key;
+    QMailMessageSortKey sortKey;
+    uint limit;
+    uint offset;
+};
+
+class CountMessagesRequest : public QMailStoreAsyncResult<int>
+{
+public:
+    explicit CountMessagesRequest(const QMailMessageKey &key) : key(key) {}
+
+protected:
+    virtual int run(QMailStore *store) { return store->countMessages(key); }
+
+private:
+    QMailMessageKey key;
+};
+
+class MessagesMetaDataRequest : public QMailStoreAsyncResult<QMailMessageMetaDataList>
+{
+public:
+    MessagesMetaDataRequest(const QMailMessageKey &key, const QMailMessageKey::Properties &properties, QMailStore::ReturnOption option)
+        : key(key), properties(properties), option(option) {}
+
+protected:
+    virtual QMailMessageMetaDataList run(QMailStore *store) { return store->messagesMetaData(key, properties, option); }
+
+private:
+    QMailMessageKey key;
+    QMailMessageKey::Properties properties;
+    QMailStore::ReturnOption option;
+};
+
+class UpdateMessagesPropertiesRequest : public QMailStoreAsyncResult<bool>
+{
+public:
+    UpdateMessagesPropertiesRequest(const QMailMessageKey &key, const QMailMessageKey::Properties &properties, const QMailMessageMetaData &data)
+        : key(key), properties(properties), data(data) {}
+
+protected:
+    virtual bool run(QMailStore *store) { return store->updateMessagesMetaData(key, properties, data); }
+
+private:
+    QMailMessageKey key;
+    QMailMessageKey::Properties properties;
+    QMailMessageMetaData data;
+};
+
+class UpdateMessagesStatusRequest : public QMailStoreAsyncResult<bool>
+{
+public:
+    UpdateMessagesStatusRequest(const QMailMessageKey &key, quint64 status, bool set)
+        : key(key), status(status), set(set) {}
+
+protected:
+    virtual bool run(QMailStore *store) { return store->updateMessagesMetaData(key, status, set); }
+
+private:
+    QMailMessageKey key;
+    quint64 status;
+    bool set;
+};
+
+class RemoveMessagesRequest : public QMailStoreAsyncResult<bool>
+{
+public:
+    RemoveMessagesRequest(const QMailMessageKey &key, QMailStore::MessageRemovalOption option)
+        : key(key), option(option) {}
+
+protected:
+    virtual bool run(QMailStore *store) { return store->removeMessages(key, option); }
+
+private:
+    QMailMessageKey key;
+    QMailStore::MessageRemovalOption option;
+};
+
+}
+
 /*!
     \class QMailStore
 
@@ -102,6 +195,13 @@
     an external message source.  QMailMessageRemovalRecord objects can be accessed
     via the messageRemovalRecords() function.
 
+    Operations selecting messages by key can also be performed asynchronously, via the
+    queryMessagesAsync(), countMessagesAsync(), messagesMetaDataAsync(),
+    updateMessagesMetaDataAsync() and removeMessagesAsync() functions.  These return
+    immediately, and perform the operation on a worker thread using a database connection
+    of its own, so that the calling thread is not blocked while another process is writing
+    to the mail store.
+
     \sa QMailAccount, QMailFolder, QMailMessage
 */
 
@@ -157,6 +257,167 @@
     \value StorageInaccessible  The operation failed because the mail storage mechanism cannot be accessed by the mail store.
 */
 
+/*!
+    \class QMailStore::QueryStatistics
+    \inmodule QmfClient
+
+    \brief The QueryStatistics structure describes the database statements performed
+    for one query descriptor while instrumentation is enabled.
+
+    \sa QMailStore::queryStatistics(), QMailStore::setInstrumentationEnabled()
+*/
+
+/*! \variable QMailStore::QueryStatistics::descriptor
+    The descriptor identifying the query, such as \c{"queryMessages mailmessages query"}.
+*/
+
+/*! \variable QMailStore::QueryStatistics::executions
+    The number of times the statement was executed.
+*/
+
+/*! \variable QMailStore::QueryStatistics::repeatedExecutions
+    The number of executions repeating a statement with identical text that was already
+    performed within the same QMailStore operation, or within the operation immediately
+    preceding it. A high value usually indicates a caller retrieving data one identifier
+    at a time, where a single query using a key would suffice.
+*/
+
+/*! \variable QMailStore::QueryStatistics::rows
+    The number of rows affected by the executions of the statement. Rows returned by
+    a \c SELECT statement are not counted, since they are consumed by the caller.
+*/
+
+/*! \variable QMailStore::QueryStatistics::prepareTime
+    The time spent preparing the statement, in microseconds.
+*/
+
+/*! \variable QMailStore::QueryStatistics::stepTime
+    The time spent executing the statement, in microseconds. For a \c SELECT statement
+    this includes locating the first result only.
+*/
+
+/*!
+    \class QMailStore::ContentionStatistics
+    \inmodule QmfClient
+
+    \brief The ContentionStatistics structure describes the time spent by this process
+    waiting for access to the mail store database while instrumentation is enabled.
+
+    \sa QMailStore::contentionStatistics(), QMailStore::setInstrumentationEnabled()
+*/
+
+/*! \variable QMailStore::ContentionStatistics::transactions
+    The number of write transactions begun.
+*/
+
+/*! \variable QMailStore::ContentionStatistics::lockWaitTime
+    The time spent acquiring the database lock and beginning transactions, in microseconds.
+*/
+
+/*! \variable QMailStore::ContentionStatistics::busyRetries
+    The number of times an operation was retried because the database was locked by another process.
+*/
+
+/*!
+    \enum QMailStore::MessageGrouping
+
+    Defines how countMessagesGrouped() groups the messages it counts.
+
+    \value GroupByParentFolder    Messages are grouped by their parent folder.
+    \value GroupByAncestorFolder  Messages are counted against each folder above their parent folder in the folder hierarchy.
+    \value GroupByParentAccount   Messages are grouped by their parent account.
+    \value GroupByParentThread    Messages are grouped by their parent thread.
+*/
+
+/*!
+    \class QMailStore::MessageGroupCounts
+    \inmodule QmfClient
+
+    \brief The MessageGroupCounts structure describes the messages counted for one group
+    by countMessagesGrouped().
+
+    \sa QMailStore::countMessagesGrouped()
+*/
+
+/*! \variable QMailStore::MessageGroupCounts::count
+    The number of messages in the group.
+*/
+
+/*! \variable QMailStore::MessageGroupCounts::size
+    The total size of the messages in the group.
+*/
+
+/*! \variable QMailStore::MessageGroupCounts::subsetCounts
+    The number of messages in the group matching each of the subset keys, in the order the keys were given.
+*/
+
+/*!
+    \enum QMailStore::SharedCacheAccess
+
+    Defines the access a process has to the metadata cache shared between processes.
+
+    \value NoSharedCacheAccess     The shared cache is not used.
+    \value SharedCacheReadAccess   Message meta data lookups consult the shared cache, which is mapped read-only.
+    \value SharedCacheWriteAccess  The shared cache is consulted, and updated as this process loads and modifies messages.
+
+    \sa setSharedCacheAccess()
+*/
+
+/*!
+    \enum QMailStore::ProcessRole
+
+    Identifies the kind of process using the store, for selecting a StoreProfile with roleProfile().
+
+    \value DefaultRole        No particular role; the settings used when no profile is selected.
+    \value MessageServerRole  The long-lived process performing messaging operations.
+    \value ClientRole         An interactive process presenting messaging data to the user.
+    \value BatchRole          A short-lived process performing bulk operations, such as imports and exports.
+*/
+
+/*!
+    \enum QMailStore::TempStore
+
+    Defines where the database stores temporary tables and indices.
+
+    \value DefaultTempStore  The database default location is used.
+    \value FileTempStore     Temporary data is stored in files.
+    \value MemoryTempStore   Temporary data is stored in memory.
+*/
+
+/*!
+    \class QMailStore::StoreProfile
+    \inmodule QmfClient
+
+    \brief The StoreProfile structure describes how this process uses its connection
+    to the mail store database.
+
+    The default constructed profile matches the profile of the DefaultRole.
+
+    \sa QMailStore::setStoreProfile(), QMailStore::roleProfile()
+*/
+
+/*! \variable QMailStore::StoreProfile::connectionLifetime
+    The time in milliseconds that the database connection may be unused before it is closed,
+    and the cached data released. A lifetime of zero keeps the connection open.
+*/
+
+/*! \variable QMailStore::StoreProfile::cacheSize
+    The number of database pages cached by the connection.
+*/
+
+/*! \variable QMailStore::StoreProfile::mmapSize
+    The maximum number of bytes of the database file read through a memory mapping, or zero
+    to read the database without mapping it.
+*/
+
+/*! \variable QMailStore::StoreProfile::tempStore
+    Where temporary tables and indices are stored.
+*/
+
+/*! \variable QMailStore::StoreProfile::walAutoCheckpoint
+    The number of pages in the write-ahead log at which the log is automatically checkpointed.
+*/
+
 /*!
     Constructs a new QMailStore object and opens the message store database.
 */
@@ -595,6 +856,9 @@ bool QMailStore::updateFolder(QMailFolder* folder)
 /*!
     Ensure mail store is durably written to the file system.
 
+    Content whose durability was deferred by the storage content managers is made
+    durable first, in a single group, before the database is checkpointed.
+
     Returns \c true if the operation completed successfully, \c false otherwise.
 */
  bool QMailStore::ensureDurability()
@@ -606,6 +870,80 @@ bool QMailStore::updateFolder(QMailFolder* folder)
      return true;
 }
 
+/*!
+    Performs the periodic maintenance tasks of the mail store that are due, such as purging
+    the content of removed messages and reclaiming unused database space.
+
+    The tasks are performed in small batches; if \a timeLimit is not negative, no further batch
+    is started once \a timeLimit milliseconds have elapsed. Progress is retained in the
+    store, so that a subsequent invocation resumes the work that remains outstanding.
+
+    If the store holds messages from before threads were stored, they are threaded by
+    rebuildThreads() before any other task is performed.
+
+    Returns \c true if all maintenance tasks that were due have been completed, or \c false
+    if some work remains to be performed or an error occurred; in the latter case, lastError()
+    reports the error.
+
+    This function is intended to be invoked periodically by the messageserver process,
+    so that client processes are not delayed by maintenance work.
+*/
+bool QMailStore::performMaintenance(int timeLimit)
+{
+    d->setLastError(NoError);
+    return d->performMaintenance(timeLimit);
+}
+
+/*!
+    Converts the mail store so that the space released by removed data can be reclaimed
+    incrementally by performMaintenance().  Stores created by this version are already
+    converted; stores created by earlier versions can only release their unused space by
+    rebuilding the entire database, which performMaintenance() never does.
+
+    The conversion blocks every process using the mail store until it is complete, and
+    may take a long time for a large store.  It should only be performed when the store
+    is otherwise idle, such as during a software update.
+
+    Returns \c true if the store is converted, or was already converted; otherwise returns
+    \c false and lastError() reports the error.
+
+    \sa performMaintenance()
+*/
+bool QMailStore::enableIncrementalVacuum()
+{
+    d->setLastError(NoError);
+    return d->enableIncrementalVacuum();
+}
+
+/*!
+    Rebuilds the thread of every message in the mail store from the identifiers, references
+    and subjects of the messages.
+
+    The messages are read from a consistent snapshot of the store and threaded in memory, with
+    the messages of each account processed concurrently. The resulting threads are written to
+    temporary tables in batches, and are then added to the store alongside the existing threads.
+    A rebuilt thread holding exactly the messages of an existing thread keeps that thread's
+    identifier. The messages whose thread has changed are moved to their rebuilt threads in
+    batches, after which the obsolete threads are removed and messages added after the snapshot
+    was taken are threaded. Clients are only notified of the messages whose thread has changed.
+
+    If \a timeLimit is not negative, no further batch is started once \a timeLimit milliseconds
+    have elapsed. The progress of the rebuild is retained, so that a subsequent invocation
+    resumes the work that remains outstanding. The threadRebuildProgress() signal is emitted
+    as the rebuild progresses.
+
+    Returns \c true if the threads have been replaced, or \c false if some work remains to be
+    performed or an error occurred; in the latter case, lastError() reports the error and the
+    rebuild restarts from the beginning on the next invocation.
+
+    \sa threadRebuildProgress()
+*/
+bool QMailStore::rebuildThreads(int timeLimit)
+{
+    d->setLastError(NoError);
+    return d->rebuildThreads(timeLimit);
+}
+
 /*!
     Updates the existing QMailMessage \a msg on the message store.
     Returns \c true if the operation completed successfully, or \c false otherwise. 
@@ -799,6 +1137,31 @@ int QMailStore::sizeOfMessages(const QMailMessageKey& key) const
     return d->sizeOfMessages(key);
 }
 
+/*!
+    Returns the count and total size of the messages which pass the filtering
+    criteria defined in QMailMessageKey \a key, grouped according to \a grouping.
+    The result maps the identifier of each group containing matching messages
+    to the counts for that group; groups without matching messages are omitted.
+
+    For each key in \a subsetKeys, the subsetCounts list of each group contains
+    the number of the group's messages that also match that key, in the same
+    order.  An empty subset key counts every message in the group.
+
+    All counts are computed by a single query, which is considerably cheaper than
+    calling countMessages() for each group and subset.
+
+    When \a grouping is GroupByAncestorFolder, each message is counted against
+    every folder above its parent folder in the folder hierarchy, matching the
+    messages selected by QMailMessageKey::ancestorFolderIds().
+
+    \sa countMessages(), sizeOfMessages()
+*/
+QMap<quint64, QMailStore::MessageGroupCounts> QMailStore::countMessagesGrouped(const QMailMessageKey& key, MessageGrouping grouping, const QList<QMailMessageKey>& subsetKeys) const
+{
+    d->setLastError(NoError);
+    return d->countMessagesGrouped(key, grouping, subsetKeys);
+}
+
 /*!
     Returns the \l{QMailAccountId}s of accounts in the store. If \a key is not empty 
     only accounts matching the parameters set by \a key will be returned, otherwise 
@@ -871,6 +1234,37 @@ const QMailMessageIdList QMailStore::queryMessages(const QMailMessageKey& key,
     return d->queryMessages(key, sortKey, limit, offset);
 }
 
+/*!
+    Returns a page of at most \a limit \l{QMailMessageId}s of messages matching \a key,
+    ordered by \a sortKey.
+
+    Rather than skipping a number of leading results, as queryMessages() does when an offset
+    is supplied, each page resumes from the position recorded in \a continuation. If
+    \a continuation is empty, the first page is returned. On return, \a continuation holds
+    an opaque token identifying the position following the last message returned; it is
+    empty if no further matching messages remain. The token should be passed unmodified,
+    together with the same \a key and \a sortKey, to retrieve the following page.
+
+    Messages comparing equal under \a sortKey are ordered by their identifiers, so that
+    every matching message is returned exactly once even if messages are added to or removed
+    from the store between pages. The cost of retrieving a page depends only on \a limit,
+    not on the position of the page within the results; this allows models and views of a
+    QMailMessageSet to page through very large folders by passing the set's messageKey().
+
+    If \a continuation was not produced for \a key and \a sortKey, an empty list is returned and
+    lastError() is set.
+
+    \sa queryMessages()
+*/
+const QMailMessageIdList QMailStore::queryMessagePage(const QMailMessageKey& key,
+                                                      const QMailMessageSortKey& sortKey,
+                                                      uint limit,
+                                                      QByteArray *continuation) const
+{
+    d->setLastError(NoError);
+    return d->queryMessagePage(key, sortKey, limit, continuation);
+}
+
 
 /*!
     Returns the \l{QMailThreadId}s of threads in the message store. If \a key is not empty
@@ -966,6 +1360,23 @@ QMailMessageMetaData QMailStore::messageMetaData(const QString& uid, const QMail
     return d->messageMetaData(uid, accountId);
 }
 
+/*!
+    Returns meta data for the message identified by the QMailMessageId \a id, in which at least
+    the elements specified by \a properties are loaded.
+
+    If the requested properties are all held in the shared metadata cache and this process has
+    access to it, the meta data may be returned without querying the database; otherwise the
+    result is the same as that of messageMetaData(). Meta data that is not completely loaded
+    has the QMailMessage::UnloadedData status flag set, and should not be used to update the message.
+
+    \sa setSharedCacheAccess()
+*/
+QMailMessageMetaData QMailStore::messageMetaData(const QMailMessageId& id, const QMailMessageKey::Properties& properties) const
+{
+    d->setLastError(NoError);
+    return d->messageMetaData(id, properties);
+}
+
 /*!
     Retrieves a list of QMailMessageMetaData objects containing meta data elements specified by 
     \a properties, for messages which match the criteria defined by \a key. If \a option is 
@@ -1002,6 +1413,82 @@ const QMailMessageRemovalRecordList QMailStore::messageRemovalRecords(const QMai
     return d->messageRemovalRecords(accountId, folderId);
 }
 
+/*!
+    Performs queryMessages() with the arguments \a key, \a sortKey, \a limit and \a offset
+    on the store worker thread, returning a future that reports the resulting identifiers.
+
+    Requests made asynchronously are performed in the order they are made, and their results
+    are reported in that order by the thread that made them.  A request that has not yet been
+    performed when its future is canceled is not performed.
+
+    \sa queryMessages()
+*/
+QFuture<QMailMessageIdList> QMailStore::queryMessagesAsync(const QMailMessageKey& key, const QMailMessageSortKey& sortKey, uint limit, uint offset)
+{
+    return d->asyncWorker()->submit(new QueryMessagesRequest(key, sortKey, limit, offset));
+}
+
+/*!
+    Performs countMessages() with the argument \a key on the store worker thread,
+    returning a future that reports the resulting count.
+
+    \sa countMessages(), queryMessagesAsync()
+*/
+QFuture<int> QMailStore::countMessagesAsync(const QMailMessageKey& key)
+{
+    return d->asyncWorker()->submit(new CountMessagesRequest(key));
+}
+
+/*!
+    Performs messagesMetaData() with the arguments \a key, \a properties and \a option on
+    the store worker thread, returning a future that reports the resulting meta data.
+
+    \sa messagesMetaData(), queryMessagesAsync()
+*/
+QFuture<QMailMessageMetaDataList> QMailStore::messagesMetaDataAsync(const QMailMessageKey& key, const QMailMessageKey::Properties& properties, ReturnOption option)
+{
+    return d->asyncWorker()->submit(new MessagesMetaDataRequest(key, properties, option));
+}
+
+/*!
+    Performs updateMessagesMetaData() with the arguments \a key, \a properties and \a data
+    on the store worker thread, returning a future that reports whether the update succeeded.
+
+    The changes made by the update are reported by the signals of this store before the
+    future reports its result.
+
+    \sa updateMessagesMetaData(), queryMessagesAsync()
+*/
+QFuture<bool> QMailStore::updateMessagesMetaDataAsync(const QMailMessageKey& key, const QMailMessageKey::Properties& properties, const QMailMessageMetaData& data)
+{
+    return d->asyncWorker()->submit(new UpdateMessagesPropertiesRequest(key, properties, data));
+}
+
+/*!
+    \overload
+
+    Performs updateMessagesMetaData() with the arguments \a key, \a messageStatus and \a set
+    on the store worker thread, returning a future that reports whether the update succeeded.
+*/
+QFuture<bool> QMailStore::updateMessagesMetaDataAsync(const QMailMessageKey& key, quint64 messageStatus, bool set)
+{
+    return d->asyncWorker()->submit(new UpdateMessagesStatusRequest(key, messageStatus, set));
+}
+
+/*!
+    Performs removeMessages() with the arguments \a key and \a option on the store worker
+    thread, returning a future that reports whether the removal succeeded.
+
+    The changes made by the removal are reported by the signals of this store before the
+    future reports its result.
+
+    \sa removeMessages(), queryMessagesAsync()
+*/
+QFuture<bool> QMailStore::removeMessagesAsync(const QMailMessageKey& key, MessageRemovalOption option)
+{
+    return d->asyncWorker()->submit(new RemoveMessagesRequest(key, option));
+}
+
 /*!
     Locks QMailStore, preventing all write operations from taking place. Will block until all write operations have
     completed and it can get a lock. Read-only operations will be permitted as normal.To resume normal operation unlock()
@@ -1032,6 +1519,44 @@ void QMailStore::unlock()
     d->unlock();
 }
 
+/*!
+    Begins a read snapshot, so that all queries made until the matching endReadSnapshot()
+    see the store in the same state, unaffected by changes committed by other processes in
+    the meantime.  This allows the results of several queries to be combined consistently,
+    such as the messages to be displayed and the conversations they belong to.
+
+    Snapshots may be nested; the snapshot is released when the outermost snapshot ends.
+    Other processes may continue to write to the store while the snapshot is held, but
+    the write-ahead log cannot be checkpointed past it, so a snapshot should be ended as
+    soon as its queries are complete, and never held across a return to the event loop.
+    A snapshot is released early if this process writes to the store before it ends.
+
+    Returns \c true if the snapshot was begun, \c false otherwise; endReadSnapshot() must
+    be called in either case.
+
+    \sa endReadSnapshot()
+*/
+bool QMailStore::beginReadSnapshot()
+{
+    d->setLastError(NoError);
+    if (!d->beginReadSnapshot()) {
+        d->setLastError(FrameworkFault);
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+    Ends the read snapshot begun by the matching call to beginReadSnapshot().
+
+    \sa beginReadSnapshot()
+*/
+void QMailStore::endReadSnapshot()
+{
+    d->endReadSnapshot();
+}
+
 /*!
     Erases message deletion records from the account with id \a accountId and 
     server uid listed in \a serverUids.  If serverUids is empty, all message deletion
@@ -1198,6 +1723,168 @@ void QMailStore::reconnectIpc()
     d->reconnectIpc();
 }
 
+/*!
+    Enables the recording of statistics describing the database statements performed by the
+    mail store in this process if \a enabled is true; otherwise disables the recording.
+
+    If \a logInterval is greater than zero, the statistics gathered are additionally written
+    to the \c StoreProfile logging category every \a logInterval seconds.
+
+    Recording adds overhead to every query: the results of each query are stepped through
+    once to be counted before being returned to the caller. Instrumentation should therefore
+    only be enabled for diagnosis. It may also be enabled at startup by setting the
+    \c QMF_STORE_INSTRUMENTATION environment variable to the desired logging interval.
+
+    \sa queryStatistics(), contentionStatistics(), resetStatistics()
+*/
+void QMailStore::setInstrumentationEnabled(bool enabled, int logInterval)
+{
+    d->setInstrumentationEnabled(enabled, logInterval);
+}
+
+/*!
+    Returns true if the recording of database statistics is enabled in this process.
+
+    \sa setInstrumentationEnabled()
+*/
+bool QMailStore::instrumentationEnabled() const
+{
+    return d->instrumentationEnabled();
+}
+
+/*!
+    Returns the statistics recorded for each query descriptor since instrumentation was
+    enabled, or since resetStatistics() was last invoked.
+
+    \sa contentionStatistics(), setInstrumentationEnabled()
+*/
+QList<QMailStore::QueryStatistics> QMailStore::queryStatistics() const
+{
+    return d->queryStatistics();
+}
+
+/*!
+    Returns the database contention statistics recorded since instrumentation was
+    enabled, or since resetStatistics() was last invoked.
+
+    \sa queryStatistics(), setInstrumentationEnabled()
+*/
+QMailStore::ContentionStatistics QMailStore::contentionStatistics() const
+{
+    return d->contentionStatistics();
+}
+
+/*!
+    Discards all statistics recorded so far.
+
+    \sa queryStatistics(), contentionStatistics()
+*/
+void QMailStore::resetStatistics()
+{
+    d->resetStatistics();
+}
+
+/*!
+    Sets the access of this process to the message metadata cache shared by all processes
+    using the same message store to \a access.
+
+    The shared cache holds the message properties required to display message lists, for
+    the most recently added messages.  It is updated only by processes with write access,
+    which would normally be limited to the messageserver; other processes may request read
+    access, in which case messageMetaData() can avoid querying the database for messages
+    present in the cache.  Read access succeeds only once a writer has created the cache,
+    and is reattempted periodically until it does.
+
+    Returns true if the cache was attached with the requested access.  The access may also
+    be requested at startup by setting the \c QMF_SHARED_CACHE environment variable to
+    \c read or \c write.
+
+    \sa sharedCacheAccess()
+*/
+bool QMailStore::setSharedCacheAccess(SharedCacheAccess access)
+{
+    return d->setSharedCacheAccess(access);
+}
+
+/*!
+    Returns the access to the shared metadata cache requested by this process.
+
+    \sa setSharedCacheAccess()
+*/
+QMailStore::SharedCacheAccess QMailStore::sharedCacheAccess() const
+{
+    return d->sharedCacheAccess();
+}
+
+/*!
+    Sets the database connection settings used by this process to \a profile.  The
+    settings take effect immediately, and are applied again each time the connection
+    is reopened.
+
+    The profile may also be selected at startup by setting the \c QMF_STORE_PROFILE
+    environment variable to \c messageserver, \c client or \c batch.
+
+    \sa storeProfile(), roleProfile()
+*/
+void QMailStore::setStoreProfile(const StoreProfile &profile)
+{
+    d->setStoreProfile(profile);
+}
+
+/*!
+    Returns the database connection settings used by this process.
+
+    \sa setStoreProfile()
+*/
+QMailStore::StoreProfile QMailStore::storeProfile() const
+{
+    return d->storeProfile();
+}
+
+/*!
+    Returns the recommended database connection settings for a process of type \a role.
+
+    The messageserver and interactive clients keep their connection open, so that the
+    first query after a period of inactivity does not reopen the database with an
+    empty page cache; clients favour the memory mapping, whose pages are shared with
+    other processes, over a private page cache.  Batch processes use a large cache
+    and checkpoint the write-ahead log less often.
+
+    \sa setStoreProfile()
+*/
+QMailStore::StoreProfile QMailStore::roleProfile(ProcessRole role)
+{
+    StoreProfile profile;
+    profile.connectionLifetime = QMail::databaseAutoCloseTimeout();
+
+    switch (role) {
+    case MessageServerRole:
+        profile.connectionLifetime = 0;
+        profile.cacheSize = 2000;
+        profile.mmapSize = 64 * 1024 * 1024;
+        profile.tempStore = MemoryTempStore;
+        break;
+
+    case ClientRole:
+        profile.connectionLifetime = 0;
+        profile.cacheSize = 500;
+        profile.mmapSize = 64 * 1024 * 1024;
+        break;
+
+    case BatchRole:
+        profile.cacheSize = 8000;
+        profile.mmapSize = 256 * 1024 * 1024;
+        profile.tempStore = MemoryTempStore;
+        profile.walAutoCheckpoint = 10000;
+        break;
+
+    case DefaultRole:
+        break;
+    }
+
+    return profile;
+}
+
 /*!
     Returns true if the running process is in the act of emitting an asynchronous QMailStore 
     signal caused by another process.  This can only be true when called from a slot
@@ -1214,6 +1901,24 @@ QMap<QString, QString> QMailStore::messageCustomFields(const QMailMessageId &id)
     return d->messageCustomFields(id);
 }
 
+/*! \internal */
+QStringList QMailStore::messageQueryPlan(const QMailMessageKey &key, const QMailMessageSortKey &sortKey) const
+{
+    return d->messageQueryPlan(key, sortKey);
+}
+
+/*! \internal */
+QStringList QMailStore::messagePageQueryPlan(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, const QByteArray &continuation) const
+{
+    return d->messagePageQueryPlan(key, sortKey, continuation);
+}
+
+/*! \internal */
+void QMailStore::setKeyCompilationEnabled(bool enabled)
+{
+    d->setKeyCompilationEnabled(enabled);
+}
+
 /*! \internal */
 void QMailStore::clearContent()
 {
@@ -1698,6 +2403,29 @@ QMailStore* QMailStore::instance()
     \sa retrievalInProgress()
 */
 
+/*!
+    \fn void QMailStore::threadRebuildProgress(int completed, int total)
+
+    Signal that is emitted as rebuildThreads() progresses, reporting that \a completed
+    units of the \a total work of the rebuild have been performed.
+
+    \sa rebuildThreads()
+*/
+
+/*!
+    \fn void QMailStore::contentPurgeProgress(int completed, int total)
+
+    Signal that is emitted as the content of messages removed by this store is purged,
+    reporting that the content of \a completed of the \a total messages awaiting removal
+    has been removed.
+
+    The removal functions return once the messages are removed from the database; their
+    content is recorded as obsolete in the same transaction, and removed afterwards without
+    blocking the caller.  Content that cannot be removed then is removed by performMaintenance().
+
+    \sa removeMessages(), performMaintenance()
+*/
+
 /*!
     \fn void QMailStore::messageDataAdded(const QMailMessageMetaDataList &data)
 
@@ -49,6 +49,7 @@
 #include "qmailaccountconfiguration.h"
 #include "qmailmessageremovalrecord.h"
 #include "qmailglobal.h"
+#include <QFuture>
 
 class QMailStore;
 class QMailStoreImplementation;
@@ -97,6 +98,77 @@ public:
         StorageInaccessible
     };
 
+    struct QueryStatistics
+    {
+        QueryStatistics() : executions(0), repeatedExecutions(0), rows(0), prepareTime(0), stepTime(0) {}
+
+        QString descriptor;
+        int executions;
+        int repeatedExecutions;
+        qint64 rows;
+        qint64 prepareTime;
+        qint64 stepTime;
+    };
+
+    struct ContentionStatistics
+    {
+        ContentionStatistics() : transactions(0), lockWaitTime(0), busyRetries(0) {}
+
+        int transactions;
+        qint64 lockWaitTime;
+        int busyRetries;
+    };
+
+    enum MessageGrouping
+    {
+        GroupByParentFolder = 0,
+        GroupByAncestorFolder,
+        GroupByParentAccount,
+        GroupByParentThread
+    };
+
+    struct MessageGroupCounts
+    {
+        MessageGroupCounts() : count(0), size(0) {}
+
+        int count;
+        qint64 size;
+        QList<int> subsetCounts;
+    };
+
+    enum SharedCacheAccess
+    {
+        NoSharedCacheAccess = 0,
+        SharedCacheReadAccess,
+        SharedCacheWriteAccess
+    };
+
+    enum ProcessRole
+    {
+        DefaultRole = 0,
+        MessageServerRole,
+        ClientRole,
+        BatchRole
+    };
+
+    enum TempStore
+    {
+        DefaultTempStore = 0,
+        FileTempStore,
+        MemoryTempStore
+    };
+
+    struct StoreProfile
+    {
+        StoreProfile() : connectionLifetime(600000), cacheSize(1000), mmapSize(0), tempStore(DefaultTempStore), walAutoCheckpoint(1000) {}
+
+        int connectionLifetime;
+        int cacheSize;
+        qint64 mmapSize;
+        TempStore tempStore;
+        int walAutoCheckpoint;
+    };
+
 public:
     virtual ~QMailStore();
 
@@ -135,6 +207,9 @@ public:
     bool updateMessagesMetaData(const QMailMessageKey& key, quint64 messageStatus, bool set);
     bool updateThread(QMailThread* t);
     bool ensureDurability();
+    bool performMaintenance(int timeLimit = -1);
+    bool rebuildThreads(int timeLimit = -1);
+    bool enableIncrementalVacuum();
 
     int countAccounts(const QMailAccountKey& key = QMailAccountKey()) const;
     int countFolders(const QMailFolderKey& key = QMailFolderKey()) const;
@@ -143,9 +218,12 @@ public:
 
     int sizeOfMessages(const QMailMessageKey& key = QMailMessageKey()) const;
 
+    QMap<quint64, QMailStore::MessageGroupCounts> countMessagesGrouped(const QMailMessageKey& key, MessageGrouping grouping, const QList<QMailMessageKey>& subsetKeys = QList<QMailMessageKey>()) const;
+
     const QMailAccountIdList queryAccounts(const QMailAccountKey& key = QMailAccountKey(), const QMailAccountSortKey& sortKey = QMailAccountSortKey(), uint limit = 0, uint offset = 0) const;
     const QMailFolderIdList queryFolders(const QMailFolderKey& key = QMailFolderKey(), const QMailFolderSortKey& sortKey = QMailFolderSortKey(), uint limit = 0, uint offset = 0) const;
     const QMailMessageIdList queryMessages(const QMailMessageKey& key = QMailMessageKey(), const QMailMessageSortKey& sortKey = QMailMessageSortKey(), uint limit = 0, uint offset = 0) const;
+    const QMailMessageIdList queryMessagePage(const QMailMessageKey& key, const QMailMessageSortKey& sortKey, uint limit, QByteArray *continuation) const;
     const QMailThreadIdList queryThreads(const QMailThreadKey &key = QMailThreadKey(), const QMailThreadSortKey &sortKey = QMailThreadSortKey(), uint limit = 0, uint offset = 0) const;
 
     QMailAccount account(const QMailAccountId& id) const;
@@ -160,13 +238,24 @@ public:
 
     QMailMessageMetaData messageMetaData(const QMailMessageId& id) const;
     QMailMessageMetaData messageMetaData(const QString& uid, const QMailAccountId& accountId) const;
+    QMailMessageMetaData messageMetaData(const QMailMessageId& id, const QMailMessageKey::Properties& properties) const;
     const QMailMessageMetaDataList messagesMetaData(const QMailMessageKey& key, const QMailMessageKey::Properties& properties, ReturnOption option = ReturnAll) const;
 
     const QMailMessageRemovalRecordList messageRemovalRecords(const QMailAccountId& parentAccountId, const QMailFolderId& parentFolderId = QMailFolderId()) const;
 
+    QFuture<QMailMessageIdList> queryMessagesAsync(const QMailMessageKey& key = QMailMessageKey(), const QMailMessageSortKey& sortKey = QMailMessageSortKey(), uint limit = 0, uint offset = 0);
+    QFuture<int> countMessagesAsync(const QMailMessageKey& key = QMailMessageKey());
+    QFuture<QMailMessageMetaDataList> messagesMetaDataAsync(const QMailMessageKey& key, const QMailMessageKey::Properties& properties, ReturnOption option = ReturnAll);
+    QFuture<bool> updateMessagesMetaDataAsync(const QMailMessageKey& key, const QMailMessageKey::Properties& properties, const QMailMessageMetaData& data);
+    QFuture<bool> updateMessagesMetaDataAsync(const QMailMessageKey& key, quint64 messageStatus, bool set);
+    QFuture<bool> removeMessagesAsync(const QMailMessageKey& key, MessageRemovalOption option = NoRemovalRecord);
+
     void lock();
     void unlock();
 
+    bool beginReadSnapshot();
+    void endReadSnapshot();
+
     bool purgeMessageRemovalRecords(const QMailAccountId& parentAccountId, const QStringList& serverUid = QStringList());
 
     bool registerAccountStatusFlag(const QString& name);
@@ -190,6 +279,19 @@ public:
     void disconnectIpc();
     void reconnectIpc();
 
+    void setInstrumentationEnabled(bool enabled, int logInterval = 0);
+    bool instrumentationEnabled() const;
+    QList<QueryStatistics> queryStatistics() const;
+    ContentionStatistics contentionStatistics() const;
+    void resetStatistics();
+
+    bool setSharedCacheAccess(SharedCacheAccess access);
+    SharedCacheAccess sharedCacheAccess() const;
+
+    void setStoreProfile(const StoreProfile &profile);
+    StoreProfile storeProfile() const;
+    static StoreProfile roleProfile(ProcessRole role);
+
     static QMailStore* instance();
 
 Q_SIGNALS:
@@ -227,12 +329,17 @@ Q_SIGNALS:
     void retrievalInProgress(const QMailAccountIdList &ids);
     void transmissionInProgress(const QMailAccountIdList &ids);
 
+    void threadRebuildProgress(int completed, int total);
+    void contentPurgeProgress(int completed, int total);
+
     void ipcConnectionEstablished();
 
 private:
     friend class QMailStoreImplementationBase;
     friend class QMailStorePrivate;
+    friend class QMailStoreWorker;
     friend class QMailMessageMetaDataPrivate; // for ensureCustomFields
+    friend class QMailMessageKeyMatcher; // for cachedMessageMetaData
     friend class tst_QMailStore;
     friend class tst_QMailStoreKeys;
     friend class tst_qmailthread;
@@ -243,6 +350,9 @@ private:
     bool updateMessages(const QList<QPair<QMailMessageMetaData*, QMailMessage*> >&);
 
     QMap<QString, QString> messageCustomFields(const QMailMessageId &id);
+    QStringList messageQueryPlan(const QMailMessageKey &key, const QMailMessageSortKey &sortKey) const;
+    QStringList messagePageQueryPlan(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, const QByteArray &continuation) const;
+    void setKeyCompilationEnabled(bool enabled);
     void clearContent();
 
     void emitErrorNotification(QMailStore::ErrorCode code);
@@ -34,18 +34,26 @@
 #include "qmailstore_p.h"
 #include "locks_p.h"
 #include "qmailcontentmanager.h"
+#include "qmailcontentpurger_p.h"
 #include "qmailmessageremovalrecord.h"
 #include "qmailtimestamp.h"
 #include "qmailnamespace.h"
 #include "qmaillog.h"
 #include <QCoreApplication>
+#include <QDataStream>
 #include <QDir>
 #include <QFile>
 #include <QSqlQuery>
 #include <QSqlError>
 #include <QSqlRecord>
+#include <QRunnable>
 #include <QTextCodec>
 #include <QThread>
+#include <QThreadPool>
+#include <QThreadStorage>
+#include <QVector>
+
+#include <algorithm>
 
 #if defined(Q_OS_LINUX)
 #include <malloc.h>
@@ -185,6 +193,21 @@ const int Sqlite3BusyErrorNumber = 5;
 
 const int Sqlite3ConstraintErrorNumber = 19;
 
+// When instrumentation is enabled, statements repeated this many times within a single
+// store operation, or operations repeated this many times in succession, are reported
+const int RepeatedStatementThreshold = 5;
+const int RepeatedOperationThreshold = 16;
+
+const char *QMF_STORE_INSTRUMENTATION_ENV = "QMF_STORE_INSTRUMENTATION";
+
+const char *QMF_SHARED_CACHE_ENV = "QMF_SHARED_CACHE";
+
+const char *QMF_STORE_PROFILE_ENV = "QMF_STORE_PROFILE";
+
+// Interval in milliseconds between attempts to attach to a shared cache that
+// has not yet been created by a writer
+const int SharedCacheAttachInterval = 10000;
+
 const uint pid = static_cast<uint>(QCoreApplication::applicationPid() & 0xffffffff);
 
 // Helper class for automatic unlocking
@@ -797,6 +820,115 @@ QVariantList whereClauseValues(const KeyType& key)
     return values;
 }
 
+// Lists of identifiers are matched with a number of placeholders rounded up to the
+// next power of two, the final value being repeated to fill the list.  This bounds
+// the number of distinct statements produced by keys of the same shape.
+int normalizedArity(const QMailMessageKey::ArgumentType &a)
+{
+    const int count(a.valueList.count());
+    if ((count < 2) || (count >= IdLookupThreshold))
+        return count;
+
+    switch (a.property)
+    {
+    case QMailMessageKey::Id:
+    case QMailMessageKey::ParentFolderId:
+    case QMailMessageKey::PreviousParentFolderId:
+    case QMailMessageKey::RestoreFolderId:
+    case QMailMessageKey::ParentAccountId:
+    case QMailMessageKey::ParentThreadId:
+    case QMailMessageKey::InResponseTo:
+    case QMailMessageKey::ServerUid:
+    case QMailMessageKey::CopyServerUid:
+        break;
+
+    default:
+        return count;
+    }
+
+    int arity(2);
+    while (arity < count)
+        arity *= 2;
+
+    return qMin(arity, IdLookupThreshold - 1);
+}
+
+template<typename ArgumentType>
+int normalizedArity(const ArgumentType &a)
+{
+    return a.valueList.count();
+}
+
+// Arguments matched against a temporary table produce a statement naming that table,
+// which cannot be reused by another key
+bool compilableArgument(const QMailMessageKey::ArgumentType &a)
+{
+    if ((a.property == QMailMessageKey::Id) || (a.property == QMailMessageKey::ServerUid) || (a.property == QMailMessageKey::CopyServerUid))
+        return (a.valueList.count() < IdLookupThreshold);
+
+    return true;
+}
+
+template<typename ArgumentType>
+bool compilableArgument(const ArgumentType &)
+{
+    return true;
+}
+
+template<typename KeyType>
+bool appendKeyShape(const KeyType &key, QString &shape);
+
+bool appendValueShape(const QVariant &value, QString &shape)
+{
+    if (value.canConvert<QMailMessageKey>()) {
+        shape.append(QLatin1Char('m'));
+        return appendKeyShape(value.value<QMailMessageKey>(), shape);
+    } else if (value.canConvert<QMailFolderKey>()) {
+        shape.append(QLatin1Char('f'));
+        return appendKeyShape(value.value<QMailFolderKey>(), shape);
+    } else if (value.canConvert<QMailAccountKey>()) {
+        shape.append(QLatin1Char('a'));
+        return appendKeyShape(value.value<QMailAccountKey>(), shape);
+    } else if (value.canConvert<QMailThreadKey>()) {
+        shape.append(QLatin1Char('t'));
+        return appendKeyShape(value.value<QMailThreadKey>(), shape);
+    }
+
+    return true;
+}
+
+// Describes the structure of a key without its values: two keys with the same shape
+// produce the same where clause text, differing only in the values bound to it
+template<typename KeyType>
+bool appendKeyShape(const KeyType &key, QString &shape)
+{
+    shape.append(QLatin1Char(key.isNegated() ? '!' : '('));
+    shape.append(QString::number(static_cast<int>(key.combiner())));
+
+    foreach (const typename KeyType::ArgumentType &a, key.arguments()) {
+        if (!compilableArgument(a))
+            return false;
+
+        shape.append(QLatin1Char(' '));
+        shape.append(QString::number(static_cast<int>(a.property)));
+        shape.append(QLatin1Char(':'));
+        shape.append(QString::number(static_cast<int>(a.op)));
+        shape.append(QLatin1Char(':'));
+        shape.append(QString::number(normalizedArity(a)));
+
+        if (!a.valueList.isEmpty() && !appendValueShape(a.valueList.first(), shape))
+            return false;
+    }
+
+    foreach (const KeyType &subkey, key.subKeys()) {
+        if (!appendKeyShape(subkey, shape))
+            return false;
+    }
+
+    shape.append(QLatin1Char(')'));
+    return true;
+}
+
 template <typename Key, typename Argument = typename Key::ArgumentType>
 class ArgumentExtractorBase
 {
@@ -1280,6 +1412,10 @@ void appendWhereValues<QMailMessageKey::ArgumentType>(const QMailMessageKey::Arg
         values += extractor.parentThreadId();
         break;
     }
+
+    // Fill any padding added to the list of values matched
+    for (int i = normalizedArity(a) - a.valueList.count(); i > 0; --i)
+        values.append(values.last());
 }
 
 
@@ -1691,6 +1827,21 @@ static QString incrementAlias(const QString &alias)
     return QString();
 }
 
+// The expression by which rows are ordered for a sort argument
+template<typename ArgumentType>
+QString sortExpression(const ArgumentType &arg, const QString &alias)
+{
+    QString field(fieldName(arg.property, alias));
+    if (arg.mask) {
+        field = QString::fromLatin1("(%1 & %2)").arg(field).arg(QString::number(arg.mask));
+    }
+    if (caseInsensitiveProperty(arg.property)) {
+        field = QLatin1String("ltrim(") + field + QLatin1String(",'\\\"') COLLATE NOCASE");
+    }
+
+    return field;
+}
+
 template<typename ArgumentListType>
 QString buildOrderClause(const ArgumentListType &list, const QString &alias)
 {
@@ -1699,16 +1850,7 @@ QString buildOrderClause(const ArgumentListType &list, const QString &alias)
 
     QStringList sortColumns;
     foreach (typename ArgumentListType::const_reference arg, list) {
-        QString field(fieldName(arg.property, alias));
-        if (arg.mask) {
-            field = QString::fromLatin1("(%1 & %2)").arg(field).arg(QString::number(arg.mask));
-        }
-        if (caseInsensitiveProperty(arg.property)) {
-            sortColumns.append(QLatin1String("ltrim(") + field + QLatin1String(",'\\\"') COLLATE NOCASE ") +
-                               QLatin1String(arg.order == Qt::AscendingOrder ? "ASC" : "DESC"));
-        } else {
-            sortColumns.append(field + QLatin1String(arg.order == Qt::AscendingOrder ? " ASC" : " DESC"));
-        }
+        sortColumns.append(sortExpression(arg, alias) + QLatin1String(arg.order == Qt::AscendingOrder ? " ASC" : " DESC"));
     }
 
     return QLatin1String(" ORDER BY ") + sortColumns.join(QLatin1Char(','));
@@ -1894,7 +2036,8 @@ QString whereClauseItem<QMailMessageKey>(const QMailMessageKey &, const QMailMes
                              (a.property == QMailMessageKey::ContentScheme) || (a.property == QMailMessageKey::ContentIdentifier));
         bool noCase(caseInsensitiveProperty(a.property));
 
-        QString expression = columnExpression(columnName, a.op, a.valueList, patternMatching, bitwise, noCase);
+        const int arity(normalizedArity(a));
+        QString expression = columnExpression(columnName, a.op, QMailStorePrivate::expandValueList(arity), (arity > 1), patternMatching, bitwise, noCase);
         
         switch(a.property)
         {
@@ -2297,11 +2440,388 @@ QMailContentManager::DurabilityRequirement durability(bool commitOnSuccess)
     return (commitOnSuccess ? QMailContentManager::EnsureDurability : QMailContentManager::DeferDurability);
 }
 
+// The number of rows or pages processed by each step of a maintenance task
+const int maintenanceBatchSize = 100;
+
+// Table statistics are refreshed no more than once a week
+const uint maintenanceAnalyzeFrequency = 7*24*60*60;
+
+bool maintenanceTimeExpired(const QElapsedTimer &timer, int timeLimit)
+{
+    return (timeLimit >= 0) && timer.hasExpired(timeLimit);
+}
+
+// The number of rows written to the staging tables by each step of a thread rebuild
+const int threadRebuildBatchSize = 500;
+
+// A message as seen by the thread rebuild
+struct RebuildMessage
+{
+    quint64 id;
+    QDateTime stamp;
+    quint64 status;
+    QString sender;
+    QString subject;
+    QString preview;
+    QString identifier;
+    QStringList references;
+
+    int thread;
+    quint64 responseId;
+
+    quint64 previousThreadId;
+    quint64 previousResponseId;
+};
+
+struct RebuildThread
+{
+    int messageCount;
+    int unreadCount;
+    QString subject;
+    QString preview;
+    QString senders;
+    QDateTime lastDate;
+    QDateTime startedDate;
+    quint64 status;
+    QList<int> members;
+    QStringList baseSubjects;
+    bool obsolete;
+};
+
+struct RebuildAncestor
+{
+    quint64 id;
+    QString baseSubject;
+    int state;
+};
+
+struct RebuildAccount
+{
+    quint64 id;
+    QList<RebuildMessage> messages;
+    QList<RebuildThread> threads;
+    QMap<quint64, QMap<int, QString> > missingReferences;
+    QMap<quint64, RebuildAncestor> missingAncestors;
+    QSet<QString> baseSubjects;
+};
+
+// The rows to be written to one of the staging tables
+struct RebuildStaging
+{
+    QString statement;
+    QList<QVariantList> columns;
+    int written;
+};
+
+// The thread assigned to a message by the rebuild, and the one it had before
+struct RebuildSwap
+{
+    quint64 id;
+    quint64 threadId;
+    quint64 responseId;
+    quint64 previousThreadId;
+    quint64 previousResponseId;
+};
+
+RebuildStaging rebuildStaging(const QString &statement, int columnCount)
+{
+    RebuildStaging staging;
+    staging.statement = statement;
+    staging.written = 0;
+    for (int i = 0; i < columnCount; ++i)
+        staging.columns.append(QVariantList());
+
+    return staging;
+}
+
+// Finds the messages of childIds that precede the predecessor in its thread, as identifyAncestors() does
+QSet<quint64> rebuildAncestors(const QList<RebuildMessage> &messages, const QHash<quint64, int> &position, quint64 predecessorId, const QList<quint64> &childIds)
+{
+    QSet<quint64> ancestors;
+
+    if (!childIds.isEmpty()) {
+        const int thread(messages.at(position.value(predecessorId)).thread);
+
+        quint64 id(predecessorId);
+        for (int steps = 0; id && (steps <= messages.count()); ++steps) {
+            if (childIds.contains(id))
+                ancestors.insert(id);
+
+            const int index(position.value(id, -1));
+            if ((index == -1) || (messages.at(index).thread != thread))
+                break;
+
+            id = messages.at(index).responseId;
+            if (ancestors.contains(id))
+                break;
+        }
+    }
+
+    ancestors.insert(predecessorId);
+    return ancestors;
+}
+
+bool laterStamp(const QPair<QDateTime, quint64> &lhs, const QPair<QDateTime, quint64> &rhs)
+{
+    return (lhs.first > rhs.first);
+}
+
+// Finds the earlier messages of threads having this base subject, most recent first
+QList<quint64> rebuildSubjectPredecessors(const RebuildAccount &account, const QHash<QString, QList<int> > &subjectThreads, const QString &baseSubject, const RebuildMessage &message)
+{
+    QList<QPair<QDateTime, quint64> > predecessors;
+    foreach (int thread, subjectThreads.value(baseSubject)) {
+        foreach (int index, account.threads.at(thread).members) {
+            const RebuildMessage &candidate(account.messages.at(index));
+            if ((candidate.id != message.id) && (candidate.stamp < message.stamp))
+                predecessors.append(qMakePair(candidate.stamp, candidate.id));
+        }
+    }
+    std::stable_sort(predecessors.begin(), predecessors.end(), laterStamp);
+
+    QList<quint64> ids;
+    for (int i = 0; i < predecessors.count(); ++i)
+        ids.append(predecessors.at(i).second);
+
+    return ids;
+}
+
+/*
+    Threads the messages of an account in time stamp order, making the choices that
+    messagePredecessor(), registerSubject() and resolveMissingMessages() make when the
+    messages are added to the store one at a time.  No database access is required,
+    so the accounts of the store can be threaded concurrently.
+*/
+void threadAccount(RebuildAccount *account, quint64 readStatus)
+{
+    QList<RebuildMessage> &messages(account->messages);
+    QList<RebuildThread> &threads(account->threads);
+
+    QHash<quint64, int> position;
+    QHash<QString, QList<quint64> > identified;
+    for (int i = 0; i < messages.count(); ++i) {
+        position.insert(messages.at(i).id, i);
+        if (!messages.at(i).identifier.isEmpty())
+            identified[messages.at(i).identifier].append(messages.at(i).id);
+    }
+
+    QHash<QString, QList<int> > subjectThreads;
+    QHash<QString, QMap<quint64, int> > pendingReferences;
+    QHash<QString, QList<quint64> > pendingAncestors;
+
+    for (int i = 0; i < messages.count(); ++i) {
+        bool replyOrForward(false);
+        const QString baseSubject(QMail::baseSubject(messages.at(i).subject, &replyOrForward));
+
+        QStringList missingReferences;
+        bool missingAncestor(false);
+        QList<quint64> candidates;
+
+        const QStringList &references(messages.at(i).references);
+        if (!references.isEmpty()) {
+            bool referenced(false);
+            for (int r = references.count() - 1; r >= 0; --r) {
+                const QList<quint64> ids(identified.value(references.at(r)));
+                if (!ids.isEmpty()) {
+                    candidates = ids;
+                    referenced = true;
+                    break;
+                }
+                missingReferences.append(references.at(r));
+            }
+
+            if (!referenced) {
+                // All the references are missing
+                missingReferences = references;
+                missingAncestor = true;
+                candidates = rebuildSubjectPredecessors(*account, subjectThreads, baseSubject, messages.at(i));
+            }
+        } else if (!baseSubject.isEmpty() && replyOrForward) {
+            missingAncestor = true;
+            candidates = rebuildSubjectPredecessors(*account, subjectThreads, baseSubject, messages.at(i));
+        }
+        missingReferences.removeDuplicates();
+
+        candidates.removeAll(messages.at(i).id);
+        const quint64 predecessorId(candidates.isEmpty() ? 0 : candidates.first());
+
+        // Join the thread of the predecessor, if it has one yet
+        int thread(-1);
+        if (predecessorId) {
+            messages[i].responseId = predecessorId;
+            thread = messages.at(position.value(predecessorId)).thread;
+        }
+
+        RebuildMessage &message(messages[i]);
+        const bool unread(!(message.status & readStatus));
+        if (thread != -1) {
+            RebuildThread &existing(threads[thread]);
+            existing.messageCount += 1;
+            existing.unreadCount += (unread ? 1 : 0);
+            if (!existing.senders.contains(message.sender))
+                existing.senders.append(QLatin1Char(',') + message.sender);
+            existing.preview = message.preview;
+            existing.lastDate = message.stamp;
+            existing.status |= message.status;
+        } else {
+            RebuildThread created;
+            created.messageCount = 1;
+            created.unreadCount = (unread ? 1 : 0);
+            created.subject = message.subject;
+            created.preview = message.preview;
+            created.senders = message.sender;
+            created.lastDate = message.stamp;
+            created.startedDate = message.stamp;
+            created.status = message.status;
+            created.obsolete = false;
+
+            thread = threads.count();
+            threads.append(created);
+        }
+        message.thread = thread;
+        threads[thread].members.append(i);
+
+        if (!baseSubject.isEmpty()) {
+            account->baseSubjects.insert(baseSubject);
+
+            if (!threads.at(thread).baseSubjects.contains(baseSubject)) {
+                threads[thread].baseSubjects.append(baseSubject);
+                subjectThreads[baseSubject].append(thread);
+            }
+
+            if (missingAncestor && !account->missingAncestors.contains(message.id)) {
+                RebuildAncestor ancestor;
+                ancestor.id = message.id;
+                ancestor.baseSubject = baseSubject;
+                ancestor.state = (predecessorId ? 1 : 0);
+                account->missingAncestors.insert(message.id, ancestor);
+                pendingAncestors[baseSubject].append(message.id);
+            }
+        }
+
+        // See if this message resolves any missing message items
+        if (!message.identifier.isEmpty()) {
+            QMap<quint64, int> descendants(pendingReferences.value(message.identifier));
+            if (!descendants.isEmpty() && predecessorId) {
+                foreach (quint64 id, rebuildAncestors(messages, position, predecessorId, descendants.keys()))
+                    descendants.remove(id);
+            }
+            descendants.remove(message.id);
+
+            QList<int> obsoleteThreads;
+            QMap<quint64, int>::const_iterator it = descendants.constBegin(), end = descendants.constEnd();
+            for ( ; it != end; ++it) {
+                RebuildMessage &descendant(messages[position.value(it.key())]);
+                descendant.responseId = message.id;
+
+                // Truncate the missing references of the descendant at the resolved level
+                QMap<int, QString> &missing(account->missingReferences[it.key()]);
+                QMap<int, QString>::iterator rit = missing.lowerBound(it.value());
+                while (rit != missing.end()) {
+                    pendingReferences[rit.value()].remove(it.key());
+                    rit = missing.erase(rit);
+                }
+
+                if ((descendant.thread != message.thread) && !obsoleteThreads.contains(descendant.thread))
+                    obsoleteThreads.append(descendant.thread);
+            }
+
+            // Attach the threads of the descendants to the thread of this message
+            foreach (int obsolete, obsoleteThreads) {
+                RebuildThread &source(threads[obsolete]);
+                RebuildThread &target(threads[message.thread]);
+
+                target.messageCount += source.messageCount;
+                target.unreadCount += source.unreadCount;
+                foreach (int index, source.members)
+                    messages[index].thread = message.thread;
+                target.members += source.members;
+
+                source.members.clear();
+                source.obsolete = true;
+            }
+        }
+
+        if (!baseSubject.isEmpty()) {
+            // See if there are any messages waiting for a thread ancestor with this subject
+            QList<quint64> ids;
+            foreach (quint64 id, pendingAncestors.value(baseSubject)) {
+                const RebuildMessage &waiting(messages.at(position.value(id)));
+                if (waiting.stamp <= message.stamp)
+                    continue;
+
+                if ((waiting.responseId == 0)
+                    || (position.contains(waiting.responseId) && (message.stamp > messages.at(position.value(waiting.responseId)).stamp)))
+                    ids.append(id);
+            }
+
+            if (!ids.isEmpty() && predecessorId) {
+                foreach (quint64 id, rebuildAncestors(messages, position, predecessorId, ids))
+                    ids.removeAll(id);
+            }
+            ids.removeAll(message.id);
+
+            foreach (quint64 id, ids) {
+                messages[position.value(id)].responseId = message.id;
+                account->missingAncestors[id].state = 1;
+            }
+        }
+
+        // Record the references that remain unresolved
+        int level = missingReferences.count();
+        foreach (const QString &ref, missingReferences) {
+            --level;
+            pendingReferences[ref].insert(message.id, level);
+            account->missingReferences[message.id].insert(level, ref);
+        }
+    }
+}
+
+class ThreadAccountTask : public QRunnable
+{
+public:
+    ThreadAccountTask(RebuildAccount *account, quint64 readStatus)
+        : _account(account), _readStatus(readStatus) {}
+
+    void run() { threadAccount(_account, _readStatus); }
+
+private:
+    RebuildAccount *_account;
+    quint64 _readStatus;
+};
+
 } // namespace
 
+struct QMailStorePrivate::ThreadRebuild
+{
+    ThreadRebuild() : snapshot(false), computed(false), swapping(false), account(0), message(0), loaded(0), total(0), stage(0), staged(0), base(0), swapped(0) {}
+
+    bool snapshot;
+    bool computed;
+    bool swapping;
+
+    QList<RebuildAccount> accounts;
+    int account;
+    int message;
+    int loaded;
+    int total;
+
+    QList<RebuildStaging> staging;
+    int stage;
+    int staged;
+
+    // Threads whose messages are unchanged keep their identifiers; the others are numbered above base
+    QHash<quint64, quint64> reusedThreadIds;
+    QList<RebuildSwap> swaps;
+    quint64 base;
+    int swapped;
+    QMailMessageIdList updatedMessageIds;
+};
 
-// We need to support recursive locking, per-process
-static volatile int mutexLockCount = 0;
+
+// We need to support recursive locking, per-thread; each thread has its own store
+// instance, and must take the database mutex for itself
+static QThreadStorage<int> mutexLockCount;
 
 
 class QMailStorePrivate::Transaction
@@ -2324,19 +2844,29 @@ QMailStorePrivate::Transaction::Transaction(QMailStorePrivate* d)
       m_initted(false),
       m_committed(false)
 {
-    if (mutexLockCount > 0) {
+    int &lockCount(mutexLockCount.localData());
+    if (lockCount > 0) {
         // Increase lock recursion depth
-        ++mutexLockCount;
+        ++lockCount;
         m_initted = true;
     } else {
-        // This process does not yet have a mutex lock
+        // This thread does not yet have a mutex lock
+        QElapsedTimer waitTimer;
+        if (m_d->instrumented)
+            waitTimer.start();
+
         m_d->databaseMutex().lock();
         if (m_d->transaction()) {
-            ++mutexLockCount;
+            ++lockCount;
             m_initted = true;
         } else {
             m_d->databaseMutex().unlock();
         }
+
+        if (m_d->instrumented) {
+            ++m_d->contention.transactions;
+            m_d->contention.lockWaitTime += waitTimer.nsecsElapsed() / 1000;
+        }
     }
 }
 
@@ -2345,8 +2875,9 @@ QMailStorePrivate::Transaction::~Transaction()
     if (m_initted && !m_committed) {
         m_d->rollback();
 
-        --mutexLockCount;
-        if (mutexLockCount == 0)
+        int &lockCount(mutexLockCount.localData());
+        --lockCount;
+        if (lockCount == 0)
             m_d->databaseMutex().unlock();
     }
 }
@@ -2356,8 +2887,9 @@ bool QMailStorePrivate::Transaction::commit()
     if (m_initted && !m_committed) {
         m_committed = m_d->commit();
         if (m_committed) {
-            --mutexLockCount;
-            if (mutexLockCount == 0)
+            int &lockCount(mutexLockCount.localData());
+            --lockCount;
+            if (lockCount == 0)
                 m_d->databaseMutex().unlock();
         }
     }
@@ -2376,6 +2908,25 @@ struct QMailStorePrivate::ReadLock
     ReadLock(QMailStorePrivate *){}
 };
 
+// Delimits a public store operation, so that statements repeated within it can be detected
+struct QMailStorePrivate::InstrumentationScope
+{
+    InstrumentationScope(const QMailStorePrivate *d, const QString &description)
+        : m_d(d->instrumented ? d : Q_NULLPTR)
+    {
+        if (m_d)
+            m_d->beginInstrumentedOperation(description);
+    }
+
+    ~InstrumentationScope()
+    {
+        if (m_d)
+            m_d->endInstrumentedOperation();
+    }
+
+    const QMailStorePrivate *m_d;
+};
+
 
 template<typename FunctionType>
 QMailStorePrivate::AttemptResult evaluate(QMailStorePrivate::WriteAccess, FunctionType func, QMailStorePrivate::Transaction &t)
@@ -2501,11 +3052,44 @@ QSqlDatabase *QMailStorePrivate::database() const
 {
     if (!databaseptr) {
         databaseptr = new QSqlDatabase(QMail::createDatabase());
+        configureDatabase(databaseptr);
     }
-    databaseUnloadTimer.start(QMail::databaseAutoCloseTimeout());
+    // A lifetime of zero keeps the connection open for the life of the store
+    if (profile.connectionLifetime > 0)
+        databaseUnloadTimer.start(profile.connectionLifetime);
     return databaseptr;
 }
 
+// Connection settings are not persistent, and must be applied again
+// whenever the connection is reopened after being unloaded
+void QMailStorePrivate::configureDatabase(QSqlDatabase *db) const
+{
+#if defined(Q_USE_SQLITE)
+    static const char *tempStoreModes[] = { "DEFAULT", "FILE", "MEMORY" };
+
+    QStringList pragmas;
+    pragmas << QString::fromLatin1("PRAGMA cache_size=%1;").arg(profile.cacheSize)
+            << QString::fromLatin1("PRAGMA mmap_size=%1;").arg(profile.mmapSize)
+            << QString::fromLatin1("PRAGMA temp_store=%1;").arg(QLatin1String(tempStoreModes[profile.tempStore]))
+            << QString::fromLatin1("PRAGMA wal_autocheckpoint=%1;").arg(profile.walAutoCheckpoint);
+#if defined(QMF_NO_SYNCHRONOUS_DB)
+    // Use sqlite synchronous=OFF does not protect integrity of database does not ensure durability
+    pragmas << QLatin1String("PRAGMA synchronous=OFF;");
+#elif defined(QMF_NO_DURABILITY)
+    // Use sqlite synchronous=NORMAL protects integrity of database but does not ensure durability
+    pragmas << QLatin1String("PRAGMA synchronous=NORMAL;");
+#endif
+
+    QSqlQuery query(*db);
+    foreach (const QString &pragma, pragmas) {
+        if (!query.exec(pragma))
+            qWarning() << "Unable to configure database connection" << pragma;
+    }
+#else
+    Q_UNUSED(db)
+#endif
+}
+
 ProcessMutex* QMailStorePrivate::contentMutex = Q_NULLPTR;
 
 QMailStorePrivate::QMailStorePrivate(QMailStore* parent)
@@ -2517,10 +3101,20 @@ QMailStorePrivate::QMailStorePrivate(QMailStore* parent)
       folderCache(folderCacheSize),
       accountCache(accountCacheSize),
       threadCache(threadCacheSize),
+      sharedAccess(QMailStore::NoSharedCacheAccess),
+      threadRebuild(Q_NULLPTR),
+      purger(Q_NULLPTR),
+      keyCompilation(true),
+      whereClauseCache(whereClauseCacheSize),
       inTransaction(false),
       lastQueryError(0),
       mutex(Q_NULLPTR),
-      globalLocks(0)
+      globalLocks(0),
+      readSnapshotDepth(0),
+      inReadSnapshot(false),
+      instrumented(false),
+      operationDepth(0),
+      repeatedOperations(0)
 {
     ProcessMutex creationMutex(QDir::rootPath());
     MutexGuard guard(creationMutex);
@@ -2531,10 +3125,35 @@ QMailStorePrivate::QMailStorePrivate(QMailStore* parent)
         contentMutex = new ProcessMutex(databaseIdentifier(), 3);
     }
     connect(&databaseUnloadTimer, SIGNAL(timeout()), this, SLOT(unloadDatabase()));
+    connect(&statisticsLogTimer, SIGNAL(timeout()), this, SLOT(logStatistics()));
+
+    // The variable holds the interval in seconds at which statistics are logged, or zero
+    const QByteArray instrumentationEnv(qgetenv(QMF_STORE_INSTRUMENTATION_ENV));
+    if (!instrumentationEnv.isEmpty())
+        setInstrumentationEnabled(true, instrumentationEnv.toInt());
+
+    // The variable names the role whose profile the store should use
+    const QByteArray profileEnv(qgetenv(QMF_STORE_PROFILE_ENV));
+    if (profileEnv == "messageserver") {
+        setStoreProfile(QMailStore::roleProfile(QMailStore::MessageServerRole));
+    } else if (profileEnv == "client") {
+        setStoreProfile(QMailStore::roleProfile(QMailStore::ClientRole));
+    } else if (profileEnv == "batch") {
+        setStoreProfile(QMailStore::roleProfile(QMailStore::BatchRole));
+    } else if (!profileEnv.isEmpty()) {
+        qWarning() << "Unknown store profile:" << profileEnv;
+    }
+
+    // The variable selects read access to the shared metadata cache, or write access if "write"
+    const QByteArray sharedCacheEnv(qgetenv(QMF_SHARED_CACHE_ENV));
+    if (!sharedCacheEnv.isEmpty())
+        setSharedCacheAccess(sharedCacheEnv == "write" ? QMailStore::SharedCacheWriteAccess : QMailStore::SharedCacheReadAccess);
 }
 
 QMailStorePrivate::~QMailStorePrivate()
 {
+    delete threadRebuild;
+    delete purger;
     delete mutex;
     delete databaseptr;
 }
@@ -2560,6 +3179,16 @@ bool QMailStorePrivate::initStore()
         return false;
     }
 
+#if defined(Q_USE_SQLITE)
+    if (database()->tables().isEmpty()) {
+        // The vacuum mode can only be selected before any table is created
+        QSqlQuery query( *database() );
+        if (!query.exec(QLatin1String("PRAGMA auto_vacuum=INCREMENTAL;"))) {
+            qWarning() << "Unable to select incremental vacuum mode" << query.lastQuery().simplified();
+        }
+    }
+#endif
+
     {
         Transaction t(this);
 
@@ -2573,7 +3202,7 @@ bool QMailStorePrivate::initStore()
                                             << tableInfo(QLatin1String("mailfoldercustom"), 100)
                                             << tableInfo(QLatin1String("mailfolderlinks"), 100)
                                             << tableInfo(QLatin1String("mailthreads"), 102)
-                                            << tableInfo(QLatin1String("mailmessages"), 114)
+                                            << tableInfo(QLatin1String("mailmessages"), 116)
                                             << tableInfo(QLatin1String("mailmessagecustom"), 101)
                                             << tableInfo(QLatin1String("mailstatusflags"), 101)
                                             << tableInfo(QLatin1String("mailmessageidentifiers"), 101)
@@ -2723,12 +3352,6 @@ bool QMailStorePrivate::initStore()
             return false;
         }
 
-        if ((countMessages(QMailMessageKey()) != 0)
-            && (countThreads(QMailThreadKey()) == 0)) {
-            if (!fullThreadTableUpdate())
-                qWarning() << Q_FUNC_INFO << "Full thread's table update is not completed.";
-        }
-
         if (!setupFolders(QList<FolderInfo>() << FolderInfo(QMailFolder::LocalStorageFolderId, tr("Local Storage"), QMailFolder::MessagesPermitted))) {
             qWarning() << "Error setting up folders";
             return false;
@@ -2751,32 +3374,9 @@ bool QMailStorePrivate::initStore()
             qWarning() << "WAL mode disabled. Please delete $QMF_DATA directory, and/or update sqlite to >= 3.7.";
         }
     }
-    {
-        // Reduce page cache from 2MB (2000 pages) to 1MB
-        QSqlQuery query( *database() );
-        if (!query.exec(QLatin1String("PRAGMA cache_size=1000;"))) {
-            qWarning() << "Unable to reduce page cache size" << query.lastQuery().simplified();
-        }
-    }
-#if defined(QMF_NO_DURABILITY) || defined(QMF_NO_SYNCHRONOUS_DB)
 #if defined(QMF_NO_SYNCHRONOUS_DB)
-    {
-        // Use sqlite synchronous=OFF does not protect integrity of database does not ensure durability
-        QSqlQuery query( *database() );
-        qWarning() << "Disabling synchronous writes, database may become corrupted!";
-        if (!query.exec(QLatin1String("PRAGMA synchronous=OFF;"))) {
-            qWarning() << "Unable to set synchronous mode to OFF" << query.lastQuery().simplified();
-        }
-    }
-#else
-    {
-        // Use sqlite synchronous=NORMAL protects integrity of database but does not ensure durability
-        QSqlQuery query( *database() );
-        if (!query.exec(QLatin1String("PRAGMA synchronous=NORMAL;"))) {
-            qWarning() << "Unable to set synchronous mode to NORMAL" << query.lastQuery().simplified();
-        }
-    }
-#endif
+    // The page cache and synchronous settings are applied by configureDatabase()
+    qWarning() << "Disabling synchronous writes, database may become corrupted!";
 #endif
 #endif
 
@@ -2785,9 +3385,8 @@ bool QMailStorePrivate::initStore()
         return false;
     }
 
-    if (!performMaintenance()) {
-        return false;
-    }
+    // Maintenance tasks, including threading messages from before threads were stored, are
+    // performed incrementally by the messageserver, see performMaintenance()
 
     // We are now correctly initialized
     return true;
@@ -2801,6 +3400,7 @@ void QMailStorePrivate::clearContent()
     messageCache.clear();
     uidCache.clear();
     threadCache.clear();
+    sharedCache.clear();
 
     Transaction t(this);
 
@@ -2832,6 +3432,13 @@ bool QMailStorePrivate::transaction(void)
 
     clearQueryError();
 
+    if (inReadSnapshot) {
+        // The snapshot cannot be upgraded once another process has written; release it
+        qMailLog(Messaging) << "(" << pid << ")" << "Write transaction within read snapshot - snapshot released";
+        database()->commit();
+        inReadSnapshot = false;
+    }
+
     // Ensure any outstanding temp tables are removed before we begin this transaction
     destroyTemporaryTables();
 
@@ -3475,11 +4082,55 @@ QVariantList QMailStorePrivate::whereClauseValues(const Key& key) const
     return QVariantList();
 }
 
-QVariantList QMailStorePrivate::messageValues(const QMailMessageKey::Properties& prop, const QMailMessageMetaData& data)
+QString QMailStorePrivate::keyShape(const Key& key, bool firstClause) const
 {
-    QVariantList values;
+    QString shape;
+    bool compilable(false);
 
-    const MessageValueExtractor<QMailMessageMetaData> extractor(data);
+    if (key.isType<QMailMessageKey>()) {
+        shape.append(QLatin1Char('m'));
+        compilable = appendKeyShape(key.key<QMailMessageKey>(), shape);
+    } else if (key.isType<QMailFolderKey>()) {
+        shape.append(QLatin1Char('f'));
+        compilable = appendKeyShape(key.key<QMailFolderKey>(), shape);
+    } else if (key.isType<QMailAccountKey>()) {
+        shape.append(QLatin1Char('a'));
+        compilable = appendKeyShape(key.key<QMailAccountKey>(), shape);
+    } else if (key.isType<QMailThreadKey>()) {
+        shape.append(QLatin1Char('t'));
+        compilable = appendKeyShape(key.key<QMailThreadKey>(), shape);
+    }
+
+    if (!compilable)
+        return QString();
+
+    shape.append(QLatin1Char(firstClause ? 'w' : '&'));
+    shape.append(key.alias());
+    shape.append(QLatin1Char('.'));
+    shape.append(key.field());
+    return shape;
+}
+
+QString QMailStorePrivate::compiledWhereClause(const Key& key, bool firstClause) const
+{
+    // Keys differing only in their values share the same where clause text
+    const QString shape(keyCompilation ? keyShape(key, firstClause) : QString());
+    if (shape.isEmpty())
+        return buildWhereClause(key, false, firstClause);
+
+    if (whereClauseCache.contains(shape))
+        return whereClauseCache.lookup(shape);
+
+    const QString whereClause(buildWhereClause(key, false, firstClause));
+    whereClauseCache.insert(shape, whereClause);
+    return whereClause;
+}
+
+QVariantList QMailStorePrivate::messageValues(const QMailMessageKey::Properties& prop, const QMailMessageMetaData& data)
+{
+    QVariantList values;
+
+    const MessageValueExtractor<QMailMessageMetaData> extractor(data);
 
     // The ContentScheme and ContentIdentifier properties map to the same field
     QMailMessageKey::Properties properties(prop);
@@ -4063,195 +4714,134 @@ bool QMailStorePrivate::upgradeTableVersion(const QString &name, qint64 current,
     return (current == final);
 }
 
-bool QMailStorePrivate::fullThreadTableUpdate()
+QMailStorePrivate::AttemptResult QMailStorePrivate::threadMessage(QMailMessageMetaData *metaData)
 {
-    //Clear mailthreads table.
-    {
-        QSqlQuery query(simpleQuery(QLatin1String("DELETE FROM mailthreads"),
-                                    QLatin1String("fullThreadTableUpdate clear mailthreads table query")));
-        if (query.lastError().type() != QSqlError::NoError)
-            return false;
-    }
-    //Clear mailthread ids and responseid for all messages
-    {
-        QSqlQuery query(simpleQuery(QLatin1String("UPDATE mailmessages SET parentthreadid = 0 , responseid = 0"),
-                                    QLatin1String("fullThreadTableUpdate clear mailmessages parentthreadid query")));
-        if (query.lastError().type() != QSqlError::NoError)
-            return false;
-    }
-    //Clear missingancestors table
-    {
-        QSqlQuery query(simpleQuery(QLatin1String("DELETE FROM missingancestors"),
-                                    QLatin1String("fullThreadTableUpdate clear missingancestors table query")));
-        if (query.lastError().type() != QSqlError::NoError)
-            return false;
-    }
-    //Clear missingmessages table
-    {
-        QSqlQuery query(simpleQuery(QLatin1String("DELETE FROM missingmessages"),
-                                    QLatin1String("fullThreadTableUpdate clear missingmessages table query")));
-        if (query.lastError().type() != QSqlError::NoError)
-            return false;
-    }
-    //Clear mailsubjects table
-    {
-        QSqlQuery query(simpleQuery(QLatin1String("DELETE FROM mailsubjects"),
-                                    QLatin1String("fullThreadTableUpdate clear mailsubjects table query")));
-        if (query.lastError().type() != QSqlError::NoError)
-            return false;
+    const QMailMessage mail(message(metaData->id()));
+    QString identifier(identifierValue(mail.headerFieldText(QLatin1String("Message-ID"))));
+    QStringList references(identifierValues(mail.headerFieldText(QLatin1String("References"))));
+    QString predecessor(identifierValue(mail.headerFieldText(QLatin1String("In-Reply-To"))));
+    if (!predecessor.isEmpty()) {
+        if (references.isEmpty() || (references.last() != predecessor)) {
+            references.append(predecessor);
+        }
     }
-    //Clear mailthreadsubjects table
-    {
-        QSqlQuery query(simpleQuery(QLatin1String("DELETE FROM mailthreadsubjects"),
-                                    QLatin1String("fullThreadTableUpdate clear mailthreadsubjects table query")));
+
+    bool replyOrForward(false);
+    QString baseSubject(QMail::baseSubject(metaData->subject(), &replyOrForward));
+    QStringList missingReferences;
+    bool missingAncestor(false);
+    // Does this message have any references to resolve?
+    AttemptResult result = messagePredecessor(metaData, references, baseSubject, replyOrForward, &missingReferences, &missingAncestor);
+    if (result != Success)
+        return result;
+    //Hack. We are using sql query here, because
+    //metaData->setParentThreadId(QMailMessageMetaData(predecessorMsgId).parentThreadId());
+    // is not working properly in messagePredecessor()
+    if (metaData->inResponseTo().toULongLong() != 0) {
+        QSqlQuery query(simpleQuery(QString::fromLatin1("SELECT parentthreadid FROM mailmessages WHERE id = %1").arg(metaData->inResponseTo().toULongLong()),
+                                    QLatin1String("threadMessage select predecessor query")));
         if (query.lastError().type() != QSqlError::NoError)
-            return false;
+            return DatabaseFailure;
+        if (query.next())
+            metaData->setParentThreadId(QMailThreadId(query.value(0).toULongLong()));
+        else
+            qWarning() << Q_FUNC_INFO << "there is no message with id" << metaData->inResponseTo().toULongLong();
     }
-    //Get all messages
-    QMailMessageMetaDataList messagesList;
-    {
-        QSqlQuery query(simpleQuery(QLatin1String("SELECT id,sender,subject,stamp,status,parentaccountid,preview FROM mailmessages ORDER BY stamp"),
-                                    QLatin1String("fullThreadTableUpdate select all messages query")));
-        if (query.lastError().type() != QSqlError::NoError)
-            return false;
-        while (query.next()) {
-            QMailMessageMetaData data;
-            data.setId(QMailMessageId(query.value(0).toULongLong()));
-            data.setFrom(QMailAddress(query.value(1).toString()));
-            data.setSubject(query.value(2).toString());
-            data.setDate(QMailTimeStamp(query.value(3).toDateTime()));
-            data.setStatus(query.value(4).toULongLong());
-            data.setParentAccountId(QMailAccountId(query.value(5).toULongLong()));
-            data.setPreview(query.value(6).toString());
-            messagesList.append(data);
-        }
-    }
-    //Re-create all threads
-    {
-        QMailMessageMetaDataList::iterator it = messagesList.begin();
-        QMailMessageMetaDataList::iterator end = messagesList.end();
-        for ( ; it != end; ++it) {
-            QMailMessageMetaData* metaData = &(*it);
-            QMailMessage message(metaData->id());
-            QString identifier(identifierValue(message.headerFieldText(QLatin1String("Message-ID"))));
-            QStringList references(identifierValues(message.headerFieldText(QLatin1String("References"))));
-            bool replyOrForward(false);
-            QString baseSubject(QMail::baseSubject(metaData->subject(), &replyOrForward));
-            QStringList missingReferences;
-            bool missingAncestor(false);
-            // Does this message have any references to resolve?
-            AttemptResult result = messagePredecessor(metaData, references, baseSubject, replyOrForward, &missingReferences, &missingAncestor);
-            if (result != Success)
-                return false;
-            //Hack. We are using sql query here, because
-            //metaData->setParentThreadId(QMailMessageMetaData(predecessorMsgId).parentThreadId());
-            // is not working properly in messagePredecessor()
-            if (metaData->inResponseTo().toULongLong() != 0) {
-                QSqlQuery query(simpleQuery(QString::fromLatin1("SELECT parentthreadid FROM mailmessages WHERE id = %1").arg(metaData->inResponseTo().toULongLong()),
-                                            QLatin1String("fullThreadTableUpdate select all messages query")));
-                if (query.lastError().type() != QSqlError::NoError)
-                    return false;
-                if (query.next())
-                    metaData->setParentThreadId(QMailThreadId(query.value(0).toULongLong()));
-                else
-                    qWarning() << Q_FUNC_INFO << "there is no message with id" << metaData->inResponseTo().toULongLong();
-            }
 
-            //QMailThreadId.isValid() is not working properly here
-            if (metaData->parentThreadId().toULongLong() != 0) {
-                QMailThread thread(metaData->parentThreadId());
-                QString senders = QMailAddress::toStringList(thread.senders()).join(QLatin1String(","));
-                const QString &newSender = metaData->from().toString();
+    //QMailThreadId.isValid() is not working properly here
+    if (metaData->parentThreadId().toULongLong() != 0) {
+        QMailThread thread(metaData->parentThreadId());
+        QString senders = QMailAddress::toStringList(thread.senders()).join(QLatin1String(","));
+        const QString &newSender = metaData->from().toString();
 
-                if (!senders.contains(newSender)) {
-                    senders.append(QLatin1String(",") + newSender);
-                }
+        if (!senders.contains(newSender)) {
+            senders.append(QLatin1String(",") + newSender);
+        }
 
-                QString sql(QLatin1String("UPDATE mailthreads SET messagecount = messagecount + 1, senders = (?), preview = (?), lastdate = (?)")
-                            + ((metaData->status() & QMailMessage::Read) ? QString() : QString::fromLatin1(", unreadcount = unreadcount + 1 "))
-                            + QString::fromLatin1(", status = (status | %1)").arg(metaData->status()) + QLatin1String(" WHERE id= (?)"));
-                QVariantList bindValues;
-                bindValues << QVariant(senders)
-                           << QVariant(metaData->preview())
-                           << QVariant(metaData->date().toUTC())
-                           << QVariant(metaData->parentThreadId().toULongLong());
-                QSqlQuery query = simpleQuery(sql, bindValues, QLatin1String("fullThreadTableUpdate update thread"));
+        QString sql(QLatin1String("UPDATE mailthreads SET messagecount = messagecount + 1, senders = (?), preview = (?), lastdate = (?)")
+                    + ((metaData->status() & QMailMessage::Read) ? QString() : QString::fromLatin1(", unreadcount = unreadcount + 1 "))
+                    + QString::fromLatin1(", status = (status | %1)").arg(metaData->status()) + QLatin1String(" WHERE id= (?)"));
+        QVariantList bindValues;
+        bindValues << QVariant(senders)
+                   << QVariant(metaData->preview())
+                   << QVariant(metaData->date().toUTC())
+                   << QVariant(metaData->parentThreadId().toULongLong());
+        QSqlQuery query = simpleQuery(sql, bindValues, QLatin1String("threadMessage update thread"));
 
-                if (query.lastError().type() != QSqlError::NoError)
-                    return false;
-            } else {
-                quint64 threadId = 0;
-
-                // Add a new thread for this message
-                QMap<QString, QVariant> values;
-                values.insert(QLatin1String("messagecount"), 1);
-                values.insert(QLatin1String("unreadcount"), ((metaData->status() & QMailMessage::Read) ? 0 : 1));
-                values.insert(QLatin1String("serveruid"), QLatin1String(""));
-                values.insert(QLatin1String("parentaccountid"), metaData->parentAccountId().toULongLong());
-                values.insert(QLatin1String("subject"), metaData->subject());
-                values.insert(QLatin1String("preview"), metaData->preview());
-                values.insert(QLatin1String("senders"), metaData->from().toString());
-                values.insert(QLatin1String("lastdate"), metaData->date().toUTC());
-                values.insert(QLatin1String("starteddate"), metaData->date().toUTC());
-                values.insert(QLatin1String("status"), metaData->status());
-                const QString &columns = QStringList(values.keys()).join(QLatin1String(","));
-                QSqlQuery query(simpleQuery(QString::fromLatin1("INSERT INTO mailthreads (%1) VALUES %2").arg(columns).arg(expandValueList(values.count())),
-                                            values.values(),
-                                            QLatin1String("fullThreadTableUpdate mailthreads insert query")));
+        if (query.lastError().type() != QSqlError::NoError)
+            return DatabaseFailure;
+    } else {
+        quint64 threadId = 0;
 
-                if (query.lastError().type() != QSqlError::NoError)
-                    return false;
+        // Add a new thread for this message
+        QMap<QString, QVariant> values;
+        values.insert(QLatin1String("messagecount"), 1);
+        values.insert(QLatin1String("unreadcount"), ((metaData->status() & QMailMessage::Read) ? 0 : 1));
+        values.insert(QLatin1String("serveruid"), QLatin1String(""));
+        values.insert(QLatin1String("parentaccountid"), metaData->parentAccountId().toULongLong());
+        values.insert(QLatin1String("subject"), metaData->subject());
+        values.insert(QLatin1String("preview"), metaData->preview());
+        values.insert(QLatin1String("senders"), metaData->from().toString());
+        values.insert(QLatin1String("lastdate"), metaData->date().toUTC());
+        values.insert(QLatin1String("starteddate"), metaData->date().toUTC());
+        values.insert(QLatin1String("status"), metaData->status());
+        const QString &columns = QStringList(values.keys()).join(QLatin1String(","));
+        QSqlQuery query(simpleQuery(QString::fromLatin1("INSERT INTO mailthreads (%1) VALUES %2").arg(columns).arg(expandValueList(values.count())),
+                                    values.values(),
+                                    QLatin1String("threadMessage mailthreads insert query")));
 
-                threadId = extractValue<quint64>(query.lastInsertId());
+        if (query.lastError().type() != QSqlError::NoError)
+            return DatabaseFailure;
 
-                Q_ASSERT(threadId != 0);
-                metaData->setParentThreadId(QMailThreadId(threadId));
-            }
-            //Update message's values
-            {
-                QVariantList bindValues;
-                bindValues << QVariant(metaData->parentThreadId().toULongLong())
-                           << QVariant(metaData->inResponseTo().toULongLong())
-                           << QVariant(metaData->id().toULongLong());
-                QSqlQuery query = simpleQuery(QLatin1String("UPDATE mailmessages SET parentthreadid = ? , responseid = ? WHERE id = ?"),
-                                              bindValues,
-                                              QLatin1String("fullThreadTableUpdate mailmessages update query"));
+        threadId = extractValue<quint64>(query.lastInsertId());
 
-                if (query.lastError().type() != QSqlError::NoError)
-                    return false;
-            }
-            if (!baseSubject.isEmpty()) {
-                // Ensure that this subject is in the subjects table
-                AttemptResult result = registerSubject(baseSubject, metaData->id().toULongLong(), metaData->inResponseTo(), missingAncestor);
-                if (result != Success)
-                    return false;
-            }
-            // See if this message resolves any missing message items
-            QMailMessageIdList updatedMessageIds;
-            result = resolveMissingMessages(identifier, metaData->inResponseTo(), baseSubject, *metaData, &updatedMessageIds);
-            if (result != Success)
-                return false;
-            if (!missingReferences.isEmpty()) {
-                // Add the missing references to the missing messages table
-                QVariantList refs;
-                QVariantList levels;
+        Q_ASSERT(threadId != 0);
+        metaData->setParentThreadId(QMailThreadId(threadId));
+    }
+    //Update message's values
+    {
+        QVariantList bindValues;
+        bindValues << QVariant(metaData->parentThreadId().toULongLong())
+                   << QVariant(metaData->inResponseTo().toULongLong())
+                   << QVariant(metaData->id().toULongLong());
+        QSqlQuery query = simpleQuery(QLatin1String("UPDATE mailmessages SET parentthreadid = ? , responseid = ? WHERE id = ?"),
+                                      bindValues,
+                                      QLatin1String("threadMessage mailmessages update query"));
 
-                int level = missingReferences.count();
-                foreach (const QString &ref, missingReferences) {
-                    refs.append(QVariant(ref));
-                    levels.append(QVariant(--level));
-                }
+        if (query.lastError().type() != QSqlError::NoError)
+            return DatabaseFailure;
+    }
+    if (!baseSubject.isEmpty()) {
+        // Ensure that this subject is in the subjects table
+        AttemptResult result = registerSubject(baseSubject, metaData->id().toULongLong(), metaData->inResponseTo(), missingAncestor);
+        if (result != Success)
+            return result;
+    }
+    // See if this message resolves any missing message items
+    QMailMessageIdList updatedMessageIds;
+    result = resolveMissingMessages(identifier, metaData->inResponseTo(), baseSubject, *metaData, &updatedMessageIds);
+    if (result != Success)
+        return result;
+    if (!missingReferences.isEmpty()) {
+        // Add the missing references to the missing messages table
+        QVariantList refs;
+        QVariantList levels;
 
-                QString sql(QLatin1String("INSERT INTO missingmessages (id,identifier,level) VALUES (%1,?,?)"));
-                QSqlQuery query(batchQuery(sql.arg(QString::number(metaData->id().toULongLong())),
-                                           QVariantList() << QVariant(refs) << QVariant(levels),
-                                           QLatin1String("fullThreadTableUpdate missingmessages insert query")));
-                if (query.lastError().type() != QSqlError::NoError)
-                    return false;
-            }
+        int level = missingReferences.count();
+        foreach (const QString &ref, missingReferences) {
+            refs.append(QVariant(ref));
+            levels.append(QVariant(--level));
         }
+
+        QString sql(QLatin1String("INSERT INTO missingmessages (id,identifier,level) VALUES (%1,?,?)"));
+        QSqlQuery query(batchQuery(sql.arg(QString::number(metaData->id().toULongLong())),
+                                   QVariantList() << QVariant(refs) << QVariant(levels),
+                                   QLatin1String("threadMessage missingmessages insert query")));
+        if (query.lastError().type() != QSqlError::NoError)
+            return DatabaseFailure;
     }
-    return true;
+
+    return Success;
 }
 
 bool QMailStorePrivate::createTable(const QString &name)
@@ -4364,140 +4954,937 @@ bool QMailStorePrivate::setupFolders(const QList<FolderInfo> &folderList)
     return true;
 }
 
-bool QMailStorePrivate::purgeMissingAncestors()
+bool QMailStorePrivate::purgeMissingAncestors(const QElapsedTimer &timer, int timeLimit, bool *completed)
+{
+    QString sql(QLatin1String("DELETE FROM missingancestors WHERE rowid IN (SELECT rowid FROM missingancestors WHERE state=1 LIMIT ?)"));
+
+    forever {
+        Transaction t(this);
+
+        QSqlQuery query(*database());
+        query.prepare(sql);
+        query.addBindValue(maintenanceBatchSize);
+        if (!query.exec()) {
+            qWarning() << "Failed to purge missing ancestors - query:" << sql << "- error:" << query.lastError().text();
+            return false;
+        }
+
+        const int purged = query.numRowsAffected();
+        if (!t.commit()) {
+            qWarning() << "Could not commit missing ancestors purge to database";
+            return false;
+        }
+
+        if (purged < maintenanceBatchSize) {
+            *completed = true;
+            return true;
+        }
+        if (maintenanceTimeExpired(timer, timeLimit)) {
+            *completed = false;
+            return true;
+        }
+    }
+}
+
+bool QMailStorePrivate::purgeObsoleteFiles(const QElapsedTimer &timer, int timeLimit, bool *completed)
+{
+    forever {
+        QStringList identifiers;
+        qint64 lastRowId = 0;
+
+        {
+            QString sql(QLatin1String("SELECT rowid,mailfile FROM obsoletefiles ORDER BY rowid LIMIT ?"));
+
+            QSqlQuery query(*database());
+            query.prepare(sql);
+            query.addBindValue(maintenanceBatchSize);
+            if (!query.exec()) {
+                qWarning() << "Failed to purge obsolete files - query:" << sql << "- error:" << query.lastError().text();
+                return false;
+            } else {
+                while (query.next()) {
+                    lastRowId = query.value(0).toLongLong();
+                    identifiers.append(query.value(1).toString());
+                }
+            }
+        }
+
+        if (identifiers.isEmpty()) {
+            *completed = true;
+            return true;
+        }
+
+        {
+            MutexGuard lock(contentManagerMutex());
+            lock.lock();
+
+            QMap<QString, QStringList> uriElements;
+
+            foreach (const QString& contentUri, identifiers) {
+                uriElements[extractUriElements(contentUri).first].append(extractUriElements(contentUri).second);
+            }
+
+            for ( QMap<QString, QStringList>::iterator it(uriElements.begin()) ; it != uriElements.end() ; ++it)
+            {
+                QStringList schemes(QStringList() << QMailContentManagerFactory::defaultFilterScheme()
+                                                  << it.key()
+                                                  << QMailContentManagerFactory::defaultIndexerScheme());
+
+                foreach(QString const& scheme, schemes)
+                {
+                    if (!scheme.isEmpty()) {
+                        QMailContentManager *manager(QMailContentManagerFactory::create(scheme));
+                        if (!manager)
+                            qWarning() << "Unable to create content manager for scheme:" << scheme;
+                        else {
+                            if (manager->remove(*it) != QMailStore::NoError) {
+                                qWarning() << "Unable to remove obsolete message contents:" << *it;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        {
+            // Rows added after our selection have higher row identifiers, and are retained
+            QString sql(QLatin1String("DELETE FROM obsoletefiles WHERE rowid<=?"));
+
+            Transaction t(this);
+
+            QSqlQuery query(*database());
+            query.prepare(sql);
+            query.addBindValue(lastRowId);
+            if (!query.exec()) {
+                qWarning() << "Failed to purge obsolete file - query:" << sql << "- error:" << query.lastError().text();
+                return false;
+            }
+
+            if (!t.commit()) {
+                qWarning() << "Could not commit obsolete files purge to database";
+                return false;
+            }
+        }
+
+        if (identifiers.count() < maintenanceBatchSize) {
+            *completed = true;
+            return true;
+        }
+        if (maintenanceTimeExpired(timer, timeLimit)) {
+            *completed = false;
+            return true;
+        }
+    }
+}
+
+bool QMailStorePrivate::analyzeTables(const QElapsedTimer &timer, int timeLimit, bool *completed)
+{
+    // Analyze one table at a time, so that the work can be resumed if the time limit is reached
+    foreach (const QString &table, database()->tables()) {
+        if (table == QLatin1String("versioninfo") || table.startsWith(QLatin1String("sqlite_")))
+            continue;
+
+        const QString task(QLatin1String("analyze ") + table);
+        bool due = false;
+        if (!maintenanceDue(task, maintenanceAnalyzeFrequency, &due))
+            return false;
+        if (!due)
+            continue;
+
+        if (maintenanceTimeExpired(timer, timeLimit)) {
+            *completed = false;
+            return true;
+        }
+
+        QString sql(QLatin1String("ANALYZE %1"));
+
+        QSqlQuery query(*database());
+        if (!query.exec(sql.arg(table))) {
+            qWarning() << "Failed to analyze table - query:" << sql.arg(table) << "- error:" << query.lastError().text();
+            return false;
+        }
+
+        if (!recordMaintenance(task))
+            return false;
+    }
+
+    *completed = true;
+    return true;
+}
+
+bool QMailStorePrivate::reclaimFreePages(const QElapsedTimer &timer, int timeLimit, bool *completed)
+{
+#if defined(Q_USE_SQLITE)
+    int autoVacuum = 0;
+    int pageCount = 0;
+    int freePages = 0;
+    {
+        QSqlQuery query(*database());
+        if (query.exec(QLatin1String("PRAGMA auto_vacuum")) && query.first())
+            autoVacuum = query.value(0).toInt();
+        if (query.exec(QLatin1String("PRAGMA page_count")) && query.first())
+            pageCount = query.value(0).toInt();
+        if (query.exec(QLatin1String("PRAGMA freelist_count")) && query.first())
+            freePages = query.value(0).toInt();
+        if (query.lastError().type() != QSqlError::NoError) {
+            qWarning() << "Failed to query free pages - query:" << query.lastQuery() << "- error:" << query.lastError().text();
+            return false;
+        }
+    }
+
+    if (autoVacuum == 2) {
+        // Incremental vacuum mode; release the free pages a few at a time
+        while (freePages > 0) {
+            {
+                MutexGuard guard(databaseMutex());
+                guard.lock();
+
+                QString sql(QLatin1String("PRAGMA incremental_vacuum(%1)"));
+
+                QSqlQuery query(*database());
+                if (!query.exec(sql.arg(maintenanceBatchSize))) {
+                    qWarning() << "Failed to reclaim free pages - query:" << sql << "- error:" << query.lastError().text();
+                    return false;
+                }
+                while (query.next()) {}
+
+                if (query.exec(QLatin1String("PRAGMA freelist_count")) && query.first()) {
+                    const int remaining = query.value(0).toInt();
+                    freePages = (remaining < freePages ? remaining : 0);
+                } else {
+                    freePages = 0;
+                }
+            }
+
+            if (freePages > 0 && maintenanceTimeExpired(timer, timeLimit)) {
+                *completed = false;
+                return true;
+            }
+        }
+    } else if (autoVacuum == 1) {
+        // Full vacuum mode can be changed without rebuilding the database
+        QSqlQuery query(*database());
+        if (!query.exec(QLatin1String("PRAGMA auto_vacuum=INCREMENTAL"))) {
+            qWarning() << "Failed to select incremental vacuum mode - query:" << query.lastQuery() << "- error:" << query.lastError().text();
+            return false;
+        }
+    } else if (autoVacuum == 0 && pageCount > 0 && (freePages * 4) > pageCount) {
+        // Converting requires the whole database to be rebuilt, which would block every process
+        // for an unbounded time; that is only done when requested, by enableIncrementalVacuum()
+        qMailLog(Messaging) << "Mail store has" << freePages << "of" << pageCount << "pages free, which can only be reclaimed after enableIncrementalVacuum()";
+    }
+#else
+    Q_UNUSED(timer)
+    Q_UNUSED(timeLimit)
+#endif
+
+    *completed = true;
+    return true;
+}
+
+bool QMailStorePrivate::enableIncrementalVacuum()
+{
+#if defined(Q_USE_SQLITE)
+    int autoVacuum = 0;
+    {
+        QSqlQuery query(*database());
+        if (!query.exec(QLatin1String("PRAGMA auto_vacuum")) || !query.first()) {
+            qWarning() << "Failed to query vacuum mode - query:" << query.lastQuery() << "- error:" << query.lastError().text();
+            setLastError(QMailStore::FrameworkFault);
+            return false;
+        }
+        autoVacuum = query.value(0).toInt();
+    }
+
+    if (autoVacuum == 2)
+        return true;
+
+    qMailLog(Messaging) << "Converting mail store to incremental vacuum mode";
+
+    MutexGuard guard(databaseMutex());
+    guard.lock();
+
+    // Only full vacuum mode can be changed in place; otherwise the database must be rebuilt
+    QSqlQuery query(*database());
+    if (!query.exec(QLatin1String("PRAGMA auto_vacuum=INCREMENTAL")) ||
+        ((autoVacuum == 0) && !query.exec(QLatin1String("VACUUM")))) {
+        qWarning() << "Failed to convert to incremental vacuum mode - query:" << query.lastQuery() << "- error:" << query.lastError().text();
+        setLastError(QMailStore::FrameworkFault);
+        return false;
+    }
+
+    return true;
+#else
+    return true;
+#endif
+}
+
+bool QMailStorePrivate::maintenanceDue(const QString &task, uint secondsFrequency, bool *due)
+{
+    QDateTime lastPerformed(QDateTime::fromTime_t(0));
+
+    QString sql(QLatin1String("SELECT performed FROM maintenancerecord WHERE task=?"));
+
+    QSqlQuery query(*database());
+    query.prepare(sql);
+    query.addBindValue(task);
+    if (!query.exec()) {
+        qWarning() << "Failed to query performed timestamp - query:" << sql << "- error:" << query.lastError().text();
+        return false;
+    } else {
+        if (query.first()) {
+            lastPerformed = query.value(0).value<QDateTime>();
+        }
+    }
+
+    *due = (QDateTime::currentDateTime() >= lastPerformed.addSecs(secondsFrequency));
+    return true;
+}
+
+bool QMailStorePrivate::recordMaintenance(const QString &task)
+{
+    const QDateTime currentTime(QDateTime::currentDateTime());
+
+    Transaction t(this);
+
+    QString sql(QLatin1String("UPDATE maintenancerecord SET performed=? WHERE task=?"));
+
+    QSqlQuery query(*database());
+    query.prepare(sql);
+    query.addBindValue(currentTime);
+    query.addBindValue(task);
+    if (query.exec() && query.numRowsAffected() == 0) {
+        sql = QLatin1String("INSERT INTO maintenancerecord (performed,task) VALUES(?,?)");
+        query.prepare(sql);
+        query.addBindValue(currentTime);
+        query.addBindValue(task);
+        query.exec();
+    }
+    if (query.lastError().type() != QSqlError::NoError) {
+        qWarning() << "Failed to update performed timestamp - query:" << sql << "- error:" << query.lastError().text();
+        return false;
+    }
+
+    if (!t.commit()) {
+        qWarning() << "Could not commit maintenance record to database";
+        return false;
+    }
+
+    return true;
+}
+
+bool QMailStorePrivate::performMaintenanceTask(const QString &task, uint secondsFrequency, MaintenanceFunction func,
+                                               const QElapsedTimer &timer, int timeLimit, bool *completed)
+{
+    bool due = false;
+    if (!maintenanceDue(task, secondsFrequency, &due))
+        return false;
+
+    if (due) {
+        if (maintenanceTimeExpired(timer, timeLimit)) {
+            *completed = false;
+            return true;
+        }
+
+        if (!(this->*func)(timer, timeLimit, completed))
+            return false;
+
+        // Only record the task as performed once all of its work is complete
+        if (*completed && !recordMaintenance(task))
+            return false;
+    }
+
+    return true;
+}
+
+bool QMailStorePrivate::performMaintenance(int timeLimit)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    bool completed = true;
+
+    // Messages stored before threads were introduced must be threaded before anything else
+    if (!rebuildThreadsIfRequired(timer, timeLimit, &completed)) {
+        setLastError(QMailStore::FrameworkFault);
+        return false;
+    }
+
+    // Perform this task no more than once every 24 hours
+    if (completed && !performMaintenanceTask(QLatin1String("purge missing ancestors"), 24*60*60, &QMailStorePrivate::purgeMissingAncestors, timer, timeLimit, &completed)) {
+        setLastError(QMailStore::FrameworkFault);
+        return false;
+    }
+
+    // Perform this task no more than once every hour
+    if (completed && !performMaintenanceTask(QLatin1String("purge obsolete files"), 60*60, &QMailStorePrivate::purgeObsoleteFiles, timer, timeLimit, &completed)) {
+        setLastError(QMailStore::FrameworkFault);
+        return false;
+    }
+
+    if (completed && !performMaintenanceTask(QLatin1String("analyze tables"), maintenanceAnalyzeFrequency, &QMailStorePrivate::analyzeTables, timer, timeLimit, &completed)) {
+        setLastError(QMailStore::FrameworkFault);
+        return false;
+    }
+
+    // Perform this task no more than once every 24 hours
+    if (completed && !performMaintenanceTask(QLatin1String("reclaim free pages"), 24*60*60, &QMailStorePrivate::reclaimFreePages, timer, timeLimit, &completed)) {
+        setLastError(QMailStore::FrameworkFault);
+        return false;
+    }
+
+    return completed;
+}
+
+bool QMailStorePrivate::rebuildThreads(int timeLimit)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    bool completed = false;
+    if (!continueThreadRebuild(timer, timeLimit, &completed)) {
+        setLastError(QMailStore::FrameworkFault);
+        return false;
+    }
+
+    return completed;
+}
+
+bool QMailStorePrivate::rebuildThreadsIfRequired(const QElapsedTimer &timer, int timeLimit, bool *completed)
+{
+    if (!threadRebuild) {
+        // A rebuild is only required for messages stored before threads were
+        QSqlQuery query(simpleQuery(QLatin1String("SELECT EXISTS (SELECT 1 FROM mailmessages) AND NOT EXISTS (SELECT 1 FROM mailthreads)"),
+                                    QLatin1String("rebuildThreadsIfRequired select query")));
+        if (query.lastError().type() != QSqlError::NoError)
+            return false;
+
+        if (!query.next() || !query.value(0).toBool())
+            return true;
+    }
+
+    if (maintenanceTimeExpired(timer, timeLimit)) {
+        *completed = false;
+        return true;
+    }
+
+    return continueThreadRebuild(timer, timeLimit, completed);
+}
+
+bool QMailStorePrivate::continueThreadRebuild(const QElapsedTimer &timer, int timeLimit, bool *completed)
+{
+    if (!threadRebuild)
+        threadRebuild = new ThreadRebuild;
+
+    *completed = false;
+    if (!threadRebuild->computed) {
+        if (!loadThreadRebuild(timer, timeLimit, completed)) {
+            abandonThreadRebuild();
+            return false;
+        }
+        if (!*completed)
+            return true;
+
+        // Each account is threaded independently of the others
+        QThreadPool pool;
+        for (int i = 0; i < threadRebuild->accounts.count(); ++i)
+            pool.start(new ThreadAccountTask(&threadRebuild->accounts[i], QMailMessage::Read));
+        pool.waitForDone();
+
+        quint64 threadId = 0;
+
+        // The number of messages in each existing thread, to find those that are unchanged
+        QHash<quint64, int> previousCounts;
+        foreach (const RebuildAccount &account, threadRebuild->accounts) {
+            foreach (const RebuildMessage &message, account.messages)
+                ++previousCounts[message.previousThreadId];
+        }
+
+        RebuildStaging threads(rebuildStaging(QLatin1String("INSERT INTO temp.qmf_rebuild_threads (id,existingid,messagecount,unreadcount,parentaccountid,subject,preview,senders,lastdate,starteddate,status) VALUES (?,?,?,?,?,?,?,?,?,?,?)"), 11));
+        RebuildStaging subjects(rebuildStaging(QLatin1String("INSERT INTO temp.qmf_rebuild_subjects (threadid,basesubject) VALUES (?,?)"), 2));
+        RebuildStaging missingMessages(rebuildStaging(QLatin1String("INSERT INTO temp.qmf_rebuild_missingmessages (id,identifier,level) VALUES (?,?,?)"), 3));
+        RebuildStaging missingAncestors(rebuildStaging(QLatin1String("INSERT INTO temp.qmf_rebuild_missingancestors (messageid,basesubject,state) VALUES (?,?,?)"), 3));
+        RebuildStaging messages(rebuildStaging(QLatin1String("INSERT INTO temp.qmf_rebuild_messages (id) VALUES (?)"), 1));
+
+        foreach (const RebuildAccount &account, threadRebuild->accounts) {
+            QVector<quint64> threadIds(account.threads.count(), 0);
+            for (int i = 0; i < account.threads.count(); ++i) {
+                const RebuildThread &thread(account.threads.at(i));
+                if (thread.obsolete)
+                    continue;
+
+                threadIds[i] = ++threadId;
+
+                // A thread holding exactly the messages of an existing thread replaces it in place
+                quint64 existingId(thread.members.isEmpty() ? 0 : account.messages.at(thread.members.first()).previousThreadId);
+                foreach (int index, thread.members) {
+                    if (account.messages.at(index).previousThreadId != existingId) {
+                        existingId = 0;
+                        break;
+                    }
+                }
+                if (existingId && (previousCounts.value(existingId) == thread.members.count()))
+                    threadRebuild->reusedThreadIds.insert(threadId, existingId);
+                else
+                    existingId = 0;
+
+                threads.columns[0].append(threadId);
+                threads.columns[1].append(existingId);
+                threads.columns[2].append(thread.messageCount);
+                threads.columns[3].append(thread.unreadCount);
+                threads.columns[4].append(account.id);
+                threads.columns[5].append(thread.subject);
+                threads.columns[6].append(thread.preview);
+                threads.columns[7].append(thread.senders);
+                threads.columns[8].append(thread.lastDate.toUTC());
+                threads.columns[9].append(thread.startedDate.toUTC());
+                threads.columns[10].append(thread.status);
+
+                foreach (const QString &baseSubject, thread.baseSubjects) {
+                    subjects.columns[0].append(threadId);
+                    subjects.columns[1].append(baseSubject);
+                }
+            }
+
+            // Subjects are registered even when no remaining thread refers to them
+            foreach (const QString &baseSubject, account.baseSubjects) {
+                subjects.columns[0].append(quint64(0));
+                subjects.columns[1].append(baseSubject);
+            }
+
+            QMap<quint64, QMap<int, QString> >::const_iterator rit = account.missingReferences.constBegin(), rend = account.missingReferences.constEnd();
+            for ( ; rit != rend; ++rit) {
+                QMap<int, QString>::const_iterator it = rit.value().constBegin(), end = rit.value().constEnd();
+                for ( ; it != end; ++it) {
+                    missingMessages.columns[0].append(rit.key());
+                    missingMessages.columns[1].append(it.value());
+                    missingMessages.columns[2].append(it.key());
+                }
+            }
+
+            foreach (const RebuildAncestor &ancestor, account.missingAncestors) {
+                missingAncestors.columns[0].append(ancestor.id);
+                missingAncestors.columns[1].append(ancestor.baseSubject);
+                missingAncestors.columns[2].append(ancestor.state);
+            }
+
+            foreach (const RebuildMessage &message, account.messages) {
+                messages.columns[0].append(message.id);
+
+                RebuildSwap swap;
+                swap.id = message.id;
+                swap.threadId = threadIds.at(message.thread);
+                swap.responseId = message.responseId;
+                swap.previousThreadId = message.previousThreadId;
+                swap.previousResponseId = message.previousResponseId;
+                threadRebuild->swaps.append(swap);
+            }
+        }
+
+        // The messages are staged last, so that their progress reflects completion
+        threadRebuild->staging << threads << subjects << missingMessages << missingAncestors << messages;
+        threadRebuild->accounts.clear();
+        threadRebuild->computed = true;
+    }
+
+    if (!threadRebuild->swapping) {
+        if (!stageThreadRebuild(timer, timeLimit, completed)) {
+            abandonThreadRebuild();
+            return false;
+        }
+        if (!*completed)
+            return true;
+    }
+
+    if (!swapThreadRebuild(timer, timeLimit, completed)) {
+        abandonThreadRebuild();
+        return false;
+    }
+    if (!*completed)
+        return true;
+
+    abandonThreadRebuild();
+    return true;
+}
+
+bool QMailStorePrivate::loadThreadRebuild(const QElapsedTimer &timer, int timeLimit, bool *completed)
+{
+    if (!threadRebuild->snapshot) {
+        // The meta data is read in a single query, for a consistent view of the messages
+        QSqlQuery query(simpleQuery(QLatin1String("SELECT id,sender,subject,stamp,status,parentaccountid,preview,parentthreadid,responseid FROM mailmessages ORDER BY parentaccountid,stamp,id"),
+                                    QLatin1String("rebuildThreads select all messages query")));
+        if (query.lastError().type() != QSqlError::NoError)
+            return false;
+
+        while (query.next()) {
+            const quint64 accountId(extractValue<quint64>(query.value(5)));
+            if (threadRebuild->accounts.isEmpty() || (threadRebuild->accounts.last().id != accountId)) {
+                RebuildAccount account;
+                account.id = accountId;
+                threadRebuild->accounts.append(account);
+            }
+
+            RebuildMessage message;
+            message.id = extractValue<quint64>(query.value(0));
+            message.sender = QMailAddress(query.value(1).toString()).toString();
+            message.subject = query.value(2).toString();
+            message.stamp = QMailTimeStamp(query.value(3).toDateTime()).toLocalTime();
+            message.status = extractValue<quint64>(query.value(4));
+            message.preview = query.value(6).toString();
+            message.thread = -1;
+            message.responseId = 0;
+            message.previousThreadId = extractValue<quint64>(query.value(7));
+            message.previousResponseId = extractValue<quint64>(query.value(8));
+            threadRebuild->accounts.last().messages.append(message);
+
+            ++threadRebuild->total;
+        }
+
+        threadRebuild->snapshot = true;
+        reportThreadRebuildProgress();
+    }
+
+    // The references of each message are found in its header
+    while (threadRebuild->account < threadRebuild->accounts.count()) {
+        QList<RebuildMessage> &messages(threadRebuild->accounts[threadRebuild->account].messages);
+        while (threadRebuild->message < messages.count()) {
+            RebuildMessage &message(messages[threadRebuild->message]);
+
+            const QMailMessage mail(this->message(QMailMessageId(message.id)));
+            message.identifier = identifierValue(mail.headerFieldText(QLatin1String("Message-ID")));
+            message.references = identifierValues(mail.headerFieldText(QLatin1String("References")));
+            const QString predecessor(identifierValue(mail.headerFieldText(QLatin1String("In-Reply-To"))));
+            if (!predecessor.isEmpty()) {
+                if (message.references.isEmpty() || (message.references.last() != predecessor)) {
+                    message.references.append(predecessor);
+                }
+            }
+
+            ++threadRebuild->message;
+            ++threadRebuild->loaded;
+
+            if ((threadRebuild->loaded % maintenanceBatchSize) == 0) {
+                reportThreadRebuildProgress();
+                if (maintenanceTimeExpired(timer, timeLimit)) {
+                    *completed = false;
+                    return true;
+                }
+            }
+        }
+
+        ++threadRebuild->account;
+        threadRebuild->message = 0;
+    }
+
+    *completed = true;
+    return true;
+}
+
+bool QMailStorePrivate::stageThreadRebuild(const QElapsedTimer &timer, int timeLimit, bool *completed)
+{
+    if (threadRebuild->stage == 0 && threadRebuild->staged == 0) {
+        // Temporary tables are private to this connection, so staging does not block other clients
+        QStringList statements;
+        statements << QLatin1String("CREATE TEMP TABLE IF NOT EXISTS qmf_rebuild_threads (id INTEGER PRIMARY KEY, existingid INTEGER, messagecount INTEGER, unreadcount INTEGER, parentaccountid INTEGER, subject VARCHAR, preview VARCHAR, senders VARCHAR, lastdate TIMESTAMP, starteddate TIMESTAMP, status INTEGER)")
+                   << QLatin1String("CREATE TEMP TABLE IF NOT EXISTS qmf_rebuild_subjects (threadid INTEGER, basesubject VARCHAR)")
+                   << QLatin1String("CREATE TEMP TABLE IF NOT EXISTS qmf_rebuild_missingmessages (id INTEGER, identifier VARCHAR, level INTEGER)")
+                   << QLatin1String("CREATE TEMP TABLE IF NOT EXISTS qmf_rebuild_missingancestors (messageid INTEGER PRIMARY KEY, basesubject VARCHAR, state INTEGER)")
+                   << QLatin1String("CREATE TEMP TABLE IF NOT EXISTS qmf_rebuild_messages (id INTEGER PRIMARY KEY)")
+                   << QLatin1String("DELETE FROM temp.qmf_rebuild_threads")
+                   << QLatin1String("DELETE FROM temp.qmf_rebuild_subjects")
+                   << QLatin1String("DELETE FROM temp.qmf_rebuild_missingmessages")
+                   << QLatin1String("DELETE FROM temp.qmf_rebuild_missingancestors")
+                   << QLatin1String("DELETE FROM temp.qmf_rebuild_messages");
+
+        foreach (const QString &statement, statements) {
+            QSqlQuery query(simpleQuery(statement, QLatin1String("rebuildThreads create staging query")));
+            if (query.lastError().type() != QSqlError::NoError)
+                return false;
+        }
+    }
+
+    while (threadRebuild->stage < threadRebuild->staging.count()) {
+        RebuildStaging &staging(threadRebuild->staging[threadRebuild->stage]);
+
+        const int rows(staging.columns.first().count());
+        if (staging.written >= rows) {
+            ++threadRebuild->stage;
+            continue;
+        }
+
+        QVariantList batch;
+        foreach (const QVariantList &column, staging.columns)
+            batch.append(QVariant(column.mid(staging.written, threadRebuildBatchSize)));
+
+        if (!transaction())
+            return false;
+
+        QSqlQuery query(batchQuery(staging.statement, batch, QLatin1String("rebuildThreads staging insert query")));
+        if (query.lastError().type() != QSqlError::NoError) {
+            rollback();
+            return false;
+        }
+
+        if (!commit())
+            return false;
+
+        const int written(qMin(threadRebuildBatchSize, rows - staging.written));
+        staging.written += written;
+        if (threadRebuild->stage == (threadRebuild->staging.count() - 1)) {
+            threadRebuild->staged += written;
+            reportThreadRebuildProgress();
+        }
+
+        if (maintenanceTimeExpired(timer, timeLimit)) {
+            *completed = false;
+            return true;
+        }
+    }
+
+    *completed = true;
+    return true;
+}
+
+bool QMailStorePrivate::swapThreadRebuild(const QElapsedTimer &timer, int timeLimit, bool *completed)
 {
-    QString sql(QLatin1String("DELETE FROM missingancestors WHERE state=1"));
+    if (!threadRebuild->swapping) {
+        Transaction t(this);
 
-    QSqlQuery query(*database());
-    query.prepare(sql);
-    if (!query.exec()) {
-        qWarning() << "Failed to purge missing ancestors - query:" << sql << "- error:" << query.lastError().text();
-        return false;
-    }
-    return true;
-}
+        {
+            QSqlQuery query(simpleQuery(QLatin1String("SELECT MAX(id) FROM mailthreads"),
+                                        QLatin1String("rebuildThreads mailthreads max query")));
+            if (query.lastError().type() != QSqlError::NoError)
+                return false;
 
-bool QMailStorePrivate::purgeObsoleteFiles()
-{
-    QStringList identifiers;
+            if (query.next())
+                threadRebuild->base = extractValue<quint64>(query.value(0));
+        }
 
-    {
-        QString sql(QLatin1String("SELECT mailfile FROM obsoletefiles"));
+        // New threads are numbered above the existing ones, so that no thread identifier changes meaning;
+        // both remain until every message has been moved, so that readers always find a message's thread
+        const QString offset(QString::number(threadRebuild->base));
 
-        QSqlQuery query(*database());
-        if (!query.exec(sql)) {
-            qWarning() << "Failed to purge obsolete files - query:" << sql << "- error:" << query.lastError().text();
+        QStringList statements;
+        statements << QString::fromLatin1("INSERT INTO mailthreads (id,messagecount,unreadcount,serveruid,parentaccountid,subject,preview,senders,lastdate,starteddate,status) "
+                                          "SELECT id+%1,messagecount,unreadcount,'',parentaccountid,subject,preview,senders,lastdate,starteddate,status FROM temp.qmf_rebuild_threads WHERE existingid=0").arg(offset)
+                   << QLatin1String("INSERT OR REPLACE INTO mailthreads (id,messagecount,unreadcount,serveruid,parentaccountid,subject,preview,senders,lastdate,starteddate,status) "
+                                    "SELECT r.existingid,r.messagecount,r.unreadcount,t.serveruid,r.parentaccountid,r.subject,r.preview,r.senders,r.lastdate,r.starteddate,r.status "
+                                    "FROM temp.qmf_rebuild_threads r JOIN mailthreads t ON t.id=r.existingid WHERE r.existingid!=0");
+
+        foreach (const QString &statement, statements) {
+            QSqlQuery query(simpleQuery(statement, QLatin1String("rebuildThreads swap threads query")));
+            if (query.lastError().type() != QSqlError::NoError)
+                return false;
+        }
+
+        if (!t.commit()) {
+            qWarning() << "Could not commit rebuilt threads to database";
             return false;
-        } else {
-            while (query.next()) {
-                identifiers.append(query.value(0).toString());
-            }
         }
+
+        threadRebuild->swapping = true;
     }
 
-    if (!identifiers.isEmpty()) {
-        QMap<QString, QStringList> uriElements;
+    // Messages are moved to their rebuilt threads in batches, skipping those whose thread is unchanged
+    while (threadRebuild->swapped < threadRebuild->swaps.count()) {
+        const int count(qMin(threadRebuildBatchSize, threadRebuild->swaps.count() - threadRebuild->swapped));
 
-        foreach (const QString& contentUri, identifiers) {
-            uriElements[extractUriElements(contentUri).first].append(extractUriElements(contentUri).second);
+        QVariantList threadIds;
+        QVariantList responseIds;
+        QVariantList messageIds;
+        for (int i = threadRebuild->swapped; i < threadRebuild->swapped + count; ++i) {
+            const RebuildSwap &swap(threadRebuild->swaps.at(i));
+            const quint64 threadId(threadRebuild->reusedThreadIds.value(swap.threadId, swap.threadId + threadRebuild->base));
+            if ((threadId != swap.previousThreadId) || (swap.responseId != swap.previousResponseId)) {
+                threadIds.append(threadId);
+                responseIds.append(swap.responseId);
+                messageIds.append(swap.id);
+            }
         }
 
-        for ( QMap<QString, QStringList>::iterator it(uriElements.begin()) ; it != uriElements.end() ; ++it)
-        {
-            QStringList schemes(QStringList() << QMailContentManagerFactory::defaultFilterScheme()
-                                              << it.key()
-                                              << QMailContentManagerFactory::defaultIndexerScheme());
+        if (!messageIds.isEmpty()) {
+            if (!transaction())
+                return false;
 
-            foreach(QString const& scheme, schemes)
-            {
-                if (!scheme.isEmpty()) {
-                    QMailContentManager *manager(QMailContentManagerFactory::create(scheme));
-                    if (!manager)
-                        qWarning() << "Unable to create content manager for scheme:" << scheme;
-                    else {
-                        if (manager->remove(*it) != QMailStore::NoError) {
-                            qWarning() << "Unable to remove obsolete message contents:" << *it;
-                        }
-                    }
-                }
+            QSqlQuery query(batchQuery(QLatin1String("UPDATE mailmessages SET parentthreadid=?,responseid=? WHERE id=?"),
+                                       QVariantList() << QVariant(threadIds) << QVariant(responseIds) << QVariant(messageIds),
+                                       QLatin1String("rebuildThreads mailmessages update query")));
+            if (query.lastError().type() != QSqlError::NoError) {
+                rollback();
+                return false;
             }
-        }
-
 
+            if (!commit())
+                return false;
 
+            foreach (const QVariant &id, messageIds)
+                threadRebuild->updatedMessageIds.append(QMailMessageId(id.toULongLong()));
+        }
 
-         QString sql(QLatin1String("DELETE FROM obsoletefiles"));
+        threadRebuild->swapped += count;
+        reportThreadRebuildProgress();
 
-        QSqlQuery query(*database());
-        if (!query.exec(sql)) {
-            qWarning() << "Failed to purge obsolete file - query:" << sql << "- error:" << query.lastError().text();
-            return false;
+        if (maintenanceTimeExpired(timer, timeLimit)) {
+            *completed = false;
+            return true;
         }
     }
 
+    QMailThreadIdList removedThreadIds;
+    QMailThreadIdList addedThreadIds;
+    QMailMessageIdList updatedMessageIds(threadRebuild->updatedMessageIds);
 
-    return true;
-}
+    {
+        Transaction t(this);
 
-bool QMailStorePrivate::performMaintenanceTask(const QString &task, uint secondsFrequency, bool (QMailStorePrivate::*func)(void))
-{
-    QDateTime lastPerformed(QDateTime::fromTime_t(0));
+        // The threads that were neither rebuilt nor replaced in place are obsolete
+        const QString offset(QString::number(threadRebuild->base));
+        const QString obsolete(QString::fromLatin1("id NOT IN (SELECT CASE WHEN existingid!=0 THEN existingid ELSE id+%1 END FROM temp.qmf_rebuild_threads)").arg(offset));
+        {
+            QSqlQuery query(simpleQuery(QLatin1String("SELECT id FROM mailthreads WHERE ") + obsolete,
+                                        QLatin1String("rebuildThreads mailthreads select query")));
+            if (query.lastError().type() != QSqlError::NoError)
+                return false;
 
-    {
-        QString sql(QLatin1String("SELECT performed FROM maintenancerecord WHERE task=?"));
+            while (query.next()) {
+                const quint64 id(extractValue<quint64>(query.value(0)));
+                if (id <= threadRebuild->base)
+                    removedThreadIds.append(QMailThreadId(id));
+            }
+        }
 
-        QSqlQuery query(*database());
-        query.prepare(sql);
-        query.addBindValue(task);
-        if (!query.exec()) {
-            qWarning() << "Failed to query performed timestamp - query:" << sql << "- error:" << query.lastError().text();
-            return false;
-        } else {
-            if (query.first()) {
-                lastPerformed = query.value(0).value<QDateTime>();
+        QStringList statements;
+        statements << QLatin1String("DELETE FROM mailthreadsubjects")
+                   << QLatin1String("DELETE FROM missingancestors")
+                   << QLatin1String("DELETE FROM missingmessages")
+                   << QLatin1String("DELETE FROM mailsubjects")
+                   << QLatin1String("DELETE FROM mailthreads WHERE ") + obsolete
+                   << QLatin1String("INSERT INTO mailsubjects (basesubject) SELECT DISTINCT basesubject FROM temp.qmf_rebuild_subjects")
+                   << QString::fromLatin1("INSERT INTO mailthreadsubjects (threadid,subjectid) "
+                                          "SELECT DISTINCT CASE WHEN t.existingid!=0 THEN t.existingid ELSE t.id+%1 END,s.id FROM temp.qmf_rebuild_subjects r "
+                                          "JOIN temp.qmf_rebuild_threads t ON t.id=r.threadid JOIN mailsubjects s ON s.basesubject=r.basesubject").arg(offset)
+                   << QLatin1String("INSERT OR IGNORE INTO missingmessages (id,identifier,level) "
+                                    "SELECT id,identifier,level FROM temp.qmf_rebuild_missingmessages WHERE id IN (SELECT id FROM mailmessages)")
+                   << QLatin1String("INSERT INTO missingancestors (messageid,subjectid,state) "
+                                    "SELECT r.messageid,s.id,r.state FROM temp.qmf_rebuild_missingancestors r JOIN mailsubjects s ON s.basesubject=r.basesubject "
+                                    "WHERE r.messageid IN (SELECT id FROM mailmessages)");
+
+        foreach (const QString &statement, statements) {
+            QSqlQuery query(simpleQuery(statement, QLatin1String("rebuildThreads swap query")));
+            if (query.lastError().type() != QSqlError::NoError)
+                return false;
+        }
+
+        // Messages added since the snapshot are threaded as they would have been when added
+        QMailMessageMetaDataList added;
+        {
+            QSqlQuery query(simpleQuery(QLatin1String("SELECT id,sender,subject,stamp,status,parentaccountid,preview FROM mailmessages "
+                                                      "WHERE id NOT IN (SELECT id FROM temp.qmf_rebuild_messages) ORDER BY stamp"),
+                                        QLatin1String("rebuildThreads select added messages query")));
+            if (query.lastError().type() != QSqlError::NoError)
+                return false;
+
+            while (query.next()) {
+                QMailMessageMetaData data;
+                data.setId(QMailMessageId(query.value(0).toULongLong()));
+                data.setFrom(QMailAddress(query.value(1).toString()));
+                data.setSubject(query.value(2).toString());
+                data.setDate(QMailTimeStamp(query.value(3).toDateTime()));
+                data.setStatus(query.value(4).toULongLong());
+                data.setParentAccountId(QMailAccountId(query.value(5).toULongLong()));
+                data.setPreview(query.value(6).toString());
+                added.append(data);
             }
         }
-    }
 
-    QDateTime nextTime(lastPerformed.addSecs(secondsFrequency));
-    QDateTime currentTime(QDateTime::currentDateTime());
-    if (currentTime >= nextTime) {
-        if (!(this->*func)()) {
-            return false;
+        for (QMailMessageMetaDataList::iterator it = added.begin(); it != added.end(); ++it) {
+            if (threadMessage(&(*it)) != Success)
+                return false;
+
+            updatedMessageIds.append(it->id());
         }
 
-        // Update the timestamp
-        QString sql;
-        if (lastPerformed.toTime_t() == 0) {
-            sql = QLatin1String("INSERT INTO maintenancerecord (performed,task) VALUES(?,?)");
-        } else {
-            sql = QLatin1String("UPDATE maintenancerecord SET performed=? WHERE task=?");
+        {
+            // Messages may have been removed or marked as read since the snapshot
+            QSqlQuery query(simpleQuery(QLatin1String("UPDATE mailthreads SET "
+                                                      "messagecount=(SELECT COUNT(*) FROM mailmessages WHERE parentthreadid=mailthreads.id),"
+                                                      "unreadcount=(SELECT COUNT(*) FROM mailmessages WHERE parentthreadid=mailthreads.id AND (status & ?)=0)"),
+                                        QVariantList() << QMailMessage::Read,
+                                        QLatin1String("rebuildThreads mailthreads count query")));
+            if (query.lastError().type() != QSqlError::NoError)
+                return false;
+        }
+        {
+            QSqlQuery query(simpleQuery(QLatin1String("SELECT id FROM mailthreads WHERE messagecount=0 AND id<=?"),
+                                        QVariantList() << threadRebuild->base,
+                                        QLatin1String("rebuildThreads mailthreads select query")));
+            if (query.lastError().type() != QSqlError::NoError)
+                return false;
+
+            while (query.next())
+                removedThreadIds.append(QMailThreadId(extractValue<quint64>(query.value(0))));
+        }
+        {
+            QSqlQuery query(simpleQuery(QLatin1String("DELETE FROM mailthreads WHERE messagecount=0"),
+                                        QLatin1String("rebuildThreads mailthreads delete query")));
+            if (query.lastError().type() != QSqlError::NoError)
+                return false;
         }
 
-        QSqlQuery query(*database());
-        query.prepare(sql);
-        query.addBindValue(currentTime);
-        query.addBindValue(task);
-        if (!query.exec()) {
-            qWarning() << "Failed to update performed timestamp - query:" << sql << "- error:" << query.lastError().text();
+        {
+            QSqlQuery query(simpleQuery(QLatin1String("SELECT id FROM mailthreads WHERE id>?"),
+                                        QVariantList() << threadRebuild->base,
+                                        QLatin1String("rebuildThreads mailthreads select query")));
+            if (query.lastError().type() != QSqlError::NoError)
+                return false;
+
+            while (query.next())
+                addedThreadIds.append(QMailThreadId(extractValue<quint64>(query.value(0))));
+        }
+
+        if (!t.commit()) {
+            qWarning() << "Could not commit thread rebuild to database";
             return false;
         }
     }
 
+    // Cached messages refer to the replaced threads
+    messageCache.clear();
+    threadCache.clear();
+
+    if (!removedThreadIds.isEmpty())
+        notifyThreadsChange(QMailStore::Removed, removedThreadIds);
+    if (!addedThreadIds.isEmpty())
+        notifyThreadsChange(QMailStore::Added, addedThreadIds);
+    if (!updatedMessageIds.isEmpty())
+        notifyMessagesChange(QMailStore::Updated, updatedMessageIds);
+
+    *completed = true;
     return true;
 }
 
-bool QMailStorePrivate::performMaintenance()
+void QMailStorePrivate::abandonThreadRebuild()
 {
-    // Perform this task no more than once every 24 hours
-    if (!performMaintenanceTask(QLatin1String("purge missing ancestors"), 24*60*60, &QMailStorePrivate::purgeMissingAncestors))
-        return false;
+    if (threadRebuild && threadRebuild->computed) {
+        QStringList tables;
+        tables << QLatin1String("qmf_rebuild_threads") << QLatin1String("qmf_rebuild_subjects") << QLatin1String("qmf_rebuild_missingmessages")
+               << QLatin1String("qmf_rebuild_missingancestors") << QLatin1String("qmf_rebuild_messages");
 
-    // Perform this task no more than once every hour
-    if (!performMaintenanceTask(QLatin1String("purge obsolete files"), 60*60, &QMailStorePrivate::purgeObsoleteFiles))
-        return false;
+        foreach (const QString &table, tables) {
+            QSqlQuery query(*database());
+            if (!query.exec(QString::fromLatin1("DROP TABLE IF EXISTS temp.%1").arg(table)))
+                qWarning() << "Failed to drop thread rebuild table - query:" << query.lastQuery() << "- error:" << query.lastError().text();
+        }
+    }
 
-    return true;
+    delete threadRebuild;
+    threadRebuild = Q_NULLPTR;
+}
+
+void QMailStorePrivate::reportThreadRebuildProgress()
+{
+    // Reading the messages, staging their threads and moving them to those threads are each a third of the work
+    emit q_ptr->threadRebuildProgress(threadRebuild->loaded + threadRebuild->staged + threadRebuild->swapped, threadRebuild->total * 3);
 }
 
 QString QMailStorePrivate::parseSql(QTextStream& ts)
@@ -4641,18 +6028,24 @@ bool QMailStorePrivate::addMessages(const QList<QMailMessage *> &messages,
     }
 
     // Ensure that the content manager makes the changes durable before we return
-    foreach (const QString &scheme, contentSchemes) {
-        if (QMailContentManager *contentManager = QMailContentManagerFactory::create(scheme)) {
-            QMailStore::ErrorCode code = contentManager->ensureDurability();
-            if (code != QMailStore::NoError) {
-                setLastError(code);
-                qWarning() << "Unable to ensure message content durability for scheme:" << scheme;
+    {
+        // The content managers are shared with the worker and purge threads
+        MutexGuard lock(contentManagerMutex());
+        lock.lock();
+
+        foreach (const QString &scheme, contentSchemes) {
+            if (QMailContentManager *contentManager = QMailContentManagerFactory::create(scheme)) {
+                QMailStore::ErrorCode code = contentManager->ensureDurability();
+                if (code != QMailStore::NoError) {
+                    setLastError(code);
+                    qWarning() << "Unable to ensure message content durability for scheme:" << scheme;
+                    return false;
+                }
+            } else {
+                setLastError(QMailStore::FrameworkFault);
+                qWarning() << "Unable to create content manager for scheme:" << scheme;
                 return false;
             }
-        } else {
-            setLastError(QMailStore::FrameworkFault);
-            qWarning() << "Unable to create content manager for scheme:" << scheme;
-            return false;
         }
     }
 
@@ -4661,6 +6054,9 @@ bool QMailStorePrivate::addMessages(const QList<QMailMessage *> &messages,
         return false;
     }
 
+    foreach (QMailMessage *message, messages)
+        sharedCache.insert(*message);
+
     return true;
 }
 
@@ -4692,6 +6088,9 @@ bool QMailStorePrivate::addMessages(const QList<QMailMessageMetaData *> &message
         return false;
     }
 
+    foreach (QMailMessageMetaData *metaData, messages)
+        sharedCache.insert(*metaData);
+
     return true;
 }
 
@@ -4816,18 +6215,23 @@ bool QMailStorePrivate::updateMessages(const QList<QPair<QMailMessageMetaData*,
         }
     }
 
-    for (QMap<QString, QStringList>::const_iterator it(contentSyncLater.begin()); it != contentSyncLater.end() ; ++it) {
-        if (QMailContentManager *contentManager = QMailContentManagerFactory::create(it.key())) {
-            QMailStore::ErrorCode code = contentManager->ensureDurability(it.value());
-            if (code != QMailStore::NoError) {
-                setLastError(code);
-                qWarning() << "Unable to ensure message content durability for scheme:" << it.key();
+    {
+        MutexGuard lock(contentManagerMutex());
+        lock.lock();
+
+        for (QMap<QString, QStringList>::const_iterator it(contentSyncLater.begin()); it != contentSyncLater.end() ; ++it) {
+            if (QMailContentManager *contentManager = QMailContentManagerFactory::create(it.key())) {
+                QMailStore::ErrorCode code = contentManager->ensureDurability(it.value());
+                if (code != QMailStore::NoError) {
+                    setLastError(code);
+                    qWarning() << "Unable to ensure message content durability for scheme:" << it.key();
+                    return false;
+                }
+            } else {
+                setLastError(QMailStore::FrameworkFault);
+                qWarning() << "Unable to create content manager for scheme:" << it.key();
                 return false;
             }
-        } else {
-            setLastError(QMailStore::FrameworkFault);
-            qWarning() << "Unable to create content manager for scheme:" << it.key();
-            return false;
         }
     }
 
@@ -4876,12 +6280,37 @@ bool QMailStorePrivate::updateMessagesMetaData(const QMailMessageKey &key, quint
 
 bool QMailStorePrivate::ensureDurability()
 {
+    // Commit any deferred content writes as one group before the checkpoint, so that
+    // the database is never durable while content it refers to is not
+    {
+        MutexGuard lock(contentManagerMutex());
+        lock.lock();
+
+        foreach (const QString &scheme, QMailContentManagerFactory::schemes()) {
+            QMailContentManager *contentManager = QMailContentManagerFactory::create(scheme);
+            if (contentManager && (contentManager->role() == QMailContentManager::StorageRole)) {
+                QMailStore::ErrorCode code = contentManager->ensureDurability();
+                if (code != QMailStore::NoError) {
+                    setLastError(code);
+                    qWarning() << "Unable to ensure message content durability for scheme:" << scheme;
+                    return false;
+                }
+            }
+        }
+    }
+
     return repeatedly<WriteAccess>(bind(&QMailStorePrivate::attemptEnsureDurability, this),
                                    QLatin1String("ensureDurability"));
 }
 
 void QMailStorePrivate::unloadDatabase()
 {
+    if (readSnapshotDepth > 0) {
+        // The connection holds the snapshot; retry once it has been released
+        databaseUnloadTimer.start(profile.connectionLifetime);
+        return;
+    }
+
     if (databaseptr) {
         shrinkMemory();
         databaseptr->close();
@@ -4935,6 +6364,45 @@ void QMailStorePrivate::unlock()
     }
 }
 
+bool QMailStorePrivate::beginReadSnapshot()
+{
+    if (readSnapshotDepth++ > 0)
+        return true;
+
+    // A write transaction already sees a consistent state
+    if (inTransaction)
+        return true;
+
+    clearQueryError();
+    destroyTemporaryTables();
+
+    // The transaction is deferred, so the snapshot is taken by the first query
+    // it contains; under WAL it does not block writers in other processes
+    if (!database()->transaction()) {
+        setQueryError(database()->lastError(), QLatin1String("Failed to begin read snapshot"));
+        return false;
+    }
+
+    inReadSnapshot = true;
+    return true;
+}
+
+void QMailStorePrivate::endReadSnapshot()
+{
+    if (readSnapshotDepth == 0) {
+        qWarning() << "Unable to end read snapshot when none was begun";
+        return;
+    }
+
+    if ((--readSnapshotDepth == 0) && inReadSnapshot) {
+        inReadSnapshot = false;
+
+        // Nothing was written, so this only releases the snapshot
+        if (!database()->commit())
+            setQueryError(database()->lastError(), QLatin1String("Failed to end read snapshot"));
+    }
+}
+
 bool QMailStorePrivate::purgeMessageRemovalRecords(const QMailAccountId &accountId, const QStringList &serverUids)
 {
     return repeatedly<WriteAccess>(bind(&QMailStorePrivate::attemptPurgeMessageRemovalRecords, this, 
@@ -4987,6 +6455,15 @@ int QMailStorePrivate::sizeOfMessages(const QMailMessageKey &key) const
     return result;
 }
 
+QMap<quint64, QMailStore::MessageGroupCounts> QMailStorePrivate::countMessagesGrouped(const QMailMessageKey &key, QMailStore::MessageGrouping grouping, const QList<QMailMessageKey> &subsetKeys) const
+{
+    QMap<quint64, QMailStore::MessageGroupCounts> result;
+    repeatedly<ReadAccess>(bind(&QMailStorePrivate::attemptCountMessagesGrouped, const_cast<QMailStorePrivate*>(this),
+                                cref(key), grouping, cref(subsetKeys), &result),
+                           QLatin1String("countMessagesGrouped"));
+    return result;
+}
+
 QMailAccountIdList QMailStorePrivate::queryAccounts(const QMailAccountKey &key, const QMailAccountSortKey &sortKey, uint limit, uint offset) const
 {
     QMailAccountIdList ids;
@@ -5014,6 +6491,33 @@ QMailMessageIdList QMailStorePrivate::queryMessages(const QMailMessageKey &key,
     return ids;
 }
 
+QStringList QMailStorePrivate::messageQueryPlan(const QMailMessageKey &key, const QMailMessageSortKey &sortKey) const
+{
+    QStringList plan;
+    repeatedly<ReadAccess>(bind(&QMailStorePrivate::attemptMessageQueryPlan, const_cast<QMailStorePrivate*>(this),
+                                cref(key), cref(sortKey), &plan),
+                           QLatin1String("messageQueryPlan"));
+    return plan;
+}
+
+QStringList QMailStorePrivate::messagePageQueryPlan(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, const QByteArray &continuation) const
+{
+    QStringList plan;
+    repeatedly<ReadAccess>(bind(&QMailStorePrivate::attemptMessagePageQueryPlan, const_cast<QMailStorePrivate*>(this),
+                                cref(key), cref(sortKey), cref(continuation), &plan),
+                           QLatin1String("messagePageQueryPlan"));
+    return plan;
+}
+
+QMailMessageIdList QMailStorePrivate::queryMessagePage(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, uint limit, QByteArray *continuation) const
+{
+    QMailMessageIdList ids;
+    repeatedly<ReadAccess>(bind(&QMailStorePrivate::attemptQueryMessagePage, const_cast<QMailStorePrivate*>(this),
+                                cref(key), cref(sortKey), limit, continuation, &ids),
+                           QLatin1String("queryMessagePage"));
+    return ids;
+}
+
 QMailThreadIdList QMailStorePrivate::queryThreads(const QMailThreadKey &key, const QMailThreadSortKey &sortKey, uint limit, uint offset) const
 {
     QMailThreadIdList ids;
@@ -5103,6 +6607,31 @@ QMailMessageMetaData QMailStorePrivate::messageMetaData(const QMailMessageId &id
     return messageCache.lookup(id);
 }
 
+QMailMessageMetaData QMailStorePrivate::messageMetaData(const QMailMessageId &id, const QMailMessageKey::Properties &properties) const
+{
+    if (messageCache.contains(id))
+        return messageCache.lookup(id);
+
+    // Properties beyond those held in the shared cache require the complete record
+    if (((properties & ~QMailStoreSharedCache::properties()) == 0) && attachSharedCache()) {
+        QMailMessageMetaData metaData;
+        if (sharedCache.lookup(id, &metaData))
+            return metaData;
+    }
+
+    return messageMetaData(id);
+}
+
+bool QMailStorePrivate::cachedMessageMetaData(const QMailMessageId &id, QMailMessageMetaData *metaData) const
+{
+    // Unlike messageMetaData(), never touch the database
+    if (!messageCache.contains(id))
+        return false;
+
+    *metaData = messageCache.lookup(id);
+    return true;
+}
+
 QMailMessageMetaData QMailStorePrivate::messageMetaData(const QString &uid, const QMailAccountId &accountId) const
 {
     QMailMessageMetaData metaData;
@@ -5134,6 +6663,7 @@ QMailMessageMetaData QMailStorePrivate::messageMetaData(const QString &uid, cons
     if (success) {
         messageCache.insert(metaData);
         uidCache.insert(qMakePair(metaData.parentAccountId(), metaData.serverUid()), metaData.id());
+        sharedCache.insert(metaData, false);
     }
 
     return metaData;
@@ -5267,41 +6797,43 @@ QMailFolderIdList QMailStorePrivate::folderAncestorIds(const QMailFolderIdList&
     return ancestorIds;
 }
 
-void QMailStorePrivate::removeExpiredData(const QMailMessageIdList& messageIds, const QMailThreadIdList& threadIds, const QStringList& contentUris, const QMailFolderIdList& folderIds, const QMailAccountIdList& accountIds)
+void QMailStorePrivate::removeExpiredData(const QMailMessageIdList& messageIds, const QMailThreadIdList& threadIds, const QStringList& contentUris, const QVariantList& contentRowIds, const QMailFolderIdList& folderIds, const QMailAccountIdList& accountIds)
 {
     foreach (const QMailMessageId& id, messageIds) {
         messageCache.remove(id);
+        sharedCache.remove(id);
     }
 
-    {
-        MutexGuard lock(contentManagerMutex());
-        lock.lock();
-
-        QMap<QString, QStringList> uriElements;
-
-        foreach (const QString& contentUri, contentUris) {
-            uriElements[extractUriElements(contentUri).first].append(extractUriElements(contentUri).second);
+    // The content is recorded as obsolete by the deletion; if it cannot be purged now, maintenance removes it later
+    if (!contentUris.isEmpty() && (contentRowIds.count() == contentUris.count())) {
+        QMap<QString, QPair<QStringList, QVariantList> > schemeContent;
+        for (int i = 0; i < contentUris.count(); ++i) {
+            const QPair<QString, QString> elements(extractUriElements(contentUris.at(i)));
+            QPair<QStringList, QVariantList> &content(schemeContent[elements.first]);
+            content.first.append(elements.second);
+            content.second.append(contentRowIds.at(i));
+        }
 
-            for ( QMap<QString, QStringList>::iterator it(uriElements.begin()) ; it != uriElements.end() ; ++it)
-            {
-                QStringList schemes(QStringList() << QMailContentManagerFactory::defaultFilterScheme()
-                                                  << it.key()
-                                                  << QMailContentManagerFactory::defaultIndexerScheme());
+        for (QMap<QString, QPair<QStringList, QVariantList> >::const_iterator it(schemeContent.constBegin()); it != schemeContent.constEnd(); ++it) {
+            QStringList schemes(QStringList() << QMailContentManagerFactory::defaultFilterScheme()
+                                              << it.key()
+                                              << QMailContentManagerFactory::defaultIndexerScheme());
 
-                foreach(QString const& scheme, schemes)
-                {
-                    if (!scheme.isEmpty()) {
-                        QMailContentManager *manager(QMailContentManagerFactory::create(scheme));
-                        if (!manager)
-                            qWarning() << "Unable to create content manager for scheme:" << scheme;
-                        else {
-                            if (manager->remove(*it) != QMailStore::NoError) {
-                                 qWarning() << "Unable to remove expired message contents:" << *it;
-                            }
-                        }
+            QList<QMailContentManager*> managers;
+            bool available(true);
+            foreach (const QString &scheme, schemes) {
+                if (!scheme.isEmpty()) {
+                    if (QMailContentManager *manager = QMailContentManagerFactory::create(scheme)) {
+                        managers.append(manager);
+                    } else {
+                        qWarning() << "Unable to create content manager for scheme:" << scheme;
+                        available = false;
                     }
                 }
             }
+
+            if (available)
+                contentPurger()->purge(managers, it.value().first, it.value().second);
         }
     }
 
@@ -5334,6 +6866,8 @@ bool QMailStorePrivate::repeatedly(FunctionType func, const QString &description
     unsigned int attemptCount = 0;
     unsigned int delay = MinRetryDelay;
 
+    InstrumentationScope scope(this, description);
+
      while (true) {
         AttemptResult result;
         if (t) {
@@ -5359,6 +6893,12 @@ bool QMailStorePrivate::repeatedly(FunctionType func, const QString &description
                 if (attemptCount < MaxAttempts) {
                     qWarning() << pid << "Failed to" << qPrintable(description) << "- busy, pausing to retry";
 
+                    if (instrumented) {
+                        ++contention.busyRetries;
+                        if (operationDepth == 1)
+                            operationStatements.clear();
+                    }
+
                     // Pause before we retry
                     QThread::usleep(delay * 1000);
                     if (delay < MaxRetryDelay)
@@ -6108,11 +7648,12 @@ QMailStorePrivate::AttemptResult QMailStorePrivate::attemptRemoveAccounts(const
                                                                           Transaction &t, bool commitOnSuccess)
 {
     QStringList expiredContent;
+    QVariantList expiredRowIds;
 
-    if (deleteAccounts(key, *out->deletedAccountIds, *out->deletedFolderIds, *out->deletedThreadIds, *out->deletedMessageIds, expiredContent, *out->updatedMessageIds, *out->modifiedFolderIds, *out->modifiedThreadIds, *out->modifiedAccountIds)) {
+    if (deleteAccounts(key, *out->deletedAccountIds, *out->deletedFolderIds, *out->deletedThreadIds, *out->deletedMessageIds, expiredContent, *out->updatedMessageIds, *out->modifiedFolderIds, *out->modifiedThreadIds, *out->modifiedAccountIds) && obsoleteContent(expiredContent, &expiredRowIds)) {
         if (commitOnSuccess && t.commit()) {
             //remove deleted objects from caches
-            removeExpiredData(*out->deletedMessageIds, *out->deletedThreadIds, expiredContent, *out->deletedFolderIds, *out->deletedAccountIds);
+            removeExpiredData(*out->deletedMessageIds, *out->deletedThreadIds, expiredContent, expiredRowIds, *out->deletedFolderIds, *out->deletedAccountIds);
             return Success;
         }
     }
@@ -6125,11 +7666,12 @@ QMailStorePrivate::AttemptResult QMailStorePrivate::attemptRemoveFolders(const Q
                                                                          Transaction &t, bool commitOnSuccess)
 {
     QStringList expiredContent;
+    QVariantList expiredRowIds;
 
-    if (deleteFolders(key, option, *out->deletedFolderIds, *out->deletedMessageIds, *out->deletedThreadIds, expiredContent, *out->updatedMessageIds, *out->modifiedFolderIds, *out->modifiedThreadIds, *out->modifiedAccountIds)) {
+    if (deleteFolders(key, option, *out->deletedFolderIds, *out->deletedMessageIds, *out->deletedThreadIds, expiredContent, *out->updatedMessageIds, *out->modifiedFolderIds, *out->modifiedThreadIds, *out->modifiedAccountIds) && obsoleteContent(expiredContent, &expiredRowIds)) {
         if (commitOnSuccess && t.commit()) {
             //remove deleted objects from caches
-            removeExpiredData(*out->deletedMessageIds, *out->deletedThreadIds, expiredContent, *out->deletedFolderIds);
+            removeExpiredData(*out->deletedMessageIds, *out->deletedThreadIds, expiredContent, expiredRowIds, *out->deletedFolderIds);
             return Success;
         }
     }
@@ -6142,11 +7684,12 @@ QMailStorePrivate::AttemptResult QMailStorePrivate::attemptRemoveThreads(const Q
                                                                          Transaction &t, bool commitOnSuccess)
 {
     QStringList expiredContent;
+    QVariantList expiredRowIds;
 
-    if (deleteThreads(key, option, *out->deletedThreadIds, *out->deletedMessageIds, expiredContent, *out->updatedMessageIds, *out->modifiedFolderIds, *out->modifiedThreadIds, *out->modifiedAccountIds)) {
+    if (deleteThreads(key, option, *out->deletedThreadIds, *out->deletedMessageIds, expiredContent, *out->updatedMessageIds, *out->modifiedFolderIds, *out->modifiedThreadIds, *out->modifiedAccountIds) && obsoleteContent(expiredContent, &expiredRowIds)) {
         if (commitOnSuccess && t.commit()) {
             //remove deleted objects from caches
-            removeExpiredData(*out->deletedMessageIds, *out->deletedThreadIds, expiredContent);
+            removeExpiredData(*out->deletedMessageIds, *out->deletedThreadIds, expiredContent, expiredRowIds);
             return Success;
         }
     }
@@ -6160,11 +7703,12 @@ QMailStorePrivate::AttemptResult QMailStorePrivate::attemptRemoveMessages(const
                                                                           Transaction &t, bool commitOnSuccess)
 {
     QStringList expiredContent;
+    QVariantList expiredRowIds;
 
-    if (deleteMessages(key, option, *deletedMessageIds, *deletedThreadIds, expiredContent, *updatedMessageIds, *modifiedFolderIds, *modifiedThreadIds, *modifiedAccountIds)) {
+    if (deleteMessages(key, option, *deletedMessageIds, *deletedThreadIds, expiredContent, *updatedMessageIds, *modifiedFolderIds, *modifiedThreadIds, *modifiedAccountIds) && obsoleteContent(expiredContent, &expiredRowIds)) {
         if (commitOnSuccess && t.commit()) {
             //remove deleted objects from caches
-            removeExpiredData(*deletedMessageIds, *deletedThreadIds, expiredContent);
+            removeExpiredData(*deletedMessageIds, *deletedThreadIds, expiredContent, expiredRowIds);
             return Success;
         }
     }
@@ -7092,8 +8636,11 @@ QMailStorePrivate::AttemptResult QMailStorePrivate::attemptUpdateMessage(QMailMe
                 updateMessageValues(updateProperties, extractedValues, metaData->customFields(), cachedMetaData);
                 cachedMetaData.setUnmodified();
                 messageCache.insert(cachedMetaData);
+                sharedCache.insert(cachedMetaData);
             }
             uidCache.insert(qMakePair(cachedMetaData.parentAccountId(), cachedMetaData.serverUid()), cachedMetaData.id());
+        } else if (!extractedValues.isEmpty()) {
+            sharedCache.remove(metaData->id());
         }
 
         APPEND_UNIQUE(all_updatedMessageIds, metaData->id());
@@ -7242,6 +8789,9 @@ QMailStorePrivate::AttemptResult QMailStorePrivate::attemptUpdateMessagesMetaDat
             cachedMetaData.setUnmodified();
             messageCache.insert(cachedMetaData);
             uidCache.insert(qMakePair(cachedMetaData.parentAccountId(), cachedMetaData.serverUid()), cachedMetaData.id());
+            sharedCache.insert(cachedMetaData);
+        } else {
+            sharedCache.remove(id);
         }
     }
 
@@ -7352,6 +8902,9 @@ QMailStorePrivate::AttemptResult QMailStorePrivate::attemptUpdateMessagesStatus(
             cachedMetaData.setUnmodified();
             messageCache.insert(cachedMetaData);
             uidCache.insert(qMakePair(cachedMetaData.parentAccountId(), cachedMetaData.serverUid()), cachedMetaData.id());
+            sharedCache.insert(cachedMetaData);
+        } else {
+            sharedCache.remove(id);
         }
     }
 
@@ -7507,6 +9060,63 @@ QMailStorePrivate::AttemptResult QMailStorePrivate::attemptSizeOfMessages(const
     return Success;
 }
 
+QMailStorePrivate::AttemptResult QMailStorePrivate::attemptCountMessagesGrouped(const QMailMessageKey &key, QMailStore::MessageGrouping grouping, const QList<QMailMessageKey> &subsetKeys,
+                                                                                QMap<quint64, QMailStore::MessageGroupCounts> *result,
+                                                                                ReadLock &)
+{
+    QString groupColumn;
+    QString source(QLatin1String("mailmessages t0"));
+    switch (grouping) {
+    case QMailStore::GroupByParentFolder:
+        groupColumn = QLatin1String("t0.parentfolderid");
+        break;
+    case QMailStore::GroupByAncestorFolder:
+        // Each message is counted once for every folder in its parent folder's ancestry
+        groupColumn = QLatin1String("t1.id");
+        source += QLatin1String(" INNER JOIN mailfolderlinks t1 ON t1.descendantid=t0.parentfolderid");
+        break;
+    case QMailStore::GroupByParentAccount:
+        groupColumn = QLatin1String("t0.parentaccountid");
+        break;
+    case QMailStore::GroupByParentThread:
+        groupColumn = QLatin1String("t0.parentthreadid");
+        break;
+    }
+
+    // Each subset is tallied in its own column; the subset values precede those of the main key
+    QString sql(QLatin1String("SELECT ") + groupColumn + QLatin1String(",COUNT(*),SUM(t0.size)"));
+    QVariantList bindValues;
+    foreach (const QMailMessageKey &subsetKey, subsetKeys) {
+        const QString subsetClause(buildWhereClause(Key(subsetKey, QLatin1String("t0")), true));
+        if (subsetClause.isEmpty()) {
+            sql += QLatin1String(",COUNT(*)");
+        } else {
+            sql += QLatin1String(",SUM(CASE WHEN (") + subsetClause + QLatin1String(") THEN 1 ELSE 0 END)");
+            bindValues << whereClauseValues(Key(subsetKey, QLatin1String("t0")));
+        }
+    }
+    sql += QLatin1String(" FROM ") + source;
+
+    QSqlQuery query(simpleQuery(sql,
+                                bindValues,
+                                QList<Key>() << Key(key, QLatin1String("t0")) << Key(QLatin1String(" GROUP BY ") + groupColumn),
+                                QLatin1String("countMessagesGrouped mailmessages query")));
+    if (query.lastError().type() != QSqlError::NoError)
+        return DatabaseFailure;
+
+    while (query.next()) {
+        QMailStore::MessageGroupCounts counts;
+        counts.count = extractValue<int>(query.value(1));
+        counts.size = extractValue<qint64>(query.value(2));
+        for (int i = 0; i < subsetKeys.count(); ++i)
+            counts.subsetCounts.append(extractValue<int>(query.value(3 + i)));
+
+        result->insert(extractValue<quint64>(query.value(0)), counts);
+    }
+
+    return Success;
+}
+
 QMailStorePrivate::AttemptResult QMailStorePrivate::attemptQueryAccounts(const QMailAccountKey &key, const QMailAccountSortKey &sortKey, uint limit, uint offset,
                                                                          QMailAccountIdList *ids, 
                                                                          ReadLock &)
@@ -7585,6 +9195,244 @@ QMailStorePrivate::AttemptResult QMailStorePrivate::attemptQueryMessages(const Q
     return Success;
 }
 
+// Reports how SQLite would perform the query issued by queryMessages()
+QMailStorePrivate::AttemptResult QMailStorePrivate::attemptMessageQueryPlan(const QMailMessageKey &key, const QMailMessageSortKey &sortKey,
+                                                                            QStringList *plan,
+                                                                            ReadLock &)
+{
+    QSqlQuery query(simpleQuery(QLatin1String("EXPLAIN QUERY PLAN SELECT id FROM mailmessages"),
+                                QVariantList(),
+                                QList<Key>() << Key(key) << Key(sortKey),
+                                QLatin1String("messageQueryPlan mailmessages query")));
+    if (query.lastError().type() != QSqlError::NoError)
+        return DatabaseFailure;
+
+    // The last column holds the description of each step
+    while (query.next())
+        plan->append(query.value(query.record().count() - 1).toString());
+
+    return Success;
+}
+
+// Builds the statements that select the page of messages following continuation, in order;
+// each seeks within a single range of the leading sort column, so that an index on the
+// filtered and sorted columns can deliver it without a sort step
+bool QMailStorePrivate::messagePageStatements(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, const QByteArray &continuation,
+                                              QList<QPair<QString, QVariantList> > *statements, quint32 *signature) const
+{
+    static const quint8 ContinuationVersion = 2;
+
+    // Order by the sort key, breaking ties by id so that every row has a unique position;
+    // the id follows the direction of the last sort column, so that an index on the
+    // sorted columns (which implicitly ends with the id) can yield the rows in order
+    QStringList expressions;
+    QList<bool> ascending;
+    foreach (const QMailMessageSortKey::ArgumentType &arg, sortKey.arguments()) {
+        expressions.append(sortExpression(arg, QString()));
+        ascending.append(arg.order == Qt::AscendingOrder);
+    }
+
+    QStringList orderColumns;
+    for (int i = 0; i < expressions.count(); ++i)
+        orderColumns.append(expressions.at(i) + QLatin1String(ascending.at(i) ? " ASC" : " DESC"));
+    const bool idAscending(ascending.isEmpty() || ascending.last());
+    orderColumns.append(QLatin1String(idAscending ? "id ASC" : "id DESC"));
+
+    const QString orderClause(QLatin1String(" ORDER BY ") + orderColumns.join(QLatin1Char(',')));
+
+    QStringList conditions;
+    QVariantList bindValues;
+
+    const QString keyClause(buildWhereClause(Key(key), true));
+    if (!keyClause.isEmpty()) {
+        conditions.append(QLatin1Char('(') + keyClause + QLatin1Char(')'));
+        bindValues << whereClauseValues(Key(key));
+    }
+
+    // A continuation is only valid for the filter and ordering that produced it
+    QByteArray keyValues;
+    {
+        QDataStream stream(&keyValues, QIODevice::WriteOnly);
+        stream << bindValues;
+    }
+    *signature = qHash(orderClause + keyClause) ^ qHash(keyValues) ^ ContinuationVersion;
+
+    // The ranges of the leading sort column to be read in turn, with a residual filter for each
+    QList<QPair<QString, QVariantList> > ranges;
+
+    if (continuation.isEmpty()) {
+        ranges.append(qMakePair(QString(), QVariantList()));
+    } else {
+        quint32 tokenSignature(0);
+        QVariantList values;
+        quint64 lastId(0);
+
+        QDataStream stream(continuation);
+        stream >> tokenSignature >> values >> lastId;
+        if ((stream.status() != QDataStream::Ok) || (tokenSignature != *signature) || (values.count() != expressions.count())) {
+            qWarning() << "queryMessagePage: continuation does not match key or sort key";
+            return false;
+        }
+
+        // Select the rows positioned after the last row returned: those that match its
+        // values in each leading sort column and follow it in the next column
+        QStringList alternatives;
+        QVariantList residualValues;
+        QString prefix;
+        QVariantList prefixValues;
+        for (int i = 0; i <= expressions.count(); ++i) {
+            const bool last(i == expressions.count());
+            const QString expression(last ? QLatin1String("id") : expressions.at(i));
+            const QVariant value(last ? QVariant(lastId) : values.at(i));
+            const bool ascendingColumn(last ? idAscending : ascending.at(i));
+
+            // NULL values are ordered before all others; the id is never NULL
+            QString following;
+            QVariantList followingValues;
+            if (value.isNull()) {
+                if (ascendingColumn)
+                    following = expression + QLatin1String(" IS NOT NULL");
+            } else if (ascendingColumn) {
+                following = expression + QLatin1String(" > ?");
+                followingValues << value;
+            } else if (last) {
+                following = expression + QLatin1String(" < ?");
+                followingValues << value;
+            } else {
+                following = QLatin1Char('(') + expression + QLatin1String(" < ? OR ") + expression + QLatin1String(" IS NULL)");
+                followingValues << value;
+            }
+
+            if (!following.isEmpty()) {
+                alternatives.append(QLatin1Char('(') + prefix + following + QLatin1Char(')'));
+                residualValues << prefixValues << followingValues;
+            }
+
+            if (!last) {
+                prefix.append(expression + QLatin1String(" IS ? AND "));
+                prefixValues << value;
+            }
+        }
+        const QString residual(QLatin1Char('(') + alternatives.join(QLatin1String(" OR ")) + QLatin1Char(')'));
+
+        if (expressions.isEmpty()) {
+            // The residual is itself a range of ids
+            ranges.append(qMakePair(residual, residualValues));
+        } else {
+            // Bound the leading column by its last value, so that the seek is a range of the
+            // index rather than a filter over every row; NULLs lie outside any such range,
+            // so the rows that are NULL in the leading column are read separately
+            const QString leading(expressions.first());
+            const QVariant leadingValue(values.first());
+            if (leadingValue.isNull()) {
+                ranges.append(qMakePair(leading + QLatin1String(" IS NULL AND ") + residual, residualValues));
+                if (ascending.first())
+                    ranges.append(qMakePair(leading + QLatin1String(" IS NOT NULL"), QVariantList()));
+            } else {
+                ranges.append(qMakePair(leading + QLatin1String(ascending.first() ? " >= ? AND " : " <= ? AND ") + residual,
+                                        QVariantList() << leadingValue << residualValues));
+                if (!ascending.first())
+                    ranges.append(qMakePair(leading + QLatin1String(" IS NULL"), QVariantList()));
+            }
+        }
+    }
+
+    QString columns(QLatin1String("SELECT id"));
+    foreach (const QString &expression, expressions)
+        columns.append(QLatin1Char(',') + expression);
+    columns.append(QLatin1String(" FROM mailmessages"));
+
+    typedef QPair<QString, QVariantList> Range;
+    foreach (const Range &range, ranges) {
+        QStringList rangeConditions(conditions);
+        if (!range.first.isEmpty())
+            rangeConditions.append(range.first);
+
+        QString statement(columns);
+        if (!rangeConditions.isEmpty())
+            statement.append(QLatin1String(" WHERE ") + rangeConditions.join(QLatin1String(" AND ")));
+        statement.append(orderClause);
+
+        statements->append(qMakePair(statement, QVariantList() << bindValues << range.second));
+    }
+
+    return true;
+}
+
+QMailStorePrivate::AttemptResult QMailStorePrivate::attemptQueryMessagePage(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, uint limit, QByteArray *continuation,
+                                                                            QMailMessageIdList *ids,
+                                                                            ReadLock &)
+{
+    QList<QPair<QString, QVariantList> > statements;
+    quint32 signature(0);
+    if (!messagePageStatements(key, sortKey, *continuation, &statements, &signature))
+        return Failure;
+
+    const int columns(sortKey.arguments().count());
+    QVariantList lastValues;
+    quint64 lastId(0);
+
+    typedef QPair<QString, QVariantList> Statement;
+    foreach (const Statement &statement, statements) {
+        const uint remaining(limit ? limit - ids->count() : 0);
+        if (limit && !remaining)
+            break;
+
+        QSqlQuery query(simpleQuery(statement.first,
+                                    statement.second,
+                                    QList<Key>(),
+                                    qMakePair(remaining, 0u),
+                                    QLatin1String("queryMessagePage mailmessages query")));
+        if (query.lastError().type() != QSqlError::NoError)
+            return DatabaseFailure;
+
+        while (query.next()) {
+            lastId = extractValue<quint64>(query.value(0));
+            ids->append(QMailMessageId(lastId));
+
+            lastValues.clear();
+            for (int i = 0; i < columns; ++i)
+                lastValues.append(query.value(i + 1));
+        }
+    }
+
+    continuation->clear();
+    if (limit && (ids->count() == static_cast<int>(limit))) {
+        QDataStream stream(continuation, QIODevice::WriteOnly);
+        stream << signature << lastValues << lastId;
+    }
+
+    //store the results of this call for cache preloading
+    lastQueryMessageResult = *ids;
+
+    return Success;
+}
+
+// Reports how SQLite would perform the queries issued by queryMessagePage()
+QMailStorePrivate::AttemptResult QMailStorePrivate::attemptMessagePageQueryPlan(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, const QByteArray &continuation,
+                                                                                QStringList *plan,
+                                                                                ReadLock &)
+{
+    QList<QPair<QString, QVariantList> > statements;
+    quint32 signature(0);
+    if (!messagePageStatements(key, sortKey, continuation, &statements, &signature))
+        return Failure;
+
+    typedef QPair<QString, QVariantList> Statement;
+    foreach (const Statement &statement, statements) {
+        QSqlQuery query(simpleQuery(QLatin1String("EXPLAIN QUERY PLAN ") + statement.first,
+                                    statement.second,
+                                    QLatin1String("messagePageQueryPlan mailmessages query")));
+        if (query.lastError().type() != QSqlError::NoError)
+            return DatabaseFailure;
+
+        while (query.next())
+            plan->append(query.value(query.record().count() - 1).toString());
+    }
+
+    return Success;
+}
+
 QMailStorePrivate::AttemptResult QMailStorePrivate::attemptAccount(const QMailAccountId &id, 
                                                                    QMailAccount *result, 
                                                                    ReadLock &)
@@ -8095,6 +9943,7 @@ void QMailStorePrivate::preloadHeaderCache(const QMailMessageId& id) const
         if (metaData.id().isValid()) {
             messageCache.insert(metaData);
             uidCache.insert(qMakePair(metaData.parentAccountId(), metaData.serverUid()), metaData.id());
+            sharedCache.insert(metaData, false);
             if (metaData.id() == id) {
                 result = metaData;
         }
@@ -8952,7 +10801,13 @@ bool QMailStorePrivate::deleteMessages(const QMailMessageKey& key,
                                        QMailAccountIdList& modifiedAccountIds)
 {
     QMailMessageIdList deletedMessageIds;
-    
+
+    // Membership is tested for every message deleted, so lists would be quadratic in the deletion size
+    QSet<QMailMessageId> previouslyDeletedIds(outDeletedMessageIds.toSet());
+    QSet<QMailAccountId> modifiedAccounts(modifiedAccountIds.toSet());
+    QSet<QMailFolderId> modifiedFolders(modifiedFolderIds.toSet());
+    QSet<QMailThreadId> modifiedThreads(modifiedThreadIds.toSet());
+
     QString elements = QString::fromLatin1("id,mailfile,parentaccountid,parentfolderid,parentthreadid");
     if (option == QMailStore::CreateRemovalRecord)
         elements += QLatin1String(",serveruid");
@@ -8974,29 +10829,36 @@ bool QMailStorePrivate::deleteMessages(const QMailMessageKey& key,
             QMailMessageId messageId(extractValue<quint64>(query.value(0)));
  
             // Deletion handling logic for this message has already been executed in this transaction
-            if (outDeletedMessageIds.contains(messageId))
+            if (previouslyDeletedIds.contains(messageId))
                 continue;
-            
+
             noMessages = false;
-            
+
+            previouslyDeletedIds.insert(messageId);
             deletedMessageIds.append(messageId);
             outDeletedMessageIds.append(messageId);
-            
+
             QString contentUri(extractValue<QString>(query.value(1)));
             if (!contentUri.isEmpty())
                 expiredContent.append(contentUri);
 
             QMailAccountId parentAccountId(extractValue<quint64>(query.value(2)));
-            if (parentAccountId.isValid() && !modifiedAccountIds.contains(parentAccountId))
+            if (parentAccountId.isValid() && !modifiedAccounts.contains(parentAccountId)) {
+                modifiedAccounts.insert(parentAccountId);
                 modifiedAccountIds.append(parentAccountId);
+            }
 
             QMailFolderId folderId(extractValue<quint64>(query.value(3)));
-            if (folderId.isValid() && !modifiedFolderIds.contains(folderId))
+            if (folderId.isValid() && !modifiedFolders.contains(folderId)) {
+                modifiedFolders.insert(folderId);
                 modifiedFolderIds.append(folderId);
+            }
 
             QMailThreadId threadId(extractValue<quint64>(query.value(4)));
-            if (threadId.isValid() && !modifiedThreadIds.contains(threadId))
+            if (threadId.isValid() && !modifiedThreads.contains(threadId)) {
+                modifiedThreads.insert(threadId);
                 modifiedThreadIds.append(threadId);
+            }
 
             if (option == QMailStore::CreateRemovalRecord) {
                 // Extract the info needed to create removal records
@@ -9021,8 +10883,10 @@ bool QMailStorePrivate::deleteMessages(const QMailMessageKey& key,
 
         while (query.next()) {
             QMailFolderId folderId(extractValue<quint64>(query.value(0)));
-            if (folderId.isValid()  && !modifiedFolderIds.contains(folderId))
+            if (folderId.isValid() && !modifiedFolders.contains(folderId)) {
+                modifiedFolders.insert(folderId);
                 modifiedFolderIds.append(folderId);
+            }
         }
     }
 
@@ -9112,7 +10976,7 @@ bool QMailStorePrivate::deleteMessages(const QMailMessageKey& key,
             for (QMap<QMailMessageId, QMailMessageId>::iterator it(update_map.begin()) ; it != update_map.end() ; ++it) {
                 QMailMessageId to_update(it.key());
 
-                if (!deletedMessageIds.contains(to_update)) {
+                if (!previouslyDeletedIds.contains(to_update)) {
                     updatedMessageIds.append(to_update);
                     messageIdList.push_back(QVariant(to_update.toULongLong()));
 
@@ -9508,6 +11372,80 @@ bool QMailStorePrivate::obsoleteContent(const QString& identifier)
     return true;
 }
 
+// Records the content in a single statement, returning the row recording each identifier,
+// so that the rows can be removed once the content has been purged
+bool QMailStorePrivate::obsoleteContent(const QStringList& identifiers, QVariantList *rowIds)
+{
+    if (identifiers.isEmpty())
+        return true;
+
+    // Rows inserted by this transaction follow any that already exist, in the order inserted
+    qint64 lastRowId = 0;
+    {
+        QSqlQuery query(simpleQuery(QLatin1String("SELECT MAX(rowid) FROM obsoletefiles"),
+                                    QLatin1String("obsoleteContent files rowid query")));
+        if (query.lastError().type() != QSqlError::NoError)
+            return false;
+
+        if (query.first())
+            lastRowId = query.value(0).toLongLong();
+    }
+
+    {
+        QVariantList values;
+        foreach (const QString &identifier, identifiers)
+            values.append(QVariant(identifier));
+
+        QSqlQuery query(batchQuery(QLatin1String("INSERT INTO obsoletefiles (mailfile) VALUES (?)"),
+                                   QVariantList() << QVariant(values),
+                                   QLatin1String("obsoleteContent files batch insert query")));
+        if (query.lastError().type() != QSqlError::NoError) {
+            qWarning() << "Unable to record obsolete content for" << identifiers.count() << "messages";
+            return false;
+        }
+    }
+
+    {
+        QSqlQuery query(simpleQuery(QLatin1String("SELECT rowid FROM obsoletefiles WHERE rowid>? ORDER BY rowid"),
+                                    QVariantList() << lastRowId,
+                                    QLatin1String("obsoleteContent files inserted query")));
+        if (query.lastError().type() != QSqlError::NoError)
+            return false;
+
+        while (query.next())
+            rowIds->append(query.value(0));
+    }
+
+    return true;
+}
+
+QMailContentPurger *QMailStorePrivate::contentPurger()
+{
+    if (!purger) {
+        purger = new QMailContentPurger(&contentManagerMutex());
+        connect(purger, SIGNAL(contentPurged(QVariantList)), this, SLOT(obsoleteContentPurged(QVariantList)));
+        connect(purger, SIGNAL(progressChanged(int,int)), q_ptr, SIGNAL(contentPurgeProgress(int,int)));
+    }
+
+    return purger;
+}
+
+void QMailStorePrivate::obsoleteContentPurged(const QVariantList &rowIds)
+{
+    Transaction t(this);
+
+    QSqlQuery query(batchQuery(QLatin1String("DELETE FROM obsoletefiles WHERE rowid=?"),
+                               QVariantList() << QVariant(rowIds),
+                               QLatin1String("obsoleteContentPurged files delete query")));
+    if (query.lastError().type() != QSqlError::NoError) {
+        qWarning() << "Failed to remove purged obsolete files";
+        return;
+    }
+
+    if (!t.commit())
+        qWarning() << "Could not commit obsolete files purge to database";
+}
+
 QSqlQuery QMailStorePrivate::simpleQuery(const QString& statement, const QString& descriptor)
 {
     return performQuery(statement, false, QVariantList(), QList<Key>(), qMakePair(0u, 0u), descriptor);
@@ -9561,7 +11499,7 @@ QSqlQuery QMailStorePrivate::performQuery(const QString& statement, bool batch,
     bool firstClause(true);
     foreach (const Key &key, keys) {
         if (key.isType<QMailMessageKey>() || key.isType<QMailFolderKey>() || key.isType<QMailAccountKey>() || key.isType<QMailThreadKey>()) {
-            keyStatements.append(buildWhereClause(key, false, firstClause));
+            keyStatements.append(compiledWhereClause(key, firstClause));
             keyValues << whereClauseValues(key);
         } else if (key.isType<QMailMessageSortKey>() || key.isType<QMailFolderSortKey>() || key.isType<QMailAccountSortKey>() || key.isType<QMailThreadSortKey>()) {
             keyStatements.append(buildOrderClause(key));
@@ -9584,7 +11522,12 @@ QSqlQuery QMailStorePrivate::performQuery(const QString& statement, bool batch,
         }
     }
 
-    QSqlQuery query(prepare(statement + keyStatements + constraintStatements));
+    QElapsedTimer timer;
+    if (instrumented)
+        timer.start();
+
+    const QString sql(statement + keyStatements + constraintStatements);
+    QSqlQuery query(prepare(sql));
     if (queryError() != QSqlError::NoError) {
         qWarning() << "Could not prepare query" << descriptor;
     } else {
@@ -9593,14 +11536,201 @@ QSqlQuery QMailStorePrivate::performQuery(const QString& statement, bool batch,
         foreach (const QVariant& value, keyValues)
             query.addBindValue(value);
 
+        const qint64 prepareTime(instrumented ? timer.nsecsElapsed() / 1000 : 0);
+        if (instrumented)
+            timer.restart();
+
         if (!execute(query, batch)){
             qWarning() << "Could not execute query" << descriptor;
+        } else if (instrumented) {
+            // The results of a select are consumed by the caller, so only the rows
+            // affected by a modifying statement can be counted without re-executing it
+            const qint64 rows(query.isSelect() ? 0 : query.numRowsAffected());
+            recordQuery(descriptor, sql, rows, prepareTime, timer.nsecsElapsed() / 1000);
         }
     }
 
     return query;
 }
 
+void QMailStorePrivate::recordQuery(const QString &descriptor, const QString &sql, qint64 rows, qint64 prepareTime, qint64 stepTime) const
+{
+    QMailStore::QueryStatistics &entry(statistics[descriptor]);
+    entry.descriptor = descriptor;
+    ++entry.executions;
+    entry.rows += rows;
+    entry.prepareTime += prepareTime;
+    entry.stepTime += stepTime;
+
+    if (operationDepth > 0) {
+        // Identical statement text implies the same query, differing only in the bound values
+        QPair<QString, int> &count(operationStatements[sql]);
+        if ((count.second > 0) || previousStatements.contains(sql))
+            ++entry.repeatedExecutions;
+
+        count.first = descriptor;
+        ++count.second;
+    }
+}
+
+void QMailStorePrivate::beginInstrumentedOperation(const QString &description) const
+{
+    if (operationDepth++ == 0) {
+        operationDescription = description;
+        operationStatements.clear();
+    }
+}
+
+void QMailStorePrivate::endInstrumentedOperation() const
+{
+    if (--operationDepth > 0)
+        return;
+
+    // Operations satisfied from the caches do not interrupt a sequence of repetitions
+    if (operationStatements.isEmpty())
+        return;
+
+    QSet<QString> statements;
+    bool repeated(true);
+
+    QHash<QString, QPair<QString, int> >::const_iterator it = operationStatements.constBegin(), end = operationStatements.constEnd();
+    for ( ; it != end; ++it) {
+        if (it.value().second >= RepeatedStatementThreshold) {
+            qMailLog(StoreProfile) << "Repeated statement in" << qPrintable(operationDescription) << "-"
+                                   << qPrintable(it.value().first) << "executed" << it.value().second << "times";
+        }
+
+        if (!previousStatements.contains(it.key()))
+            repeated = false;
+        statements.insert(it.key());
+    }
+
+    // Successive operations performing the same statements indicate a caller
+    // iterating over identifiers, where a single operation using a key would suffice
+    if (repeated) {
+        ++repeatedOperations;
+        if ((repeatedOperations >= RepeatedOperationThreshold) && ((repeatedOperations & (repeatedOperations - 1)) == 0)) {
+            qMailLog(StoreProfile) << "Performed" << qPrintable(operationDescription) << repeatedOperations << "times in succession";
+        }
+    } else {
+        repeatedOperations = 0;
+    }
+
+    previousStatements = statements;
+    operationStatements.clear();
+}
+
+void QMailStorePrivate::setInstrumentationEnabled(bool enabled, int logInterval)
+{
+    instrumented = enabled;
+
+    if (enabled && (logInterval > 0)) {
+        statisticsLogTimer.start(logInterval * 1000);
+    } else {
+        statisticsLogTimer.stop();
+    }
+}
+
+bool QMailStorePrivate::instrumentationEnabled() const
+{
+    return instrumented;
+}
+
+bool QMailStorePrivate::setSharedCacheAccess(QMailStore::SharedCacheAccess access)
+{
+    sharedAccess = access;
+    sharedAttachTimer.start();
+
+    return sharedCache.attach(databaseIdentifier(), access);
+}
+
+QMailStore::SharedCacheAccess QMailStorePrivate::sharedCacheAccess() const
+{
+    return sharedAccess;
+}
+
+void QMailStorePrivate::setStoreProfile(const QMailStore::StoreProfile &newProfile)
+{
+    profile = newProfile;
+
+    if (databaseptr) {
+        configureDatabase(databaseptr);
+
+        if (profile.connectionLifetime > 0) {
+            databaseUnloadTimer.start(profile.connectionLifetime);
+        } else {
+            databaseUnloadTimer.stop();
+        }
+    }
+}
+
+QMailStore::StoreProfile QMailStorePrivate::storeProfile() const
+{
+    return profile;
+}
+
+// Readers may start before any writer has created the shared cache; retry
+// the attachment periodically rather than on every lookup
+bool QMailStorePrivate::attachSharedCache() const
+{
+    if (sharedCache.isAttached())
+        return true;
+
+    if ((sharedAccess == QMailStore::NoSharedCacheAccess) ||
+        (sharedAttachTimer.isValid() && (sharedAttachTimer.elapsed() < SharedCacheAttachInterval)))
+        return false;
+
+    sharedAttachTimer.start();
+    return sharedCache.attach(databaseIdentifier(), sharedAccess);
+}
+
+void QMailStorePrivate::setKeyCompilationEnabled(bool enabled)
+{
+    keyCompilation = enabled;
+    whereClauseCache.clear();
+}
+
+static bool moreExpensive(const QMailStore::QueryStatistics &lhs, const QMailStore::QueryStatistics &rhs)
+{
+    return (lhs.prepareTime + lhs.stepTime) > (rhs.prepareTime + rhs.stepTime);
+}
+
+QList<QMailStore::QueryStatistics> QMailStorePrivate::queryStatistics() const
+{
+    QList<QMailStore::QueryStatistics> result(statistics.values());
+    std::sort(result.begin(), result.end(), moreExpensive);
+    return result;
+}
+
+QMailStore::ContentionStatistics QMailStorePrivate::contentionStatistics() const
+{
+    return contention;
+}
+
+void QMailStorePrivate::resetStatistics()
+{
+    statistics.clear();
+    contention = QMailStore::ContentionStatistics();
+    previousStatements.clear();
+    repeatedOperations = 0;
+}
+
+void QMailStorePrivate::logStatistics()
+{
+    qMailLog(StoreProfile) << "Transactions:" << contention.transactions
+                           << "lock wait:" << contention.lockWaitTime / 1000 << "ms"
+                           << "busy retries:" << contention.busyRetries;
+
+    foreach (const QMailStore::QueryStatistics &entry, queryStatistics()) {
+        qMailLog(StoreProfile) << qPrintable(entry.descriptor)
+                               << "- executions:" << entry.executions
+                               << "repeated:" << entry.repeatedExecutions
+                               << "rows:" << entry.rows
+                               << "prepare:" << entry.prepareTime / 1000 << "ms"
+                               << "step:" << entry.stepTime / 1000 << "ms";
+    }
+}
+
 void QMailStorePrivate::emitIpcNotification(QMailStoreImplementation::AccountUpdateSignal signal, const QMailAccountIdList &ids)
 {
     if ((signal == &QMailStore::accountsUpdated) || (signal == &QMailStore::accountsRemoved)) {
@@ -9636,8 +11766,10 @@ void QMailStorePrivate::emitIpcNotification(QMailStoreImplementation::MessageUpd
     Q_ASSERT(!ids.contains(QMailMessageId()));
 
     if ((signal == &QMailStore::messagesUpdated) || (signal == &QMailStore::messagesRemoved)) {
-        foreach (const QMailMessageId &id, ids)
+        foreach (const QMailMessageId &id, ids) {
             messageCache.remove(id);
+            sharedCache.remove(id);
+        }
     }
 
     QMailStoreImplementation::emitIpcNotification(signal, ids);
@@ -9653,6 +11785,7 @@ void QMailStorePrivate::emitIpcNotification(QMailStoreImplementation::MessageDat
         {
             messageCache.insert(metaData);
             uidCache.insert(qMakePair(metaData.parentAccountId(), metaData.serverUid()), metaData.id());
+            sharedCache.insert(metaData);
 
             ids.append(metaData.id());
         }
@@ -9762,7 +11895,9 @@ void QMailStorePrivate::emitIpcNotification(const QMailMessageIdList& ids,  cons
 
             metaData.setUnmodified();
             messageCache.insert(metaData);
-
+            sharedCache.insert(metaData);
+        } else {
+            sharedCache.remove(id);
         }
     }
 
@@ -9780,6 +11915,9 @@ void QMailStorePrivate::emitIpcNotification(const QMailMessageIdList& ids, quint
             metaData.setStatus(status, set);
             metaData.setUnmodified();
             messageCache.insert(metaData);
+            sharedCache.insert(metaData);
+        } else {
+            sharedCache.remove(id);
         }
     }
 
@@ -46,8 +46,12 @@
 //
 
 #include "qmailstoreimplementation_p.h"
+#include "qmailstoresharedcache_p.h"
 #include <QSqlDatabase>
 #include <QCache>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
 #include <QTimer>
 
 //#define QMAILSTORE_LOG_SQL //define to enable SQL query logging
@@ -58,6 +62,7 @@
 #endif
 
 class ProcessMutex;
+class QMailContentPurger;
 
 struct ThreadUpdateData
 {
@@ -116,6 +121,8 @@ public:
 
     class Transaction;
     struct ReadLock;
+    struct InstrumentationScope;
+    struct ThreadRebuild;
     class Key;
 
     struct ReadAccess {};
@@ -177,11 +184,29 @@ public:
                                 QMailMessageIdList *updatedMessageIds, QMailThreadIdList *modifiedThreads, QMailFolderIdList *modifiedFolderIds, QMailAccountIdList *modifiedAccountIds);
 
     virtual bool ensureDurability();
+    virtual bool performMaintenance(int timeLimit);
+    virtual bool rebuildThreads(int timeLimit);
+    virtual bool enableIncrementalVacuum();
+
+    virtual void setInstrumentationEnabled(bool enabled, int logInterval);
+    virtual bool instrumentationEnabled() const;
+    virtual QList<QMailStore::QueryStatistics> queryStatistics() const;
+    virtual QMailStore::ContentionStatistics contentionStatistics() const;
+    virtual void resetStatistics();
+
+    virtual bool setSharedCacheAccess(QMailStore::SharedCacheAccess access);
+    virtual QMailStore::SharedCacheAccess sharedCacheAccess() const;
+
+    virtual void setStoreProfile(const QMailStore::StoreProfile &profile);
+    virtual QMailStore::StoreProfile storeProfile() const;
     virtual bool shrinkMemory();
 
     virtual void lock();
     virtual void unlock();
 
+    virtual bool beginReadSnapshot();
+    virtual void endReadSnapshot();
+
     virtual bool purgeMessageRemovalRecords(const QMailAccountId &accountId, const QStringList &serverUids);
 
     virtual int countAccounts(const QMailAccountKey &key) const;
@@ -191,9 +216,12 @@ public:
 
     virtual int sizeOfMessages(const QMailMessageKey &key) const;
 
+    virtual QMap<quint64, QMailStore::MessageGroupCounts> countMessagesGrouped(const QMailMessageKey &key, QMailStore::MessageGrouping grouping, const QList<QMailMessageKey> &subsetKeys) const;
+
     virtual QMailAccountIdList queryAccounts(const QMailAccountKey &key, const QMailAccountSortKey &sortKey, uint limit, uint offset) const;
     virtual QMailFolderIdList queryFolders(const QMailFolderKey &key, const QMailFolderSortKey &sortKey, uint limit, uint offset) const;
     virtual QMailMessageIdList queryMessages(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, uint limit, uint offset) const;
+    virtual QMailMessageIdList queryMessagePage(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, uint limit, QByteArray *continuation) const;
     virtual QMailThreadIdList queryThreads(const QMailThreadKey &key, const QMailThreadSortKey &sortKey, uint limit, uint offset) const;
 
     virtual QMailAccount account(const QMailAccountId &id) const;
@@ -208,6 +236,8 @@ public:
 
     virtual QMailMessageMetaData messageMetaData(const QMailMessageId &id) const;
     virtual QMailMessageMetaData messageMetaData(const QString &uid, const QMailAccountId &accountId) const;
+    virtual QMailMessageMetaData messageMetaData(const QMailMessageId &id, const QMailMessageKey::Properties &properties) const;
+    virtual bool cachedMessageMetaData(const QMailMessageId &id, QMailMessageMetaData *metaData) const;
     virtual QMailMessageMetaDataList messagesMetaData(const QMailMessageKey &key, const QMailMessageKey::Properties &properties, QMailStore::ReturnOption option) const;
 
     virtual QMailThreadList threads(const QMailThreadKey &key, QMailStore::ReturnOption option) const;
@@ -227,6 +257,8 @@ public:
 
     QString buildWhereClause(const Key& key, bool nested = false, bool firstClause = true) const;
     QVariantList whereClauseValues(const Key& key) const;
+    bool messagePageStatements(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, const QByteArray &continuation,
+                               QList<QPair<QString, QVariantList> > *statements, quint32 *signature) const;
 
     static QString expandValueList(const QVariantList& valueList);
     static QString expandValueList(int valueCount);
@@ -234,6 +266,12 @@ public:
     static QString temporaryTableName(const QMailMessageKey::ArgumentType &arg);
 
     virtual QMap<QString, QString> messageCustomFields(const QMailMessageId &id);
+    virtual QStringList messageQueryPlan(const QMailMessageKey &key, const QMailMessageSortKey &sortKey) const;
+    virtual QStringList messagePageQueryPlan(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, const QByteArray &continuation) const;
+    virtual void setKeyCompilationEnabled(bool enabled);
+
+    QString compiledWhereClause(const Key& key, bool firstClause = true) const;
+    QString keyShape(const Key& key, bool firstClause = true) const;
 
     template<typename ValueType>
     static ValueType extractValue(const QVariant& var, const ValueType &defaultValue = ValueType());
@@ -241,10 +279,13 @@ public:
     enum AttemptResult { Success = 0, Failure, DatabaseFailure };
 public slots:
     void unloadDatabase();
+    void logStatistics();
+    void obsoleteContentPurged(const QVariantList &rowIds);
     
 private:
     friend class Transaction;
     friend struct ReadLock;
+    friend struct InstrumentationScope;
 
     static ProcessMutex& contentManagerMutex(void);
 
@@ -272,7 +313,14 @@ private:
 
     bool upgradeTimeStampToUtc();
 
-    bool fullThreadTableUpdate();
+    AttemptResult threadMessage(QMailMessageMetaData *metaData);
+
+    bool continueThreadRebuild(const QElapsedTimer &timer, int timeLimit, bool *completed);
+    bool loadThreadRebuild(const QElapsedTimer &timer, int timeLimit, bool *completed);
+    bool stageThreadRebuild(const QElapsedTimer &timer, int timeLimit, bool *completed);
+    bool swapThreadRebuild(const QElapsedTimer &timer, int timeLimit, bool *completed);
+    void abandonThreadRebuild();
+    void reportThreadRebuildProgress();
 
     bool createTable(const QString &name);
 
@@ -294,12 +342,19 @@ private:
 
     bool setupFolders(const QList<FolderInfo> &folderList);
 
-    bool purgeMissingAncestors();
-    bool purgeObsoleteFiles();
+    typedef bool (QMailStorePrivate::*MaintenanceFunction)(const QElapsedTimer &timer, int timeLimit, bool *completed);
+
+    bool rebuildThreadsIfRequired(const QElapsedTimer &timer, int timeLimit, bool *completed);
+    bool purgeMissingAncestors(const QElapsedTimer &timer, int timeLimit, bool *completed);
+    bool purgeObsoleteFiles(const QElapsedTimer &timer, int timeLimit, bool *completed);
+    bool analyzeTables(const QElapsedTimer &timer, int timeLimit, bool *completed);
+    bool reclaimFreePages(const QElapsedTimer &timer, int timeLimit, bool *completed);
 
-    bool performMaintenanceTask(const QString &task, uint secondsFrequency, bool (QMailStorePrivate::*func)(void));
+    bool maintenanceDue(const QString &task, uint secondsFrequency, bool *due);
+    bool recordMaintenance(const QString &task);
 
-    bool performMaintenance();
+    bool performMaintenanceTask(const QString &task, uint secondsFrequency, MaintenanceFunction func,
+                                const QElapsedTimer &timer, int timeLimit, bool *completed);
 
     void createTemporaryTable(const QMailMessageKey::ArgumentType &arg, const QString &dataType) const;
     void destroyTemporaryTables(void);
@@ -317,6 +372,10 @@ private:
 
     QSqlQuery performQuery(const QString& statement, bool batch, const QVariantList& bindValues, const QList<Key>& keys, const QPair<uint, uint> &constraint, const QString& descriptor);
 
+    void recordQuery(const QString &descriptor, const QString &sql, qint64 rows, qint64 prepareTime, qint64 stepTime) const;
+    void beginInstrumentedOperation(const QString &description) const;
+    void endInstrumentedOperation() const;
+
     bool executeFile(QFile &file);
 
     QSqlQuery simpleQuery(const QString& statement, const QString& descriptor);
@@ -342,6 +401,8 @@ private:
     bool checkPreconditions(const QMailFolder& folder, bool update = false);
 
     void preloadHeaderCache(const QMailMessageId& id) const;
+    bool attachSharedCache() const;
+    void configureDatabase(QSqlDatabase *db) const;
     void preloadThreadCache(const QMailThreadId& id) const;
 
     QMailFolderIdList folderAncestorIds(const QMailFolderIdList& ids, bool inTransaction, AttemptResult *result) const;
@@ -395,12 +456,16 @@ private:
     void removeExpiredData(const QMailMessageIdList& messageIds,
                            const QMailThreadIdList& threadIds,
                            const QStringList& mailfiles,
+                           const QVariantList& mailfileRowIds,
                            const QMailFolderIdList& folderIds = QMailFolderIdList(),
                            const QMailAccountIdList& accountIds = QMailAccountIdList());
 
     AttemptResult findPotentialPredecessorsBySubject(QMailMessageMetaData *metaData, const QString& baseSubject, bool* missingAncestor, QList<quint64>& potentialPredecessors);
 
     bool obsoleteContent(const QString& identifier);
+    bool obsoleteContent(const QStringList& identifiers, QVariantList *rowIds);
+
+    QMailContentPurger *contentPurger();
 
     template<typename AccessType, typename FunctionType>
     bool repeatedly(FunctionType func, const QString &description, Transaction *t = Q_NULLPTR) const;
@@ -610,6 +675,10 @@ private:
                                         int *result, 
                                         ReadLock &);
 
+    AttemptResult attemptCountMessagesGrouped(const QMailMessageKey &key, QMailStore::MessageGrouping grouping, const QList<QMailMessageKey> &subsetKeys,
+                                              QMap<quint64, QMailStore::MessageGroupCounts> *result,
+                                              ReadLock &);
+
     AttemptResult attemptQueryAccounts(const QMailAccountKey &key, const QMailAccountSortKey &sortKey, uint limit, uint offset,
                                        QMailAccountIdList *ids, 
                                        ReadLock &);
@@ -622,6 +691,18 @@ private:
                                        QMailMessageIdList *ids, 
                                        ReadLock &);
 
+    AttemptResult attemptMessageQueryPlan(const QMailMessageKey &key, const QMailMessageSortKey &sortKey,
+                                          QStringList *plan,
+                                          ReadLock &);
+
+    AttemptResult attemptQueryMessagePage(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, uint limit, QByteArray *continuation,
+                                          QMailMessageIdList *ids,
+                                          ReadLock &);
+
+    AttemptResult attemptMessagePageQueryPlan(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, const QByteArray &continuation,
+                                              QStringList *plan,
+                                              ReadLock &);
+
     AttemptResult attemptQueryThreads(const QMailThreadKey &key, const QMailThreadSortKey &sortKey, uint limit, uint offset,
                                       QMailThreadIdList *ids,
                                       ReadLock &);
@@ -728,6 +809,7 @@ private:
     static const int uidCacheSize = 500;
     static const int folderCacheSize = 100;
     static const int accountCacheSize = 10;
+    static const int whereClauseCacheSize = 100;
     static const int lookAhead = 5;
 
     static QString parseSql(QTextStream& ts);
@@ -781,6 +863,7 @@ private:
     QSqlDatabase *database() const;
     mutable QSqlDatabase *databaseptr;
     mutable QTimer databaseUnloadTimer;
+    QMailStore::StoreProfile profile;
 
     mutable QMailMessageIdList lastQueryMessageResult;
     mutable QMailThreadIdList lastQueryThreadResult;
@@ -791,6 +874,16 @@ private:
     mutable IdCache<QMailAccount, QMailAccountId> accountCache;
     mutable IdCache<QMailThread, QMailThreadId> threadCache;
 
+    mutable QMailStoreSharedCache sharedCache;
+    QMailStore::SharedCacheAccess sharedAccess;
+    mutable QElapsedTimer sharedAttachTimer;
+
+    ThreadRebuild *threadRebuild;
+    QMailContentPurger *purger;
+
+    bool keyCompilation;
+    mutable Cache<QString, QString> whereClauseCache;
+
     mutable QList<QPair<const QMailMessageKey::ArgumentType*, QString> > requiredTableKeys;
     mutable QList<const QMailMessageKey::ArgumentType*> temporaryTableKeys;
     QList<const QMailMessageKey::ArgumentType*> expiredTableKeys;
@@ -803,6 +896,19 @@ private:
     static ProcessMutex *contentMutex;
 
     int globalLocks;
+
+    int readSnapshotDepth;
+    bool inReadSnapshot;
+
+    bool instrumented;
+    QTimer statisticsLogTimer;
+    mutable QHash<QString, QMailStore::QueryStatistics> statistics;
+    mutable QMailStore::ContentionStatistics contention;
+    mutable int operationDepth;
+    mutable QString operationDescription;
+    mutable QHash<QString, QPair<QString, int> > operationStatements;
+    mutable QSet<QString> previousStatements;
+    mutable int repeatedOperations;
 };
 
 template <typename ValueType>
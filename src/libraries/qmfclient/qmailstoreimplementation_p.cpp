@@ -32,6 +32,7 @@
 ****************************************************************************/
 
 #include "qmailstoreimplementation_p.h"
+#include "qmailstoreworker_p.h"
 #include <qmailipc.h>
 #include "qmaillog.h"
 #include <qcopadaptor_p.h>
@@ -143,6 +144,45 @@ void emitIpcUpdates(const QMailMessageIdList& ids,  quint64 status, bool set, co
     }
 }
 
+// Records a notification in the form that emitIpcNotification() consumes
+template<typename ValueType>
+void recordNotification(QMailStoreImplementationBase::NotificationList *record, const QString &sig, const ValueType &value)
+{
+    if (record) {
+        QByteArray data;
+        {
+            QDataStream ds(&data, QIODevice::WriteOnly);
+            ds << pid << value;
+        }
+        record->append(qMakePair(sig, data));
+    }
+}
+
+void recordNotification(QMailStoreImplementationBase::NotificationList *record, const QMailMessageIdList& ids,
+                        const QMailMessageKey::Properties& properties, const QMailMessageMetaData& data)
+{
+    if (record) {
+        QByteArray notification;
+        {
+            QDataStream ds(&notification, QIODevice::WriteOnly);
+            ds << pid << ids << int(properties) << data;
+        }
+        record->append(qMakePair(QMailStoreImplementationBase::messagePropertyUpdatedSig(), notification));
+    }
+}
+
+void recordNotification(QMailStoreImplementationBase::NotificationList *record, const QMailMessageIdList& ids, quint64 status, bool set)
+{
+    if (record) {
+        QByteArray notification;
+        {
+            QDataStream ds(&notification, QIODevice::WriteOnly);
+            ds << pid << ids << status << set;
+        }
+        record->append(qMakePair(QMailStoreImplementationBase::messageStatusUpdatedSig(), notification));
+    }
+}
+
 template<typename IDSetType>
 void dispatchNotifications(IDSetType &ids, const QString &sig)
 {
@@ -198,7 +238,9 @@ QMailStoreImplementationBase::QMailStoreImplementationBase(QMailStore* parent)
       asyncEmission(false),
       retrievalSetInitialized(false),
       transmissionSetInitialized(false),
-      watcher(0)
+      watcher(0),
+      notificationRecord(0),
+      worker(0)
 {
     Q_ASSERT(q);
 
@@ -231,6 +273,7 @@ QMailStoreImplementationBase::QMailStoreImplementationBase(QMailStore* parent)
 
 QMailStoreImplementationBase::~QMailStoreImplementationBase()
 {
+    delete worker;
 }
 
 void QMailStoreImplementationBase::initialize()
@@ -388,6 +431,7 @@ static NotifyFunctionMap initMessageDataFunctions()
 void QMailStoreImplementationBase::notifyAccountsChange(QMailStore::ChangeType changeType, const QMailAccountIdList& ids)
 {
     static NotifyFunctionMap sig(initAccountFunctions());
+    recordNotification(notificationRecord, sig[changeType], ids);
 
     // Use the preFlushTimer to activate buffering when multiple changes occur proximately
     if (preFlushTimer.isActive() || flushTimer.isActive()) {
@@ -425,6 +469,7 @@ void QMailStoreImplementationBase::notifyAccountsChange(QMailStore::ChangeType c
 void QMailStoreImplementationBase::notifyMessagesChange(QMailStore::ChangeType changeType, const QMailMessageIdList& ids)
 {
     static NotifyFunctionMap sig(initMessageFunctions());
+    recordNotification(notificationRecord, sig[changeType], ids);
 
     // Use the preFlushTimer to activate buffering when multiple changes occur proximately
     if (preFlushTimer.isActive() || flushTimer.isActive()) {
@@ -462,6 +507,7 @@ void QMailStoreImplementationBase::notifyMessagesChange(QMailStore::ChangeType c
 void QMailStoreImplementationBase::notifyMessagesDataChange(QMailStore::ChangeType changeType, const QMailMessageMetaDataList& data)
 {
     static NotifyFunctionMap sig(initMessageDataFunctions());
+    recordNotification(notificationRecord, sig[changeType], data);
     // Use the preFlushTimer to activate buffering when multiple changes occur proximately
     if (preFlushTimer.isActive() || flushTimer.isActive()) {
         if (!flushTimer.isActive()) {
@@ -492,6 +538,8 @@ void QMailStoreImplementationBase::notifyMessagesDataChange(QMailStore::ChangeTy
 void QMailStoreImplementationBase::notifyMessagesDataChange(const QMailMessageIdList& ids,  const QMailMessageKey::Properties& properties,
                                                             const QMailMessageMetaData& data)
 {
+    recordNotification(notificationRecord, ids, properties, data);
+
     // Use the preFlushTimer to activate buffering when multiple changes occur proximately
     if (preFlushTimer.isActive() || flushTimer.isActive()) {
         if (!flushTimer.isActive()) {
@@ -511,6 +559,8 @@ void QMailStoreImplementationBase::notifyMessagesDataChange(const QMailMessageId
 
 void QMailStoreImplementationBase::notifyMessagesDataChange(const QMailMessageIdList& ids,  quint64 status, bool set)
 {
+    recordNotification(notificationRecord, ids, status, set);
+
     // Use the preFlushTimer to activate buffering when multiple changes occur proximately
     if (preFlushTimer.isActive() || flushTimer.isActive()) {
         if (!flushTimer.isActive()) {
@@ -531,6 +581,7 @@ void QMailStoreImplementationBase::notifyMessagesDataChange(const QMailMessageId
 void QMailStoreImplementationBase::notifyThreadsChange(QMailStore::ChangeType changeType, const QMailThreadIdList& ids)
 {
     static NotifyFunctionMap sig(initThreadFunctions());
+    recordNotification(notificationRecord, sig[changeType], ids);
 
     // Use the preFlushTimer to activate buffering when multiple changes occur proximately
     if (preFlushTimer.isActive() || flushTimer.isActive()) {
@@ -569,6 +620,7 @@ void QMailStoreImplementationBase::notifyThreadsChange(QMailStore::ChangeType ch
 void QMailStoreImplementationBase::notifyFoldersChange(QMailStore::ChangeType changeType, const QMailFolderIdList& ids)
 {
     static NotifyFunctionMap sig(initFolderFunctions());
+    recordNotification(notificationRecord, sig[changeType], ids);
 
     // Use the preFlushTimer to activate buffering when multiple changes occur proximately
     if (preFlushTimer.isActive() || flushTimer.isActive()) {
@@ -606,6 +658,7 @@ void QMailStoreImplementationBase::notifyFoldersChange(QMailStore::ChangeType ch
 void QMailStoreImplementationBase::notifyMessageRemovalRecordsChange(QMailStore::ChangeType changeType, const QMailAccountIdList& ids)
 {
     static NotifyFunctionMap sig(initMessageRemovalRecordFunctions());
+    recordNotification(notificationRecord, sig[changeType], ids);
 
     // Use the preFlushTimer to activate buffering when multiple changes occur proximately
     if (preFlushTimer.isActive() || flushTimer.isActive()) {
@@ -689,6 +742,40 @@ void QMailStoreImplementationBase::reconnectIpc()
     ipcChannel->connectRepeatedly();
 }
 
+/*
+    While \a record is set, each change notified by this store is also appended to it,
+    so that it can be delivered to another store instance by processNotifications().
+*/
+void QMailStoreImplementationBase::setNotificationRecord(NotificationList *record)
+{
+    notificationRecord = record;
+}
+
+/*
+    Emits the changes in \a notifications, recorded by a store instance in another
+    thread of this process, as if they had been received from another process.
+    Notifications already queued are emitted first, and all are emitted before
+    this function returns.
+*/
+void QMailStoreImplementationBase::processNotifications(const NotificationList &notifications)
+{
+    if (notifications.isEmpty())
+        return;
+
+    messageQueue += notifications;
+
+    queueTimer.stop();
+    while (emitIpcNotification()) {}
+}
+
+QMailStoreWorker *QMailStoreImplementationBase::asyncWorker()
+{
+    if (!worker)
+        worker = new QMailStoreWorker(this);
+
+    return worker;
+}
+
 QString QMailStoreImplementationBase::accountAddedSig()
 {
     return QStringLiteral("accountAdded(uint,QList<quint64>)");
@@ -1169,6 +1256,63 @@ bool QMailStoreNullImplementation::ensureDurability()
     return false;
 }
 
+bool QMailStoreNullImplementation::performMaintenance(int)
+{
+    return false;
+}
+
+bool QMailStoreNullImplementation::rebuildThreads(int)
+{
+    return false;
+}
+
+bool QMailStoreNullImplementation::enableIncrementalVacuum()
+{
+    return false;
+}
+
+void QMailStoreNullImplementation::setInstrumentationEnabled(bool, int)
+{
+}
+
+bool QMailStoreNullImplementation::instrumentationEnabled() const
+{
+    return false;
+}
+
+QList<QMailStore::QueryStatistics> QMailStoreNullImplementation::queryStatistics() const
+{
+    return QList<QMailStore::QueryStatistics>();
+}
+
+QMailStore::ContentionStatistics QMailStoreNullImplementation::contentionStatistics() const
+{
+    return QMailStore::ContentionStatistics();
+}
+
+void QMailStoreNullImplementation::resetStatistics()
+{
+}
+
+bool QMailStoreNullImplementation::setSharedCacheAccess(QMailStore::SharedCacheAccess)
+{
+    return false;
+}
+
+QMailStore::SharedCacheAccess QMailStoreNullImplementation::sharedCacheAccess() const
+{
+    return QMailStore::NoSharedCacheAccess;
+}
+
+void QMailStoreNullImplementation::setStoreProfile(const QMailStore::StoreProfile &)
+{
+}
+
+QMailStore::StoreProfile QMailStoreNullImplementation::storeProfile() const
+{
+    return QMailStore::StoreProfile();
+}
+
 void QMailStoreNullImplementation::lock()
 {
 }
@@ -1177,6 +1321,15 @@ void QMailStoreNullImplementation::unlock()
 {
 }
 
+bool QMailStoreNullImplementation::beginReadSnapshot()
+{
+    return false;
+}
+
+void QMailStoreNullImplementation::endReadSnapshot()
+{
+}
+
 bool QMailStoreNullImplementation::purgeMessageRemovalRecords(const QMailAccountId &, const QStringList &)
 {
     return false;
@@ -1207,6 +1360,11 @@ int QMailStoreNullImplementation::sizeOfMessages(const QMailMessageKey &) const
     return 0;
 }
 
+QMap<quint64, QMailStore::MessageGroupCounts> QMailStoreNullImplementation::countMessagesGrouped(const QMailMessageKey &, QMailStore::MessageGrouping, const QList<QMailMessageKey> &) const
+{
+    return QMap<quint64, QMailStore::MessageGroupCounts>();
+}
+
 QMailAccountIdList QMailStoreNullImplementation::queryAccounts(const QMailAccountKey &, const QMailAccountSortKey &, uint, uint) const
 {
     return QMailAccountIdList();
@@ -1222,6 +1380,11 @@ QMailMessageIdList QMailStoreNullImplementation::queryMessages(const QMailMessag
     return QMailMessageIdList();
 }
 
+QMailMessageIdList QMailStoreNullImplementation::queryMessagePage(const QMailMessageKey &, const QMailMessageSortKey &, uint, QByteArray *) const
+{
+    return QMailMessageIdList();
+}
+
 QMailThreadIdList QMailStoreNullImplementation::queryThreads(const QMailThreadKey &, const QMailThreadSortKey &, uint, uint) const
 {
     return QMailThreadIdList();
@@ -1267,6 +1430,16 @@ QMailMessageMetaData QMailStoreNullImplementation::messageMetaData(const QString
     return QMailMessageMetaData();
 }
 
+QMailMessageMetaData QMailStoreNullImplementation::messageMetaData(const QMailMessageId &, const QMailMessageKey::Properties &) const
+{
+    return QMailMessageMetaData();
+}
+
+bool QMailStoreNullImplementation::cachedMessageMetaData(const QMailMessageId &, QMailMessageMetaData *) const
+{
+    return false;
+}
+
 QMailMessageMetaDataList QMailStoreNullImplementation::messagesMetaData(const QMailMessageKey &, const QMailMessageKey::Properties &, QMailStore::ReturnOption) const
 {
     return QMailMessageMetaDataList();
@@ -1317,6 +1490,20 @@ QMap<QString, QString> QMailStoreNullImplementation::messageCustomFields(const Q
     return QMap<QString, QString>();
 }
 
+QStringList QMailStoreNullImplementation::messageQueryPlan(const QMailMessageKey &, const QMailMessageSortKey &) const
+{
+    return QStringList();
+}
+
+QStringList QMailStoreNullImplementation::messagePageQueryPlan(const QMailMessageKey &, const QMailMessageSortKey &, const QByteArray &) const
+{
+    return QStringList();
+}
+
+void QMailStoreNullImplementation::setKeyCompilationEnabled(bool)
+{
+}
+
 bool QMailStoreNullImplementation::initStore()
 {
     return false;
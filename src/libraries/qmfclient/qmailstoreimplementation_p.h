@@ -58,6 +58,8 @@ class QFileSystemWatcher;
 
 QT_END_NAMESPACE
 
+class QMailStoreWorker;
+
 class QMF_EXPORT QMailStoreImplementationBase : public QObject
 {
     Q_OBJECT
@@ -96,6 +98,13 @@ public:
     void disconnectIpc();
     void reconnectIpc();
 
+    typedef QList<QPair<QString, QByteArray> > NotificationList;
+
+    void setNotificationRecord(NotificationList *record);
+    void processNotifications(const NotificationList &notifications);
+
+    QMailStoreWorker *asyncWorker();
+
     static QString accountAddedSig();
     static QString accountRemovedSig();
     static QString accountUpdatedSig();
@@ -226,6 +235,9 @@ private:
     QList<QPair<QString, QByteArray> > messageQueue;
     class QCopChannel* ipcChannel;
     class QFileSystemWatcher* watcher;
+
+    NotificationList *notificationRecord;
+    QMailStoreWorker *worker;
 };
 
 
@@ -285,10 +297,28 @@ public:
                               QMailThreadIdList *updatedThreadIds) = 0;
 
     virtual bool ensureDurability() = 0;
+    virtual bool performMaintenance(int timeLimit) = 0;
+    virtual bool rebuildThreads(int timeLimit) = 0;
+    virtual bool enableIncrementalVacuum() = 0;
+
+    virtual void setInstrumentationEnabled(bool enabled, int logInterval) = 0;
+    virtual bool instrumentationEnabled() const = 0;
+    virtual QList<QMailStore::QueryStatistics> queryStatistics() const = 0;
+    virtual QMailStore::ContentionStatistics contentionStatistics() const = 0;
+    virtual void resetStatistics() = 0;
+
+    virtual bool setSharedCacheAccess(QMailStore::SharedCacheAccess access) = 0;
+    virtual QMailStore::SharedCacheAccess sharedCacheAccess() const = 0;
+
+    virtual void setStoreProfile(const QMailStore::StoreProfile &profile) = 0;
+    virtual QMailStore::StoreProfile storeProfile() const = 0;
 
     virtual void lock() = 0;
     virtual void unlock() = 0;
 
+    virtual bool beginReadSnapshot() = 0;
+    virtual void endReadSnapshot() = 0;
+
     virtual bool purgeMessageRemovalRecords(const QMailAccountId &accountId, const QStringList &serverUids) = 0;
 
     virtual int countAccounts(const QMailAccountKey &key) const = 0;
@@ -298,9 +328,12 @@ public:
 
     virtual int sizeOfMessages(const QMailMessageKey &key) const = 0;
 
+    virtual QMap<quint64, QMailStore::MessageGroupCounts> countMessagesGrouped(const QMailMessageKey &key, QMailStore::MessageGrouping grouping, const QList<QMailMessageKey> &subsetKeys) const = 0;
+
     virtual QMailAccountIdList queryAccounts(const QMailAccountKey &key, const QMailAccountSortKey &sortKey, uint limit, uint offset) const = 0;
     virtual QMailFolderIdList queryFolders(const QMailFolderKey &key, const QMailFolderSortKey &sortKey, uint limit, uint offset) const = 0;
     virtual QMailMessageIdList queryMessages(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, uint limit, uint offset) const = 0;
+    virtual QMailMessageIdList queryMessagePage(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, uint limit, QByteArray *continuation) const = 0;
     virtual QMailThreadIdList queryThreads(const QMailThreadKey &key, const QMailThreadSortKey &sortKey, uint limit, uint offset) const = 0;
 
     virtual QMailAccount account(const QMailAccountId &id) const = 0;
@@ -315,6 +348,8 @@ public:
 
     virtual QMailMessageMetaData messageMetaData(const QMailMessageId &id) const = 0;
     virtual QMailMessageMetaData messageMetaData(const QString &uid, const QMailAccountId &accountId) const = 0;
+    virtual QMailMessageMetaData messageMetaData(const QMailMessageId &id, const QMailMessageKey::Properties &properties) const = 0;
+    virtual bool cachedMessageMetaData(const QMailMessageId &id, QMailMessageMetaData *metaData) const = 0;
     virtual QMailMessageMetaDataList messagesMetaData(const QMailMessageKey &key, const QMailMessageKey::Properties &properties, QMailStore::ReturnOption option) const = 0;
 
     virtual QMailThreadList threads(const QMailThreadKey &key, QMailStore::ReturnOption option) const = 0;
@@ -330,6 +365,9 @@ public:
     virtual bool registerMessageStatusFlag(const QString &name) = 0;
     virtual quint64 messageStatusMask(const QString &name) const = 0;
     virtual QMap<QString, QString> messageCustomFields(const QMailMessageId &id) = 0;
+    virtual QStringList messageQueryPlan(const QMailMessageKey &key, const QMailMessageSortKey &sortKey) const = 0;
+    virtual QStringList messagePageQueryPlan(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, const QByteArray &continuation) const = 0;
+    virtual void setKeyCompilationEnabled(bool enabled) = 0;
 };
 
 class QMF_EXPORT QMailStoreNullImplementation : public QMailStoreImplementation
@@ -388,10 +426,28 @@ public:
                                  QMailThreadIdList *updatedThreadIds);
 
     virtual bool ensureDurability();
+    virtual bool performMaintenance(int timeLimit);
+    virtual bool rebuildThreads(int timeLimit);
+    virtual bool enableIncrementalVacuum();
+
+    virtual void setInstrumentationEnabled(bool enabled, int logInterval);
+    virtual bool instrumentationEnabled() const;
+    virtual QList<QMailStore::QueryStatistics> queryStatistics() const;
+    virtual QMailStore::ContentionStatistics contentionStatistics() const;
+    virtual void resetStatistics();
+
+    virtual bool setSharedCacheAccess(QMailStore::SharedCacheAccess access);
+    virtual QMailStore::SharedCacheAccess sharedCacheAccess() const;
+
+    virtual void setStoreProfile(const QMailStore::StoreProfile &profile);
+    virtual QMailStore::StoreProfile storeProfile() const;
 
     virtual void lock();
     virtual void unlock();
 
+    virtual bool beginReadSnapshot();
+    virtual void endReadSnapshot();
+
     virtual bool purgeMessageRemovalRecords(const QMailAccountId &accountId, const QStringList &serverUids);
 
     virtual int countAccounts(const QMailAccountKey &key) const;
@@ -401,9 +457,12 @@ public:
 
     virtual int sizeOfMessages(const QMailMessageKey &key) const;
 
+    virtual QMap<quint64, QMailStore::MessageGroupCounts> countMessagesGrouped(const QMailMessageKey &key, QMailStore::MessageGrouping grouping, const QList<QMailMessageKey> &subsetKeys) const;
+
     virtual QMailAccountIdList queryAccounts(const QMailAccountKey &key, const QMailAccountSortKey &sortKey, uint limit, uint offset) const;
     virtual QMailFolderIdList queryFolders(const QMailFolderKey &key, const QMailFolderSortKey &sortKey, uint limit, uint offset) const;
     virtual QMailMessageIdList queryMessages(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, uint limit, uint offset) const;
+    virtual QMailMessageIdList queryMessagePage(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, uint limit, QByteArray *continuation) const;
     virtual QMailThreadIdList queryThreads(const QMailThreadKey &key, const QMailThreadSortKey &sortKey, uint limit, uint offset) const;
 
     virtual QMailAccount account(const QMailAccountId &id) const;
@@ -418,6 +477,8 @@ public:
 
     virtual QMailMessageMetaData messageMetaData(const QMailMessageId &id) const;
     virtual QMailMessageMetaData messageMetaData(const QString &uid, const QMailAccountId &accountId) const;
+    virtual QMailMessageMetaData messageMetaData(const QMailMessageId &id, const QMailMessageKey::Properties &properties) const;
+    virtual bool cachedMessageMetaData(const QMailMessageId &id, QMailMessageMetaData *metaData) const;
     virtual QMailMessageMetaDataList messagesMetaData(const QMailMessageKey &key, const QMailMessageKey::Properties &properties, QMailStore::ReturnOption option) const;
 
     virtual QMailThreadList threads(const QMailThreadKey &key, QMailStore::ReturnOption option) const;
@@ -434,6 +495,9 @@ public:
     virtual quint64 messageStatusMask(const QString &name) const;
 
     virtual QMap<QString, QString> messageCustomFields(const QMailMessageId &id);
+    virtual QStringList messageQueryPlan(const QMailMessageKey &key, const QMailMessageSortKey &sortKey) const;
+    virtual QStringList messagePageQueryPlan(const QMailMessageKey &key, const QMailMessageSortKey &sortKey, const QByteArray &continuation) const;
+    virtual void setKeyCompilationEnabled(bool enabled);
 
 private:
     virtual bool initStore();
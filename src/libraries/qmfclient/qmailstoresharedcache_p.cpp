@@ -0,0 +1,441 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qmailstoresharedcache_p.h"
+#include "qmaillog.h"
+
+#include <QDateTime>
+
+#include <atomic>
+#include <string.h>
+
+namespace {
+
+const quint32 sharedCacheMagic = 0x514d4643;
+const quint32 sharedCacheVersion = 1;
+
+enum {
+    SenderLength = 128,
+    RecipientsLength = 192,
+    SubjectLength = 192
+};
+
+enum {
+    DateValid = 0x01
+};
+
+struct SharedCacheHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 capacity;
+    quint32 recordSize;
+};
+
+// Strings are stored in the encoding used by the mailmessages table, and are
+// never truncated: a message whose values do not fit is not cached at all
+bool encodeString(const QString &value, char *buffer, int capacity, quint16 *length)
+{
+    const QByteArray encoded(value.toUtf8());
+    if (encoded.length() > capacity)
+        return false;
+
+    memcpy(buffer, encoded.constData(), encoded.length());
+    *length = quint16(encoded.length());
+    return true;
+}
+
+}
+
+struct QMailStoreSharedEntry
+{
+    quint64 id;
+    quint64 parentFolderId;
+    quint64 parentAccountId;
+    quint64 status;
+    qint64 date;
+    quint32 size;
+    qint32 messageType;
+    quint16 senderLength;
+    quint16 recipientsLength;
+    quint16 subjectLength;
+    quint16 flags;
+    char sender[SenderLength];
+    char recipients[RecipientsLength];
+    char subject[SubjectLength];
+};
+
+// The entry is only meaningful if the sequence number is even, and has not
+// changed by the time the entry has been copied out
+struct QMailStoreSharedRecord
+{
+    QBasicAtomicInt sequence;
+    qint32 reserved;
+    QMailStoreSharedEntry entry;
+};
+
+#ifndef QT_NO_SHAREDMEMORY
+
+static void writeRecord(QMailStoreSharedRecord *record, const QMailStoreSharedEntry &entry)
+{
+    const int sequence = record->sequence.load();
+
+    record->sequence.store(sequence + 1);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(&record->entry, &entry, sizeof(entry));
+
+    record->sequence.storeRelease(sequence + 2);
+}
+
+static int segmentSize()
+{
+    return int(sizeof(SharedCacheHeader) + QMailStoreSharedCache::capacity * sizeof(QMailStoreSharedRecord));
+}
+
+#endif
+
+QMailStoreSharedCache::QMailStoreSharedCache()
+    : writable(false)
+{
+}
+
+QMailStoreSharedCache::~QMailStoreSharedCache()
+{
+    detach();
+}
+
+bool QMailStoreSharedCache::attach(const QString &identifier, QMailStore::SharedCacheAccess access)
+{
+    detach();
+
+    if (access == QMailStore::NoSharedCacheAccess)
+        return true;
+
+#ifndef QT_NO_SHAREDMEMORY
+    memory.setKey(QLatin1String("qmf-metadata-") + identifier);
+
+    bool existing = false;
+    if (access == QMailStore::SharedCacheWriteAccess) {
+        if (!memory.create(segmentSize())) {
+            if ((memory.error() != QSharedMemory::AlreadyExists) || !memory.attach()) {
+                qWarning() << "Unable to create shared metadata cache:" << memory.errorString();
+                return false;
+            }
+            existing = true;
+        }
+
+        // A newly created segment is zero filled
+        memory.lock();
+        SharedCacheHeader *header = static_cast<SharedCacheHeader *>(memory.data());
+        if ((header->magic == 0) && (memory.size() >= segmentSize())) {
+            header->magic = sharedCacheMagic;
+            header->version = sharedCacheVersion;
+            header->capacity = capacity;
+            header->recordSize = sizeof(QMailStoreSharedRecord);
+        }
+        memory.unlock();
+
+        writable = true;
+    } else if (!memory.attach(QSharedMemory::ReadOnly)) {
+        // The segment does not exist until a writer has created it
+        qMailLog(Messaging) << "Shared metadata cache not available:" << memory.errorString();
+        return false;
+    }
+
+    if (!compatible()) {
+        qWarning() << "Incompatible shared metadata cache - detaching";
+        detach();
+        return false;
+    }
+
+    if (!writable) {
+        foreach (int index, pending)
+            invalidate(index);
+    } else if (existing) {
+        // Changes made while this process was detached may not have been recorded
+        // by any writer, so start from an empty table
+        clear();
+    }
+    pending.clear();
+
+    return true;
+#else
+    Q_UNUSED(identifier)
+    return false;
+#endif
+}
+
+void QMailStoreSharedCache::detach()
+{
+#ifndef QT_NO_SHAREDMEMORY
+    if (memory.isAttached())
+        memory.detach();
+#endif
+    writable = false;
+
+    // Records ignored while attached remain so if the cache is attached again
+    foreach (int index, stale.keys())
+        pending.insert(index);
+    stale.clear();
+}
+
+bool QMailStoreSharedCache::isAttached() const
+{
+#ifndef QT_NO_SHAREDMEMORY
+    return memory.isAttached();
+#else
+    return false;
+#endif
+}
+
+bool QMailStoreSharedCache::isWritable() const
+{
+    return writable;
+}
+
+// The properties populated by lookup()
+QMailMessageKey::Properties QMailStoreSharedCache::properties()
+{
+    return (QMailMessageKey::Id | QMailMessageKey::Type | QMailMessageKey::ParentFolderId |
+            QMailMessageKey::Sender | QMailMessageKey::Recipients | QMailMessageKey::Subject |
+            QMailMessageKey::TimeStamp | QMailMessageKey::Status | QMailMessageKey::Size |
+            QMailMessageKey::ParentAccountId);
+}
+
+bool QMailStoreSharedCache::lookup(const QMailMessageId &id, QMailMessageMetaData *metaData) const
+{
+#ifndef QT_NO_SHAREDMEMORY
+    if (!memory.isAttached() || !id.isValid())
+        return false;
+
+    const QMailStoreSharedRecord *shared = record(id.toULongLong());
+
+    QMailStoreSharedEntry entry;
+    int sequence = 0;
+    bool consistent = false;
+    for (int attempt = 0; !consistent && (attempt < 3); ++attempt) {
+        sequence = shared->sequence.loadAcquire();
+        if (sequence & 1)
+            continue;
+
+        memcpy(&entry, &shared->entry, sizeof(entry));
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        consistent = (shared->sequence.load() == sequence);
+    }
+
+    // A record being rewritten is treated as a miss rather than waited for
+    if (!consistent || (entry.id != id.toULongLong()))
+        return false;
+
+    // The segment can be written by any process with access to it
+    if ((entry.senderLength > SenderLength) || (entry.recipientsLength > RecipientsLength) ||
+        (entry.subjectLength > SubjectLength))
+        return false;
+
+    if (!stale.isEmpty()) {
+        // A record invalidated by this process is current once a writer has rewritten it
+        const int index = int(id.toULongLong() % capacity);
+        QHash<int, int>::iterator it = stale.find(index);
+        if (it != stale.end()) {
+            if (it.value() == sequence)
+                return false;
+            stale.erase(it);
+        }
+    }
+
+    metaData->setId(QMailMessageId(entry.id));
+    metaData->setMessageType(static_cast<QMailMessage::MessageType>(entry.messageType));
+    metaData->setParentFolderId(QMailFolderId(entry.parentFolderId));
+    metaData->setParentAccountId(QMailAccountId(entry.parentAccountId));
+    metaData->setFrom(QMailAddress(QString::fromUtf8(entry.sender, entry.senderLength)));
+    metaData->setRecipients(QMailAddress::fromStringList(QString::fromUtf8(entry.recipients, entry.recipientsLength)));
+    metaData->setSubject(QString::fromUtf8(entry.subject, entry.subjectLength));
+    if (entry.flags & DateValid)
+        metaData->setDate(QMailTimeStamp(QDateTime::fromMSecsSinceEpoch(entry.date, Qt::UTC)));
+    metaData->setSize(entry.size);
+
+    // Only a subset of the message properties have been loaded
+    metaData->setStatus(entry.status | QMailMessage::UnloadedData);
+    metaData->setUnmodified();
+    return true;
+#else
+    Q_UNUSED(id)
+    Q_UNUSED(metaData)
+    return false;
+#endif
+}
+
+// Records the properties of the message, unless replace is false and the
+// message is already present.  Messages loaded from the database should not
+// replace existing records, which may reflect a later update.
+void QMailStoreSharedCache::insert(const QMailMessageMetaData &metaData, bool replace)
+{
+#ifndef QT_NO_SHAREDMEMORY
+    if (!metaData.id().isValid())
+        return;
+
+    if (!writable) {
+        // Values loaded from the database can't be newer than the record, but changes can
+        if (replace)
+            invalidate(int(metaData.id().toULongLong() % capacity));
+        return;
+    }
+
+    QMailStoreSharedEntry entry;
+    memset(&entry, 0, sizeof(entry));
+
+    if (!encodeString(metaData.from().toString(), entry.sender, SenderLength, &entry.senderLength)
+        || !encodeString(QMailAddress::toStringList(metaData.recipients()).join(QLatin1String(",")), entry.recipients, RecipientsLength, &entry.recipientsLength)
+        || !encodeString(metaData.subject(), entry.subject, SubjectLength, &entry.subjectLength)) {
+        remove(metaData.id());
+        return;
+    }
+
+    entry.id = metaData.id().toULongLong();
+    entry.parentFolderId = metaData.parentFolderId().toULongLong();
+    entry.parentAccountId = metaData.parentAccountId().toULongLong();
+    entry.status = (metaData.status() & ~QMailMessage::UnloadedData);
+    entry.size = metaData.size();
+    entry.messageType = static_cast<qint32>(metaData.messageType());
+
+    const QDateTime date(metaData.date().toUTC());
+    if (date.isValid()) {
+        entry.date = date.toMSecsSinceEpoch();
+        entry.flags |= DateValid;
+    }
+
+    memory.lock();
+    QMailStoreSharedRecord *shared = record(entry.id);
+    if (replace || (shared->entry.id != entry.id))
+        writeRecord(shared, entry);
+    memory.unlock();
+#else
+    Q_UNUSED(metaData)
+    Q_UNUSED(replace)
+#endif
+}
+
+void QMailStoreSharedCache::remove(const QMailMessageId &id)
+{
+#ifndef QT_NO_SHAREDMEMORY
+    if (!id.isValid())
+        return;
+
+    if (!writable) {
+        invalidate(int(id.toULongLong() % capacity));
+        return;
+    }
+
+    QMailStoreSharedEntry entry;
+    memset(&entry, 0, sizeof(entry));
+
+    memory.lock();
+    QMailStoreSharedRecord *shared = record(id.toULongLong());
+    if (shared->entry.id == id.toULongLong())
+        writeRecord(shared, entry);
+    memory.unlock();
+#else
+    Q_UNUSED(id)
+#endif
+}
+
+void QMailStoreSharedCache::clear()
+{
+#ifndef QT_NO_SHAREDMEMORY
+    if (!writable) {
+        for (int i = 0; i < capacity; ++i)
+            invalidate(i);
+        return;
+    }
+
+    QMailStoreSharedEntry entry;
+    memset(&entry, 0, sizeof(entry));
+
+    memory.lock();
+    for (int i = 0; i < capacity; ++i) {
+        QMailStoreSharedRecord *shared = record(i);
+        if (shared->entry.id != 0)
+            writeRecord(shared, entry);
+    }
+    memory.unlock();
+#endif
+}
+
+// Ignore the record at index until a writer next rewrites it
+void QMailStoreSharedCache::invalidate(int index)
+{
+#ifndef QT_NO_SHAREDMEMORY
+    if (!memory.isAttached()) {
+        // The record can only be ignored from the state it has once attached
+        pending.insert(index);
+        return;
+    }
+
+    // A write in progress has already been superseded
+    const int sequence = record(index)->sequence.loadAcquire();
+    stale.insert(index, (sequence & 1) ? sequence + 1 : sequence);
+#else
+    Q_UNUSED(index)
+#endif
+}
+
+// Identifiers are allocated sequentially, so the most recent messages map
+// to distinct records
+QMailStoreSharedRecord *QMailStoreSharedCache::record(quint64 id) const
+{
+#ifndef QT_NO_SHAREDMEMORY
+    char *base = static_cast<char *>(memory.data()) + sizeof(SharedCacheHeader);
+    return reinterpret_cast<QMailStoreSharedRecord *>(base) + (id % capacity);
+#else
+    Q_UNUSED(id)
+    return Q_NULLPTR;
+#endif
+}
+
+bool QMailStoreSharedCache::compatible() const
+{
+#ifndef QT_NO_SHAREDMEMORY
+    if (!memory.isAttached() || (memory.size() < segmentSize()))
+        return false;
+
+    const SharedCacheHeader *header = static_cast<const SharedCacheHeader *>(memory.constData());
+    return ((header->magic == sharedCacheMagic) &&
+            (header->version == sharedCacheVersion) &&
+            (header->capacity == quint32(capacity)) &&
+            (header->recordSize == sizeof(QMailStoreSharedRecord)));
+#else
+    return false;
+#endif
+}
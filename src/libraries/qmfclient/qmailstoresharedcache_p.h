@@ -0,0 +1,106 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QMAILSTORESHAREDCACHE_P_H
+#define QMAILSTORESHAREDCACHE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Extended API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "qmailmessage.h"
+#include "qmailmessagekey.h"
+#include "qmailstore.h"
+
+#include <QHash>
+#include <QSet>
+#include <QSharedMemory>
+
+struct QMailStoreSharedRecord;
+
+// A fixed size table of the message properties needed to display message
+// lists, shared by every process using the same database.  Records are only
+// written by processes attached with write access, which serialize on the
+// segment lock; readers never lock, and use the sequence number of each
+// record to detect a concurrent modification.
+//
+// A process without write access can't update the records for the changes
+// it makes or is told of.  Until a writer has rewritten them, those records
+// are treated as misses, so that the process never reads back stale values.
+class QMailStoreSharedCache
+{
+public:
+    QMailStoreSharedCache();
+    ~QMailStoreSharedCache();
+
+    bool attach(const QString &identifier, QMailStore::SharedCacheAccess access);
+    void detach();
+
+    bool isAttached() const;
+    bool isWritable() const;
+
+    static QMailMessageKey::Properties properties();
+
+    bool lookup(const QMailMessageId &id, QMailMessageMetaData *metaData) const;
+
+    void insert(const QMailMessageMetaData &metaData, bool replace = true);
+    void remove(const QMailMessageId &id);
+    void clear();
+
+    static const int capacity = 4096;
+
+private:
+    QMailStoreSharedRecord *record(quint64 id) const;
+    bool compatible() const;
+
+    void invalidate(int index);
+
+#ifndef QT_NO_SHAREDMEMORY
+    mutable QSharedMemory memory;
+#endif
+    bool writable;
+
+    // Sequence numbers of the records invalidated by this process, by record index
+    mutable QHash<int, int> stale;
+    QSet<int> pending;
+};
+
+#endif
@@ -0,0 +1,131 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qmailstoreworker_p.h"
+
+#include <QMutexLocker>
+
+QMailStoreWorker::QMailStoreWorker(QMailStoreImplementationBase *caller)
+    : QThread(),
+      caller(caller),
+      executor(new QMailStoreWorkerExecutor(this))
+{
+    executor->moveToThread(this);
+    start();
+}
+
+QMailStoreWorker::~QMailStoreWorker()
+{
+    quit();
+    wait();
+
+    delete executor;
+
+    // The results of executed requests are still reported; the remainder are canceled
+    foreach (QMailStoreAsyncRequest *request, completed) {
+        request->complete();
+        delete request;
+    }
+    foreach (QMailStoreAsyncRequest *request, pending) {
+        request->cancel();
+        delete request;
+    }
+}
+
+void QMailStoreWorker::enqueue(QMailStoreAsyncRequest *request)
+{
+    QMutexLocker locker(&mutex);
+
+    pending.append(request);
+    if (pending.count() == 1)
+        QMetaObject::invokeMethod(executor, "processRequests", Qt::QueuedConnection);
+}
+
+void QMailStoreWorker::processRequests()
+{
+    // The store instance for this thread has its own database connection
+    QMailStore *store = QMailStore::instance();
+
+    forever {
+        QMailStoreAsyncRequest *request = 0;
+        {
+            QMutexLocker locker(&mutex);
+            if (pending.isEmpty())
+                break;
+
+            request = pending.takeFirst();
+        }
+
+        if (!request->isCanceled()) {
+            // Capture the changes made by this request, for the store that requested it
+            store->d->setNotificationRecord(&request->notifications);
+            request->execute(store);
+            store->d->setNotificationRecord(0);
+        }
+
+        QMutexLocker locker(&mutex);
+        completed.append(request);
+        if (completed.count() == 1)
+            QMetaObject::invokeMethod(this, "completeRequests", Qt::QueuedConnection);
+    }
+}
+
+void QMailStoreWorker::completeRequests()
+{
+    QList<QMailStoreAsyncRequest*> requests;
+    {
+        QMutexLocker locker(&mutex);
+        requests = completed;
+        completed.clear();
+    }
+
+    // Requests complete in the order they were made, each after the changes it caused are reported
+    foreach (QMailStoreAsyncRequest *request, requests) {
+        caller->processNotifications(request->notifications);
+        request->complete();
+        delete request;
+    }
+}
+
+
+QMailStoreWorkerExecutor::QMailStoreWorkerExecutor(QMailStoreWorker *worker)
+    : QObject(),
+      worker(worker)
+{
+}
+
+void QMailStoreWorkerExecutor::processRequests()
+{
+    worker->processRequests();
+}
@@ -0,0 +1,155 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QMAILSTOREWORKER_P_H
+#define QMAILSTOREWORKER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Extended API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "qmailstoreimplementation_p.h"
+
+#include <QFuture>
+#include <QFutureInterface>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+
+// A store operation performed on the worker thread, whose result is reported
+// on the thread that requested it
+class QMailStoreAsyncRequest
+{
+public:
+    QMailStoreAsyncRequest() {}
+    virtual ~QMailStoreAsyncRequest() {}
+
+    virtual bool isCanceled() const = 0;
+    virtual void execute(QMailStore *store) = 0;
+    virtual void complete() = 0;
+    virtual void cancel() = 0;
+
+    QMailStoreImplementationBase::NotificationList notifications;
+};
+
+template<typename ResultType>
+class QMailStoreAsyncResult : public QMailStoreAsyncRequest
+{
+public:
+    QMailStoreAsyncResult() : result(ResultType()) { interface.reportStarted(); }
+
+    QFuture<ResultType> future() { return interface.future(); }
+
+    virtual bool isCanceled() const { return interface.isCanceled(); }
+    virtual void execute(QMailStore *store) { result = run(store); }
+
+    virtual void complete()
+    {
+        // A canceled future ignores the result
+        interface.reportResult(result);
+        interface.reportFinished();
+    }
+
+    virtual void cancel()
+    {
+        interface.cancel();
+        interface.reportFinished();
+    }
+
+protected:
+    virtual ResultType run(QMailStore *store) = 0;
+
+private:
+    QFutureInterface<ResultType> interface;
+    ResultType result;
+};
+
+class QMailStoreWorkerExecutor;
+
+class QMailStoreWorker : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit QMailStoreWorker(QMailStoreImplementationBase *caller);
+    ~QMailStoreWorker();
+
+    template<typename ResultType>
+    QFuture<ResultType> submit(QMailStoreAsyncResult<ResultType> *request)
+    {
+        QFuture<ResultType> future(request->future());
+        enqueue(request);
+        return future;
+    }
+
+private slots:
+    void completeRequests();
+
+private:
+    friend class QMailStoreWorkerExecutor;
+
+    void enqueue(QMailStoreAsyncRequest *request);
+    void processRequests();
+
+    QMailStoreImplementationBase *caller;
+    QMailStoreWorkerExecutor *executor;
+
+    QMutex mutex;
+    QList<QMailStoreAsyncRequest*> pending;
+    QList<QMailStoreAsyncRequest*> completed;
+};
+
+// Lives in the worker thread, so that requests are executed there
+class QMailStoreWorkerExecutor : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit QMailStoreWorkerExecutor(QMailStoreWorker *worker);
+
+public slots:
+    void processRequests();
+
+private:
+    QMailStoreWorker *worker;
+};
+
+#endif
@@ -75,15 +75,19 @@ HEADERS += \
     mailsortkeyimpl_p.h \
     qmailaccountkey_p.h \
     qmailaccountsortkey_p.h \
+    qmailcontentpurger_p.h \
     qmailfolderkey_p.h \
     qmailfoldersortkey_p.h \
     qmailmessage_p.h \
     qmailmessagekey_p.h \
+    qmailmessagekeymatcher_p.h \
     qmailmessageset_p.h \
     qmailmessagesortkey_p.h \
     qmailserviceaction_p.h \
     qmailstore_p.h \
     qmailstoreimplementation_p.h \
+    qmailstoresharedcache_p.h \
+    qmailstoreworker_p.h \
     qmailthread_p.h \
     qmailthreadkey_p.h \
     qmailthreadsortkey_p.h \
@@ -109,6 +113,7 @@ SOURCES += longstream.cpp \
            qmailaddress.cpp \
            qmailcodec.cpp \
            qmailcontentmanager.cpp \
+           qmailcontentpurger_p.cpp \
            qmailcrypto.cpp \
            qmaildatacomparator.cpp \
            qmaildisconnected.cpp \
@@ -122,6 +127,7 @@ SOURCES += longstream.cpp \
            qmailmessage.cpp \
            qmailmessagefwd.cpp \
            qmailmessagekey.cpp \
+           qmailmessagekeymatcher.cpp \
            qmailmessagelistmodel.cpp \
            qmailmessagemodelbase.cpp \
            qmailmessageremovalrecord.cpp \
@@ -133,6 +139,8 @@ SOURCES += longstream.cpp \
            qmailstore.cpp \
            qmailstore_p.cpp \
            qmailstoreimplementation_p.cpp \
+           qmailstoresharedcache_p.cpp \
+           qmailstoreworker_p.cpp \
            qmailtimestamp.cpp \
            qmailthread.cpp \
            qmailthreadkey.cpp \
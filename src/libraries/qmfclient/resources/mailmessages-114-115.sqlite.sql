@@ -0,0 +1,7 @@
+DROP INDEX IF EXISTS parentfolderid_idx;
+DROP INDEX IF EXISTS parentaccountid_idx;
+
+CREATE INDEX parentfolderid_stamp_idx ON mailmessages("parentfolderid", "stamp");
+CREATE INDEX parentfolderid_receivedstamp_idx ON mailmessages("parentfolderid", "receivedstamp");
+CREATE INDEX parentfolderid_size_idx ON mailmessages("parentfolderid", "size");
+CREATE INDEX parentaccountid_stamp_idx ON mailmessages("parentaccountid", "stamp");
@@ -0,0 +1,8 @@
+DROP INDEX IF EXISTS parentfolderid_stamp_idx;
+DROP INDEX IF EXISTS parentfolderid_receivedstamp_idx;
+
+CREATE INDEX parentfolderid_stamp_id_status_idx ON mailmessages("parentfolderid", "stamp", "id", "status");
+CREATE INDEX parentfolderid_receivedstamp_id_status_idx ON mailmessages("parentfolderid", "receivedstamp", "id", "status");
+CREATE INDEX parentaccountid_type_receivedstamp_id_status_idx ON mailmessages("parentaccountid", "type", "receivedstamp", "id", "status");
+CREATE INDEX parentthreadid_idx ON mailmessages("parentthreadid");
+CREATE INDEX responseid_idx ON mailmessages("responseid");
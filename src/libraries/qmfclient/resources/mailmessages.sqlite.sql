@@ -28,7 +28,12 @@ CREATE TABLE mailmessages (
     FOREIGN KEY (parentthreadid) REFERENCES mailthreads(id)
     );
 
-CREATE INDEX parentfolderid_idx ON mailmessages("parentfolderid"); 
-CREATE INDEX parentaccountid_idx ON mailmessages("parentaccountid");
+CREATE INDEX parentfolderid_stamp_id_status_idx ON mailmessages("parentfolderid", "stamp", "id", "status");
+CREATE INDEX parentfolderid_receivedstamp_id_status_idx ON mailmessages("parentfolderid", "receivedstamp", "id", "status");
+CREATE INDEX parentfolderid_size_idx ON mailmessages("parentfolderid", "size");
+CREATE INDEX parentaccountid_stamp_idx ON mailmessages("parentaccountid", "stamp");
+CREATE INDEX parentaccountid_type_receivedstamp_id_status_idx ON mailmessages("parentaccountid", "type", "receivedstamp", "id", "status");
+CREATE INDEX parentthreadid_idx ON mailmessages("parentthreadid");
+CREATE INDEX responseid_idx ON mailmessages("responseid");
 CREATE INDEX frommailbox_idx ON mailmessages("frommailbox");
 CREATE INDEX stamp_idx ON mailmessages("stamp");
@@ -49,6 +49,33 @@
 #include "qmetaobject.h"
 #include "qmaillog.h"
 
+struct QCopPacketHeader
+{
+    int totalLength;
+    int command;
+    int chLength;
+    int msgLength;
+    int dataLength;
+    int forwardToLength;
+};
+
+// Check that the lengths in a packet header fit within the len bytes of the
+// packet, so that parsing it can't read beyond its end.
+static bool validPacket(const QCopPacketHeader *header, int len)
+{
+    if (len < int(sizeof(QCopPacketHeader)))
+        return false;
+    if (header->chLength < 0 || header->msgLength < 0 ||
+        header->dataLength < 0 || header->forwardToLength < 0)
+        return false;
+
+    qint64 required = qint64(sizeof(QCopPacketHeader)) + qint64(header->chLength) * 2 +
+                      qint64(header->msgLength) * 2 + header->dataLength;
+    if (header->forwardToLength > 0)
+        required += (header->dataLength % 2) + qint64(header->forwardToLength) * 2;
+    return required <= len;
+}
+
 QCopServerRegexp::QCopServerRegexp(const QString& ch, QCopClient *cl)
     : channel(ch), client(cl)
 {
@@ -627,6 +654,71 @@ void QCopClient::answer(const QString& ch, const char *packet, int packetLen)
     }
 }
 
+// Count the deliveries that answer() will make for a packet on channel ch.
+int QCopClient::recipientCount(const QString& ch)
+{
+    QCopThreadData *td = qcopThreadData();
+
+    int count = 0;
+    QCopServerMap::ConstIterator it = td->serverMap.constFind(ch);
+    if (it != td->serverMap.constEnd())
+        count = it.value().count();
+
+    if (!td->serverRegexpList.isEmpty() && !containsWildcards(ch)) {
+        QCopServerRegexpList::Iterator it2;
+        td->serverRegexpList.begin(it2);
+        while (!it2.atEnd()) {
+            if (it2.current->match(ch))
+                ++count;
+            it2.advance();
+        }
+    }
+
+    return count;
+}
+
+// Route a descriptor for a packet held in the sender's shared ring.  The
+// payload itself is never touched by the server.
+void QCopClient::answerShared(const QString& ch, const char *packet, int packetLen)
+{
+#ifndef QT_NO_SHAREDMEMORY
+    const QCopPacketHeader *header = (const QCopPacketHeader *)packet;
+    const char *descriptor = packet + sizeof(QCopPacketHeader) + header->chLength * 2 + header->msgLength * 2;
+
+    // A client may only refer to its own ring: the first key it sends is
+    // claimed for it, unless another client has already claimed that key
+    const QString key(QCopSharedRing::descriptorKey(descriptor, header->dataLength));
+    if (key.isEmpty() || (key != sharedKey && (!sharedKey.isEmpty() || !qcopThreadData()->claimSharedKey(key)))) {
+        qWarning() << "Discarding QCop message with invalid shared descriptor on" << ch;
+        return;
+    }
+    sharedKey = key;
+
+    QCopSharedSlot *slot = QCopSharedRing::slot(descriptor, header->dataLength);
+    if (!slot) {
+        qWarning() << "Discarding QCop message with invalid shared descriptor on" << ch;
+        return;
+    }
+    const quint32 sequence = slot->sequence;
+
+    // Take a reference for each recipient before any of them can release one
+    int count = recipientCount(ch);
+    if (count > 0 && !slot->adjustReferences(sequence, count)) {
+        qWarning() << "Discarding QCop message with expired shared slot on" << ch;
+        return;
+    }
+
+    answer(ch, packet, packetLen);
+
+    // Release the reference held on behalf of the sender
+    slot->adjustReferences(sequence, -1);
+#else
+    Q_UNUSED(ch);
+    Q_UNUSED(packet);
+    Q_UNUSED(packetLen);
+#endif
+}
+
 /* !
     \internal
     Client side: distribute received event to the QCop instance managing the
@@ -641,7 +733,7 @@ void QCopChannel::sendLocally(const QString& ch, const QString& msg,
 
     // feed local clients with received data
     QCopThreadData *td = qcopThreadData();
-    QList<QCopChannelPrivatePointer> clients = td->clientMap[ch];
+    QList<QCopChannelPrivatePointer> clients = td->clientMap.value(ch);
     for (int i = 0; i < clients.size(); ++i) {
 	QCopChannelPrivate *channel = clients.at(i).data();
 	if (channel->object)
@@ -670,7 +762,7 @@ void QCopClient::forwardLocally
      const QByteArray& data)
 {
     QCopThreadData *td = qcopThreadData();
-    QList<QCopChannelPrivatePointer> clients = td->clientMap[forwardTo];
+    QList<QCopChannelPrivatePointer> clients = td->clientMap.value(forwardTo);
     QByteArray newData;
     for (int i = 0; i < clients.size(); ++i) {
 	QCopChannelPrivate *channel = clients.at(i).data();
@@ -696,16 +788,6 @@ void QCopClient::forwardLocally
     }
 }
 
-struct QCopPacketHeader
-{
-    int totalLength;
-    int command;
-    int chLength;
-    int msgLength;
-    int dataLength;
-    int forwardToLength;
-};
-
 QCopClient::QCopClient(QIODevice *device, QCopLocalSocket *socket)
     : QObject()
 {
@@ -750,6 +832,11 @@ void QCopClient::init()
 
     finished = false;
 
+#ifndef QT_NO_SHAREDMEMORY
+    sharedRing = 0;
+    sharedRingFailed = false;
+#endif
+
     loopback = qobject_cast<QCopLoopbackDevice *>(device);
 }
 
@@ -763,6 +850,9 @@ QCopClient::~QCopClient()
         delete socket;
         socket = 0;
     }
+#ifndef QT_NO_SHAREDMEMORY
+    delete sharedRing;
+#endif
 }
 
 void QCopClient::registerChannel(const QString& ch)
@@ -814,11 +904,36 @@ void QCopClient::sendChannelCommand(int cmd, const QString& ch)
 	delete[] buf;
 }
 
+static void writePacket
+    (char *buf, int len, int cmd, const QString& ch, const QString& msg, const QByteArray& data)
+{
+    QCopPacketHeader *header = (QCopPacketHeader *)buf;
+    header->command = cmd;
+    header->totalLength = len;
+    header->chLength = ch.length();
+    header->msgLength = msg.length();
+    header->forwardToLength = 0;
+    header->dataLength = data.length();
+    char *ptr = buf + sizeof(QCopPacketHeader);
+    memcpy(ptr, ch.constData(), ch.length() * 2);
+    ptr += ch.length() * 2;
+    memcpy(ptr, msg.constData(), msg.length() * 2);
+    ptr += msg.length() * 2;
+    memcpy(ptr, data.constData(), data.length());
+}
+
 void QCopClient::send
     (const QString& ch, const QString& msg, const QByteArray& data, int cmd)
 {
     int len = ch.length() * 2 + msg.length() * 2 + data.length();
     len += sizeof(QCopPacketHeader);
+#ifndef QT_NO_SHAREDMEMORY
+    // Bulk payloads to other processes travel through shared memory
+    if (cmd == QCopCmd_Send && len >= QCopSharedRing::minimumPacketSize && !loopback && device) {
+        if (sendShared(ch, msg, data, len))
+            return;
+    }
+#endif
     int writelen;
     char *buf;
     bool freeBuf = false;
@@ -840,25 +955,50 @@ void QCopClient::send
         writelen = len;
         freeBuf = true;
     }
-    QCopPacketHeader *header = (QCopPacketHeader *)buf;
-    header->command = cmd;
-    header->totalLength = len;
-    header->chLength = ch.length();
-    header->msgLength = msg.length();
-    header->forwardToLength = 0;
-    header->dataLength = data.length();
-    char *ptr = buf + sizeof(QCopPacketHeader);
-    memcpy(ptr, ch.constData(), ch.length() * 2);
-    ptr += ch.length() * 2;
-    memcpy(ptr, msg.constData(), msg.length() * 2);
-    ptr += msg.length() * 2;
-    memcpy(ptr, data.constData(), data.length());
+    writePacket(buf, len, cmd, ch, msg, data);
     if (!loopback)
         write(buf, writelen);
     if (freeBuf)
 	delete[] buf;
 }
 
+bool QCopClient::sendShared
+    (const QString& ch, const QString& msg, const QByteArray& data, int len)
+{
+#ifndef QT_NO_SHAREDMEMORY
+    if (!sharedRing) {
+        if (sharedRingFailed)
+            return false;
+
+        sharedRing = new QCopSharedRing;
+        if (!sharedRing->create()) {
+            delete sharedRing;
+            sharedRing = 0;
+            sharedRingFailed = true;
+            return false;
+        }
+    }
+
+    int offset;
+    quint32 sequence;
+    char *buf = sharedRing->reserve(len, &offset, &sequence);
+    if (!buf) {
+        // The ring is full; use the socket instead
+        return false;
+    }
+
+    writePacket(buf, len, QCopCmd_Send, ch, msg, data);
+    send(ch, QString(), QCopSharedRing::descriptor(sharedRing->key(), offset, sequence), QCopCmd_SendShared);
+    return true;
+#else
+    Q_UNUSED(ch);
+    Q_UNUSED(msg);
+    Q_UNUSED(data);
+    Q_UNUSED(len);
+    return false;
+#endif
+}
+
 void QCopClient::forward(const char *packet, const QString& forwardTo)
 {
     // Copy the original QCopCmd_Send packet, append the "forwardTo"
@@ -891,7 +1031,7 @@ void QCopClient::forward(const char *packet, const QString& forwardTo)
     }
     memcpy(buf, packet, totalLength);
     QCopPacketHeader *header = (QCopPacketHeader *)buf;
-    header->command = QCopCmd_Forward;
+    header->command = (header->command == QCopCmd_SendShared ? QCopCmd_ForwardShared : QCopCmd_Forward);
     header->totalLength = len;
     header->forwardToLength = forwardTo.length();
     char *ptr = buf + sizeof(QCopPacketHeader);
@@ -964,22 +1104,27 @@ void QCopClient::readyRead()
             // and the channel name, but nothing else just yet.
             QCopPacketHeader *header = (QCopPacketHeader *)inBufferPtr;
             int command = header->command;
+            const bool valid = validPacket(header, inBufferUsed);
             QString channel;
             char *ptr = inBufferPtr + sizeof(QCopPacketHeader);
-            if (header->chLength > 0) {
+            if (valid && header->chLength > 0) {
                 channel = QString::fromUtf16
                     ((const ushort *)ptr, header->chLength);
                 ptr += header->chLength * 2;
             }
 
             // Dispatch the command that we received.
-            if (server) {
+            if (!valid) {
+                qWarning() << "Discarding malformed QCop packet of" << inBufferUsed << "bytes";
+            } else if (server) {
                 // Processing command on server side.
                 if (command == QCopCmd_Send) {
                     // Pass the whole packet, including padding, to answer()
                     // which can then write it directly to the destination
                     // sockets without needing to parse it further.
                     answer(channel, inBufferPtr, inBufferUsed);
+                } else if (command == QCopCmd_SendShared) {
+                    answerShared(channel, inBufferPtr, inBufferUsed);
                 } else if (command == QCopCmd_RegisterChannel) {
                     handleRegisterChannel(channel);
                 } else if (command == QCopCmd_DetachChannel) {
@@ -1013,6 +1158,42 @@ void QCopClient::readyRead()
                         ((const ushort *)ptr, header->forwardToLength);
                 }
 
+#ifndef QT_NO_SHAREDMEMORY
+                if (command == QCopCmd_SendShared || command == QCopCmd_ForwardShared) {
+                    // Copy the packet out of the sender's ring, then release it
+                    int length;
+                    QCopSharedSlot *slot = QCopSharedRing::slot(data.constData(), data.length(), 0, &length);
+                    if (!slot) {
+                        qWarning() << "Discarding QCop message with invalid shared descriptor on" << channel;
+                        command = 0;
+                    } else {
+                        // The sender can still write to its ring, so only the header copied
+                        // here is trusted, and only once it fits within the slot
+                        const quint32 sequence = slot->sequence;
+                        QCopPacketHeader shared;
+                        memcpy(&shared, slot + 1, sizeof(shared));
+                        const bool sharedValid = validPacket(&shared, length);
+                        if (sharedValid) {
+                            const char *sptr = reinterpret_cast<const char *>(slot + 1) + sizeof(shared) + shared.chLength * 2;
+                            msg = QString::fromUtf16((const ushort *)sptr, shared.msgLength);
+                            sptr += shared.msgLength * 2;
+                            data = QByteArray(sptr, shared.dataLength);
+                        }
+
+                        // If the lease expired while the packet was copied, the slot may have been reused
+                        if (!slot->adjustReferences(sequence, -1)) {
+                            qWarning() << "Discarding QCop message with expired shared slot on" << channel;
+                            command = 0;
+                        } else if (!sharedValid) {
+                            qWarning() << "Discarding malformed shared QCop packet on" << channel;
+                            command = 0;
+                        } else {
+                            command = (command == QCopCmd_SendShared ? QCopCmd_Send : QCopCmd_Forward);
+                        }
+                    }
+                }
+#endif
+
                 // Processing command on client side.
                 if (command == QCopCmd_Send) {
                     QCopChannel::sendLocally(channel, msg, data);
@@ -1063,6 +1244,12 @@ void QCopClient::disconnected()
         finished = true;
         if (server) {
             detachAll();
+#ifndef QT_NO_SHAREDMEMORY
+            if (!sharedKey.isEmpty()) {
+                qcopThreadData()->releaseSharedSegment(sharedKey);
+                qcopThreadData()->claimedSharedKeys.remove(sharedKey);
+            }
+#endif
             deleteLater();
         } else if (disconnectHandler) {
             (*disconnectHandler)();
@@ -1269,3 +1456,219 @@ bool QCopLoopbackDevice::event(QEvent *e)
         return QIODevice::event(e);
     }
 }
+
+#ifndef QT_NO_SHAREDMEMORY
+
+struct QCopSharedDescriptor
+{
+    qint32 offset;
+    quint32 sequence;
+    qint32 keyLength;
+};
+
+static const char sharedRingPrefix[] = "qcop-ring-";
+
+QCopSharedRing::QCopSharedRing()
+    : sequence(0),
+      lease(defaultLease)
+{
+    clock.start();
+}
+
+bool QCopSharedRing::create()
+{
+    static QAtomicInt rings;
+
+    memory.setKey(QLatin1String(sharedRingPrefix) + QString::fromLatin1("%1-%2")
+                  .arg(QCoreApplication::applicationPid())
+                  .arg(rings.fetchAndAddRelaxed(1)));
+    if (!memory.create(capacity)) {
+        // A segment left behind by an earlier process with our pid can be reused
+        if (memory.error() != QSharedMemory::AlreadyExists || !memory.attach() || memory.size() < capacity) {
+            qWarning() << "Unable to create QCop shared ring:" << memory.errorString();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+QString QCopSharedRing::key() const
+{
+    return memory.key();
+}
+
+// Reserve space for a packet of len bytes, returning a pointer to where the
+// packet should be written, or null if the ring has no room for it.
+char *QCopSharedRing::reserve(int len, int *offset, quint32 *seq)
+{
+    const int required = (int(sizeof(QCopSharedSlot)) + len + 7) & ~7;
+
+    reclaim();
+
+    // Use the first gap between the live slots that is large enough
+    int position = -1;
+    int index = 0;
+    int end = 0;
+    for ( ; index < allocations.count(); ++index) {
+        const Allocation &allocation(allocations.at(index));
+        if (allocation.offset - end >= required)
+            break;
+        end = allocation.offset + allocation.length;
+    }
+    if (index < allocations.count() || capacity - end >= required)
+        position = end;
+
+    if (position == -1)
+        return 0;
+
+    // Zero is never used, so that it never matches a descriptor
+    if (++sequence == 0)
+        ++sequence;
+
+    QCopSharedSlot *slot = reinterpret_cast<QCopSharedSlot *>(static_cast<char *>(memory.data()) + position);
+    slot->sequence = sequence;
+    slot->length = len;
+    slot->state.storeRelease(QCopSharedSlot::tag(sequence) | 1);
+
+    Allocation allocation;
+    allocation.offset = position;
+    allocation.length = required;
+    allocation.sequence = sequence;
+    allocation.reserved = clock.elapsed();
+    allocations.insert(index, allocation);
+
+    *offset = position;
+    *seq = sequence;
+    return reinterpret_cast<char *>(slot + 1);
+}
+
+// Free every slot whose references have all been released, and any whose
+// lease has expired.
+void QCopSharedRing::reclaim()
+{
+    char *base = static_cast<char *>(memory.data());
+    const qint64 now = clock.elapsed();
+
+    QList<Allocation>::iterator it = allocations.begin();
+    while (it != allocations.end()) {
+        QCopSharedSlot *slot = reinterpret_cast<QCopSharedSlot *>(base + it->offset);
+        if (slot->references() > 0) {
+            if (now - it->reserved < lease) {
+                ++it;
+                continue;
+            }
+
+            // Retag the slot so that late references to it are refused
+            qWarning() << "Reclaiming QCop shared slot unreleased after" << (now - it->reserved) << "ms";
+            slot->state.storeRelease(QCopSharedSlot::tag(it->sequence + 1));
+            slot->sequence = 0;
+        }
+        it = allocations.erase(it);
+    }
+}
+
+QByteArray QCopSharedRing::descriptor(const QString& key, int offset, quint32 sequence)
+{
+    QCopSharedDescriptor descriptor;
+    descriptor.offset = offset;
+    descriptor.sequence = sequence;
+    descriptor.keyLength = key.length();
+
+    QByteArray result(reinterpret_cast<const char *>(&descriptor), sizeof(descriptor));
+    result.append(reinterpret_cast<const char *>(key.constData()), key.length() * 2);
+    return result;
+}
+
+// Return the key of the segment that a descriptor refers to, or a null
+// string if the descriptor is malformed or names a segment that isn't a ring.
+QString QCopSharedRing::descriptorKey(const char *data, int len)
+{
+    QCopSharedDescriptor descriptor;
+    if (len < int(sizeof(descriptor)))
+        return QString();
+
+    // The descriptor may not be aligned within a packet
+    memcpy(&descriptor, data, sizeof(descriptor));
+    if (descriptor.keyLength <= 0 || len < int(sizeof(descriptor)) + descriptor.keyLength * 2)
+        return QString();
+
+    QString key(descriptor.keyLength, Qt::Uninitialized);
+    memcpy(key.data(), data + sizeof(descriptor), descriptor.keyLength * 2);
+    if (!key.startsWith(QLatin1String(sharedRingPrefix)))
+        return QString();
+
+    return key;
+}
+
+// Locate the slot referred to by a descriptor, attaching to the sender's
+// segment if necessary.  The packet length is read from the slot once, and
+// returned in length after it has been checked against the segment size.
+QCopSharedSlot *QCopSharedRing::slot(const char *data, int len, QString *key, int *length)
+{
+    const QString segmentKey(descriptorKey(data, len));
+    if (segmentKey.isEmpty())
+        return 0;
+
+    QCopSharedDescriptor descriptor;
+    memcpy(&descriptor, data, sizeof(descriptor));
+    if (descriptor.offset < 0 || descriptor.offset > capacity - int(sizeof(QCopSharedSlot)))
+        return 0;
+
+    char *base = qcopThreadData()->sharedSegment(segmentKey);
+    if (!base)
+        return 0;
+
+    QCopSharedSlot *slot = reinterpret_cast<QCopSharedSlot *>(base + descriptor.offset);
+    const int slotLength = slot->length;
+    if (slot->sequence != descriptor.sequence || slotLength < int(sizeof(QCopPacketHeader)) ||
+        slotLength > capacity - descriptor.offset - int(sizeof(QCopSharedSlot)))
+        return 0;
+
+    if (key)
+        *key = segmentKey;
+    if (length)
+        *length = slotLength;
+    return slot;
+}
+
+char *QCopThreadData::sharedSegment(const QString& key)
+{
+    QHash<QString, QSharedMemory *>::ConstIterator it = sharedSegments.constFind(key);
+    if (it != sharedSegments.constEnd())
+        return static_cast<char *>(it.value()->data());
+
+    QSharedMemory *memory = new QSharedMemory(key);
+    if (!memory->attach() || memory->size() < QCopSharedRing::capacity) {
+        qWarning() << "Unable to attach to QCop shared ring" << key << ":" << memory->errorString();
+        delete memory;
+        return 0;
+    }
+
+    // Senders come and go; keep only the most recently attached segments
+    if (sharedSegmentOrder.count() >= maximumSharedSegments)
+        releaseSharedSegment(sharedSegmentOrder.first());
+
+    sharedSegments.insert(key, memory);
+    sharedSegmentOrder.append(key);
+    return static_cast<char *>(memory->data());
+}
+
+// Claim a ring key for the server-side connection of the client that owns
+// it, failing if another connected client has already claimed the key.
+bool QCopThreadData::claimSharedKey(const QString& key)
+{
+    if (claimedSharedKeys.contains(key))
+        return false;
+
+    claimedSharedKeys.insert(key);
+    return true;
+}
+
+void QCopThreadData::releaseSharedSegment(const QString& key)
+{
+    delete sharedSegments.take(key);
+    sharedSegmentOrder.removeAll(key);
+}
+
+#endif
@@ -59,6 +59,11 @@
 #endif
 #include <QtCore/qshareddata.h>
 #include <QtCore/qregexp.h>
+#include <QtCore/qatomic.h>
+#include <QtCore/qhash.h>
+#include <QtCore/qset.h>
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qsharedmemory.h>
 #include <private/qringbuffer_p.h>
 #include "qmailglobal.h"
 
@@ -87,6 +92,95 @@ QT_END_NAMESPACE
 #define QCopCmd_SendRequestAck      12
 #define QCopCmd_Ack                 13
 #define QCopCmd_StartupComplete     14
+#define QCopCmd_SendShared          15
+#define QCopCmd_ForwardShared       16
+
+#ifndef QT_NO_SHAREDMEMORY
+
+// Header of a packet stored in a QCopSharedRing.  A reference is held by
+// the sender until the server has routed the descriptor, and by each
+// recipient until it has copied the packet out of the ring.
+//
+// The low 16 bits of state count the references, and the bits above them
+// are a tag taken from the sequence number.  References can only be taken
+// or released while the tag matches, so a peer holding a descriptor to a
+// slot that has since been reclaimed can't disturb whatever reuses it.
+struct QCopSharedSlot
+{
+    QBasicAtomicInt state;
+    quint32 sequence;
+    qint32 length;
+    qint32 reserved;
+
+    static int tag(quint32 sequence) { return int(sequence & 0x7fff) << 16; }
+
+    int references() const { return state.loadAcquire() & 0xffff; }
+
+    bool adjustReferences(quint32 seq, int delta)
+    {
+        for (;;) {
+            const int current = state.loadAcquire();
+            if ((current & ~0xffff) != tag(seq))
+                return false;
+
+            const int count = (current & 0xffff) + delta;
+            if (count < 0 || count > 0xffff)
+                return false;
+
+            if (state.testAndSetOrdered(current, tag(seq) | count))
+                return true;
+        }
+    }
+};
+
+// Packets in a shared memory segment owned by a single sending client.
+// Bulk payloads are written into the ring, and only a small descriptor
+// referring to the slot is sent through the QCop server.
+//
+// Each slot is freed as soon as its references are released, whatever
+// the state of the slots around it.  A slot still referenced after the
+// lease has expired belongs to a recipient that died or dropped the
+// packet, and is freed regardless.
+class QMF_EXPORT QCopSharedRing
+{
+    friend class tst_QCop;
+
+public:
+    QCopSharedRing();
+
+    bool create();
+    QString key() const;
+
+    char *reserve(int len, int *offset, quint32 *sequence);
+
+    static QByteArray descriptor(const QString& key, int offset, quint32 sequence);
+    static QString descriptorKey(const char *descriptor, int len);
+    static QCopSharedSlot *slot(const char *descriptor, int len, QString *key = 0, int *length = 0);
+
+    static const int capacity = 8 * 1024 * 1024;
+    static const int minimumPacketSize = 16 * 1024;
+    static const int defaultLease = 30 * 1000;
+
+private:
+    void reclaim();
+
+    struct Allocation
+    {
+        int offset;
+        int length;
+        quint32 sequence;
+        qint64 reserved;
+    };
+
+    QSharedMemory memory;
+    // Ordered by offset
+    QList<Allocation> allocations;
+    quint32 sequence;
+    int lease;
+    QElapsedTimer clock;
+};
+
+#endif
 
 class QMF_EXPORT QCopClient : public QObject
 {
@@ -138,6 +232,7 @@ public:
     void sendChannelCommand(int cmd, const QString& ch);
     void send(const QString& ch, const QString& msg, const QByteArray& data,
               int cmd = QCopCmd_Send);
+    bool sendShared(const QString& ch, const QString& msg, const QByteArray& data, int len);
     void forward(const char *packet, const QString& forwardTo);
     void isRegisteredReply(const QString& ch, bool known);
     void requestRegistered(const QString& ch);
@@ -191,10 +286,17 @@ private:
     bool connecting;
     bool reconnecting;
     int channelCount;
+#ifndef QT_NO_SHAREDMEMORY
+    QCopSharedRing *sharedRing;
+    bool sharedRingFailed;
+    QString sharedKey;
+#endif
 
     void detachAll();
     void detach(const QString& ch);
     static void answer(const QString& ch, const char *packet, int packetLen);
+    static int recipientCount(const QString& ch);
+    void answerShared(const QString& ch, const char *packet, int packetLen);
     void handleRegisterChannel(const QString& ch);
     void handleRequestRegistered(const QString& ch);
     static void forwardLocally(const QString& forwardTo, const QString& ch, const QString& msg, const QByteArray& data);
@@ -361,9 +463,9 @@ public:
 
 typedef QExplicitlySharedDataPointer<QCopChannelPrivate> QCopChannelPrivatePointer;
 typedef QExplicitlySharedDataPointer<QCopChannelMonitorPrivate> QCopChannelMonitorPrivatePointer;
-typedef QMap<QString, QList<QCopChannelPrivatePointer> > QCopClientMap;
-typedef QMap<QString, QList<QCopChannelMonitorPrivatePointer> > QCopClientMonitorMap;
-typedef QMap<QString, QList<QCopClient*> > QCopServerMap;
+typedef QHash<QString, QList<QCopChannelPrivatePointer> > QCopClientMap;
+typedef QHash<QString, QList<QCopChannelMonitorPrivatePointer> > QCopClientMonitorMap;
+typedef QHash<QString, QList<QCopClient*> > QCopServerMap;
 
 // Thread-specific data for QCop client and server implementations.
 class QCopThreadData
@@ -384,6 +486,9 @@ public:
 
             delete conn;
         }
+#ifndef QT_NO_SHAREDMEMORY
+        qDeleteAll(sharedSegments);
+#endif
     }
 
     static QCopThreadData *instance();
@@ -426,6 +531,21 @@ public:
     // Pointer to the QCopServer instance if this thread is the server.
     QCopServer *server;
 
+#ifndef QT_NO_SHAREDMEMORY
+    // Shared rings of other clients that this thread has attached to.
+    QHash<QString, QSharedMemory *> sharedSegments;
+    QList<QString> sharedSegmentOrder;
+
+    // Ring keys claimed by the clients connected to the server.
+    QSet<QString> claimedSharedKeys;
+
+    char *sharedSegment(const QString& key);
+    void releaseSharedSegment(const QString& key);
+    bool claimSharedKey(const QString& key);
+
+    static const int maximumSharedSegments = 8;
+#endif
+
     QCopClient *conn;
 
 private:
@@ -105,6 +105,7 @@ static void createDefaultLogConfig(QSettings &settings)
         settings.setValue(QLatin1String("IMAP"), 1);
         settings.setValue(QLatin1String("SMTP"), 1);
         settings.setValue(QLatin1String("POP"), 1);
+        settings.setValue(QLatin1String("StoreProfile"), 1);
         settings.endGroup();
     }
 }
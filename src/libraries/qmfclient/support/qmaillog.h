@@ -98,11 +98,13 @@ QLOG_RUNTIME(Messaging, true)
 QLOG_RUNTIME(IMAP, true)
 QLOG_RUNTIME(SMTP, true)
 QLOG_RUNTIME(POP, true)
+QLOG_RUNTIME(StoreProfile, true)
 #else
 QLOG_DISABLE(Messaging)
 QLOG_DISABLE(IMAP)
 QLOG_DISABLE(SMTP)
 QLOG_DISABLE(POP)
+QLOG_DISABLE(StoreProfile)
 #endif // QMF_ENABLE_LOGGING
 
 #endif //QMAILLOG_H
@@ -118,11 +118,8 @@ QMailMessageKey EmailFolderMessageSet::descendantsMessageKey() const
     return contentKey(folderId(), true);
 }
 
-QMailMessageKey EmailFolderMessageSet::contentKey(const QMailFolderId &id, bool descendants)
+static quint64 contentExclusions(const QMailFolderId &id)
 {
-    // Only return email messages from this folder
-    QMailMessageKey key(QMailFolderMessageSet::contentKey(id, descendants) & QMailMessageKey::messageType(QMailMessage::Email));
-
     quint64 exclusions = 0;
 
     QMailFolder folder(id);
@@ -133,6 +130,13 @@ QMailMessageKey EmailFolderMessageSet::contentKey(const QMailFolderId &id, bool
         exclusions |= QMailMessage::Junk;
     }
 
+    return exclusions;
+}
+
+static QMailMessageKey emailContentFilter(quint64 exclusions)
+{
+    QMailMessageKey key(QMailMessageKey::messageType(QMailMessage::Email));
+
     if (exclusions) {
         key &= QMailMessageKey::status(exclusions, QMailDataComparator::Excludes);
     }
@@ -140,6 +144,16 @@ QMailMessageKey EmailFolderMessageSet::contentKey(const QMailFolderId &id, bool
     return key;
 }
 
+// The possible combinations of exclusions, in the order of EmailFolderModel::folderCountFilters()
+static const quint64 filterExclusions[] = { 0, QMailMessage::Trash, QMailMessage::Junk, QMailMessage::Trash | QMailMessage::Junk };
+static const int filterExclusionsCount = sizeof(filterExclusions) / sizeof(filterExclusions[0]);
+
+QMailMessageKey EmailFolderMessageSet::contentKey(const QMailFolderId &id, bool descendants)
+{
+    // Only return email messages from this folder
+    return QMailFolderMessageSet::contentKey(id, descendants) & emailContentFilter(contentExclusions(id));
+}
+
 void EmailFolderMessageSet::createChild(const QMailFolderId &childId)
 {
     // Our child folders should also be email-only
@@ -287,6 +301,11 @@ QMailAccountKey InboxMessageSet::emailAccountKey()
 EmailFolderModel::EmailFolderModel(QObject *parent)
     : FolderModel(parent)
 {
+    QList<QMailMessageKey> filters;
+    for (int i = 0; i < filterExclusionsCount; ++i)
+        filters.append(emailContentFilter(filterExclusions[i]));
+
+    setFolderCountFilters(filters, &EmailFolderModel::emailFolderCountFilter);
 }
 
 EmailFolderModel::~EmailFolderModel()
@@ -448,6 +467,23 @@ FolderModel::StatusText EmailFolderModel::standardFolderStatusText(EmailStandard
     return qMakePair(status, detail);
 }
 
+bool EmailFolderModel::emailFolderCountFilter(QMailFolderMessageSet *item, int *filter, bool *descendants)
+{
+    if (item->metaObject() != &EmailFolderMessageSet::staticMetaObject)
+        return FolderModel::folderCountFilter(item, filter, descendants);
+
+    const quint64 exclusions(contentExclusions(item->folderId()));
+    for (int i = 0; i < filterExclusionsCount; ++i) {
+        if (filterExclusions[i] == exclusions) {
+            *filter = i;
+            *descendants = true;
+            return true;
+        }
+    }
+
+    return false;
+}
+
 bool EmailFolderModel::itemSynchronizationEnabled(QMailMessageSet *item) const
 {
     if (QMailFolderMessageSet *folderItem = qobject_cast<QMailFolderMessageSet*>(item)) {
@@ -165,6 +165,9 @@ protected:
     virtual bool itemSynchronizationEnabled(QMailMessageSet *item) const;
     virtual bool itemPermitted(QMailMessageSet *item, Roles role) const;
     virtual QMailAccountId itemContextualAccountId(QMailMessageSet *item) const;
+
+private:
+    static bool emailFolderCountFilter(QMailFolderMessageSet *item, int *filter, bool *descendants);
 };
 
 class QMFUTIL_EXPORT AccountFolderModel : public EmailFolderModel
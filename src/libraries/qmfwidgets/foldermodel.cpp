@@ -36,19 +36,63 @@
 #include <qmailfolder.h>
 #include <qmailstore.h>
 #include <QApplication>
+#include <QHash>
+#include <QSet>
 #include <QTimer>
 #include "qtmailnamespace.h"
 
 using QMailDataComparator::Includes;
 using QMailDataComparator::Excludes;
 
+static int groupCount(const QMap<quint64, QMailStore::MessageGroupCounts> &counts, const QMailFolderId &id, int index)
+{
+    QMap<quint64, QMailStore::MessageGroupCounts>::const_iterator it = counts.find(id.toULongLong());
+    if (it == counts.end())
+        return 0;
+
+    return it->subsetCounts.value(index);
+}
+
+namespace {
+
+typedef bool (*CountFilterFunction)(QMailFolderMessageSet *item, int *filter, bool *descendants);
+
+// The message counts loaded for every folder at once, and how they apply to the model's items
+struct FolderCounts
+{
+    FolderCounts(const QList<QMailMessageKey> &f, CountFilterFunction ff)
+        : valid(false), filters(f), filterFunction(ff) {}
+
+    bool valid;
+    QSet<QMailFolderId> staleFolderIds;
+    QMap<quint64, QMailStore::MessageGroupCounts> folderCounts;
+    QMap<quint64, QMailStore::MessageGroupCounts> descendantFolderCounts;
+
+    QList<QMailMessageKey> filters;
+    CountFilterFunction filterFunction;
+};
+
+typedef QHash<const FolderModel*, FolderCounts*> FolderCountsMap;
+
+}
+
+// Held outside FolderModel, so that its layout is unchanged for subclasses built against earlier versions
+Q_GLOBAL_STATIC(FolderCountsMap, folderCountsMap)
+
+static FolderCounts *folderCounts(const FolderModel *model)
+{
+    return folderCountsMap()->value(model);
+}
+
 FolderModel::FolderModel(QObject *parent)
     : QMailMessageSetModel(parent)
 {
+    folderCountsMap()->insert(this, new FolderCounts(QList<QMailMessageKey>() << QMailMessageKey(), &FolderModel::folderCountFilter));
 }
 
 FolderModel::~FolderModel()
 {
+    delete folderCountsMap()->take(this);
 }
 
 QVariant FolderModel::data(QMailMessageSet *item, int role, int column) const
@@ -191,7 +235,28 @@ FolderModel::StatusText FolderModel::folderStatusText(QMailFolderMessageSet *ite
 {
     QString status, detail;
 
-    if (QMailStore* store = QMailStore::instance()) {
+    int filter = 0;
+    bool descendants = false;
+
+    const FolderCounts *counts(folderCounts(this));
+    if (counts->filterFunction(item, &filter, &descendants)) {
+        // Take the counts from those loaded for all folders at once
+        loadFolderCounts();
+
+        const QMailFolderId id(item->folderId());
+        int total = groupCount(counts->folderCounts, id, filter * 2);
+        int unreadTotal = groupCount(counts->folderCounts, id, filter * 2 + 1);
+
+        int inclusiveTotal = total;
+        int inclusiveUnreadTotal = unreadTotal;
+        if (descendants) {
+            inclusiveTotal += groupCount(counts->descendantFolderCounts, id, filter * 2);
+            inclusiveUnreadTotal += groupCount(counts->descendantFolderCounts, id, filter * 2 + 1);
+        }
+
+        detail = describeFolderCount(total, unreadTotal, Unread);
+        status = formatCounts(total, unreadTotal, (inclusiveTotal > total), (inclusiveUnreadTotal > unreadTotal));
+    } else if (QMailStore* store = QMailStore::instance()) {
         int inclusiveTotal = 0;
         int inclusiveUnreadTotal = 0;
 
@@ -266,8 +331,108 @@ FolderModel::StatusText FolderModel::filterStatusText(QMailFilterMessageSet *ite
     return qMakePair(status, detail);
 }
 
+/*
+    Sets the \a filters whose counts are loaded for every folder at once. A folder item
+    whose content is its folder's messages matching one of these filters can report its
+    status without issuing queries of its own; \a function identifies the filter that
+    applies to an item, in the manner of folderCountFilter().
+*/
+void FolderModel::setFolderCountFilters(const QList<QMailMessageKey> &filters, FolderCountFilterFunction function)
+{
+    FolderCounts *counts(folderCounts(this));
+    counts->filters = filters;
+    counts->filterFunction = function;
+    counts->valid = false;
+}
+
+/*
+    Returns true if the status of \a item can be taken from the loaded folder counts,
+    setting \a filter to the index of the filter that matches its content, and
+    \a descendants to true if its descendantsMessageKey() selects the messages in
+    all folders beneath it. Only the filter selecting all messages is considered.
+*/
+bool FolderModel::folderCountFilter(QMailFolderMessageSet *item, int *filter, bool *descendants)
+{
+    // Subclasses may select their content differently
+    if (item->metaObject() != &QMailFolderMessageSet::staticMetaObject)
+        return false;
+
+    if (item->hierarchical()) {
+        *descendants = true;
+    } else if (item->count() == 0) {
+        *descendants = false;
+    } else {
+        return false;
+    }
+
+    *filter = 0;
+    return true;
+}
+
+void FolderModel::loadFolderCounts() const
+{
+    FolderCounts *counts(folderCounts(this));
+    if (counts->valid && counts->staleFolderIds.isEmpty())
+        return;
+
+    QMailStore* store = QMailStore::instance();
+    if (!store)
+        return;
+
+    // Count the total and unread messages for each filter
+    QList<QMailMessageKey> subsetKeys;
+    foreach (const QMailMessageKey &filter, counts->filters)
+        subsetKeys << filter << (filter & unreadKey());
+
+    if (!counts->valid) {
+        // Load the counts for every folder at once
+        counts->folderCounts = store->countMessagesGrouped(QMailMessageKey(), QMailStore::GroupByParentFolder, subsetKeys);
+        counts->descendantFolderCounts = store->countMessagesGrouped(QMailMessageKey(), QMailStore::GroupByAncestorFolder, subsetKeys);
+        counts->valid = true;
+        counts->staleFolderIds.clear();
+        return;
+    }
+
+    // Reload only the counts of the folders whose content has changed
+    const QMailFolderIdList ids(counts->staleFolderIds.toList());
+    counts->staleFolderIds.clear();
+
+    const QMap<quint64, QMailStore::MessageGroupCounts> parentCounts(
+        store->countMessagesGrouped(QMailMessageKey::parentFolderId(ids), QMailStore::GroupByParentFolder, subsetKeys));
+    // Messages beneath a stale folder are also counted for its other ancestors, which are ignored
+    const QMap<quint64, QMailStore::MessageGroupCounts> descendantCounts(
+        store->countMessagesGrouped(QMailMessageKey::ancestorFolderIds(ids), QMailStore::GroupByAncestorFolder, subsetKeys));
+
+    foreach (const QMailFolderId &id, ids) {
+        const quint64 key(id.toULongLong());
+
+        QMap<quint64, QMailStore::MessageGroupCounts>::const_iterator it = parentCounts.find(key);
+        if (it != parentCounts.end())
+            counts->folderCounts.insert(key, it.value());
+        else
+            counts->folderCounts.remove(key);
+
+        it = descendantCounts.find(key);
+        if (it != descendantCounts.end())
+            counts->descendantFolderCounts.insert(key, it.value());
+        else
+            counts->descendantFolderCounts.remove(key);
+    }
+}
+
+void FolderModel::invalidateFolderCounts(QMailMessageSet *item)
+{
+    // The store reports a change to a folder's content for the folder and each of its
+    // ancestors, so the counts of the other folders remain current
+    if (QMailFolderMessageSet *folderItem = qobject_cast<QMailFolderMessageSet*>(item))
+        folderCounts(this)->staleFolderIds.insert(folderItem->folderId());
+}
+
 void FolderModel::scheduleUpdate(QMailMessageSet *item)
 {
+    // The store content has changed since the counts were loaded
+    invalidateFolderCounts(item);
+
     if (updatedItems.isEmpty()) {
         QTimer::singleShot(0, this, SLOT(processUpdatedItems()));
     } else if (updatedItems.contains(item)) {
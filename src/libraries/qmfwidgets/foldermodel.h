@@ -89,9 +89,18 @@ protected:
     static QString describeFolderCount(int total, int subTotal, SubTotalType type = Unread);
     static QString formatCounts(int total, int unread, bool excessTotal = false, bool excessUnread = false);
 
+    typedef bool (*FolderCountFilterFunction)(QMailFolderMessageSet *item, int *filter, bool *descendants);
+
+    void setFolderCountFilters(const QList<QMailMessageKey> &filters, FolderCountFilterFunction function);
+    static bool folderCountFilter(QMailFolderMessageSet *item, int *filter, bool *descendants);
+
     QMap<QMailMessageSet*, StatusText> statusMap;
 
     QList<QMailMessageSet*> updatedItems;
+
+private:
+    void loadFolderCounts() const;
+    void invalidateFolderCounts(QMailMessageSet *item);
 };
 
 
@@ -37,25 +37,52 @@
 #include "qmailnamespace.h"
 #include "qmaillog.h"
 #include <QCoreApplication>
+#include <QCryptographicHash>
 #include <QDateTime>
 #include <QDir>
 #include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTextStream>
 #include <QtPlugin>
 #include <QUrl>
 #if defined(Q_OS_WIN)
 #include <windows.h>
 #include <io.h>
-#define USE_FSYNC_PER_FILE
 #elif defined(Q_OS_UNIX)
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#define USE_SHARED_PARTS
 #endif
 
+#include <zlib.h>
+
 namespace {
 
 const QString gKey("qmfstoragemanager");
 
+// Content is added, loaded and removed from store worker and purge threads as well
+QMutex gAccountMutex;
 QMap<QMailAccountId, QString> gAccountPath;
 
+// An account that has never been configured for shared parts has no part manifests,
+// while one that has been may still hold compressed parts after sharing is disabled
+enum SharedPartsMode { SharedPartsUnconfigured, SharedPartsDisabled, SharedPartsEnabled };
+QMap<QMailAccountId, SharedPartsMode> gAccountSharedParts;
+
+// Text parts smaller than this are not worth compressing
+const int minimumCompressibleSize = 512;
+
+// Compressed parts are written and read in chunks of this size
+const int compressionChunkSize = 16 * 1024;
+
+// Above this many files, syncing each filesystem once is cheaper than syncing every file
+const int groupSyncFileThreshold = 32;
+
 QString defaultPath()
 {
     QString path = QMail::dataPath();
@@ -66,43 +93,84 @@ QString defaultPath()
     return path;
 }
 
-QString randomString(int length)
+// Content files are spread over this many shard directories beneath each base path
+const int shardCount = 256;
+
+QString shardName(const QString &name)
 {
-    if (length <= 0) 
-        return QString();
+    // The shard must be stable across processes, so qHash (which is seeded) is unsuitable
+    const QByteArray data(name.toUtf8());
+    const quint16 checksum(qChecksum(data.constData(), data.length()));
+    return QString::number(checksum % shardCount, 16).rightJustified(2, '0');
+}
 
-    QString str;
-    str.resize(length);
+// Returns the location of a content file in the sharded layout, given its location in the flat layout
+QString shardedPath(const QString &path)
+{
+    QFileInfo fi(path);
+    return fi.absolutePath() + '/' + shardName(fi.fileName()) + '/' + fi.fileName();
+}
 
-    int i = 0;
-    while (length--) {
-        int r=qrand() % 62;
-        r+=48;
-        if (r>57) r+=7;
-        if (r>90) r+=6;
-        str[i++] =  char(r);
+// Returns the longest known base path containing path, or an empty string if there is none
+QString knownContentRoot(const QString &path)
+{
+    QStringList roots(defaultPath());
+    {
+        QMutexLocker lock(&gAccountMutex);
+        foreach (const QString &basePath, gAccountPath) {
+            if (!basePath.isEmpty())
+                roots.append(basePath);
+        }
     }
 
-    return str;
+    QString result;
+    foreach (const QString &root, roots) {
+        const QString directory(QDir::cleanPath(root));
+        if ((directory.length() > result.length()) && path.startsWith(directory + '/'))
+            result = directory;
+    }
+    return result;
 }
 
-QString generateUniqueFileName(const QMailAccountId &accountId, const QString &name = QString())
+bool isShardedPath(const QString &path)
+{
+    // The shard of a content file is determined by its name, and is the only directory
+    // between the file and its base path
+    const QFileInfo fi(path);
+    const QString directory(fi.absolutePath());
+    if (QFileInfo(directory).fileName() != shardName(fi.fileName()))
+        return false;
+
+    const QString root(knownContentRoot(fi.absoluteFilePath()));
+    return (root.isEmpty() || (QFileInfo(directory).absolutePath() == root));
+}
+
+// Returns the base path containing the content file, whichever layout it uses
+QString contentRoot(const QString &path)
 {
-    static const quint64 pid = QCoreApplication::applicationPid();
+    QFileInfo fi(path);
+    if (isShardedPath(path))
+        return QFileInfo(fi.absolutePath()).absolutePath();
 
-    QString filename;
+    return fi.absolutePath();
+}
 
-    // Format: [name]seconds_epoch.pid.randomchars
-    filename = name;
-    filename.append(QString::number(QDateTime::currentDateTime().toTime_t()));
-    filename.append('.');
-    filename.append(QString::number(pid));
-    filename.append('.');
+QString generateUniqueFileName(const QMailAccountId &accountId, const QString &name = QString())
+{
+    // Format: [name]seconds_epoch.pid.counter
+    // The epoch is taken once per process; together with the pid it makes the counter
+    // unique to this process, so no probing for an unused name is required
+    static const QString prefix(QString::number(QDateTime::currentDateTime().toTime_t()) + '.' +
+                                QString::number(QCoreApplication::applicationPid()) + '.');
+    static QAtomicInt counter(0);
 
-    QString path;
-    do {
-        path = QmfStorageManager::messageFilePath(filename + randomString(5), accountId);
-    } while (QFile::exists(path));
+    QString filename(name + prefix + QString::number(counter.fetchAndAddRelaxed(1)));
+    QString path(shardedPath(QmfStorageManager::messageFilePath(filename, accountId)));
+
+    // The shard may have been removed since it was last used, so existence is not cached
+    QString directory(QFileInfo(path).absolutePath());
+    if (!QDir::root().mkpath(directory))
+        qMailLog(Messaging) << "Unable to create messages storage directory " << directory;
 
     return path;
 }
@@ -155,12 +223,397 @@ void syncFile(QSharedPointer<QFile> file)
 #endif
 }
 
+bool syncPath(const QString &path)
+{
+    // Synchronization applies to the file rather than the descriptor, so the
+    // file can be reopened after the handle used to write it has been closed
+    QSharedPointer<QFile> file(new QFile(path));
+#if defined(Q_OS_WIN)
+    if (!file->open(QIODevice::ReadWrite)) {
+#else
+    if (!file->open(QIODevice::ReadOnly)) {
+#endif
+        // The file may have been renamed or removed since it was written
+        qMailLog(Messaging) << "Unable to open content file for synchronization:" << path;
+        return false;
+    }
+
+    syncFile(file);
+    return true;
+}
+
+void syncDirectory(const QString &path)
+{
+#if defined(QMF_NO_DURABILITY) || defined(QMF_NO_SYNCHRONOUS_DB)
+    // Durability is disabled
+    Q_UNUSED(path)
+#elif defined(Q_OS_UNIX)
+    // New directory entries are only durable once the directory itself is synchronized
+    int handle = ::open(QFile::encodeName(path).constData(), O_RDONLY);
+    if (handle != -1) {
+        ::fsync(handle);
+        ::close(handle);
+    }
+#else
+    Q_UNUSED(path)
+#endif
+}
+
+void syncBatch(const QStringList &files, const QSet<QString> &directories)
+{
+#if defined(QMF_NO_DURABILITY) || defined(QMF_NO_SYNCHRONOUS_DB)
+    // Durability is disabled
+    Q_UNUSED(files)
+    Q_UNUSED(directories)
+    return;
+#else
+#if defined(Q_OS_LINUX)
+    if (files.count() > groupSyncFileThreshold) {
+        // A single syncfs covers the data and directory entries of every file on that filesystem
+        QSet<dev_t> devices;
+        foreach (const QString &directory, directories) {
+            int handle = ::open(QFile::encodeName(directory).constData(), O_RDONLY);
+            if (handle == -1)
+                continue;
+
+            struct stat info;
+            if ((::fstat(handle, &info) == 0) && !devices.contains(info.st_dev)) {
+                devices.insert(info.st_dev);
+                if (::syncfs(handle) != 0)
+                    qWarning() << "Could not sync content filesystem for:" << directory;
+            }
+            ::close(handle);
+        }
+        return;
+    }
+#endif
+
+    foreach (const QString &file, files) {
+        syncPath(file);
+    }
+    foreach (const QString &directory, directories) {
+        syncDirectory(directory);
+    }
+#endif
+}
+
+// Part files of accounts using shared parts are hard linked into a content addressed
+// directory, so that identical content is stored once.  The link count of each blob
+// tracks how many part files still refer to it.  Hard links cannot cross filesystems,
+// so the blob directory is kept at the root of each content path rather than once for
+// the whole store: accounts using the default path share one blob directory, while an
+// account configured with its own basePath has its own.
+QString blobDirectory(const QString &fileName)
+{
+    return contentRoot(fileName) + QLatin1String("/blobs");
+}
+
+QString blobFilePath(const QString &fileName, const QByteArray &hash)
+{
+    const QString hex(QString::fromLatin1(hash.toHex()));
+    return blobDirectory(fileName) + '/' + hex.left(2) + '/' + hex;
+}
+
+QString manifestFilePath(const QString &fileName)
+{
+    return QmfStorageManager::messagePartDirectory(fileName) + QLatin1String("/manifest");
+}
+
+class HashingFile : public QFile
+{
+public:
+    HashingFile(const QString &name)
+        : QFile(name),
+          _hash(QCryptographicHash::Sha256)
+    {
+    }
+
+    QByteArray hash() const { return _hash.result(); }
+
+protected:
+    qint64 writeData(const char *data, qint64 len)
+    {
+        qint64 written = QFile::writeData(data, len);
+        if (written > 0)
+            _hash.addData(data, written);
+        return written;
+    }
+
+private:
+    QCryptographicHash _hash;
+};
+
+// Compresses the data written to it into another device, in the format produced by
+// qCompress(), so that a part need not be held in memory to be compressed
+class CompressingDevice : public QIODevice
+{
+public:
+    CompressingDevice(QIODevice *device)
+        : _device(device),
+          _length(0),
+          _failed(false)
+    {
+        _zStream.zalloc = Z_NULL;
+        _zStream.zfree = Z_NULL;
+        _zStream.opaque = Z_NULL;
+        _failed = (deflateInit(&_zStream, Z_DEFAULT_COMPRESSION) != Z_OK);
+
+        // The uncompressed length precedes the data, once it is known
+        const char placeholder[4] = { 0, 0, 0, 0 };
+        _failed |= (_device->write(placeholder, 4) != 4);
+    }
+
+    ~CompressingDevice()
+    {
+        deflateEnd(&_zStream);
+    }
+
+    bool finish()
+    {
+        if (!_failed && deflateChunks(Z_FINISH)) {
+            const uchar length[4] = { uchar(_length >> 24), uchar(_length >> 16), uchar(_length >> 8), uchar(_length) };
+            _failed = !_device->seek(0) || (_device->write(reinterpret_cast<const char *>(length), 4) != 4) ||
+                      !_device->seek(_device->size());
+        }
+        return !_failed;
+    }
+
+protected:
+    qint64 readData(char *, qint64)
+    {
+        return -1;
+    }
+
+    qint64 writeData(const char *data, qint64 len)
+    {
+        _zStream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        _zStream.avail_in = uInt(len);
+        _length += quint32(len);
+        return (!_failed && deflateChunks(Z_NO_FLUSH)) ? len : -1;
+    }
+
+private:
+    bool deflateChunks(int flush)
+    {
+        char buffer[compressionChunkSize];
+        int result;
+        do {
+            _zStream.next_out = reinterpret_cast<Bytef *>(buffer);
+            _zStream.avail_out = compressionChunkSize;
+            result = deflate(&_zStream, flush);
+            if (result == Z_STREAM_ERROR) {
+                _failed = true;
+                return false;
+            }
+
+            const qint64 produced(compressionChunkSize - _zStream.avail_out);
+            if (_device->write(buffer, produced) != produced) {
+                _failed = true;
+                return false;
+            }
+        } while ((_zStream.avail_out == 0) || ((flush == Z_FINISH) && (result != Z_STREAM_END)));
+
+        return true;
+    }
+
+    QIODevice *_device;
+    z_stream _zStream;
+    quint32 _length;
+    bool _failed;
+};
+
+// Reads a part written in the format produced by qCompress(), a chunk at a time
+bool uncompressPart(QFile &file, QByteArray *data)
+{
+    uchar header[4];
+    if (file.read(reinterpret_cast<char *>(header), 4) != 4)
+        return false;
+
+    // The length is only a hint; don't trust it for more than the part could plausibly hold
+    const quint32 expected((quint32(header[0]) << 24) | (quint32(header[1]) << 16) | (quint32(header[2]) << 8) | quint32(header[3]));
+    data->reserve(int(qMin<qint64>(expected, file.size() * 64)));
+
+    z_stream zStream;
+    zStream.zalloc = Z_NULL;
+    zStream.zfree = Z_NULL;
+    zStream.opaque = Z_NULL;
+    zStream.next_in = Z_NULL;
+    zStream.avail_in = 0;
+    if (inflateInit(&zStream) != Z_OK)
+        return false;
+
+    char input[compressionChunkSize];
+    char output[compressionChunkSize];
+    int result(Z_OK);
+    while (result != Z_STREAM_END) {
+        if (zStream.avail_in == 0) {
+            const qint64 count(file.read(input, compressionChunkSize));
+            if (count <= 0)
+                break;
+            zStream.next_in = reinterpret_cast<Bytef *>(input);
+            zStream.avail_in = uInt(count);
+        }
+
+        zStream.next_out = reinterpret_cast<Bytef *>(output);
+        zStream.avail_out = compressionChunkSize;
+        result = inflate(&zStream, Z_NO_FLUSH);
+        if ((result != Z_OK) && (result != Z_STREAM_END))
+            break;
+
+        data->append(output, compressionChunkSize - zStream.avail_out);
+    }
+    inflateEnd(&zStream);
+
+    return (result == Z_STREAM_END);
+}
+
+}
+
+struct PartBlob
+{
+    QByteArray hash;
+    bool compressed;
+
+    PartBlob() : compressed(false) {}
+    PartBlob(const QByteArray &h, bool c) : hash(h), compressed(c) {}
+};
+
+typedef QMap<QString, PartBlob> PartManifest;
+
+static PartManifest readManifest(const QString &fileName)
+{
+    PartManifest manifest;
+
+    QFile file(manifestFilePath(fileName));
+    if (!file.open(QIODevice::ReadOnly))
+        return manifest;
+
+    // Format: one 'location hash flags' line per part
+    while (!file.atEnd()) {
+        const QList<QByteArray> fields(file.readLine().trimmed().split(' '));
+        if (fields.count() == 3) {
+            manifest.insert(QString::fromLatin1(fields.at(0)),
+                            PartBlob(QByteArray::fromHex(fields.at(1)), fields.at(2).contains('z')));
+        }
+    }
+
+    return manifest;
+}
+
+static bool writeManifest(const QString &fileName, const PartManifest &manifest, QList< QSharedPointer<QFile> > *openParts)
+{
+    QSharedPointer<QFile> file(new QFile(manifestFilePath(fileName)));
+    if (!file->open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to open message part manifest file:" << file->fileName();
+        return false;
+    }
+
+    QTextStream out(file.data());
+    PartManifest::const_iterator it = manifest.constBegin(), end = manifest.constEnd();
+    for ( ; it != end; ++it) {
+        out << it.key() << ' ' << it.value().hash.toHex() << ' ' << (it.value().compressed ? 'z' : '-') << '\n';
+    }
+    out.flush();
+    if (out.status() != QTextStream::Ok) {
+        qWarning() << "Unable to write message part manifest file:" << file->fileName();
+        return false;
+    }
+
+    if (openParts) {
+        openParts->append(file);
+    } else {
+        syncFile(file);
+    }
+    return true;
+}
+
+static bool shareBlob(const QString &partFilePath, const QString &blobPath)
+{
+#ifdef USE_SHARED_PARTS
+    const QByteArray part(QFile::encodeName(partFilePath));
+    const QByteArray blob(QFile::encodeName(blobPath));
+
+    // If this is the first copy of the content, it becomes the blob
+    if (::link(part.constData(), blob.constData()) == 0)
+        return true;
+    if (errno == ENOENT) {
+        QDir::root().mkpath(QFileInfo(blobPath).absolutePath());
+        if (::link(part.constData(), blob.constData()) == 0)
+            return true;
+    }
+    if (errno != EEXIST)
+        return false;
+
+    // Identical content is already stored; replace our copy with a link to it
+    const QByteArray replacement(part + "-link");
+    if ((::link(blob.constData(), replacement.constData()) == 0) &&
+        (::rename(replacement.constData(), part.constData()) == 0))
+        return true;
+
+    ::unlink(replacement.constData());
+#else
+    Q_UNUSED(partFilePath)
+    Q_UNUSED(blobPath)
+#endif
+    return false;
+}
+
+static void releaseBlob(const QString &blobPath)
+{
+#ifdef USE_SHARED_PARTS
+    // A blob linked only from the blob directory is no longer referenced by any part.
+    // A concurrent writer linking to it just before removal still keeps its own link.
+    const QByteArray blob(QFile::encodeName(blobPath));
+    struct stat info;
+    if ((::stat(blob.constData(), &info) == 0) && (info.st_nlink == 1)) {
+        if (::unlink(blob.constData()) != 0)
+            qMailLog(Messaging) << "Unable to remove unreferenced part blob:" << blobPath;
+    }
+#else
+    Q_UNUSED(blobPath)
+#endif
+}
+
+static SharedPartsMode sharedPartsMode(const QMailAccountId &accountId)
+{
+#ifdef USE_SHARED_PARTS
+    if (!accountId.isValid())
+        return SharedPartsUnconfigured;
+
+    QMutexLocker lock(&gAccountMutex);
+
+    QMap<QMailAccountId, SharedPartsMode>::const_iterator it = gAccountSharedParts.find(accountId);
+    if (it == gAccountSharedParts.end()) {
+        lock.unlock();
+
+        SharedPartsMode mode(SharedPartsUnconfigured);
+
+        // Look up the configuration for this account
+        QMailAccountConfiguration config(accountId);
+
+        if (config.services().contains(gKey)) {
+            QMailAccountConfiguration::ServiceConfiguration &svcCfg = config.serviceConfiguration(gKey);
+            const QString value(svcCfg.value("sharedParts"));
+            if (value == QLatin1String("true"))
+                mode = SharedPartsEnabled;
+            else if (!value.isEmpty())
+                mode = SharedPartsDisabled;
+        }
+
+        lock.relock();
+        it = gAccountSharedParts.insert(accountId, mode);
+    }
+
+    return it.value();
+#else
+    Q_UNUSED(accountId)
+    return SharedPartsUnconfigured;
+#endif
 }
 
 
 QmfStorageManager::QmfStorageManager(QObject *parent)
-    : QObject(parent),
-      _useFullSync(false)
+    : QObject(parent)
 {
     QString path(messagesBodyPath(QMailAccountId()));
 
@@ -184,8 +637,11 @@ QmfStorageManager::~QmfStorageManager()
 
 void QmfStorageManager::clearAccountPath(const QMailAccountIdList &ids)
 {
-    foreach (const QMailAccountId &id, ids)
+    QMutexLocker lock(&gAccountMutex);
+    foreach (const QMailAccountId &id, ids) {
         gAccountPath.remove(id);
+        gAccountSharedParts.remove(id);
+    }
 }
 
 QMailStore::ErrorCode QmfStorageManager::add(QMailMessage *message, QMailContentManager::DurabilityRequirement durability)
@@ -238,6 +694,7 @@ QMailStore::ErrorCode QmfStorageManager::addOrRename(QMailMessage *message, cons
 
     if (durability == QMailContentManager::EnsureDurability) {
         syncFile(file);
+        syncDirectory(QFileInfo(filePath).absolutePath());
     } else if (durability == QMailContentManager::DeferDurability) {
         syncLater(file);
     } // else NoDurability
@@ -277,41 +734,40 @@ QMailStore::ErrorCode QmfStorageManager::update(QMailMessage *message, QMailCont
 
 QMailStore::ErrorCode QmfStorageManager::ensureDurability()
 {
-    if (_useFullSync) {
-        // More than one file needs to be synchronized
-#if !defined(QMF_NO_DURABILITY) && !defined(QMF_NO_SYNCHRONOUS_DB)
+    // All deferred writes are committed as one group
+    syncBatch(_pendingFiles, _pendingDirectories);
 
-        // Durability is not disabled
-#if defined(Q_OS_WIN)
-        qWarning() << "Unable to call sync on Windows.";
-#else
-        ::sync();
-#endif
-#endif
-        _useFullSync = false;
-    } else {
-        foreach (QSharedPointer<QFile> file, _openFiles) {
-            syncFile(file);
-        }
-    }
-    _openFiles.clear();
+    _pendingFiles.clear();
+    _pendingDirectories.clear();
 
     return QMailStore::NoError;
 }
 
 QMailStore::ErrorCode QmfStorageManager::ensureDurability(const QList<QString> &identifiers)
 {
-    Q_UNUSED(identifiers)
-#if !defined(QMF_NO_DURABILITY) && !defined(QMF_NO_SYNCHRONOUS_DB)
-    // Durability is not disabled
-    
     // Can't just sync identifiers, also must sync message parts
-#if defined(Q_OS_WIN)
-            qWarning() << "Unable to call sync in ensureDurability.";
-#else
-            ::sync();
-#endif
-#endif
+    QStringList files;
+    QSet<QString> directories;
+
+    foreach (const QString &identifier, identifiers) {
+        QFileInfo fi(identifier);
+        if (!fi.exists())
+            continue;
+
+        files.append(fi.absoluteFilePath());
+        directories.insert(fi.absolutePath());
+
+        QDir partDirectory(messagePartDirectory(fi.absoluteFilePath()));
+        if (partDirectory.exists()) {
+            foreach (const QString &entry, partDirectory.entryList(QDir::Files)) {
+                files.append(partDirectory.absoluteFilePath(entry));
+            }
+            directories.insert(partDirectory.absolutePath());
+        }
+    }
+
+    syncBatch(files, directories);
+
     return QMailStore::NoError;
 }
 
@@ -326,7 +782,7 @@ QMailStore::ErrorCode QmfStorageManager::remove(const QString &identifier)
         result = QMailStore::ContentNotRemoved;
     }
 
-    if (!removeParts(identifier)) {
+    if (!removeParts(path)) {
         qMailLog(Messaging) << "Unable to remove part content files for:" << identifier;
         result = QMailStore::ContentNotRemoved;
     }
@@ -334,6 +790,102 @@ QMailStore::ErrorCode QmfStorageManager::remove(const QString &identifier)
     return result;
 }
 
+#if defined(Q_OS_UNIX)
+// Removes the part directory partName of the content file at path, relative to the
+// descriptor of their containing directory
+static bool removePartsAt(int directory, const QByteArray &partName, const QString &path)
+{
+    const int handle = ::openat(directory, partName.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (handle == -1)
+        return (errno == ENOENT);
+
+    // Only the parts of accounts configured for shared parts have a manifest, which must be
+    // read before it is removed with the part files
+    PartManifest manifest;
+
+    bool result(true);
+
+    DIR *parts = ::fdopendir(handle);
+    if (!parts) {
+        ::close(handle);
+        return false;
+    }
+
+    while (struct dirent *entry = ::readdir(parts)) {
+        if ((qstrcmp(entry->d_name, ".") == 0) || (qstrcmp(entry->d_name, "..") == 0))
+            continue;
+
+        if (qstrcmp(entry->d_name, "manifest") == 0)
+            manifest = readManifest(path);
+
+        if ((::unlinkat(::dirfd(parts), entry->d_name, 0) != 0) && (errno != ENOENT)) {
+            qMailLog(Messaging) << "Unable to remove part file:" << entry->d_name;
+            result = false;
+        }
+    }
+    ::closedir(parts);
+
+    if ((::unlinkat(directory, partName.constData(), AT_REMOVEDIR) != 0) && (errno != ENOENT)) {
+        qMailLog(Messaging) << "Unable to remove directory for message part content:" << QmfStorageManager::messagePartDirectory(path);
+        result = false;
+    }
+
+    foreach (const PartBlob &blob, manifest) {
+        releaseBlob(blobFilePath(path, blob.hash));
+    }
+
+    return result;
+}
+#endif
+
+QMailStore::ErrorCode QmfStorageManager::remove(const QList<QString> &identifiers)
+{
+#if defined(Q_OS_UNIX)
+    // Group the content files by directory, so that each directory is opened once for
+    // the batch and its entries are unlinked relative to it, without resolving each path
+    QMap<QString, QStringList> directoryFiles;
+    foreach (const QString &identifier, identifiers) {
+        const QFileInfo fi(identifier);
+        directoryFiles[fi.absolutePath()].append(fi.fileName());
+    }
+
+    QMailStore::ErrorCode result(QMailStore::NoError);
+
+    for (QMap<QString, QStringList>::const_iterator it = directoryFiles.constBegin(); it != directoryFiles.constEnd(); ++it) {
+        const int directory = ::open(QFile::encodeName(it.key()).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (directory == -1) {
+            // Nothing remains to be removed from a directory that no longer exists
+            if (errno != ENOENT) {
+                qMailLog(Messaging) << "Unable to open content directory:" << it.key();
+                result = QMailStore::ContentNotRemoved;
+            }
+            continue;
+        }
+
+        foreach (const QString &fileName, it.value()) {
+            const QByteArray name(QFile::encodeName(fileName));
+            const QString path(it.key() + '/' + fileName);
+
+            if ((::unlinkat(directory, name.constData(), 0) != 0) && (errno != ENOENT)) {
+                qMailLog(Messaging) << "Unable to remove content file:" << path;
+                result = QMailStore::ContentNotRemoved;
+            }
+
+            if (!removePartsAt(directory, QFile::encodeName(messagePartDirectory(fileName)), path)) {
+                qMailLog(Messaging) << "Unable to remove part content files for:" << path;
+                result = QMailStore::ContentNotRemoved;
+            }
+        }
+
+        ::close(directory);
+    }
+
+    return result;
+#else
+    return QMailContentManager::remove(identifiers);
+#endif
+}
+
 struct ReferenceLoader
 {
     const QMailMessage *message;
@@ -393,8 +945,14 @@ static bool loadPartUndecoded(QMailMessagePart &part, const QString &fileName)
 struct PartLoader
 {
     QString fileName;
+    PartManifest manifest;
 
-    PartLoader(const QString &path) : fileName(path) {}
+    PartLoader(const QString &path, bool hasManifest)
+     : fileName(path)
+    {
+        if (hasManifest)
+            manifest = readManifest(path);
+    }
 
     bool operator()(QMailMessagePart &part)
     {
@@ -412,7 +970,18 @@ struct PartLoader
                 // Is the file content in encoded or decoded form?  Since we're delivering
                 // server-side data, the parameter seems reversed...
                 QMailMessageBody::EncodingStatus dataState(part.contentAvailable() ? QMailMessageBody::AlreadyEncoded : QMailMessageBody::RequiresEncoding);
-                part.setBody(QMailMessageBody::fromFile(partFilePath, part.contentType(), part.transferEncoding(), dataState));
+                PartManifest::const_iterator it = (localAttachment ? manifest.constEnd() : manifest.constFind(part.location().toString(false)));
+                if ((it != manifest.constEnd()) && it.value().compressed) {
+                    QFile file(partFilePath);
+                    QByteArray data;
+                    if (!file.open(QIODevice::ReadOnly) || !uncompressPart(file, &data)) {
+                        qMailLog(Messaging) << "Unable to decompress message part content:" << partFilePath;
+                        return false;
+                    }
+                    part.setBody(QMailMessageBody::fromData(data, part.contentType(), part.transferEncoding(), dataState));
+                } else {
+                    part.setBody(QMailMessageBody::fromFile(partFilePath, part.contentType(), part.transferEncoding(), dataState));
+                }
                 if (!part.hasBody() && QFile(partFilePath).size())
                     return false;
             }
@@ -442,6 +1011,9 @@ QMailStore::ErrorCode QmfStorageManager::load(const QString &identifier, QMailMe
         return (pathOnDefault(path) ? QMailStore::FrameworkFault : QMailStore::ContentInaccessible);
     }
 
+    // Content stored before the sharded layout is left in place, since other processes may be
+    // reading it; its identifier continues to name its location
+
     QMailMessage result(QMailMessage::fromSkeletonRfc2822File(path));
 
     // Load the reference information from the meta data into our content object
@@ -452,7 +1024,8 @@ QMailStore::ErrorCode QmfStorageManager::load(const QString &identifier, QMailMe
     }
 
     // Load the content of each part
-    PartLoader partLoader(path);
+    // Only accounts configured for shared parts have a manifest to find compressed parts by
+    PartLoader partLoader(path, sharedPartsMode(message->parentAccountId()) != SharedPartsUnconfigured);
     if (!result.foreachPart<PartLoader&>(partLoader)) {
         qMailLog(Messaging) << "Unable to load parts for:" << identifier;
         return QMailStore::FrameworkFault;
@@ -521,8 +1094,12 @@ const QString &QmfStorageManager::messagesBodyPath(const QMailAccountId &account
     static QString path(defaultPath());
 
     if (accountId.isValid()) {
+        QMutexLocker lock(&gAccountMutex);
+
         QMap<QMailAccountId, QString>::const_iterator it = gAccountPath.find(accountId);
         if (it == gAccountPath.end()) {
+            lock.unlock();
+
             QString basePath;
 
             // Look up the configuration for this account
@@ -533,6 +1110,7 @@ const QString &QmfStorageManager::messagesBodyPath(const QMailAccountId &account
                 basePath = svcCfg.value("basePath");
             }
 
+            lock.relock();
             it = gAccountPath.insert(accountId, basePath);
         }
 
@@ -543,6 +1121,11 @@ const QString &QmfStorageManager::messagesBodyPath(const QMailAccountId &account
     return path;
 }
 
+bool QmfStorageManager::sharedPartsEnabled(const QMailAccountId &accountId)
+{
+    return (sharedPartsMode(accountId) == SharedPartsEnabled);
+}
+
 QString QmfStorageManager::messageFilePath(const QString &fileName, const QMailAccountId &accountId)
 {
     return messagesBodyPath(accountId) + '/' + fileName;
@@ -602,9 +1185,17 @@ struct PartStorer
     QString existing;
     QList< QSharedPointer<QFile> > *openParts;
     bool allowRename;
+    bool shareParts;
+    PartManifest existingManifest;
+    PartManifest *manifest;
 
-    PartStorer(QMailMessage *m, const QString &f, const QString &e, QList< QSharedPointer<QFile> > *o, bool ar)
-     : message(m), fileName(f), existing(e), openParts(o), allowRename(ar) {}
+    PartStorer(QMailMessage *m, const QString &f, const QString &e, QList< QSharedPointer<QFile> > *o, bool ar, SharedPartsMode mode, PartManifest *pm)
+     : message(m), fileName(f), existing(e), openParts(o), allowRename(ar), shareParts(mode == SharedPartsEnabled), manifest(pm)
+    {
+        // Only accounts configured for shared parts have a manifest to carry over
+        if (!existing.isEmpty() && (mode != SharedPartsUnconfigured))
+            existingManifest = readManifest(existing);
+    }
 
     bool operator()(const QMailMessagePart &part)
     {
@@ -612,12 +1203,16 @@ struct PartStorer
             (part.multipartType() == QMailMessagePartContainer::MultipartNone) &&
             part.hasBody()) {
             // We need to store this part
+            QString location(part.location().toString(false));
             QString partFilePath(QmfStorageManager::messagePartFilePath(part, fileName));
 
             if (!part.contentModified() && !existing.isEmpty() && allowRename) {
                 // This part is not modified; see if we can simply move the existing file to the new identifier
                 QString existingPath(QmfStorageManager::messagePartFilePath(part, existing));
                 if (QFile::rename(existingPath, partFilePath)) {
+                    PartManifest::const_iterator it = existingManifest.constFind(location);
+                    if (it != existingManifest.constEnd())
+                        manifest->insert(location, it.value());
                     return true;
                 }
             }
@@ -640,16 +1235,32 @@ struct PartStorer
                 }
             }
 
-            // We need to write the content to a new file
-            QSharedPointer<QFile> file(new QFile(partFilePath));
+            // We need to write the content to a new file, hashing it only if it is to be shared
+            HashingFile *hashingFile = (shareParts ? new HashingFile(partFilePath) : 0);
+            QSharedPointer<QFile> file(hashingFile ? hashingFile : new QFile(partFilePath));
             if (!file->open(QIODevice::WriteOnly)) {
                 qWarning() << "Unable to open new message part content file:" << partFilePath;
                 return false;
             }
 
+            // Complete text parts are stored compressed when sharing is enabled
+            const bool compressed(shareParts && (outputFormat == QMailMessageBody::Decoded) &&
+                                  (part.contentType().type().toLower() == "text") &&
+                                  (part.body().length() >= minimumCompressibleSize));
+
             // Write the part content to file
-            QDataStream out(file.data());
-            if (!part.body().toStream(out, outputFormat) || (out.status() != QDataStream::Ok)) {
+            bool written(false);
+            if (compressed) {
+                CompressingDevice compressor(file.data());
+                compressor.open(QIODevice::WriteOnly);
+                QDataStream out(&compressor);
+                written = (part.body().toStream(out, outputFormat) && (out.status() == QDataStream::Ok) && compressor.finish());
+            } else {
+                QDataStream out(file.data());
+                written = (part.body().toStream(out, outputFormat) && (out.status() == QDataStream::Ok));
+            }
+
+            if (!written) {
                 qMailLog(Messaging) << "Unable to save message part content, removing temporary file:" << partFilePath;
                 file->close();
                 if (!QFile::remove(partFilePath)){
@@ -658,6 +1269,15 @@ struct PartStorer
                 return false;
             }
 
+            if (shareParts) {
+                const QByteArray hash(hashingFile->hash());
+                if (!shareBlob(partFilePath, blobFilePath(fileName, hash))) {
+                    // The part remains usable as an unshared copy
+                    qMailLog(Messaging) << "Unable to share message part content:" << partFilePath;
+                }
+                manifest->insert(location, PartBlob(hash, compressed));
+            }
+
             if (openParts) {
                 openParts->append(file);
             } else {
@@ -683,18 +1303,33 @@ bool QmfStorageManager::addOrRenameParts(QMailMessage *message, const QString &f
     }
 
     QList< QSharedPointer<QFile> > openParts;
-    bool durable = (durability == QMailContentManager::EnsureDurability);
     bool allowRename = (durability != QMailContentManager::NoDurability);
-    PartStorer partStorer(message, fileName, existing, (durable ? 0 : &openParts), allowRename);
+    PartManifest manifest;
+    PartStorer partStorer(message, fileName, existing, &openParts, allowRename,
+                          sharedPartsMode(message->parentAccountId()), &manifest);
     if (!const_cast<const QMailMessage*>(message)->foreachPart(partStorer)) {
         qMailLog(Messaging) << "Unable to store parts for message:" << fileName;
         return false;
     }
 
+    if (!manifest.isEmpty() && !writeManifest(fileName, manifest, &openParts)) {
+        qMailLog(Messaging) << "Unable to store part manifest for message:" << fileName;
+        return false;
+    }
+
     if (durability == QMailContentManager::NoDurability)
       return true; // Don't sync parts, they should be sync'd later
-    foreach(QSharedPointer<QFile> part, openParts) {
-        syncLater(part);
+
+    if (durability == QMailContentManager::EnsureDurability) {
+        // Sync the parts once they have all been written, rather than as each is written
+        foreach (QSharedPointer<QFile> part, openParts) {
+            syncFile(part);
+        }
+        syncDirectory(partDirectory);
+    } else {
+        foreach (QSharedPointer<QFile> part, openParts) {
+            syncLater(part);
+        }
     }
 
     return true;
@@ -708,8 +1343,15 @@ bool QmfStorageManager::removeParts(const QString &fileName)
 
     QDir dir(partDirectory);
     if (dir.exists()) {
+        const QStringList entries(dir.entryList());
+
+        // Only the parts of accounts configured for shared parts have a manifest
+        PartManifest manifest;
+        if (entries.contains(QLatin1String("manifest")))
+            manifest = readManifest(fileName);
+
         // Remove any files in this directory
-        foreach (const QString &entry, dir.entryList()) {
+        foreach (const QString &entry, entries) {
             if ((entry != QString('.')) && (entry != QLatin1String(".."))) {
                 if (!dir.remove(entry)) {
                     qMailLog(Messaging) << "Unable to remove part file:" << entry;
@@ -722,6 +1364,11 @@ bool QmfStorageManager::removeParts(const QString &fileName)
             qMailLog(Messaging) << "Unable to remove directory for message part content:" << partDirectory;
             result = false;
         }
+
+        // Drop any shared content no longer referenced by a part file
+        foreach (const PartBlob &blob, manifest) {
+            releaseBlob(blobFilePath(fileName, blob.hash));
+        }
     }
 
     return result;
@@ -729,20 +1376,12 @@ bool QmfStorageManager::removeParts(const QString &fileName)
 
 void QmfStorageManager::syncLater(QSharedPointer<QFile> file)
 {
-#ifdef USE_FSYNC_PER_FILE
-    _openFiles.append(file);
-#else
-    // In the case of managing multiple files use ::sync, otherwise use fsync
-    if (!_useFullSync) {
-        if (_openFiles.count()) {
-            // Multiple files case
-            _useFullSync = true;
-            _openFiles.clear();
-        } else {
-            _openFiles.append(file);
-        }
-    }
-#endif
+    // Only the name is retained, so that deferring many files does not keep them open
+    file->flush();
+
+    const QString path(QFileInfo(*file).absoluteFilePath());
+    _pendingFiles.append(path);
+    _pendingDirectories.insert(QFileInfo(path).absolutePath());
 }
 
 QmfStorageManagerPlugin::QmfStorageManagerPlugin()
@@ -38,7 +38,9 @@
 #include <qmailcontentmanager.h>
 #include <QList>
 #include <QMap>
+#include <QSet>
 #include <QSharedPointer>
+#include <QStringList>
 
 class QMailMessagePart;
 class QMailMessagePartContainer;
@@ -49,7 +51,7 @@ class QFile;
 
 QT_END_NAMESPACE
 
-class QmfStorageManager : public QObject, public QMailContentManager
+class QmfStorageManager : public QObject, public QMailContentManager, public QMailConcurrentRemovalInterface
 {
     Q_OBJECT
 
@@ -64,6 +66,7 @@ public:
     QMailStore::ErrorCode ensureDurability(const QList<QString> &identifiers);
 
     QMailStore::ErrorCode remove(const QString &identifier);
+    QMailStore::ErrorCode remove(const QList<QString> &identifiers);
     QMailStore::ErrorCode load(const QString &identifier, QMailMessage *message);
 
     bool init();
@@ -74,6 +77,7 @@ public:
     static QString messagePartDirectory(const QString &fileName);
     static QString messagePartFilePath(const QMailMessagePart &part, const QString &fileName);
     static QString messagePartUndecodedFilePath(const QMailMessagePart &part, const QString &fileName);
+    static bool sharedPartsEnabled(const QMailAccountId &accountId);
 
     virtual ManagerRole role() const { return StorageRole; }
 protected slots:
@@ -86,8 +90,8 @@ private:
     bool removeParts(const QString &fileName);
     void syncLater(QSharedPointer<QFile> file);
 
-    QList< QSharedPointer<QFile> > _openFiles;
-    bool _useFullSync;
+    QStringList _pendingFiles;
+    QSet<QString> _pendingDirectories;
 };
 
 
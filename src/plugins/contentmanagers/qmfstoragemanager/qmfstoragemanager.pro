@@ -9,3 +9,9 @@ DEFINES += PLUGIN_INTERNAL
 HEADERS += qmfstoragemanager.h
 
 SOURCES += qmfstoragemanager.cpp
+
+qtConfig(system-zlib) {
+    QMAKE_USE_PRIVATE += zlib
+} else {
+    QT_PRIVATE += zlib-private
+}
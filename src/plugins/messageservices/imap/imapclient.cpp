@@ -201,6 +201,8 @@ protected slots:
     virtual void idleErrorRecovery();
 
 protected:
+    virtual void selectMonitored() { sendSelect(_folder); }
+
     ImapClient *_client;
     QMailFolder _folder;
 
@@ -329,7 +331,7 @@ void IdleProtocol::idleCommandTransition(const ImapCommand command, const Operat
             }
 
             // Server does not support COMPRESS or already compressing
-            sendSelect(_folder);
+            selectMonitored();
             return;
         }
         case IMAP_Select:
@@ -388,6 +390,160 @@ void IdleProtocol::idleErrorRecovery()
     emit openRequest();
 }
 
+class NotifyProtocol : public IdleProtocol {
+    Q_OBJECT
+
+public:
+    NotifyProtocol(ImapClient *client, const QMailFolderIdList &folderIds);
+    virtual ~NotifyProtocol() {}
+
+    const QMailFolderIdList &folderIds() const { return _folderIds; }
+
+    virtual void handleIdling();
+
+protected:
+    virtual void selectMonitored();
+
+protected slots:
+    virtual void idleCommandTransition(ImapCommand, OperationStatus);
+    void notifyStatus(const QString &path, int messages, quint32 uidNext, const QString &highestModSeq);
+
+private:
+    void sendMonitoredNotify();
+
+    struct MailboxStatus
+    {
+        int messages;
+        quint32 uidNext;
+        QString highestModSeq;
+    };
+
+    QMailFolderIdList _folderIds;
+    QMap<QString, QMailFolderId> _pathIds;
+    QMap<QMailFolderId, MailboxStatus> _status;
+};
+
+NotifyProtocol::NotifyProtocol(ImapClient *client, const QMailFolderIdList &folderIds)
+    : IdleProtocol(client, QMailFolder()),
+      _folderIds(folderIds)
+{
+    foreach (const QMailFolderId &id, _folderIds)
+        _pathIds.insert(QMailFolder(id).path(), id);
+
+    connect(this, SIGNAL(mailboxStatus(QString, int, quint32, QString)),
+            this, SLOT(notifyStatus(QString, int, quint32, QString)));
+}
+
+void NotifyProtocol::handleIdling()
+{
+    // One connection is idling on behalf of every monitored folder
+    foreach (const QMailFolderId &id, _folderIds)
+        _client->idling(id);
+}
+
+void NotifyProtocol::selectMonitored()
+{
+    // Flag changes in mailboxes other than the selected one are only reported with CONDSTORE
+    if (capabilities().contains("CONDSTORE")) {
+        sendEnable("CONDSTORE");
+    } else {
+        sendMonitoredNotify();
+    }
+}
+
+void NotifyProtocol::sendMonitoredNotify()
+{
+    QMailFolderList mailboxes;
+    foreach (const QMailFolderId &id, _folderIds)
+        mailboxes.append(QMailFolder(id));
+
+    _status.clear();
+    sendNotify(mailboxes);
+}
+
+void NotifyProtocol::idleCommandTransition(const ImapCommand command, const OperationStatus status)
+{
+    if (command == IMAP_Notify) {
+        if (status != OpOk) {
+            // The server won't monitor these folders for us
+            _client->notifyRejected();
+            return;
+        }
+
+        // No mailbox is selected; events are reported while idling in the authenticated state
+        sendIdle();
+        return;
+    }
+
+    if (command == IMAP_Enable) {
+        if (status != OpOk) {
+            // NOTIFY would miss flag changes, which IDLE on each folder still reports
+            _client->notifyRejected();
+            return;
+        }
+
+        sendMonitoredNotify();
+        return;
+    }
+
+    IdleProtocol::idleCommandTransition(command, status);
+}
+
+void NotifyProtocol::notifyStatus(const QString &path, int messages, quint32 uidNext, const QString &highestModSeq)
+{
+    QMap<QString, QMailFolderId>::const_iterator it = _pathIds.find(path);
+    if ((it == _pathIds.end()) && (path.compare("INBOX", Qt::CaseInsensitive) == 0)) {
+        // The inbox name is case-insensitive
+        for (it = _pathIds.begin(); it != _pathIds.end(); ++it) {
+            if (it.key().compare("INBOX", Qt::CaseInsensitive) == 0)
+                break;
+        }
+    }
+    if (it == _pathIds.end())
+        return;
+
+    const QMailFolderId id(it.value());
+    QMap<QMailFolderId, MailboxStatus>::iterator current = _status.find(id);
+    if (current == _status.end()) {
+        // Initial status, reported in response to NOTIFY SET STATUS
+        MailboxStatus initial;
+        initial.messages = messages;
+        initial.uidNext = uidNext;
+        initial.highestModSeq = highestModSeq;
+        _status.insert(id, initial);
+        return;
+    }
+
+    // Only the attributes affected by an event are reported
+    MailboxStatus &previous(current.value());
+    bool newMail = false;
+    bool changed = false;
+    if (uidNext && (uidNext != previous.uidNext)) {
+        newMail = true;
+        previous.uidNext = uidNext;
+    }
+    if ((messages != -1) && (messages != previous.messages)) {
+        if ((previous.messages != -1) && (messages > previous.messages))
+            newMail = true;
+        else
+            changed = true;
+        previous.messages = messages;
+    }
+    if (!highestModSeq.isEmpty() && (highestModSeq != previous.highestModSeq)) {
+        changed = true;
+        previous.highestModSeq = highestModSeq;
+    }
+
+    if (newMail) {
+        qMailLog(IMAP) << objectName() << "NOTIFY: new mail event occurred in" << path;
+        emit idleNewMailNotification(id);
+    } else if (changed) {
+        // The flags check will also find expunged messages
+        qMailLog(IMAP) << objectName() << "NOTIFY: flags changed event occurred in" << path;
+        emit idleFlagsChangedNotification(id);
+    }
+}
+
 ImapClient::ImapClient(QObject* parent)
     : QObject(parent),
       _closeCount(0),
@@ -397,6 +553,7 @@ ImapClient::ImapClient(QObject* parent)
       _requestRapidClose(false),
       _rapidClosing(false),
       _idleRetryDelay(InitialIdleRetryDelay),
+      _notifier(0),
       _pushConnectionsReserved(0)
 {
     static int count(0);
@@ -460,6 +617,7 @@ ImapClient::~ImapClient()
             protocol->close();
         delete protocol;
     }
+    closeNotifier();
     foreach(QMailMessageBufferFlushCallback *callback, callbacks) {
         QMailMessageBuffer::instance()->removeCallback(callback);
     }
@@ -627,6 +785,7 @@ void ImapClient::commandTransition(ImapCommand command, OperationStatus status)
                         protocol->close();
                         delete protocol;
                     }
+                    closeNotifier();
                 }
                 emit updateStatus( tr("Logging in" ) );
                 _protocol.sendLogin(_config);
@@ -1670,6 +1829,34 @@ void ImapClient::monitor(const QMailFolderIdList &mailboxIds)
         || !imapCfg.pushEnabled()) {
         return;
     }
+
+    if (_protocol.supportsCapability("NOTIFY")) {
+        // All folders can be monitored over a single connection
+        foreach(const QMailFolderId &id, _monitored.keys()) {
+            IdleProtocol *protocol = _monitored.take(id);
+            protocol->close();
+            delete protocol;
+        }
+
+        if (_notifier && (_notifier->folderIds() != mailboxIds))
+            closeNotifier();
+
+        if (!_notifier && !mailboxIds.isEmpty()) {
+            ++count;
+            _notifier = new NotifyProtocol(this, mailboxIds);
+            _notifier->setObjectName(QString("N:%1").arg(count));
+            connect(_notifier, SIGNAL(idleNewMailNotification(QMailFolderId)),
+                    this, SIGNAL(idleNewMailNotification(QMailFolderId)));
+            connect(_notifier, SIGNAL(idleFlagsChangedNotification(QMailFolderId)),
+                    this, SIGNAL(idleFlagsChangedNotification(QMailFolderId)));
+            connect(_notifier, SIGNAL(openRequest()),
+                    this, SLOT(idleOpenRequested()));
+            _notifier->open(imapCfg);
+        }
+        return;
+    }
+
+    closeNotifier();
     
     foreach(const QMailFolderId &id, _monitored.keys()) {
         if (!mailboxIds.contains(id)) {
@@ -1696,6 +1883,38 @@ void ImapClient::monitor(const QMailFolderIdList &mailboxIds)
     }
 }
 
+void ImapClient::notifyRejected()
+{
+    if (!_notifier)
+        return;
+
+    qMailLog(IMAP) << _protocol.objectName()
+                   << "NOTIFY: Server rejected the request to monitor folders, using IDLE for each folder instead.";
+
+    // Remove the capability so that each folder gets its own IDLE connection
+    QStringList capa(_protocol.capabilities());
+    capa.removeAll("NOTIFY");
+    _protocol.setCapabilities(capa);
+
+    // Called by the notifier itself, which must not be deleted yet
+    NotifyProtocol *notifier = _notifier;
+    _notifier = 0;
+    notifier->close();
+    notifier->deleteLater();
+
+    monitor(notifier->folderIds());
+}
+
+void ImapClient::closeNotifier()
+{
+    if (_notifier) {
+        if (_notifier->inUse())
+            _notifier->close();
+        delete _notifier;
+        _notifier = 0;
+    }
+}
+
 void ImapClient::idleOpenRequested()
 {
     if (_protocol.inUse()) { // Setting up new idle connection may be in progress
@@ -1712,6 +1931,7 @@ void ImapClient::idleOpenRequested()
             protocol->close();
         delete protocol;
     }
+    closeNotifier();
     _idlesEstablished = false;
     qMailLog(IMAP) << _protocol.objectName() 
                    << "IDLE: IMAP IDLE error recovery trying to establish IDLE state now.";
@@ -51,6 +51,7 @@
 class ImapStrategy;
 class ImapStrategyContext;
 class IdleProtocol;
+class NotifyProtocol;
 class QMailMessageBufferFlushCallback;
 
 class ImapClient : public QObject
@@ -86,6 +87,7 @@ public:
 
     bool idlesEstablished();
     void idling(const QMailFolderId &id);
+    void notifyRejected();
     QMailFolderIdList configurationIdleFolderIds();
     void monitor(const QMailFolderIdList &mailboxIds);
     void removeAllFromBuffer(QMailMessage *message);
@@ -148,6 +150,7 @@ private:
 
     void deactivateConnection();
     void retrieveOperationCompleted();
+    void closeNotifier();
 
     void operationFailed(int code, const QString &text);
     void operationFailed(QMailServiceAction::Status::ErrorCode code, const QString &text);
@@ -174,6 +177,7 @@ private:
     ImapStrategyContext *_strategyContext;
 
     QMap<QMailFolderId, IdleProtocol*> _monitored;
+    NotifyProtocol *_notifier;
     QList<QMailMessageBufferFlushCallback*> callbacks;
     QVector<QMailMessage*> _bufferedMessages;
     int _pushConnectionsReserved;
@@ -341,6 +341,7 @@ public:
     void setPermanentFlags(const QStringList &flags) { mProtocol->_mailbox.permanentFlags = flags; }
     void setVanished(const QString &vanished) { mProtocol->_mailbox.vanished = vanished; }
     void setChanges(const QList<FlagChange> &changes) { mProtocol->_mailbox.flagChanges = changes; }
+    void setMailboxStatus(const QString &path, int messages, quint32 uidNext, const QString &highestModSeq) { emit mProtocol->mailboxStatus(path, messages, uidNext, highestModSeq); }
 
     void createMail(const QString& uid, const QDateTime &timeStamp, int size, uint flags, const QString &file, const QStringList& structure) { mProtocol->createMail(uid, timeStamp, size, flags, file, structure); }
     void createPart(const QString& uid, const QString &section, const QString &file, int size) { mProtocol->createPart(uid, section, file, size); }
@@ -387,6 +388,9 @@ public:
     OperationStatus status() const { return mStatus; }
     void setStatus(OperationStatus s) { mStatus = s; }
 
+protected:
+    static void statusResponse(ImapContext *c, const QString &line);
+
 private:
     ImapCommand mCommand;
     QString mName;
@@ -413,11 +417,51 @@ void ImapState::untaggedResponse(ImapContext *c, const QString &line)
     } else if (line.indexOf("* CAPABILITY ", 0) != -1) {
         QStringList capabilities = line.mid(13).trimmed().split(' ', QString::SkipEmptyParts);
         c->protocol()->setCapabilities(capabilities);
+    } else if (line.startsWith("* STATUS ", Qt::CaseInsensitive)) {
+        // May be unsolicited, when the server has been asked to NOTIFY us of changes
+        statusResponse(c, line);
     }
 
     c->buffer().append(line);
 }
 
+void ImapState::statusResponse(ImapContext *c, const QString &line)
+{
+    // The attribute list is the last parenthesized item, the mailbox name may contain parentheses
+    const int listStart = line.lastIndexOf('(');
+    const int listEnd = line.lastIndexOf(')');
+    if (listStart == -1 || listEnd < listStart)
+        return;
+
+    QString path(line.mid(9, listStart - 9).trimmed());
+    int pos = 0;
+    if (!token(path, '"', '"', &pos, "\\\"").isNull()) {
+        pos = 0;
+        path = token(path, '"', '"', &pos, "\\\"");
+    }
+    path = ImapProtocol::unescapeFolderPath(path);
+
+    int messages = -1;
+    quint32 uidNext = 0;
+    QString highestModSeq;
+
+    QStringList items(line.mid(listStart + 1, listEnd - listStart - 1).split(' ', QString::SkipEmptyParts));
+    for (int i = 0; i + 1 < items.count(); i += 2) {
+        const QString &name(items.at(i));
+        const QString &value(items.at(i + 1));
+        if (name.compare("MESSAGES", Qt::CaseInsensitive) == 0) {
+            messages = value.toInt();
+        } else if (name.compare("UIDNEXT", Qt::CaseInsensitive) == 0) {
+            uidNext = value.toUInt();
+        } else if (name.compare("HIGHESTMODSEQ", Qt::CaseInsensitive) == 0) {
+            highestModSeq = value;
+        }
+    }
+
+    if (!path.isEmpty())
+        c->setMailboxStatus(path, messages, uidNext, highestModSeq);
+}
+
 void ImapState::taggedResponse(ImapContext *c, const QString &line)
 {
     int index = line.indexOf("[ALERT]", Qt::CaseInsensitive);
@@ -1353,7 +1397,10 @@ void SelectedState::untaggedResponse(ImapContext *c, const QString &line)
 {
     bool result;
 
-    if (line.indexOf("EXISTS", 0, Qt::CaseInsensitive) != -1) {
+    if (line.startsWith("* STATUS ", Qt::CaseInsensitive)) {
+        // Refers to some other mailbox, not the selected one
+        ImapState::untaggedResponse(c, line);
+    } else if (line.indexOf("EXISTS", 0, Qt::CaseInsensitive) != -1) {
         int start = 0;
         QString temp = token(line, ' ', ' ', &start);
         quint32 exists = temp.toUInt(&result);
@@ -1550,7 +1597,7 @@ class FetchFlagsState : public SelectedState
 public:
     FetchFlagsState() : SelectedState(IMAP_FetchFlags, "FetchFlags") { FetchFlagsState::init(); }
 
-    void setProperties(const QString &range, const QString &prefix);
+    void setProperties(const QString &range, const QString &prefix, const QString &changedSince);
 
     virtual void init();
     virtual QString transmit(ImapContext *c);
@@ -1562,12 +1609,14 @@ protected:
     IntegerRegion mReceivedMessages;
     QString mRange;
     QString mPrefix;
+    QString mChangedSince;
 };
 
-void FetchFlagsState::setProperties(const QString &range, const QString &prefix)
+void FetchFlagsState::setProperties(const QString &range, const QString &prefix, const QString &changedSince)
 {
     mRange = range;
     mPrefix = prefix;
+    mChangedSince = changedSince;
 }
 
 void FetchFlagsState::init() 
@@ -1613,6 +1662,10 @@ QString FetchFlagsState::transmit(ImapContext *c)
     QString command = QString("FETCH %1 %2").arg(mRange).arg("(FLAGS UID)");
     if (!mPrefix.isEmpty())
         command = mPrefix.simplified() + " " + command;
+    if (!mChangedSince.isEmpty()) {
+        // RFC 7162: only messages whose mod-sequence exceeds the value are reported
+        command += QString(" (CHANGEDSINCE %1)").arg(mChangedSince);
+    }
     return c->sendCommand(command);
 }
 
@@ -2804,6 +2857,43 @@ void IdleState::untaggedResponse(ImapContext *c, const QString &line)
     }
 }
 
+class NotifyState : public ImapState
+{
+    Q_OBJECT
+
+public:
+    NotifyState() : ImapState(IMAP_Notify, "Notify") {}
+
+    void setMailboxes(const QMailFolderList &mailboxes);
+
+    virtual void init();
+    virtual QString transmit(ImapContext *c);
+
+private:
+    QStringList _paths;
+};
+
+void NotifyState::setMailboxes(const QMailFolderList &mailboxes)
+{
+    _paths.clear();
+    foreach (const QMailFolder &mailbox, mailboxes)
+        _paths.append(ImapProtocol::quoteString(mailbox.path()));
+}
+
+void NotifyState::init()
+{
+    ImapState::init();
+    _paths.clear();
+}
+
+QString NotifyState::transmit(ImapContext *c)
+{
+    // RFC 5465: report new messages, expunges and flag changes in the listed mailboxes,
+    // preceded by the current status of each so that later changes can be detected
+    QString cmd("NOTIFY SET STATUS (mailboxes (" + _paths.join(" ") + ") (MessageNew MessageExpunge FlagChange))");
+    return c->sendCommand(cmd);
+}
+
 class CompressState : public ImapState
 {
     Q_OBJECT
@@ -2865,6 +2955,7 @@ public:
     FullState fullState;
     IdleState idleState;
     CompressState compressState;
+    NotifyState notifyState;
 
     virtual QString sendCommandLiteral(const QString &cmd, uint length);
 
@@ -3322,9 +3413,9 @@ void ImapProtocol::sendUidSearch(MessageFlags flags, const QString &range)
     _fsm->setState(&_fsm->uidSearchState);
 }
 
-void ImapProtocol::sendFetchFlags(const QString &range, const QString &prefix)
+void ImapProtocol::sendFetchFlags(const QString &range, const QString &prefix, const QString &changedSince)
 {
-    _fsm->uidFetchFlagsState.setProperties(range, prefix);
+    _fsm->uidFetchFlagsState.setProperties(range, prefix, changedSince);
     _fsm->setState(&_fsm->uidFetchFlagsState);
 }
 
@@ -3368,6 +3459,12 @@ void ImapProtocol::sendClose()
     _fsm->setState(&_fsm->closeState);
 }
 
+void ImapProtocol::sendNotify(const QMailFolderList &mailboxes)
+{
+    _fsm->notifyState.setMailboxes(mailboxes);
+    _fsm->setState(&_fsm->notifyState);
+}
+
 void ImapProtocol::sendEnable(const QString &extensions)
 {
     _fsm->enableState.setExtensions(extensions);
@@ -84,7 +84,8 @@ enum ImapCommand
     IMAP_FetchFlags,
     IMAP_Noop,
     IMAP_Compress,
-    IMAP_Move
+    IMAP_Move,
+    IMAP_Notify
 };
 
 enum MessageFlag
@@ -189,12 +190,13 @@ public:
     void sendDelete(const QMailFolder &mailbox);
     void sendRename(const QMailFolder &mailbox, const QString &newname);
     void sendMove(const QMailFolder &mailbox, const QMailFolderId &newParentId);
+    void sendNotify(const QMailFolderList &mailboxes);
 
     /*  Valid in Selected state only */
     void sendSearchMessages(const QMailMessageKey &key, const QString &body, const QMailMessageSortKey &sort, bool count);
     void sendSearch(MessageFlags flags, const QString &range = QString());
     void sendUidSearch(MessageFlags flags, const QString &range = QString());
-    void sendFetchFlags(const QString &range, const QString &prefix = QString());
+    void sendFetchFlags(const QString &range, const QString &prefix = QString(), const QString &changedSince = QString());
     void sendUidFetch(FetchItemFlags items, const QString &uidList);
     void sendUidFetchSection(const QString &uid, const QString &section, int start, int end);
     void sendUidFetchSectionHeader(const QString &uid, const QString &section);
@@ -251,6 +253,9 @@ signals:
     void highestModSeq(const QString &);
     void noModSeq();
 
+    // Status of a mailbox other than the selected one, reported by STATUS or NOTIFY
+    void mailboxStatus(const QString &path, int messages, quint32 uidNext, const QString &highestModSeq);
+
 protected slots:
     void connected(QMailTransport::EncryptType encryptType);
     void errorHandling(int status, QString msg);
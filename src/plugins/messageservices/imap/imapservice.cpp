@@ -1488,7 +1488,9 @@ void ImapService::enable()
     _previousConnectionSettings = connectionSettings(imapCfg);
     
     if (imapCfg.pushEnabled() && imapCfg.pushFolders().count()) {
-        _client->setPushConnectionsReserved(reservePushConnections(imapCfg.pushFolders().count()));
+        // A server supporting NOTIFY can monitor all push folders over a single connection
+        const bool notifyCapable(imapCfg.capabilities().contains("NOTIFY", Qt::CaseInsensitive));
+        _client->setPushConnectionsReserved(reservePushConnections(notifyCapable ? 1 : imapCfg.pushFolders().count()));
     }
     
     if (imapCfg.pushEnabled() && _client->pushConnectionsReserved()) {
@@ -62,13 +62,56 @@ QString stripFolderPrefix(const QString &str)
     return str;
 }
 
-QStringList stripFolderPrefix(const QStringList &list)
+// Returns the numeric IMAP UID of the server uid \a str, without allocating a stripped copy
+uint serverUidNumber(const QString &str, bool *ok = 0)
 {
-    QStringList result;
-    foreach(const QString &uid, list) {
-        result.append(stripFolderPrefix(uid));
+    const QChar *begin(str.constData());
+    const QChar *end(begin + str.length());
+    const QChar *it(end);
+    while ((it != begin) && (*(it - 1) != QLatin1Char(UID_SEPARATOR)))
+        --it;
+
+    quint64 value(0);
+    bool valid(it != end);
+    for ( ; valid && (it != end); ++it) {
+        valid = it->isDigit() && ((value = (value * 10) + it->digitValue()) <= INT_MAX);
     }
-    return result;
+
+    if (ok)
+        *ok = valid;
+    return (valid ? static_cast<uint>(value) : 0);
+}
+
+IntegerRegion serverUidRegion(const QStringList &uids)
+{
+    QVector<int> numbers;
+    numbers.reserve(uids.count());
+    foreach (const QString &uid, uids) {
+        bool ok;
+        uint number = serverUidNumber(uid, &ok);
+        if (ok)
+            numbers.append(number);
+    }
+    return IntegerRegion::fromNumbers(numbers);
+}
+
+// Returns the UIDs of the messages in the store matching \a key
+IntegerRegion clientUidRegion(const QMailMessageKey &key)
+{
+    QVector<int> numbers;
+    foreach (const QMailMessageMetaData &metaData, QMailStore::instance()->messagesMetaData(key, QMailMessageKey::ServerUid)) {
+        bool ok;
+        uint number = serverUidNumber(metaData.serverUid(), &ok);
+        if (ok)
+            numbers.append(number);
+    }
+    return IntegerRegion::fromNumbers(numbers);
+}
+
+// Returns the server uids of the messages in \a folderId identified by \a region
+QStringList serverUidList(const QMailFolderId &folderId, const IntegerRegion &region)
+{
+    return region.toStringList(QString::number(folderId.toULongLong()) + UID_SEPARATOR);
 }
 
 QStringList inFirstAndSecond(const QStringList &first, const QStringList &second)
@@ -1185,7 +1228,7 @@ void ImapMessageListStrategy::selectedMailsAppend(const QMailMessageIdList& ids)
 
     QMailMessageKey::Properties props(QMailMessageKey::Id | QMailDisconnected::parentFolderProperties() | QMailMessageKey::ServerUid);
     foreach (const QMailMessageMetaData &metaData, QMailStore::instance()->messagesMetaData(QMailMessageKey::id(ids), props)) {
-        uint serverUid(stripFolderPrefix(metaData.serverUid()).toUInt());
+        uint serverUid(serverUidNumber(metaData.serverUid()));
         _selectionMap[QMailDisconnected::sourceFolderId(metaData)].append(MessageSelector(serverUid, metaData.id(), SectionProperties()));
     }
 }
@@ -1194,7 +1237,7 @@ void ImapMessageListStrategy::selectedSectionsAppend(const QMailMessagePart::Loc
 {
     QMailMessageMetaData metaData(location.containingMessageId());
     if (metaData.id().isValid()) {
-        uint serverUid(stripFolderPrefix(metaData.serverUid()).toUInt());
+        uint serverUid(serverUidNumber(metaData.serverUid()));
         _selectionMap[QMailDisconnected::sourceFolderId(metaData)].append(MessageSelector(serverUid, metaData.id(), SectionProperties(location)));
     }
 }
@@ -1228,6 +1271,8 @@ void ImapMessageListStrategy::checkUidValidity(ImapStrategyContextBase *context)
         folder.removeCustomField("qmf-min-serveruid");
         folder.removeCustomField("qmf-max-serveruid");
         folder.removeCustomField("qmf-highestmodseq");
+        folder.removeCustomField("qmf-modseq-exists");
+        folder.removeCustomField("qmf-modseq-uidnext");
         if (!QMailStore::instance()->updateFolder(&folder)) {
             _error = true;
             qWarning() << "Unable to update folder for account:" << context->config().id();
@@ -1724,7 +1769,7 @@ void ImapFetchSelectedMessagesStrategy::selectedMailsAppend(const QMailMessageId
         }
 
         foreach (const QMailMessageMetaData &metaData, QMailStore::instance()->messagesMetaData(QMailMessageKey::id(idsBatch), props)) {
-            uint serverUid(stripFolderPrefix(metaData.serverUid()).toUInt());
+            uint serverUid(serverUidNumber(metaData.serverUid()));
 
             QMailFolderId remoteFolderId(QMailDisconnected::sourceFolderId(metaData));
 
@@ -1748,7 +1793,7 @@ void ImapFetchSelectedMessagesStrategy::selectedSectionsAppend(const QMailMessag
 
     const QMailMessage message(location.containingMessageId());
     if (message.id().isValid()) {
-        uint serverUid(stripFolderPrefix(message.serverUid()).toUInt());
+        uint serverUid(serverUidNumber(message.serverUid()));
         _selectionMap[QMailDisconnected::sourceFolderId(message)].append(MessageSelector(serverUid, message.id(), SectionProperties(location, minimum)));
 
         if (minimum == SectionProperties::All || minimum >= 0) {
@@ -2028,7 +2073,7 @@ void ImapSearchMessageStrategy::handleSearchMessage(ImapStrategyContextBase *con
         if (ids.size())
             searchResults.append(ids.first());
         else
-            uidsToFetch.add(stripFolderPrefix(uidString).toInt());
+            uidsToFetch.add(serverUidNumber(uidString));
     }
 
     context->messagesCount(properties.searchCount);
@@ -2040,13 +2085,8 @@ void ImapSearchMessageStrategy::handleSearchMessage(ImapStrategyContextBase *con
     context->remainingMessagesCount(qMax(0, int(uidsToFetch.cardinality()) - limit));
 
     if (limit) {
-        QStringList uids = uidsToFetch.toStringList();
-        int start = qMax(0, uids.count() - limit);
-        if (start < uids.count()) {
-            uidsToFetch = IntegerRegion(uids.mid(start, -1));
-        } else {
-            uidsToFetch.clear();
-        }
+        // Fetch only the newest messages, which have the highest UIDs
+        uidsToFetch = uidsToFetch.mid(qMax(0, int(uidsToFetch.cardinality()) - limit));
     }
 
     if(uidsToFetch.isEmpty())
@@ -3212,7 +3252,7 @@ void ImapExportUpdatesStrategy::folderListFolderAction(ImapStrategyContextBase *
     // We have selected the current mailbox
     if (context->mailbox().exists > 0) {
         // Find which of our messages-of-interest are still on the server
-        IntegerRegion clientRegion(stripFolderPrefix(_clientReadUids + _clientUnreadUids + _clientImportantUids + _clientUnimportantUids + _clientDeletedUids));
+        IntegerRegion clientRegion(serverUidRegion(_clientReadUids + _clientUnreadUids + _clientImportantUids + _clientUnimportantUids + _clientDeletedUids));
         context->protocol().sendUidSearch(MFlag_All, "UID " + clientRegion.toString());
     } else {
         // No messages, so no need to perform search
@@ -3376,7 +3416,7 @@ void ImapUpdateMessagesFlagsStrategy::folderListFolderAction(ImapStrategyContext
 
     //  If we have messages, we need to discover any flag changes
     if (properties.exists > 0) {
-        IntegerRegion clientRegion(stripFolderPrefix(_serverUids));
+        IntegerRegion clientRegion(serverUidRegion(_serverUids));
         _filter = clientRegion.toString();
         _searchState = Unseen;
 
@@ -3513,7 +3553,9 @@ void ImapRetrieveMessageListStrategy::handleLogin(ImapStrategyContextBase *conte
     _completionList.clear();
     _completionSectionList.clear();
     _newMinMaxMap.clear();
+    _modSeqMap.clear();
     _listAll = false;
+    _changedSince = false;
     _qresyncListingNew = false;
     _qresyncRetrieve.clear();
     _qresyncVanished = 0;
@@ -3532,6 +3574,12 @@ void ImapRetrieveMessageListStrategy::messageListCompleted(ImapStrategyContextBa
                 folder.setCustomField("qmf-min-serveruid", QString::number(_newMinMaxMap[folderId].minimum()));
                 folder.setCustomField("qmf-max-serveruid", QString::number(_newMinMaxMap[folderId].maximum()));
             }
+            if (_modSeqMap.contains(folderId)) {
+                const ModSeqState &state(_modSeqMap[folderId]);
+                folder.setCustomField("qmf-highestmodseq", state.highestModSeq);
+                folder.setCustomField("qmf-modseq-exists", QString::number(state.exists));
+                folder.setCustomField("qmf-modseq-uidnext", QString::number(state.uidNext));
+            }
             modified = true;
         }
 
@@ -3548,6 +3596,7 @@ void ImapRetrieveMessageListStrategy::messageListCompleted(ImapStrategyContextBa
 
     _updatedFolders.clear();
     _newMinMaxMap.clear();
+    _modSeqMap.clear();
     
     if (!_error) {
         updateAccountLastSynchronized(context);
@@ -3566,11 +3615,7 @@ static void markMessages(IntegerRegion region, quint64 flag, bool set, const QMa
     if (!region.cardinality())
         return;
     
-    QStringList uidList;
-    foreach(QString uid, region.toStringList()) {
-        uidList.append(QString::number(folderId.toULongLong()) + UID_SEPARATOR + uid);
-    }
-    QMailMessageKey uidKey(QMailMessageKey::serverUid(uidList) & QMailMessageKey::status(flag, set ? QMailDataComparator::Excludes : QMailDataComparator::Includes));
+    QMailMessageKey uidKey(QMailMessageKey::serverUid(serverUidList(folderId, region)) & QMailMessageKey::status(flag, set ? QMailDataComparator::Excludes : QMailDataComparator::Includes));
     if (!QMailStore::instance()->updateMessagesMetaData(uidKey, flag, set)) {
         qWarning() << "Unable to update message metadata for folder:" << folderId << "flag" << flag << "set" << set;
         *error = true;
@@ -3587,10 +3632,9 @@ static void processFlagChanges(const QList<FlagChange> &changes, const QMailFold
     IntegerRegion undeleted;
     foreach(FlagChange change, changes) {
         bool ok;
-        QString uidStr(stripFolderPrefix(change.first));
         MessageFlags flags(change.second);
-        int uid(uidStr.toUInt(&ok));
-        if (!uidStr.isEmpty() && ok) {
+        int uid(serverUidNumber(change.first, &ok));
+        if (ok) {
             if (flags & MFlag_Seen) {
                 read.add(uid);
             } else {
@@ -3622,6 +3666,12 @@ static void processFlagChanges(const QList<FlagChange> &changes, const QMailFold
 
 void ImapRetrieveMessageListStrategy::handleFetchFlags(ImapStrategyContextBase *context)
 {
+    if (_changedSince) {
+        _changedSince = false;
+        condstoreHandleFetchFlags(context);
+        return;
+    }
+
     // implement this, should only be hit in non qresync case.
     const ImapMailboxProperties &properties(context->mailbox());
     QMailFolder folder(properties.id);
@@ -3637,37 +3687,26 @@ void ImapRetrieveMessageListStrategy::handleFetchFlags(ImapStrategyContextBase *
     //       been removed from the server using exportUpdates)
     //
     // The set of messages to fetch needs to be adjusted based on the number of such messages
-    IntegerRegion rawServerRegion;
     processFlagChanges(properties.flagChanges, properties.id, &_error);
-    foreach(const QString &uid, properties.uidList) {
-        bool ok;
-        uint number = stripFolderPrefix(uid).toUInt(&ok);
-        if (ok)
-            rawServerRegion.add(number);
-    }
+    IntegerRegion rawServerRegion(serverUidRegion(properties.uidList));
 
     QMailMessageKey sourceKey(QMailDisconnected::sourceKey(folder.id()));
-    
-    IntegerRegion trueClientRegion;
-    foreach (const QMailMessageMetaData& r, QMailStore::instance()->messagesMetaData(sourceKey, QMailMessageKey::ServerUid)) {
-        const QString uid(r.serverUid());
-        int serverUid(stripFolderPrefix(uid).toUInt());
-        trueClientRegion.add(serverUid);
-    }
+    IntegerRegion trueClientRegion(clientUidRegion(sourceKey));
 
     IntegerRegion missingRegion(rawServerRegion.subtract(trueClientRegion));
     missingRegion = missingRegion.subtract(IntegerRegion(1, clientMin-1)).subtract(IntegerRegion(clientMax+1, properties.uidNext));
     if (missingRegion.cardinality()) {
         // Don't fetch message deleted on client but not yet deleted on remote server
-        IntegerRegion removedRegion;
+        QVector<int> removedNumbers;
         foreach (const QMailMessageRemovalRecord& r, QMailStore::instance()->messageRemovalRecords(context->config().id(), folder.id())) {
             if (!r.serverUid().isEmpty() && (r.parentFolderId() == folder.id())) {
-                const QString uid(r.serverUid());
-                int serverUid(stripFolderPrefix(uid).toUInt());
-                removedRegion.add(serverUid);
+                bool ok;
+                uint number = serverUidNumber(r.serverUid(), &ok);
+                if (ok)
+                    removedNumbers.append(number);
             }
         }
-        missingRegion = missingRegion.subtract(removedRegion);
+        missingRegion = missingRegion.subtract(IntegerRegion::fromNumbers(removedNumbers));
     }
 
     if (missingRegion.cardinality()) {
@@ -3686,20 +3725,10 @@ void ImapRetrieveMessageListStrategy::handleFetchFlags(ImapStrategyContextBase *
         serverMinimum = rawServerRegion.minimum();
         if (_listAll) {
             // Considering all messages on the client in the folder
-            IntegerRegion beginningClientRegion; // none of these messages are on the server
-            foreach (const QMailMessageMetaData& r, QMailStore::instance()->messagesMetaData(sourceKey, QMailMessageKey::ServerUid)) {
-                const QString uid(r.serverUid());
-                int serverUid(stripFolderPrefix(uid).toUInt());
-                if (serverUid < serverMinimum)
-                    beginningClientRegion.add(serverUid);
-            }
-            
-            QStringList removedList;
-            foreach(QString uid, beginningClientRegion.toStringList()) {
-                removedList.append(QString::number(folder.id().toULongLong()) + UID_SEPARATOR + uid);
-            }
+            // none of these messages are on the server
+            IntegerRegion beginningClientRegion(trueClientRegion.intersect(IntegerRegion(0, serverMinimum - 1)));
 
-            QMailMessageKey removedKey(QMailMessageKey::serverUid(removedList));
+            QMailMessageKey removedKey(QMailMessageKey::serverUid(serverUidList(folder.id(), beginningClientRegion)));
             if (!purge(context, removedKey)) {
                 _error = true;
             }
@@ -3708,11 +3737,8 @@ void ImapRetrieveMessageListStrategy::handleFetchFlags(ImapStrategyContextBase *
 
     IntegerRegion serverRange(serverMinimum, serverMaximum);
     IntegerRegion clientRegionWithinServerRange(serverRange.intersect(trueClientRegion));
-    IntegerRegion clientRemovedRegion(clientRegionWithinServerRange.subtract(rawServerRegion).toStringList());
-    QStringList removed;
-    foreach(QString uid, clientRemovedRegion.toStringList()) {
-        removed.append(QString::number(folder.id().toULongLong()) + UID_SEPARATOR + uid);
-    }
+    IntegerRegion clientRemovedRegion(clientRegionWithinServerRange.subtract(rawServerRegion));
+    QStringList removed(serverUidList(folder.id(), clientRemovedRegion));
 
     // The list of existing messages on the server can be used to update the status of
     // messages on the client i.e. mark messages on the client as removed for messages that have
@@ -3755,12 +3781,7 @@ void ImapRetrieveMessageListStrategy::handleFetchFlags(ImapStrategyContextBase *
     // The idea here is that if the client has say n messages in a folder and 
     // minimum is set to n then don't get any more messages even if some messages 
     // are marked as removed on the client.
-    QStringList serverOldList(serverOld.toStringList());
-    if (adjustment < serverOldList.count()) {
-        serverOld = IntegerRegion(serverOldList.mid(adjustment));
-    } else {
-        serverOld = IntegerRegion();
-    }
+    serverOld = serverOld.mid(adjustment);
     
     serverRegion = serverNew.add(serverOld);
     _updatedFolders.append(properties.id);
@@ -3785,9 +3806,59 @@ void ImapRetrieveMessageListStrategy::handleFetchFlags(ImapStrategyContextBase *
             _newMinMaxMap.insert(properties.id, IntegerRegion(newClientMin, newClientMax));
     }
 
+    if (_accountCheck && context->protocol().capabilities().contains("CONDSTORE")) {
+        // The flags of all the messages held for this folder are now current
+        recordModSeq(properties);
+    }
+
+    processNextFolder(context);
+}
+
+void ImapRetrieveMessageListStrategy::condstoreHandleFetchFlags(ImapStrategyContextBase *context)
+{
+    const ImapMailboxProperties &properties(context->mailbox());
+    QMailFolder folder(properties.id);
+
+    uint clientMin(folder.customField("qmf-min-serveruid").toUInt());
+    uint clientMax(folder.customField("qmf-max-serveruid").toUInt());
+    uint exists(folder.customField("qmf-modseq-exists").toUInt());
+    uint uidNext(folder.customField("qmf-modseq-uidnext").toUInt());
+
+    // Every message appended since the last synchronization has a greater mod-sequence, so is
+    // reported.  CHANGEDSINCE does not report expunged messages; if the message count is not
+    // accounted for by the appended messages, the full listing is needed to find the removals
+    IntegerRegion changed(serverUidRegion(properties.uidList));
+    IntegerRegion appended(changed.intersect(IntegerRegion(uidNext, INT_MAX)));
+    if (properties.exists != exists + appended.cardinality()) {
+        fetchFlags(context);
+        return;
+    }
+
+    processFlagChanges(properties.flagChanges, properties.id, &_error);
+    _updatedFolders.append(properties.id);
+
+    IntegerRegion difference(changed.subtract(IntegerRegion(0, clientMax)));
+    if (difference.cardinality()) {
+        _retrieveUids.append(qMakePair(properties.id, difference.toStringList()));
+        _newMinMaxMap.insert(properties.id, IntegerRegion(clientMin, difference.maximum()));
+    }
+
+    recordModSeq(properties);
     processNextFolder(context);
 }
 
+void ImapRetrieveMessageListStrategy::recordModSeq(const ImapMailboxProperties &properties)
+{
+    if (properties.noModSeq || properties.highestModSeq.isEmpty())
+        return;
+
+    ModSeqState state;
+    state.highestModSeq = properties.highestModSeq;
+    state.exists = properties.exists;
+    state.uidNext = properties.uidNext;
+    _modSeqMap.insert(properties.id, state);
+}
+
 void ImapRetrieveMessageListStrategy::handleUidSearch(ImapStrategyContextBase *context)
 {
     if (context->protocol().capabilities().contains("QRESYNC")) {
@@ -3804,7 +3875,6 @@ void ImapRetrieveMessageListStrategy::folderListFolderAction(ImapStrategyContext
     uint minimum(_minimum);
     QMailMessageKey sourceKey(QMailDisconnected::sourceKey(properties.id));
 
-    // Could get flag changes mod sequences when CONDSTORE is available
     if ((properties.exists == 0) || (minimum <= 0)) {
         // No messages, so no need to perform search
         if (properties.exists == 0) {
@@ -3824,7 +3894,57 @@ void ImapRetrieveMessageListStrategy::folderListFolderAction(ImapStrategyContext
         qresyncFolderListFolderAction(context);
         return;
     }
-    
+
+    if (context->protocol().capabilities().contains("CONDSTORE") && condstoreFolderListFolderAction(context))
+        return;
+
+    fetchFlags(context);
+}
+
+bool ImapRetrieveMessageListStrategy::condstoreFolderListFolderAction(ImapStrategyContextBase *context)
+{
+    const ImapMailboxProperties &properties(context->mailbox());
+    if (properties.noModSeq || properties.highestModSeq.isEmpty() || _currentModSeq.isEmpty())
+        return false;
+
+    // The state recorded when the folder was last synchronized
+    QMailFolder folder(properties.id);
+    bool ok[4];
+    uint clientMin(folder.customField("qmf-min-serveruid").toUInt(&ok[0]));
+    uint clientMax(folder.customField("qmf-max-serveruid").toUInt(&ok[1]));
+    uint exists(folder.customField("qmf-modseq-exists").toUInt(&ok[2]));
+    uint uidNext(folder.customField("qmf-modseq-uidnext").toUInt(&ok[3]));
+    if (!ok[0] || !ok[1] || !ok[2] || !ok[3] || (clientMin == 0) || (clientMax == 0) || (uidNext == 0))
+        return false;
+
+    // A server whose mod-sequence went backwards no longer reports the changes since ours
+    if (properties.highestModSeq.toULongLong() < _currentModSeq.toULongLong())
+        return false;
+
+    // Listing older messages than those already held requires the full listing
+    QMailMessageKey countKey(QMailDisconnected::sourceKey(properties.id));
+    countKey &= ~QMailMessageKey::status(QMailMessage::Temporary);
+    if ((uint)QMailStore::instance()->countMessages(countKey) < _minimum)
+        return false;
+
+    if ((properties.highestModSeq == _currentModSeq) && (properties.exists == exists) && (properties.uidNext == uidNext)) {
+        // Nothing has changed in this folder
+        processNextFolder(context);
+        return true;
+    }
+
+    // Fetch the flags of only the messages changed since the folder was last synchronized
+    _changedSince = true;
+    context->protocol().sendFetchFlags(QString("%1:*").arg(clientMin), "UID", _currentModSeq);
+    return true;
+}
+
+void ImapRetrieveMessageListStrategy::fetchFlags(ImapStrategyContextBase *context)
+{
+    const ImapMailboxProperties &properties(context->mailbox());
+    uint minimum(_minimum);
+    QMailMessageKey sourceKey(QMailDisconnected::sourceKey(properties.id));
+
     if (_accountCheck) {
         // Request all (non search) messages in this folder or _minimum which ever is greater
         // For all but the first retrieval detect vanished messages and update flags of existing messages
@@ -3847,13 +3967,7 @@ void ImapRetrieveMessageListStrategy::qresyncHandleUidSearch(ImapStrategyContext
 {
     // Add the listed uids to the retrieve list
     const ImapMailboxProperties &properties(context->mailbox());
-    foreach(const QString &uid, properties.uidList) {
-        bool ok;
-        uint number = stripFolderPrefix(uid).toUInt(&ok);
-        if (ok) {
-            _qresyncRetrieve.add(number);
-        }
-    }
+    _qresyncRetrieve = _qresyncRetrieve.add(serverUidRegion(properties.uidList));
         
     if (_qresyncListingNew) {
         // Only new messages have been retrieved, check to see if it's necessary to get more messages
@@ -3882,12 +3996,7 @@ void ImapRetrieveMessageListStrategy::qresyncHandleUidSearch(ImapStrategyContext
         
     // Retrieve messages list in _qresyncRetrieve region that are not already in the store
     QMailMessageKey sourceKey(QMailDisconnected::sourceKey(properties.id));
-    IntegerRegion clientRegion;
-    foreach (const QMailMessageMetaData& r, QMailStore::instance()->messagesMetaData(sourceKey, QMailMessageKey::ServerUid)) {
-        const QString uid(r.serverUid());
-        int serverUid(stripFolderPrefix(uid).toUInt());
-        clientRegion.add(serverUid);
-    }
+    IntegerRegion clientRegion(clientUidRegion(sourceKey));
     
     IntegerRegion difference(_qresyncRetrieve.subtract(clientRegion));
     if (difference.cardinality()) {
@@ -3925,10 +4034,7 @@ void ImapRetrieveMessageListStrategy::qresyncFolderListFolderAction(ImapStrategy
     if (!minServerUid.isEmpty() && !maxServerUid.isEmpty() && ok && ok2) {
         IntegerRegion vanishedOnClient(vanished.intersect(IntegerRegion(clientMin, INT_MAX)));
         _qresyncVanished = vanishedOnClient.cardinality();
-        QStringList removedList;
-        foreach(QString uid, vanishedOnClient.toStringList()) {
-            removedList.append(QString::number(folder.id().toULongLong()) + UID_SEPARATOR + uid);
-        }
+        QStringList removedList(serverUidList(folder.id(), vanishedOnClient));
         if (!removedList.isEmpty()) {
             QMailMessageKey removedKey(QMailMessageKey::serverUid(removedList));
             if (!purge(context, removedKey)) {
@@ -539,6 +539,7 @@ protected:
     virtual void handleUidSearch(ImapStrategyContextBase *context);
     virtual void handleFetchFlags(ImapStrategyContextBase *context);
     virtual void qresyncHandleUidSearch(ImapStrategyContextBase *context);
+    virtual void condstoreHandleFetchFlags(ImapStrategyContextBase *context);
 
     virtual void messageListCompleted(ImapStrategyContextBase *context);
     virtual void folderListCompleted(ImapStrategyContextBase *context);
@@ -546,17 +547,31 @@ protected:
 
     virtual void folderListFolderAction(ImapStrategyContextBase *context);
     virtual void qresyncFolderListFolderAction(ImapStrategyContextBase *context);
+    virtual bool condstoreFolderListFolderAction(ImapStrategyContextBase *context);
 
     virtual bool synchronizationEnabled(const QMailFolder &folder) const;
 
+    void fetchFlags(ImapStrategyContextBase *context);
+    void recordModSeq(const ImapMailboxProperties &properties);
+
+    // The folder state that a later CHANGEDSINCE fetch is relative to
+    struct ModSeqState
+    {
+        QString highestModSeq;
+        uint exists;
+        uint uidNext;
+    };
+
     uint _minimum;
     bool _accountCheck;
     bool _fillingGap;
     bool _listAll;
+    bool _changedSince;
     bool _qresyncListingNew;
     IntegerRegion _qresyncRetrieve;
     int _qresyncVanished;
     QMap<QMailFolderId, IntegerRegion> _newMinMaxMap;
+    QMap<QMailFolderId, ModSeqState> _modSeqMap;
     QMailFolderIdList _updatedFolders;
 };
 
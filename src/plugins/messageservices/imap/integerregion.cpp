@@ -34,6 +34,9 @@
 #include "integerregion.h"
 #include <qmaillog.h>
 
+#include <algorithm>
+#include <climits>
+
 /*
   \class IntegerRegion
   \brief The IntegerRegion class provides a one dimensional integer region 
@@ -42,19 +45,56 @@
   Instantiations can be used to store IMAP sequences sets as described
   in RFC3501.
 
-  Currently the internal representation consists of a list of inclusive 
-  ranges stored in ascending order. A range is stored as a qpair of ints, 
-  the first int in the pair being the beginning of the range (low value) 
-  and the second being the end of the range (high value). A single integer 
+  The internal representation consists of a vector of inclusive ranges
+  stored in ascending order. A range is stored as a qpair of ints, the
+  first int in the pair being the beginning of the range (low value) and
+  the second being the end of the range (high value). A single integer 
   is stored as a range with the start and end being equal. Ranges are 
   non-overlapping, and non-adjacent i.e. there is a gap of at least 
   length one between ranges.
-  
-  If useful this class could be extended to contain new methods such as
-  left (first n integers contained), mid, right, union, intersection, 
-  at (nth integer contained). cardinality could be optimized.
+
+  The set operations are performed by merging the range vectors, so their
+  cost is proportional to the number of ranges rather than the number of
+  integers contained. A folder of many thousands of messages with few gaps
+  in its UIDs is represented by a handful of ranges.
 */
 
+namespace {
+
+// Returns true if a range beginning at \a begin overlaps or abuts a range ending at \a end
+bool adjoins(int end, int begin)
+{
+    return qint64(begin) <= qint64(end) + 1;
+}
+
+bool endsBefore(const IntegerRange &range, int number)
+{
+    return qint64(range.second) + 1 < qint64(number);
+}
+
+bool beginsAfter(int number, const IntegerRange &range)
+{
+    return number < range.first;
+}
+
+// Parses the decimal number at \a it, advancing \a it past the digits consumed
+bool parseNumber(const QChar *&it, const QChar *end, int *number)
+{
+    qint64 value(0);
+    const QChar *begin(it);
+    while ((it != end) && it->isDigit()) {
+        value = (value * 10) + it->digitValue();
+        if (value > INT_MAX)
+            return false;
+        ++it;
+    }
+
+    *number = static_cast<int>(value);
+    return (it != begin);
+}
+
+}
+
 /*!
     Constructs an empty IntegerRegion object.
 */
@@ -67,14 +107,15 @@ IntegerRegion::IntegerRegion()
 */
 IntegerRegion::IntegerRegion(const QStringList &uids)
 {
-    // Performance note currently O(n^2), n = uids.count()
-    // TODO: sort uids if they are not already sorted
+    QVector<int> numbers;
+    numbers.reserve(uids.count());
     foreach(const QString &uid, uids) {
         bool ok(false);
         uint number = uid.toUInt(&ok);
         if (ok)
-            add(number);
+            numbers.append(number);
     }
+    *this = fromNumbers(numbers);
 }
 
 /*
@@ -84,40 +125,58 @@ IntegerRegion::IntegerRegion(const QStringList &uids)
 */
 IntegerRegion::IntegerRegion(const QString &uidString)
 {
-    // Performance note currently O(n^2), n = uids.count()
-    // TODO: sort uids in uidString if they are not already sorted
-    QStringList rangeList = uidString.split(",", QString::SkipEmptyParts);
-    foreach(const QString &s, rangeList) {
-        bool ok = false;
-        int index = s.indexOf(":");
-        if (index == -1) {
-            int a = s.toInt(&ok);
-            if (!ok)
-                continue;
-            add(a);
-        } else if (index > 0) {
-            int a = s.left(index).toInt(&ok);
-            if (!ok)
-                continue;
-            int b = s.mid(index+1).toInt(&ok);
-            if (!ok)
-                continue;
-            for(int i = a; i <= b; ++i) {
-                // could be optimized if union is implemented
-                add(i);
-            }
+    const QChar *it(uidString.constData());
+    const QChar *end(it + uidString.length());
+
+    while (it != end) {
+        int first(0);
+        int second(0);
+        bool valid(parseNumber(it, end, &first));
+        second = first;
+        if (valid && (it != end) && (*it == QLatin1Char(':'))) {
+            ++it;
+            valid = parseNumber(it, end, &second);
         }
+        if (valid && (it != end) && (*it != QLatin1Char(',')))
+            valid = false;
+
+        if (valid) {
+            // The bounds of a range may be given in either order
+            mRangeList.append(IntegerRange(qMin(first, second), qMax(first, second)));
+        }
+
+        // Skip to the next element of the set
+        while ((it != end) && (*it != QLatin1Char(',')))
+            ++it;
+        if (it != end)
+            ++it;
     }
+
+    normalize();
 }
 
 IntegerRegion::IntegerRegion(int begin, int end)
 {
-    clear();
     if (begin > end)
         return;
     mRangeList.append(IntegerRange(begin, end));
 }
 
+/*
+  Returns a region containing the integers of \a numbers, which may be unordered
+  and may contain duplicates.
+*/
+IntegerRegion IntegerRegion::fromNumbers(QVector<int> numbers)
+{
+    std::sort(numbers.begin(), numbers.end());
+
+    IntegerRegion result;
+    foreach (int number, numbers)
+        result.appendRange(number, number);
+
+    return result;
+}
+
 /*
   Removes all ranges from the region.
 */
@@ -135,8 +194,7 @@ bool IntegerRegion::isEmpty() const
 }
 
 /*
-  Number of integers contained in the region. Could be optimized by keeping 
-  a running count in a member variable.
+  Number of integers contained in the region.
 */
 //  Maybe count would be a better name.
 uint IntegerRegion::cardinality() const
@@ -149,6 +207,14 @@ uint IntegerRegion::cardinality() const
     return result;
 }
 
+/*
+  Number of ranges the region is composed of.
+*/
+int IntegerRegion::rangeCount() const
+{
+    return mRangeList.count();
+}
+
 /*
   The maximum integer contained in the region. The region must be not
   be empty. If the region can be empty call isEmpty() before calling this function.
@@ -167,16 +233,56 @@ int IntegerRegion::minimum() const
     return mRangeList.first().first;
 }
 
+/*
+  Returns true if \a number is contained by the region; otherwise returns false.
+*/
+bool IntegerRegion::contains(int number) const
+{
+    QVector<IntegerRange>::const_iterator it = std::upper_bound(mRangeList.constBegin(), mRangeList.constEnd(), number, beginsAfter);
+    if (it == mRangeList.constBegin())
+        return false;
+
+    --it;
+    return (number <= (*it).second);
+}
+
+/*
+  Returns a region containing the integers of this region, omitting the
+  \a position smallest integers.
+*/
+IntegerRegion IntegerRegion::mid(uint position) const
+{
+    IntegerRegion result;
+    foreach (const IntegerRange &range, mRangeList) {
+        const uint length(range.second - range.first + 1);
+        if (position >= length) {
+            position -= length;
+        } else {
+            result.mRangeList.append(IntegerRange(range.first + position, range.second));
+            position = 0;
+        }
+    }
+    return result;
+}
+
 /*
   Returns a string list of integers contained in the region.
 */
 QStringList IntegerRegion::toStringList() const
+{
+    return toStringList(QString());
+}
+
+/*
+  Returns a string list of integers contained in the region, each preceded by \a prefix.
+*/
+QStringList IntegerRegion::toStringList(const QString &prefix) const
 {
     QStringList result;
+    result.reserve(cardinality());
     foreach(const IntegerRange &range, mRangeList) {
-        result += QString::number(range.first);
-        for (int i = range.first + 1; i <= range.second; ++i)
-            result += QString::number(i);
+        for (qint64 i = range.first; i <= range.second; ++i)
+            result += prefix + QString::number(i);
     }
     return result;
 }
@@ -187,13 +293,16 @@ QStringList IntegerRegion::toStringList() const
 QString IntegerRegion::toString() const
 {
     QString result;
+    result.reserve(mRangeList.count() * 12);
     bool first(true);
     foreach(const IntegerRange &range, mRangeList) {
         if (!first)
-            result += ",";
+            result += QLatin1Char(',');
         result += QString::number(range.first);
-        if (range.second > range.first)
-            result += QString(":%1").arg(range.second);
+        if (range.second > range.first) {
+            result += QLatin1Char(':');
+            result += QString::number(range.second);
+        }
         first = false;
     }
     return result;
@@ -203,137 +312,154 @@ QString IntegerRegion::toString() const
   Inserts \a number into the integer region if it is not already contained; 
   otherwise does nothing.
   
-  Currently optimized for appending integers greater than any contained by 
-  the region.
+  Appending integers greater than any contained by the region is performed
+  in constant time; other insertions locate their range by binary search.
 */
 void IntegerRegion::add(int number)
 {
-    // Start from the end of the list of ranges since it's expected that 
-    // normally numbers above the current range contained will be added.
-    QList< IntegerRange >::iterator previous = mRangeList.end();
-    QList< IntegerRange >::iterator next;
-
-    while (previous != mRangeList.begin()) {
-        next = previous;
-        --previous;
-        const int first = (*previous).first;
-        const int second = (*previous).second;
-        if (number < first - 1) {
-            continue;
-        } else if (number > second + 1) {
-            // insert new range between previous and next item
-            mRangeList.insert(next, IntegerRange(number, number));
-            return;
-        } else if (number == second + 1) {
-            // increment upper bound
-            (*previous).second = number;
-            return;
-        } else if ((number >= first) && (number <= second)) {
-            // already contained nothing todo
-            return;
-        } else if (number == first - 1) {
-            if (previous == mRangeList.begin()) {
-                // decrement lower bound first item
-                (*previous).first = number;
-                return;
-            }
+    if (mRangeList.isEmpty() || !adjoins(mRangeList.last().second, number)) {
+        mRangeList.append(IntegerRange(number, number));
+        return;
+    }
 
-            next = previous;
-            --previous;
-            if ((*previous).second == first - 2) {
-                // coalesce current and previous item
-                (*previous).second = (*next).second;
-                mRangeList.erase(next);
-            } else {
-                // decrement lower bound
-                (*next).first = number;
-            }
-            return;
+    // Find the first range that contains or abuts number from below
+    QVector<IntegerRange>::iterator it = std::lower_bound(mRangeList.begin(), mRangeList.end(), number, endsBefore);
+    if (qint64(number) < qint64((*it).first) - 1) {
+        mRangeList.insert(it, IntegerRange(number, number));
+    } else if (qint64(number) == qint64((*it).first) - 1) {
+        // decrement lower bound; the previous range ends before number - 1
+        (*it).first = number;
+    } else if (qint64(number) == qint64((*it).second) + 1) {
+        // increment upper bound, coalescing with the next range if they now abut
+        (*it).second = number;
+        QVector<IntegerRange>::iterator next = it + 1;
+        if ((next != mRangeList.end()) && adjoins(number, (*next).first)) {
+            (*it).second = (*next).second;
+            mRangeList.erase(next);
         }
     }
-    // insert new item at start of list
-    mRangeList.insert(previous, IntegerRange(number, number));
+    // otherwise already contained, nothing todo
 }
 
 /*
   Returns a region containing all integers in this region that are not also 
   in the \a other region.
 */
-IntegerRegion IntegerRegion::subtract(IntegerRegion other) const
+IntegerRegion IntegerRegion::subtract(const IntegerRegion &other) const
 {
-    // Performance note O(n), n = max(a.cardinality(), b.cardinality())
-    IntegerRegion result(*this);
-    QList< IntegerRange >::iterator a = result.mRangeList.begin();
-    QList< IntegerRange >::iterator b = other.mRangeList.begin();
-    
-    while (a != result.mRangeList.end()
-           && b != other.mRangeList.end()) {
-        if ((*b).second < (*a).first) {
-            // b < a, strictly
-            ++b;
-            continue;
-        } else if ((*b).first > (*a).second) {
-            // b > a, strictly
-            ++a;
-            continue;
-        } else if (((*b).first <= (*a).first) && ((*b).second >= (*a).second)) {
-            // b contains a
-            a = result.mRangeList.erase(a);
-            continue;
-        } else if (((*b).first > (*a).first) && ((*b).second < (*a).second)) {
-            // a strictly contains b
-            IntegerRange lowerSlice((*a).first, (*b).first - 1);
-            a = result.mRangeList.insert(a, lowerSlice);
-            ++a;
-            (*a).first = (*b).second + 1;
-            ++b;
-            continue;
-        } else if (((*b).first <= (*a).first) && ((*b).second < (*a).second)) {
-            // b < a, but overlap
-            (*a).first = (*b).second + 1;
-            ++b;
-        } else if (((*b).first <= (*a).second) && ((*b).second >= (*a).second)) {
-            // b > a, but overlap
-            (*a).second = (*b).first - 1;
-            ++a;
-        } else {
-            qWarning() << "Unhandled IntegerRegion case a " << *a << " b " << *b;
-            return result;
+    // Performance note O(n), n = a.rangeCount() + b.rangeCount()
+    IntegerRegion result;
+    result.mRangeList.reserve(mRangeList.count());
+
+    const QVector<IntegerRange> &b(other.mRangeList);
+    int j = 0;
+    foreach (const IntegerRange &a, mRangeList) {
+        qint64 begin(a.first);
+        const qint64 end(a.second);
+
+        while ((j < b.count()) && (b.at(j).second < begin))
+            ++j;
+
+        // Remove each range of b that overlaps a; the last may also overlap the next range of a
+        while ((j < b.count()) && (b.at(j).first <= end)) {
+            if (b.at(j).first > begin)
+                result.mRangeList.append(IntegerRange(static_cast<int>(begin), b.at(j).first - 1));
+
+            begin = qMax(begin, qint64(b.at(j).second) + 1);
+            if (b.at(j).second > end)
+                break;
+            ++j;
         }
+
+        if (begin <= end)
+            result.mRangeList.append(IntegerRange(static_cast<int>(begin), static_cast<int>(end)));
     }
+
     return result;
 }
 
 /*
   Returns the union of this region and the \a other region.
 */
-IntegerRegion IntegerRegion::add(IntegerRegion other) const
+IntegerRegion IntegerRegion::add(const IntegerRegion &other) const
 {
-    if (!cardinality())
+    if (isEmpty())
         return other;
     
-    if (!other.cardinality())
+    if (other.isEmpty())
         return *this;
-    
-    int min = qMin(minimum(), other.minimum());
-    int max = qMax(maximum(), other.maximum());
-    IntegerRegion c(min, max);
-    // a + b = c - (c - a - b)
-    return c.subtract(c.subtract(*this).subtract(other));
+
+    IntegerRegion result;
+    result.mRangeList.reserve(mRangeList.count() + other.mRangeList.count());
+
+    const QVector<IntegerRange> &a(mRangeList);
+    const QVector<IntegerRange> &b(other.mRangeList);
+    int i = 0;
+    int j = 0;
+    while ((i < a.count()) || (j < b.count())) {
+        const IntegerRange &next(((j == b.count()) || ((i < a.count()) && (a.at(i).first <= b.at(j).first))) ? a.at(i++) : b.at(j++));
+        result.appendRange(next.first, next.second);
+    }
+
+    return result;
 }
 
 /*
   Returns the intersection of this region and the \a other region.
 */
-IntegerRegion IntegerRegion::intersect(IntegerRegion other) const
+IntegerRegion IntegerRegion::intersect(const IntegerRegion &other) const
 {
-    IntegerRegion A(*this);
-    IntegerRegion B(other);
-    // A n B = (A U B) - ((A - B) U (B - A)) 
-    IntegerRegion result(A.add(B).subtract(A.subtract(B).add(B.subtract(A))));
+    IntegerRegion result;
+
+    const QVector<IntegerRange> &a(mRangeList);
+    const QVector<IntegerRange> &b(other.mRangeList);
+    int i = 0;
+    int j = 0;
+    while ((i < a.count()) && (j < b.count())) {
+        const int begin(qMax(a.at(i).first, b.at(j).first));
+        const int end(qMin(a.at(i).second, b.at(j).second));
+        if (begin <= end)
+            result.mRangeList.append(IntegerRange(begin, end));
+
+        // Advance whichever range finishes first
+        if (a.at(i).second < b.at(j).second)
+            ++i;
+        else
+            ++j;
+    }
+
     return result;
 }
 
+/*
+  Appends the range \a begin to \a end, which must not begin before the last
+  range of the region, coalescing it with the last range where they overlap or abut.
+*/
+void IntegerRegion::appendRange(int begin, int end)
+{
+    if (mRangeList.isEmpty() || !adjoins(mRangeList.last().second, begin)) {
+        mRangeList.append(IntegerRange(begin, end));
+    } else if (end > mRangeList.last().second) {
+        mRangeList.last().second = end;
+    }
+}
+
+/*
+  Sorts the ranges of the region, coalescing any that overlap or abut.
+*/
+void IntegerRegion::normalize()
+{
+    if (mRangeList.count() < 2)
+        return;
+
+    QVector<IntegerRange> ranges(mRangeList);
+    std::sort(ranges.begin(), ranges.end());
+
+    mRangeList.clear();
+    foreach (const IntegerRange &range, ranges)
+        appendRange(range.first, range.second);
+}
+
 /*
   Returns true if \a uids contains a list of integers; otherwise returns false.
 */
@@ -377,229 +503,3 @@ QList<int> IntegerRegion::toList(const QString &region)
 
     return result;
 }
-
-
-#if 0
-//TODO Convert these tests to standard qunit style
-
-/*
-  Test function.
-  
-  Returns an integer region containing all integers marked in the binary 
-  string \s, counting from zero.
-*/
-IntegerRegion IntegerRegion::fromBinaryString(const QString &s)
-{
-    IntegerRegion result;
-    for (int i = 0; i < s.length(); ++i) {
-        if (!s[i].isSpace())
-            result.add(i);
-    }
-    return result;
-}
-
-/*
-  Test function.
-  
-  Returns a binary string of all integers contained by \ir, counting from zero.
-*/
-QString IntegerRegion::toBinaryString(const IntegerRegion &ir)
-{
-    QString result;
-    int last(0);
-    foreach(const QString &s, ir.toStringList()) {
-        bool ok;
-        int value = s.toInt(&ok);
-        for (int i = last; i < value; ++i)
-            result += ' ';
-        result += '-';
-        last = value + 1;
-    }
-    return result;
-}
-
-/*
-  Test function.
-  
-  Run through some tests.
-*/
-int IntegerRegion::tests()
-{
-    QList<int> values;
-    values << 12 << 13 << 16 << 20 << 22 << 23 << 24 << 27 << 28 << 34;
-
-    QStringList list;
-    foreach (const int &v, values) {
-        list << QString::number(v);
-    }
-
-    qMailLog(Messaging) << "Constructing from QStringList " << list;
-    
-    IntegerRegion ir(list);
-    qMailLog(Messaging) << "IntegerRegion = " << ir.toString();
-    qMailLog(Messaging) << "IntegerRegion::IntegerRegion(QStringList) test1"
-                        << ((ir.toString() == "12:13,16,20,22:24,27:28,34") ? "passed" : "failed");
-    qMailLog(Messaging) << "IntegerRegion::toList(QString) test1"
-                        << ((IntegerRegion::toList(ir.toString()) == values) ? "passed" : "failed");
-    qMailLog(Messaging) << "Adding 31. Insert new region between existing regions.";
-    ir.add(31);
-    qMailLog(Messaging) << "IntegerRegion = " << ir.toString();
-    qMailLog(Messaging) << "Adding 14. Increment first region.";
-    ir.add(14);
-    qMailLog(Messaging) << "IntegerRegion = " << ir.toString();
-    qMailLog(Messaging) << "Adding 13. Ignore.";
-    ir.add(13);
-    qMailLog(Messaging) << "IntegerRegion = " << ir.toString();
-    qMailLog(Messaging) << "Adding 11. Decrement first region.";
-    ir.add(11);
-    qMailLog(Messaging) << "IntegerRegion = " << ir.toString();
-    qMailLog(Messaging) << "Adding 15. Decrement second region and coalesce.";
-    ir.add(15);
-    qMailLog(Messaging) << "IntegerRegion = " << ir.toString();
-    qMailLog(Messaging) << "Adding 26. Decrement lower bound.";
-    ir.add(26);
-    qMailLog(Messaging) << "IntegerRegion = " << ir.toString();
-    qMailLog(Messaging) << "Adding 7. Insert new region at start of list";
-    ir.add(7);
-    qMailLog(Messaging) << "IntegerRegion = " << ir.toString();
-    qMailLog(Messaging) << "Adding 42. Insert new region at end";
-    ir.add(42);
-    qMailLog(Messaging) << "IntegerRegion " << ir.toString();
-    qMailLog(Messaging) << "Adding 43. Increment last region.";
-    ir.add(43);
-    qMailLog(Messaging) << "IntegerRegion = " << ir.toString();
-    qMailLog(Messaging) << "Adding 25. Another coalesce.";
-    ir.add(25);
-    qMailLog(Messaging) << "IntegerRegion = " << ir.toString();
-    qMailLog(Messaging) << "IntegerRegion::toString test2"
-                        << ((ir.toString() == "7,11:16,20,22:28,31,34,42:43") ? "passed" : "failed");
-    qMailLog(Messaging) << "IntegerRegion::cardinality test3"
-                        << ((ir.cardinality() == 19) ? "passed" : "failed");
-
-    qMailLog(Messaging) << "IntegerRegion cardinality() = " << ir.cardinality();
-    qMailLog(Messaging) << "IntegerRegion toStringList() = " << ir.toStringList();
-    qMailLog(Messaging) << "IntegerRegion::isIntegerRegion test4: " 
-                    << (IntegerRegion::isIntegerRegion(ir.toStringList()) ? "passed" : "failed");
-    QStringList hippo;
-    hippo << "1" << "3" << "hippo" << "7";
-    qMailLog(Messaging) << "IntegerRegion::isIntegerRegion test5: " 
-                    << (IntegerRegion::isIntegerRegion(hippo) ? "failed" : "passed");
-
-    QList<int> newValues;
-    foreach (const QString &number, ir.toStringList()) {
-        newValues << number.toInt();
-    }
-    qMailLog(Messaging) << "IntegerRegion::toList(QString) test2"
-                        << ((IntegerRegion::toList(ir.toString()) == newValues) ? "passed" : "failed");
-
-    QString a("    --  -  --  --- -- -- -   --   -- -  -");
-    QString b("  - -- -- ----  -   - -   -   -- --  -   ");
-    QString c("               - - -   - -   -     -    -");
-    IntegerRegion ar = IntegerRegion::fromBinaryString(a);
-    IntegerRegion br = IntegerRegion::fromBinaryString(b);
-    IntegerRegion cr = ar.subtract(br);
-    qMailLog(Messaging) << "a " << ar.toString();
-    qMailLog(Messaging) << "b " << br.toString();
-    qMailLog(Messaging) << "a   " << IntegerRegion::toBinaryString(ar) << " - ";
-    qMailLog(Messaging) << "b   " << IntegerRegion::toBinaryString(br) << " = ";
-    qMailLog(Messaging) << "a-b " << IntegerRegion::toBinaryString(cr);
-    qMailLog(Messaging) << "c   " << c;
-    qMailLog(Messaging) << "IntegerRegion::subtract test6: " 
-                        << ((IntegerRegion::toBinaryString(cr) == c) ? "passed" : "failed");
-    QString a2("     ---  --  ----  ----- ---- ---- ---     ---     --- --  -");
-    QString b2("  -  --- --- ------  ---    -- --      ---    --- ---   --   ");
-    QString c2("                    -   - --     -- ---     --       --     -");
-    ar = IntegerRegion::fromBinaryString(a2);
-    br = IntegerRegion::fromBinaryString(b2);
-    cr = ar.subtract(br);
-    qMailLog(Messaging) << "a2 " << ar.toString();
-    qMailLog(Messaging) << "b2 " << br.toString();
-    qMailLog(Messaging) << "a   " << IntegerRegion::toBinaryString(ar) << " - ";
-    qMailLog(Messaging) << "b   " << IntegerRegion::toBinaryString(br) << " = ";
-    qMailLog(Messaging) << "a-b " << IntegerRegion::toBinaryString(cr);
-    qMailLog(Messaging) << "c   " << c2;
-    qMailLog(Messaging) << "IntegerRegion::subtract test7: " 
-                        << ((IntegerRegion::toBinaryString(cr) == c2) ? "passed" : "failed");
-
-    QString a3("1:7,9:15");
-    QString b3("2:5,10:13,7,1,6,9,12:15");
-    ar = IntegerRegion(b3);
-    qMailLog(Messaging) << "b3 " << b3;
-    qMailLog(Messaging) << "c3 " << ar.toString();
-    qMailLog(Messaging) << "IntegerRegion::fromString test8: " 
-                        << ((ar.toString() == a3) ? "passed" : "failed");
-
-
-    values.clear();
-    list.clear();
-    values << 15555 << 15556 << 15557 << 15558 << 15559 << 15561 << 15562 << 15563 << 15565 
-           << 15566 << 15567 << 15569 << 15573 << 15578 << 15579 << 15580 << 15581 << 15582 
-           << 15584 << 15586 << 15587 << 15590 << 15593 << 15595 << 15596 << 15599 << 15600 
-           << 15602 << 15605 << 15606 << 15607 << 15609;
-
-    foreach (const int &v, values) {
-        list << QString::number(v);
-    }
-    
-    ir = IntegerRegion(list);
-    IntegerRegion jr(ir.minimum(), ir.maximum());
-    ar = jr.subtract(ir);
-    QString a4("15560,15564,15568,15570:15572,15574:15577,15583,15585,15588:15589,15591:15592,15594,15597:15598,15601,15603:15604,15608");
-    
-    qMailLog(Messaging) << "IntegerRegion::subtractTest test9: " 
-                        << ((ar.toString() == a4) ? "passed" : "failed");
-    
-    ir = IntegerRegion("1:20");
-    jr = IntegerRegion("10:30");
-    ar = jr.intersect(ir);
-    QString a5("10:20");
-    qMailLog(Messaging) << "IntegerRegion::intersectionTest test10: " 
-                        << ((ar.toString() == a5) ? "passed" : "failed");
-
-    ar = ir.intersect(jr);
-    qMailLog(Messaging) << "IntegerRegion::intersectionTest test11: " 
-                        << ((ar.toString() == a5) ? "passed" : "failed");
-    
-    ir = IntegerRegion("1:10");
-    jr = IntegerRegion("20:30");
-    ar = jr.intersect(ir);
-    QString a6("");
-    qMailLog(Messaging) << "IntegerRegion::intersectionTest test12: " 
-                        << ((ar.toString() == a6) ? "passed" : "failed");
-
-    ir = IntegerRegion("1:10");
-    jr = IntegerRegion("20:30");
-    ar = ir.intersect(jr);
-    QString a7("");
-    qMailLog(Messaging) << "IntegerRegion::intersectionTest test13: " 
-                        << ((ar.toString() == a7) ? "passed" : "failed");
-
-    ar = ir.intersect(ir);
-    QString a8("1:10");
-    qMailLog(Messaging) << "IntegerRegion::intersectionTest test14: " 
-                        << ((ar.toString() == a8) ? "passed" : "failed");
-    
-    ir = IntegerRegion("1:4,6:8,9,10,30,1000,20000,30000");
-    jr = IntegerRegion("1:30000");
-    ar = ir.intersect(jr);
-    qMailLog(Messaging) << "IntegerRegion::intersectionTest test15: " 
-                        << ((ar.toString() == ir.toString()) ? "passed" : "failed");
-    ar = jr.intersect(ir);
-    qMailLog(Messaging) << "IntegerRegion::intersectionTest test16: " 
-                        << ((ar.toString() == ir.toString()) ? "passed" : "failed");
-    
-    jr = IntegerRegion("2,5,7,100:10000,25000,26000,27000,28000");
-    ar = jr.intersect(ir);
-    QString a9("2,7,1000");
-    qMailLog(Messaging) << "IntegerRegion::intersectionTest test17: " 
-                        << ((ar.toString() == a9) ? "passed" : "failed");
-    
-    ar = ir.intersect(jr);
-    qMailLog(Messaging) << "IntegerRegion::intersectionTest test18: " 
-                        << ((ar.toString() == a9) ? "passed" : "failed");
-
-    return 1;
-}
-
-static const int testsRun = IntegerRegion::tests();
-#endif
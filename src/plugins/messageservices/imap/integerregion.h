@@ -37,6 +37,7 @@
 #include <QString>
 #include <QStringList>
 #include <QPair>
+#include <QVector>
 
 typedef QPair<int, int> IntegerRange;
 
@@ -48,33 +49,34 @@ public:
     IntegerRegion(const QString &uidString);
     IntegerRegion(int begin, int end);
 
+    static IntegerRegion fromNumbers(QVector<int> numbers);
+
     void clear();
     bool isEmpty() const;
     uint cardinality() const;
+    int rangeCount() const;
     int maximum() const;
     int minimum() const;
+    bool contains(int number) const;
+    IntegerRegion mid(uint position) const;
     QStringList toStringList() const;
+    QStringList toStringList(const QString &prefix) const;
     QString toString() const;
 
     void add(int number);
-    IntegerRegion subtract(IntegerRegion) const;
-    IntegerRegion add(IntegerRegion) const;
-    IntegerRegion intersect(IntegerRegion) const;
+    IntegerRegion subtract(const IntegerRegion &other) const;
+    IntegerRegion add(const IntegerRegion &other) const;
+    IntegerRegion intersect(const IntegerRegion &other) const;
 
     static bool isIntegerRegion(QStringList uids);
 
     static QList<int> toList(const QString &region);
 
-#if 0
-// TODO Convert these tests to standard qunit style
-    static IntegerRegion fromBinaryString(const QString &);
-    static QString toBinaryString(const IntegerRegion &);
-    static int tests();
-#endif
-
 private:
-    // TODO: Consider using shared pointer
-    QList< QPair<int, int> > mRangeList;
+    void appendRange(int begin, int end);
+    void normalize();
+
+    QVector<IntegerRange> mRangeList;
 };
 
 #endif
@@ -0,0 +1,848 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "mailboxtransfer.h"
+#include <qmailcontentmanager.h>
+#include <qmailfolder.h>
+#include <qmaillog.h>
+#include <qmailstore.h>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QLocale>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QVector>
+
+#include <algorithm>
+
+#if defined(Q_OS_UNIX)
+#include <unistd.h>
+#endif
+
+struct MailboxMessage
+{
+    MailboxMessage() : status(0) {}
+
+    QByteArray data;
+    quint64 status;
+};
+
+// Reads the messages of a mailbox in order, continuing after the message
+// identified by a checkpoint previously reported by checkpoint()
+class MailboxReader
+{
+public:
+    virtual ~MailboxReader() {}
+
+    virtual bool open(const QString &checkpoint) = 0;
+    virtual bool read(MailboxMessage *message) = 0;
+
+    virtual QString checkpoint() const = 0;
+    virtual uint progress() const = 0;
+    virtual uint total() const = 0;
+
+    QString errorString() const { return _error; }
+
+protected:
+    QString _error;
+};
+
+namespace {
+
+const char checkpointField[] = "qmf-import-checkpoint";
+
+// Returns true once the written content is on stable storage
+bool syncFile(QFile &file)
+{
+    if (!file.flush())
+        return false;
+
+#if defined(QMF_NO_DURABILITY) || defined(QMF_NO_SYNCHRONOUS_DB)
+    // Durability is disabled
+    return true;
+#elif defined(Q_OS_UNIX)
+    return (::fsync(file.handle()) == 0);
+#else
+    return true;
+#endif
+}
+
+QString transferToken(const QByteArray &identity)
+{
+    return QString::fromLatin1(QCryptographicHash::hash(identity, QCryptographicHash::Md5).toHex().left(16));
+}
+
+quint64 maildirStatus(const QString &name)
+{
+    // The flags of a message in cur follow the "2," prefix of the info section
+    const int index = name.lastIndexOf(QLatin1String(":2,"));
+    if (index == -1)
+        return 0;
+
+    quint64 status = 0;
+    foreach (const QChar &flag, name.mid(index + 3)) {
+        switch (flag.toLatin1()) {
+        case 'D': status |= QMailMessage::Draft; break;
+        case 'F': status |= QMailMessage::Important; break;
+        case 'P': status |= QMailMessage::Forwarded; break;
+        case 'R': status |= QMailMessage::Replied; break;
+        case 'S': status |= QMailMessage::Read; break;
+        case 'T': status |= QMailMessage::Trash; break;
+        default: break;
+        }
+    }
+    return status;
+}
+
+QString maildirFlags(quint64 status)
+{
+    // Flags must be listed in ASCII order
+    QString flags;
+    if (status & QMailMessage::Draft)
+        flags.append(QLatin1Char('D'));
+    if (status & QMailMessage::Important)
+        flags.append(QLatin1Char('F'));
+    if (status & QMailMessage::Forwarded)
+        flags.append(QLatin1Char('P'));
+    if (status & QMailMessage::Replied)
+        flags.append(QLatin1Char('R'));
+    if (status & QMailMessage::Read)
+        flags.append(QLatin1Char('S'));
+    if (status & QMailMessage::Trash)
+        flags.append(QLatin1Char('T'));
+    return flags;
+}
+
+// Maildir names change as flags are added, so messages are ordered by the unique part alone
+QString maildirUniqueName(const QString &entry)
+{
+    return entry.section(QLatin1Char('/'), -1).section(QLatin1Char(':'), 0, 0);
+}
+
+bool maildirLessThan(const QString &lhs, const QString &rhs)
+{
+    return maildirUniqueName(lhs) < maildirUniqueName(rhs);
+}
+
+// The status of an mbox message is described by the Status and X-Status header fields
+quint64 mboxStatus(const QMailMessage &message)
+{
+    quint64 status = 0;
+    if (message.headerFieldText(QLatin1String("Status")).contains(QLatin1Char('R')))
+        status |= QMailMessage::Read;
+
+    const QString extended(message.headerFieldText(QLatin1String("X-Status")));
+    if (extended.contains(QLatin1Char('A')))
+        status |= QMailMessage::Replied;
+    if (extended.contains(QLatin1Char('F')))
+        status |= QMailMessage::Important;
+    if (extended.contains(QLatin1Char('T')))
+        status |= QMailMessage::Draft;
+    if (extended.contains(QLatin1Char('D')))
+        status |= QMailMessage::Trash;
+    return status;
+}
+
+void setMboxStatus(QMailMessage *message)
+{
+    const quint64 status(message->status());
+    message->setHeaderField(QLatin1String("Status"), QLatin1String((status & QMailMessage::Read) ? "RO" : "O"));
+
+    QString extended;
+    if (status & QMailMessage::Replied)
+        extended.append(QLatin1Char('A'));
+    if (status & QMailMessage::Important)
+        extended.append(QLatin1Char('F'));
+    if (status & QMailMessage::Draft)
+        extended.append(QLatin1Char('T'));
+    if (status & QMailMessage::Trash)
+        extended.append(QLatin1Char('D'));
+
+    if (extended.isEmpty()) {
+        message->removeHeaderField(QLatin1String("X-Status"));
+    } else {
+        message->setHeaderField(QLatin1String("X-Status"), extended);
+    }
+}
+
+// Returns true if the line is a separator, or a separator quoted by mboxrd
+bool isFromLine(const char *line, int length)
+{
+    int i = 0;
+    while ((i < length) && (line[i] == '>'))
+        ++i;
+    return ((length - i) >= 5) && (qstrncmp(line + i, "From ", 5) == 0);
+}
+
+QByteArray separatorLine(const QMailMessage &message)
+{
+    QString sender(message.from().address());
+    if (sender.isEmpty() || sender.contains(QLatin1Char(' ')))
+        sender = QLatin1String("MAILER-DAEMON");
+
+    QDateTime date(message.date().toUTC());
+    if (!date.isValid())
+        date = QDateTime::currentDateTimeUtc();
+
+    // The date is in the format produced by asctime()
+    const QLocale c(QLocale::c());
+    const QString asctime(c.toString(date, QLatin1String("ddd MMM ")) +
+                          QString::number(date.date().day()).rightJustified(2, QLatin1Char(' ')) +
+                          c.toString(date, QLatin1String(" hh:mm:ss yyyy")));
+
+    return "From " + sender.toLatin1() + ' ' + asctime.toLatin1() + '\n';
+}
+
+QByteArray localLineEndings(const QMailMessage &message)
+{
+    QByteArray data(message.toRfc2822(QMailMessage::IdentityFormat));
+    data.replace("\r\n", "\n");
+    return data;
+}
+
+QMailMessage parseMessage(const MailboxMessage &raw, bool mbox, const QMailFolderId &folderId, const QMailAccountId &accountId, const QString &scheme)
+{
+    QMailMessage message(QMailMessage::fromRfc2822(raw.data));
+
+    message.setParentFolderId(folderId);
+    message.setParentAccountId(accountId);
+    message.setContentScheme(scheme);
+    message.setSize(raw.data.size());
+
+    quint64 status(raw.status | QMailMessage::LocalOnly | QMailMessage::ContentAvailable | QMailMessage::PartialContentAvailable);
+    if (mbox)
+        status |= mboxStatus(message);
+    message.setStatus(status, true);
+
+    return message;
+}
+
+class ParseTask : public QRunnable
+{
+public:
+    ParseTask(const MailboxMessage *raw, QMailMessage *messages, int count, bool mbox,
+              const QMailFolderId &folderId, const QMailAccountId &accountId, const QString &scheme)
+        : _raw(raw), _messages(messages), _count(count), _mbox(mbox),
+          _folderId(folderId), _accountId(accountId), _scheme(scheme)
+    {
+    }
+
+    void run()
+    {
+        for (int i = 0; i < _count; ++i)
+            _messages[i] = parseMessage(_raw[i], _mbox, _folderId, _accountId, _scheme);
+    }
+
+private:
+    const MailboxMessage *_raw;
+    QMailMessage *_messages;
+    int _count;
+    bool _mbox;
+    QMailFolderId _folderId;
+    QMailAccountId _accountId;
+    QString _scheme;
+};
+
+// Messages are delimited by lines beginning with "From ", preceded by an empty
+// line.  Lines of message content that would be mistaken for a delimiter are
+// quoted with '>', which is removed again as the message is read (mboxrd).
+class MboxReader : public MailboxReader
+{
+public:
+    MboxReader(const QString &path)
+        : _file(path),
+          _next(-1)
+    {
+    }
+
+    bool open(const QString &checkpoint)
+    {
+        const qint64 position(checkpoint.toLongLong());
+        if (!_file.open(QIODevice::ReadOnly)) {
+            _error = _file.errorString();
+            return false;
+        }
+        if (position > _file.size()) {
+            _error = QLatin1String("Mailbox is shorter than when previously imported");
+            return false;
+        }
+
+        _file.seek(position);
+        if (_file.atEnd())
+            return true;
+
+        if (!_file.readLine().startsWith("From ")) {
+            _error = QLatin1String("Not an mbox mailbox");
+            return false;
+        }
+
+        _next = position;
+        return true;
+    }
+
+    bool read(MailboxMessage *message)
+    {
+        if (_next == -1)
+            return false;
+
+        message->data.clear();
+        message->status = 0;
+
+        bool blank = false;
+        _next = -1;
+        while (!_file.atEnd()) {
+            const qint64 offset = _file.pos();
+            QByteArray line(_file.readLine());
+            if (blank && line.startsWith("From ")) {
+                _next = offset;
+                break;
+            }
+
+            blank = ((line == "\n") || (line == "\r\n"));
+            if (line.startsWith('>') && isFromLine(line.constData(), line.length()))
+                line.remove(0, 1);
+            message->data.append(line);
+        }
+
+        // The empty line preceding a delimiter is not part of the message
+        if (blank)
+            message->data.chop(message->data.endsWith("\r\n") ? 2 : 1);
+
+        return true;
+    }
+
+    // The checkpoint is the offset of the next message
+    QString checkpoint() const
+    {
+        return QString::number(position());
+    }
+
+    // Progress is reported in kilobytes of the mailbox
+    uint progress() const
+    {
+        return uint(position() / 1024);
+    }
+
+    uint total() const
+    {
+        return uint(_file.size() / 1024);
+    }
+
+private:
+    qint64 position() const
+    {
+        return (_next == -1 ? _file.size() : _next);
+    }
+
+    QFile _file;
+    qint64 _next;
+};
+
+class MaildirReader : public MailboxReader
+{
+public:
+    MaildirReader(const QString &path)
+        : _dir(path),
+          _index(0)
+    {
+    }
+
+    bool open(const QString &checkpoint)
+    {
+        if (!_dir.exists(QLatin1String("cur")) && !_dir.exists(QLatin1String("new"))) {
+            _error = QLatin1String("Not a Maildir mailbox");
+            return false;
+        }
+
+        foreach (const QString &subdirectory, QStringList() << QLatin1String("cur") << QLatin1String("new")) {
+            QDir dir(_dir.filePath(subdirectory));
+            foreach (const QString &name, dir.entryList(QDir::Files))
+                _entries.append(subdirectory + QLatin1Char('/') + name);
+        }
+        std::sort(_entries.begin(), _entries.end(), maildirLessThan);
+
+        // Messages delivered or removed since the checkpoint do not move it
+        _last = checkpoint;
+        if (!_last.isEmpty()) {
+            while ((_index < _entries.count()) && !(_last < maildirUniqueName(_entries.at(_index))))
+                ++_index;
+        }
+        return true;
+    }
+
+    bool read(MailboxMessage *message)
+    {
+        while (_index < _entries.count()) {
+            const QString entry(_entries.at(_index++));
+
+            // Other clients may remove messages while the import is in progress
+            QFile file(_dir.filePath(entry));
+            if (!file.open(QIODevice::ReadOnly)) {
+                qMailLog(Messaging) << "Unable to read Maildir message:" << file.fileName();
+                continue;
+            }
+
+            message->data = file.readAll();
+            message->status = (entry.startsWith(QLatin1String("cur/")) ? maildirStatus(entry) : 0);
+            _last = maildirUniqueName(entry);
+            return true;
+        }
+
+        return false;
+    }
+
+    // The checkpoint is the unique name of the last message read
+    QString checkpoint() const
+    {
+        return _last;
+    }
+
+    uint progress() const
+    {
+        return uint(_index);
+    }
+
+    uint total() const
+    {
+        return uint(_entries.count());
+    }
+
+private:
+    QDir _dir;
+    QStringList _entries;
+    int _index;
+    QString _last;
+};
+
+}
+
+
+MailboxTransfer::MailboxTransfer(quint64 action, QObject *parent)
+    : QObject(parent),
+      _action(action),
+      _messages(0),
+      _bytes(0)
+{
+    _batchTimer.setSingleShot(true);
+    connect(&_batchTimer, SIGNAL(timeout()), this, SLOT(transferBatch()));
+
+    _clock.start();
+}
+
+MailboxTransfer::~MailboxTransfer()
+{
+}
+
+quint64 MailboxTransfer::action() const
+{
+    return _action;
+}
+
+void MailboxTransfer::cancel()
+{
+    _batchTimer.stop();
+}
+
+QMailServiceAction::Status MailboxTransfer::status() const
+{
+    return _status;
+}
+
+void MailboxTransfer::scheduleBatch()
+{
+    // Other requests are serviced between batches
+    _batchTimer.start(0);
+}
+
+void MailboxTransfer::setStatus(QMailServiceAction::Status::ErrorCode code, const QString &text)
+{
+    _status = QMailServiceAction::Status(code, text, QMailAccountId(), QMailFolderId(), QMailMessageId());
+}
+
+void MailboxTransfer::finish()
+{
+    qMailLog(Messaging) << "Mailbox transfer" << _action
+                        << (_status.errorCode == QMailServiceAction::Status::ErrNoError ? "completed:" : "failed:")
+                        << _messages << "messages," << (_bytes / 1024) << "KiB in" << _clock.elapsed() << "ms";
+
+    emit finished(_action, _status);
+}
+
+void MailboxTransfer::batchTransferred(int messages, qint64 bytes)
+{
+    _messages += messages;
+    _bytes += bytes;
+
+    const qint64 elapsed = qMax<qint64>(_clock.elapsed(), 1);
+    const qint64 messageRate = qint64(_messages) * 1000 / elapsed;
+    const qint64 byteRate = _bytes * 1000 / 1024 / elapsed;
+    qMailLog(Messaging) << "Mailbox transfer" << _action << "has moved" << _messages << "messages at"
+                        << messageRate << "messages/s," << byteRate << "KiB/s";
+
+    // Clients see the throughput as the status text of the action
+    const QString text(tr("%n message(s) transferred", "", _messages) + QLatin1String(", ")
+                       + tr("%1 messages/s, %2 KiB/s").arg(messageRate).arg(byteRate));
+    emit statusChanged(_action, QMailServiceAction::Status(QMailServiceAction::Status::ErrNoError, text,
+                                                           QMailAccountId(), QMailFolderId(), QMailMessageId()));
+}
+
+
+MailboxImport::MailboxImport(quint64 action, const QString &path, QMailStorageAction::MailboxFormat format, const QMailFolderId &folderId, QObject *parent)
+    : MailboxTransfer(action, parent),
+      _path(QFileInfo(path).absoluteFilePath()),
+      _format(format),
+      _folderId(folderId)
+{
+    _token = transferToken(QByteArray::number(int(_format)) + ':' + _path.toUtf8());
+}
+
+MailboxImport::~MailboxImport()
+{
+    _parsers.waitForDone();
+}
+
+bool MailboxImport::start()
+{
+    const QMailFolder folder(QMailStore::instance()->folder(_folderId));
+    if (!folder.id().isValid()) {
+        setStatus(QMailServiceAction::Status::ErrInvalidData, tr("Unable to import mailbox to nonexistent folder"));
+        return false;
+    }
+
+    _accountId = folder.parentAccountId();
+    _scheme = QMailContentManagerFactory::defaultScheme();
+
+    if (_format == QMailStorageAction::MaildirFormat) {
+        _reader.reset(new MaildirReader(_path));
+    } else {
+        _reader.reset(new MboxReader(_path));
+    }
+
+    const QString position(checkpoint());
+    if (!_reader->open(position)) {
+        setStatus(QMailServiceAction::Status::ErrInvalidData, tr("Unable to import mailbox %1: %2").arg(_path).arg(_reader->errorString()));
+        return false;
+    }
+
+    if (!position.isEmpty())
+        qMailLog(Messaging) << "Resuming import of" << _path << "from checkpoint" << position;
+
+    emit progressChanged(action(), _reader->progress(), _reader->total());
+    scheduleBatch();
+    return true;
+}
+
+// Returns the checkpoint reached by an earlier import of the same mailbox to this folder
+QString MailboxImport::checkpoint() const
+{
+    const QString field(QLatin1String(checkpointField));
+    const QMailMessageKey key(QMailMessageKey::parentFolderId(_folderId)
+                              & QMailMessageKey::customField(field, _token + QLatin1Char(':'), QMailDataComparator::Includes));
+
+    // The most recently added batch carries the latest checkpoint
+    const QMailMessageIdList ids(QMailStore::instance()->queryMessages(key, QMailMessageSortKey::id(Qt::DescendingOrder), 1));
+    if (ids.isEmpty())
+        return QString();
+
+    return QMailStore::instance()->messageMetaData(ids.first()).customField(field).section(QLatin1Char(':'), 1);
+}
+
+void MailboxImport::transferBatch()
+{
+    QVector<MailboxMessage> raw;
+    qint64 bytes = 0;
+
+    MailboxMessage message;
+    while ((raw.count() < BatchMessages) && (bytes < BatchBytes) && _reader->read(&message)) {
+        bytes += message.data.size();
+        raw.append(message);
+    }
+
+    if (raw.isEmpty()) {
+        finish();
+        return;
+    }
+
+    const bool mbox(_format == QMailStorageAction::MboxFormat);
+
+    // The first message is parsed on this thread, so that anything the parser
+    // initializes on first use is ready before the workers start
+    QVector<QMailMessage> messages(raw.count());
+    QMailMessage *parsed = messages.data();
+    parsed[0] = parseMessage(raw.at(0), mbox, _folderId, _accountId, _scheme);
+
+    const int threads = qMax(_parsers.maxThreadCount(), 1);
+    const int slice = (raw.count() - 1 + threads - 1) / threads;
+    for (int begin = 1; begin < raw.count(); begin += slice) {
+        _parsers.start(new ParseTask(raw.constData() + begin, parsed + begin, qMin(slice, raw.count() - begin),
+                                     mbox, _folderId, _accountId, _scheme));
+    }
+    _parsers.waitForDone();
+
+    // The position reached is committed in the same transaction as the messages,
+    // so that a resumed import neither repeats nor skips any message
+    messages.last().setCustomField(QLatin1String(checkpointField), _token + QLatin1Char(':') + _reader->checkpoint());
+
+    QList<QMailMessage*> list;
+    for (int i = 0; i < messages.count(); ++i)
+        list.append(parsed + i);
+
+    QMailStore *store = QMailStore::instance();
+    if (!store->addMessages(list)) {
+        setStatus(QMailServiceAction::Status::ErrFrameworkFault, tr("Unable to add imported messages"));
+        finish();
+        return;
+    }
+
+    QMailMessageIdList ids;
+    foreach (const QMailMessage *added, list)
+        ids.append(added->id());
+
+    emit messagesAdded(action(), ids);
+    emit progressChanged(action(), _reader->progress(), _reader->total());
+    batchTransferred(raw.count(), bytes);
+
+    store->flushIpcNotifications();
+    scheduleBatch();
+}
+
+
+MailboxExport::MailboxExport(quint64 action, const QMailMessageKey &key, const QString &path, QMailStorageAction::MailboxFormat format, QObject *parent)
+    : MailboxTransfer(action, parent),
+      _key(key),
+      _path(QFileInfo(path).absoluteFilePath()),
+      _format(format),
+      _next(0)
+{
+    QByteArray identity;
+    {
+        QDataStream stream(&identity, QIODevice::WriteOnly);
+        stream << int(_format) << _key;
+    }
+    _token = transferToken(identity);
+}
+
+MailboxExport::~MailboxExport()
+{
+}
+
+bool MailboxExport::start()
+{
+    _ids = QMailStore::instance()->queryMessages(_key, QMailMessageSortKey::id());
+
+    QMailMessageId lastId;
+    qint64 size = 0;
+    const bool resuming(readCheckpoint(&lastId, &size));
+    if (resuming) {
+        while ((_next < _ids.count()) && (_ids.at(_next).toULongLong() <= lastId.toULongLong()))
+            ++_next;
+
+        qMailLog(Messaging) << "Resuming export to" << _path << "after message" << lastId;
+    }
+
+    bool opened;
+    if (_format == QMailStorageAction::MaildirFormat) {
+        QDir dir(_path);
+        opened = (dir.mkpath(QLatin1String("cur")) && dir.mkpath(QLatin1String("new")) && dir.mkpath(QLatin1String("tmp")));
+    } else {
+        _mbox.setFileName(_path);
+        opened = _mbox.open(QIODevice::WriteOnly | QIODevice::Append);
+        if (opened && resuming) {
+            if (size > _mbox.size()) {
+                // Content covered by the checkpoint has been lost, so the export starts again
+                qMailLog(Messaging) << "Mailbox" << _path << "is shorter than when previously exported; restarting export";
+                _next = 0;
+                lastId = QMailMessageId();
+            } else if (size < _mbox.size()) {
+                // Anything written after the last checkpoint is incomplete
+                opened = _mbox.resize(size);
+            }
+        }
+        size = _mbox.size();
+    }
+
+    if (!opened || !writeCheckpoint(lastId, size)) {
+        setStatus(QMailServiceAction::Status::ErrFrameworkFault, tr("Unable to export mailbox to %1").arg(_path));
+        return false;
+    }
+
+    emit progressChanged(action(), _next, _ids.count());
+    scheduleBatch();
+    return true;
+}
+
+QString MailboxExport::checkpointPath() const
+{
+    if (_format == QMailStorageAction::MaildirFormat)
+        return QDir(_path).filePath(QLatin1String(".qmf-export"));
+
+    return _path + QLatin1String(".qmf-export");
+}
+
+bool MailboxExport::readCheckpoint(QMailMessageId *lastId, qint64 *size) const
+{
+    QFile file(checkpointPath());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QString token;
+    quint64 id;
+    QDataStream stream(&file);
+    stream >> token >> id >> *size;
+
+    // A checkpoint left by an export of different messages does not apply
+    if ((stream.status() != QDataStream::Ok) || (token != _token)) {
+        *size = 0;
+        return false;
+    }
+
+    *lastId = QMailMessageId(id);
+    return true;
+}
+
+bool MailboxExport::writeCheckpoint(const QMailMessageId &lastId, qint64 size) const
+{
+    QSaveFile file(checkpointPath());
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream << _token << lastId.toULongLong() << size;
+    return file.commit();
+}
+
+bool MailboxExport::writeMbox(QMailMessage &message, qint64 *bytes)
+{
+    setMboxStatus(&message);
+    const QByteArray data(localLineEndings(message));
+
+    QByteArray output(separatorLine(message));
+    output.reserve(output.size() + data.size() + 64);
+
+    int start = 0;
+    while (start < data.size()) {
+        int end = data.indexOf('\n', start);
+        if (end == -1)
+            end = data.size() - 1;
+
+        // Any line that could be mistaken for a delimiter is quoted
+        if (isFromLine(data.constData() + start, end - start + 1))
+            output.append('>');
+        output.append(data.constData() + start, end - start + 1);
+        start = end + 1;
+    }
+
+    if (!output.endsWith('\n'))
+        output.append('\n');
+    output.append('\n');
+
+    *bytes += output.size();
+    return (_mbox.write(output) == output.size());
+}
+
+bool MailboxExport::writeMaildir(QMailMessage &message, qint64 *bytes)
+{
+    const QByteArray data(localLineEndings(message));
+
+    // Names are derived from the message, so a resumed export replaces rather than duplicates
+    QDateTime date(message.date().toUTC());
+    const QString unique(QString::fromLatin1("%1.M%2.qmf").arg(date.isValid() ? date.toSecsSinceEpoch() : 0).arg(message.id().toULongLong()));
+
+    QDir dir(_path);
+    const QString temporary(dir.filePath(QLatin1String("tmp/") + unique));
+    const QString target(dir.filePath(QLatin1String("cur/") + unique + QLatin1String(":2,") + maildirFlags(message.status())));
+
+    QFile file(temporary);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || (file.write(data) != data.size())) {
+        qWarning() << "Unable to write Maildir message:" << temporary << file.errorString();
+        return false;
+    }
+    file.close();
+
+    // Messages only appear in cur once they are complete
+    QFile::remove(target);
+    if (!QFile::rename(temporary, target)) {
+        qWarning() << "Unable to deliver Maildir message:" << target;
+        return false;
+    }
+
+    *bytes += data.size();
+    return true;
+}
+
+void MailboxExport::transferBatch()
+{
+    if (_next >= _ids.count()) {
+        _mbox.close();
+        QFile::remove(checkpointPath());
+        finish();
+        return;
+    }
+
+    int count = 0;
+    qint64 bytes = 0;
+    while ((_next < _ids.count()) && (count < BatchMessages) && (bytes < BatchBytes)) {
+        const QMailMessageId id(_ids.at(_next));
+
+        // Messages removed since the export began are skipped
+        QMailMessage message(id);
+        if (message.id().isValid()) {
+            const bool written(_format == QMailStorageAction::MaildirFormat ? writeMaildir(message, &bytes) : writeMbox(message, &bytes));
+            if (!written) {
+                setStatus(QMailServiceAction::Status::ErrFileSystemFull, tr("Unable to write message to %1").arg(_path));
+                finish();
+                return;
+            }
+            ++count;
+        }
+        ++_next;
+    }
+
+    // The checkpoint must never cover content that could still be lost
+    if (_mbox.isOpen() && !syncFile(_mbox)) {
+        setStatus(QMailServiceAction::Status::ErrFileSystemFull, tr("Unable to write message to %1").arg(_path));
+        finish();
+        return;
+    }
+    if (!writeCheckpoint(_ids.at(_next - 1), _mbox.isOpen() ? _mbox.size() : 0)) {
+        setStatus(QMailServiceAction::Status::ErrFrameworkFault, tr("Unable to record progress of export to %1").arg(_path));
+        finish();
+        return;
+    }
+
+    emit progressChanged(action(), _next, _ids.count());
+    batchTransferred(count, bytes);
+    scheduleBatch();
+}
@@ -0,0 +1,165 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef MAILBOXTRANSFER_H
+#define MAILBOXTRANSFER_H
+
+#include <qmailmessage.h>
+#include <qmailmessagekey.h>
+#include <qmailserviceaction.h>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QObject>
+#include <QScopedPointer>
+#include <QString>
+#include <QThreadPool>
+#include <QTimer>
+
+class MailboxReader;
+
+/*
+    Moves whole mailboxes between the mail store and files in the mbox or
+    Maildir formats.  The mailbox is processed in batches, each of which is
+    a single store transaction or a single flush of the output, and control
+    returns to the event loop between batches.  Only the messages of the
+    current batch are held in memory, however large the mailbox is.
+
+    Each batch also records how far the transfer has progressed, so that a
+    transfer which is interrupted continues from that point when the same
+    request is made again.
+*/
+class MailboxTransfer : public QObject
+{
+    Q_OBJECT
+
+public:
+    virtual ~MailboxTransfer();
+
+    quint64 action() const;
+
+    // Returns false, with the reason in status(), if the transfer can't begin
+    virtual bool start() = 0;
+    void cancel();
+
+    QMailServiceAction::Status status() const;
+
+signals:
+    void progressChanged(quint64 action, uint progress, uint total);
+    void statusChanged(quint64 action, const QMailServiceAction::Status &status);
+    void messagesAdded(quint64 action, const QMailMessageIdList &ids);
+    void finished(quint64 action, const QMailServiceAction::Status &status);
+
+protected slots:
+    virtual void transferBatch() = 0;
+
+protected:
+    MailboxTransfer(quint64 action, QObject *parent);
+
+    void scheduleBatch();
+    void setStatus(QMailServiceAction::Status::ErrorCode code, const QString &text);
+    void finish();
+
+    void batchTransferred(int messages, qint64 bytes);
+
+    static const int BatchMessages = 500;
+    static const int BatchBytes = 16 * 1024 * 1024;
+
+private:
+    quint64 _action;
+    QMailServiceAction::Status _status;
+    QTimer _batchTimer;
+
+    QElapsedTimer _clock;
+    int _messages;
+    qint64 _bytes;
+};
+
+class MailboxImport : public MailboxTransfer
+{
+    Q_OBJECT
+
+public:
+    MailboxImport(quint64 action, const QString &path, QMailStorageAction::MailboxFormat format, const QMailFolderId &folderId, QObject *parent = 0);
+    ~MailboxImport();
+
+    bool start();
+
+protected slots:
+    void transferBatch();
+
+private:
+    QString checkpoint() const;
+
+    QString _path;
+    QMailStorageAction::MailboxFormat _format;
+    QMailFolderId _folderId;
+    QMailAccountId _accountId;
+    QString _scheme;
+    QString _token;
+
+    QScopedPointer<MailboxReader> _reader;
+    QThreadPool _parsers;
+};
+
+class MailboxExport : public MailboxTransfer
+{
+    Q_OBJECT
+
+public:
+    MailboxExport(quint64 action, const QMailMessageKey &key, const QString &path, QMailStorageAction::MailboxFormat format, QObject *parent = 0);
+    ~MailboxExport();
+
+    bool start();
+
+protected slots:
+    void transferBatch();
+
+private:
+    QString checkpointPath() const;
+    bool readCheckpoint(QMailMessageId *lastId, qint64 *size) const;
+    bool writeCheckpoint(const QMailMessageId &lastId, qint64 size) const;
+
+    bool writeMbox(QMailMessage &message, qint64 *bytes);
+    bool writeMaildir(QMailMessage &message, qint64 *bytes);
+
+    QMailMessageKey _key;
+    QString _path;
+    QMailStorageAction::MailboxFormat _format;
+    QString _token;
+
+    QMailMessageIdList _ids;
+    int _next;
+    QFile _mbox;
+};
+
+#endif
@@ -156,6 +156,10 @@ MailMessageClient::MailMessageClient(QObject* parent)
                this, SIGNAL(flagMessages(quint64, QMailMessageIdList, quint64, quint64)));
     connectIpc(adaptor, MESSAGE(restoreToPreviousFolder(quint64, QMailMessageKey)),
                this, SIGNAL(restoreToPreviousFolder(quint64, QMailMessageKey)));
+    connectIpc(adaptor, MESSAGE(importMailbox(quint64, QString, QMailStorageAction::MailboxFormat, QMailFolderId)),
+               this, SIGNAL(importMailbox(quint64, QString, QMailStorageAction::MailboxFormat, QMailFolderId)));
+    connectIpc(adaptor, MESSAGE(exportMailbox(quint64, QMailMessageKey, QString, QMailStorageAction::MailboxFormat)),
+               this, SIGNAL(exportMailbox(quint64, QMailMessageKey, QString, QMailStorageAction::MailboxFormat)));
     connectIpc(adaptor, MESSAGE(onlineCreateFolder(quint64, QString, QMailAccountId, QMailFolderId)),
                this, SIGNAL(onlineCreateFolder(quint64,QString,QMailAccountId,QMailFolderId)));
     connectIpc(adaptor, MESSAGE(onlineRenameFolder(quint64, QMailFolderId, QString)),
@@ -95,6 +95,8 @@ signals:
     void moveToFolder(quint64, const QMailMessageIdList& ids, const QMailFolderId& folderId);
     void flagMessages(quint64, const QMailMessageIdList& ids, quint64 setMask, quint64 unsetMask);
     void restoreToPreviousFolder(quint64, const QMailMessageKey& key);
+    void importMailbox(quint64, const QString &path, QMailStorageAction::MailboxFormat format, const QMailFolderId &folderId);
+    void exportMailbox(quint64, const QMailMessageKey &key, const QString &path, QMailStorageAction::MailboxFormat format);
 
     void onlineCreateFolder(quint64, const QString &name, const QMailAccountId &accountId, const QMailFolderId &parentId);
     void onlineRenameFolder(quint64, const QMailFolderId &folderId, const QString &name);
@@ -53,6 +53,13 @@ extern "C" {
 #include <signal.h>
 }
 
+// Store maintenance is performed in slices of limited duration, separated by
+// pauses that allow other processes to access the store
+static const int maintenanceStartDelay = 30 * 1000;
+static const int maintenanceSliceDuration = 100;
+static const int maintenanceSlicePause = 1000;
+static const int maintenanceInterval = 60 * 60 * 1000;
+
 #if defined(Q_OS_UNIX)
 #include <unistd.h>
 int MessageServer::sighupFd[2];
@@ -120,6 +127,14 @@ MessageServer::MessageServer(QObject *parent)
     } else {
         handler = new ServiceHandler(this);
 
+        // Keep the database connection warm, unless another profile has been selected
+        if (qgetenv("QMF_STORE_PROFILE").isEmpty())
+            store->setStoreProfile(QMailStore::roleProfile(QMailStore::MessageServerRole));
+
+        // Maintain the metadata cache shared with client processes, unless configured otherwise
+        if (store->sharedCacheAccess() == QMailStore::NoSharedCacheAccess)
+            store->setSharedCacheAccess(QMailStore::SharedCacheWriteAccess);
+
         connect(store, SIGNAL(messagesAdded(QMailMessageIdList)),
                 this, SLOT(messagesAdded(QMailMessageIdList)));
         connect(store, SIGNAL(messagesUpdated(QMailMessageIdList)),
@@ -237,6 +252,10 @@ MessageServer::MessageServer(QObject *parent)
                 handler, SLOT(flagMessages(quint64, QMailMessageIdList, quint64, quint64)));
         connect(client, SIGNAL(restoreToPreviousFolder(quint64, QMailMessageKey)),
                 handler, SLOT(restoreToPreviousFolder(quint64, QMailMessageKey)));
+        connect(client, SIGNAL(importMailbox(quint64, QString, QMailStorageAction::MailboxFormat, QMailFolderId)),
+                handler, SLOT(importMailbox(quint64, QString, QMailStorageAction::MailboxFormat, QMailFolderId)));
+        connect(client, SIGNAL(exportMailbox(quint64, QMailMessageKey, QString, QMailStorageAction::MailboxFormat)),
+                handler, SLOT(exportMailbox(quint64, QMailMessageKey, QString, QMailStorageAction::MailboxFormat)));
         connect(client, SIGNAL(onlineCreateFolder(quint64, QString, QMailAccountId, QMailFolderId)),
                 handler, SLOT(onlineCreateFolder(quint64, QString, QMailAccountId, QMailFolderId)));
         connect(client, SIGNAL(onlineRenameFolder(quint64, QMailFolderId, QString)),
@@ -270,6 +289,10 @@ MessageServer::MessageServer(QObject *parent)
         //clean up any temporary messages that were not cleaned up by clients
         QTimer::singleShot(0, this, SLOT(cleanupTemporaryMessages()));
 
+        maintenanceTimer.setSingleShot(true);
+        connect(&maintenanceTimer, SIGNAL(timeout()), this, SLOT(performStoreMaintenance()));
+        maintenanceTimer.start(maintenanceStartDelay);
+
         emit client->actionsListed(QMailActionDataList());
     }
 
@@ -523,6 +546,20 @@ void MessageServer::cleanupTemporaryMessages()
     QMailStore::instance()->removeMessages(QMailMessageKey::status(QMailMessage::Temporary), QMailStore::NoRemovalRecord);
 }
 
+void MessageServer::performStoreMaintenance()
+{
+    QMailStore *store = QMailStore::instance();
+    if (store->performMaintenance(maintenanceSliceDuration)) {
+        maintenanceTimer.start(maintenanceInterval);
+    } else if (store->lastError() != QMailStore::NoError) {
+        qWarning() << "Unable to perform store maintenance, error:" << store->lastError();
+        maintenanceTimer.start(maintenanceInterval);
+    } else {
+        // Some work remains outstanding
+        maintenanceTimer.start(maintenanceSlicePause);
+    }
+}
+
 #if defined(Q_OS_UNIX)
 void MessageServer::hupSignalHandler(int)
 {
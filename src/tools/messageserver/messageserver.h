@@ -38,6 +38,7 @@
 #include <QObject>
 #include <QSet>
 #include <QSocketNotifier>
+#include <QTimer>
 #include <private/qcopadaptor_p.h>
 
 class ServiceHandler;
@@ -89,6 +90,7 @@ private slots:
     void acknowledgeNewMessages(const QMailMessageTypeList&);
 
     void cleanupTemporaryMessages();
+    void performStoreMaintenance();
 
 private:
     int newMessageCount(QMailMessage::MessageType type) const;
@@ -106,6 +108,8 @@ private:
 
     QSet<QMailMessageId> completionList;
     bool completionAttempted;
+
+    QTimer maintenanceTimer;
 #if defined(Q_OS_UNIX)
     static int sighupFd[2];
     QSocketNotifier *snHup;
@@ -8,12 +8,18 @@ else:DEFINES+=QTOPIA_NO_SMS QTOPIA_NO_MMS
 
 HEADERS=\
     servicehandler.h\
+    requestjournal.h\
+    requestscheduler.h\
+    mailboxtransfer.h\
     mailmessageclient.h\
     messageserver.h\
     newcountnotifier.h
 
 SOURCES=\
     servicehandler.cpp\
+    requestjournal.cpp\
+    requestscheduler.cpp\
+    mailboxtransfer.cpp\
     mailmessageclient.cpp\
     messageserver.cpp\
     prepareaccounts.cpp\
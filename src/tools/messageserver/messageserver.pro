@@ -23,13 +23,19 @@ target.path += $$QMF_INSTALL_ROOT/bin
 HEADERS += mailmessageclient.h \
            messageserver.h \
            servicehandler.h \
+           requestjournal.h \
+           requestscheduler.h \
+           mailboxtransfer.h \
            newcountnotifier.h
 
 SOURCES += mailmessageclient.cpp \
            messageserver.cpp \
            prepareaccounts.cpp \
            newcountnotifier.cpp \
-           servicehandler.cpp
+           servicehandler.cpp \
+           requestjournal.cpp \
+           requestscheduler.cpp \
+           mailboxtransfer.cpp
 
 !SERVER_AS_DLL: {
     SOURCES += main.cpp
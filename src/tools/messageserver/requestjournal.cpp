@@ -0,0 +1,276 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "requestjournal.h"
+#include <qmaillog.h>
+#include <QDataStream>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#if defined(Q_OS_UNIX)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+void syncFile(QFileDevice &file)
+{
+    // Ensure data is flushed to OS before attempting sync
+    file.flush();
+#if defined(QMF_NO_DURABILITY) || defined(QMF_NO_SYNCHRONOUS_DB)
+    // Durability is disabled
+    return;
+#endif
+
+#if defined(Q_OS_UNIX)
+#if defined(_POSIX_SYNCHRONIZED_IO) && (_POSIX_SYNCHRONIZED_IO > 0)
+    ::fdatasync(file.handle());
+#else
+    ::fsync(file.handle());
+#endif
+#endif
+}
+
+void syncDirectory(const QString &path)
+{
+#if defined(QMF_NO_DURABILITY) || defined(QMF_NO_SYNCHRONOUS_DB)
+    Q_UNUSED(path)
+    return;
+#endif
+
+#if defined(Q_OS_UNIX)
+    // A replaced file is only durable once the directory entry is
+    int handle = ::open(QFile::encodeName(QFileInfo(path).absolutePath()).constData(), O_RDONLY);
+    if (handle != -1) {
+        ::fsync(handle);
+        ::close(handle);
+    }
+#else
+    Q_UNUSED(path)
+#endif
+}
+
+}
+
+RequestJournal::RequestJournal(const QString &path, QObject *parent)
+    : QObject(parent),
+      _file(path),
+      _sequence(0),
+      _obsolete(0)
+{
+    _commitTimer.setSingleShot(true);
+    connect(&_commitTimer, SIGNAL(timeout()), this, SLOT(commit()));
+
+    _compactTimer.setSingleShot(true);
+    connect(&_compactTimer, SIGNAL(timeout()), this, SLOT(compact()));
+}
+
+RequestJournal::~RequestJournal()
+{
+    commit();
+}
+
+QList<RequestJournal::Record> RequestJournal::open()
+{
+    if (_file.exists()) {
+        if (!_file.open(QIODevice::ReadOnly)) {
+            qWarning() << "Unable to open request journal for read:" << _file.fileName();
+        } else {
+            QDataStream stream(&_file);
+            while (!stream.atEnd()) {
+                quint32 size;
+                quint16 checksum;
+                stream >> size >> checksum;
+                if ((stream.status() != QDataStream::Ok) || (_file.bytesAvailable() < size))
+                    break;
+
+                // An entry that was only partially written before a crash ends the journal
+                QByteArray data(size, '\0');
+                stream.readRawData(data.data(), size);
+                if (qChecksum(data.constData(), data.size()) != checksum) {
+                    qWarning() << "Discarding damaged entries at the end of the request journal";
+                    break;
+                }
+
+                QDataStream entryStream(data);
+                quint8 type;
+                quint64 action;
+                QByteArray payload;
+                entryStream >> type >> action >> payload;
+
+                if (type == RequestEntry) {
+                    track(action, payload);
+                } else if (type == CompletionEntry) {
+                    untrack(action);
+                }
+            }
+
+            _file.close();
+        }
+    }
+
+    // Replace the journal with the outstanding requests alone, before any of them is resumed;
+    // they remain recorded until they are completed
+    _obsolete = 0;
+    rewrite();
+
+    return _outstanding.values();
+}
+
+void RequestJournal::append(quint64 action, const QByteArray &payload)
+{
+    track(action, payload);
+    write(entry(RequestEntry, action, payload));
+}
+
+void RequestJournal::complete(quint64 action)
+{
+    const int removed = untrack(action);
+    if (!removed)
+        return;
+
+    write(entry(CompletionEntry, action, QByteArray()));
+
+    // The request entries and this completion are no longer needed
+    _obsolete += removed + 1;
+    if ((_obsolete >= CompactThreshold) && (_obsolete > _outstanding.count()) && !_compactTimer.isActive())
+        _compactTimer.start(CompactInterval);
+}
+
+void RequestJournal::write(const QByteArray &data)
+{
+    // Entries are committed together, after a short delay or once enough have accumulated
+    _buffer.append(data);
+    if (_buffer.size() >= CommitBufferSize) {
+        commit();
+    } else if (!_commitTimer.isActive()) {
+        _commitTimer.start(CommitInterval);
+    }
+}
+
+bool RequestJournal::contains(quint64 action) const
+{
+    return _actionSequences.contains(action);
+}
+
+void RequestJournal::commit()
+{
+    _commitTimer.stop();
+    if (_buffer.isEmpty())
+        return;
+
+    if (_file.isOpen()) {
+        if (_file.write(_buffer) != _buffer.size())
+            qWarning() << "Unable to write request journal:" << _file.errorString();
+        syncFile(_file);
+    }
+    _buffer.clear();
+}
+
+void RequestJournal::compact()
+{
+    commit();
+
+    const int obsolete = _obsolete;
+    if (rewrite()) {
+        qMailLog(Messaging) << "Compacted request journal, removed" << obsolete << "entries";
+        _obsolete = 0;
+    }
+}
+
+bool RequestJournal::rewrite()
+{
+    // The replacement is written beside the journal, and atomically renamed over it once synchronized
+    QSaveFile replacement(_file.fileName());
+    if (!replacement.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to open request journal for rewrite:" << replacement.errorString();
+    } else {
+        foreach (const Record &record, _outstanding)
+            replacement.write(entry(RequestEntry, record.first, record.second));
+    }
+
+    _file.close();
+
+    bool replaced = false;
+    if (replacement.isOpen()) {
+        if (!replacement.commit()) {
+            qWarning() << "Unable to rewrite request journal:" << replacement.errorString();
+        } else {
+            syncDirectory(_file.fileName());
+            replaced = true;
+        }
+    }
+
+    // Continue appending to the journal, whether or not it was replaced
+    if (!_file.open(QIODevice::WriteOnly | QIODevice::Append))
+        qWarning() << "Unable to open request journal for write:" << _file.fileName();
+
+    return replaced;
+}
+
+void RequestJournal::track(quint64 action, const QByteArray &payload)
+{
+    const quint64 sequence = ++_sequence;
+    _outstanding.insert(sequence, qMakePair(action, payload));
+    _actionSequences[action].append(sequence);
+}
+
+int RequestJournal::untrack(quint64 action)
+{
+    QHash<quint64, QList<quint64> >::iterator it = _actionSequences.find(action);
+    if (it == _actionSequences.end())
+        return 0;
+
+    const int count = it->count();
+    foreach (quint64 sequence, *it)
+        _outstanding.remove(sequence);
+    _actionSequences.erase(it);
+    return count;
+}
+
+QByteArray RequestJournal::entry(EntryType type, quint64 action, const QByteArray &payload)
+{
+    QByteArray data;
+    {
+        QDataStream stream(&data, QIODevice::WriteOnly);
+        stream << static_cast<quint8>(type) << action << payload;
+    }
+
+    // Each entry is prefixed by its size and checksum, so that a torn write can be detected
+    QByteArray result;
+    QDataStream stream(&result, QIODevice::WriteOnly);
+    stream << static_cast<quint32>(data.size()) << qChecksum(data.constData(), data.size());
+    stream.writeRawData(data.constData(), data.size());
+    return result;
+}
@@ -0,0 +1,110 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef REQUESTJOURNAL_H
+#define REQUESTJOURNAL_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QObject>
+#include <QPair>
+#include <QString>
+#include <QTimer>
+
+/*
+    An append-only journal of the requests accepted by the message server.
+    Each request is recorded with an opaque payload when it is queued, and a
+    completion record is appended when it finishes.  Records are buffered and
+    written together, so that a burst of requests costs a single write and
+    synchronization.  Once enough records have been made obsolete by their
+    completions, the journal is rewritten to hold only outstanding requests;
+    it is also rewritten that way when it is opened.
+*/
+class RequestJournal : public QObject
+{
+    Q_OBJECT
+
+public:
+    typedef QPair<quint64, QByteArray> Record;
+
+    RequestJournal(const QString &path, QObject *parent = 0);
+    ~RequestJournal();
+
+    // Returns the requests left outstanding by the previous run, which remain in the journal
+    QList<Record> open();
+
+    void append(quint64 action, const QByteArray &payload);
+    void complete(quint64 action);
+
+    bool contains(quint64 action) const;
+
+public slots:
+    void commit();
+
+private slots:
+    void compact();
+
+private:
+    enum EntryType {
+        RequestEntry = 1,
+        CompletionEntry = 2
+    };
+
+    static QByteArray entry(EntryType type, quint64 action, const QByteArray &payload);
+    void write(const QByteArray &data);
+    bool rewrite();
+
+    void track(quint64 action, const QByteArray &payload);
+    int untrack(quint64 action);
+
+    QFile _file;
+    QByteArray _buffer;
+
+    quint64 _sequence;
+    QMap<quint64, Record> _outstanding;
+    QHash<quint64, QList<quint64> > _actionSequences;
+    int _obsolete;
+
+    QTimer _commitTimer;
+    QTimer _compactTimer;
+
+    static const int CommitInterval = 20; // milliseconds
+    static const int CommitBufferSize = 64 * 1024;
+    static const int CompactInterval = 5000; // milliseconds
+    static const int CompactThreshold = 256;
+};
+
+#endif
@@ -0,0 +1,199 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "requestscheduler.h"
+
+namespace {
+
+quint64 actionProcess(quint64 action)
+{
+    return (action >> 32);
+}
+
+// Whether two requests must be dispatched in the order they were made; a request
+// that names no account or service may depend on any other
+bool ordered(const RequestScheduler::Entry &earlier, const RequestScheduler::Entry &later)
+{
+    if ((earlier.accounts.isEmpty() && earlier.services.isEmpty()) ||
+        (later.accounts.isEmpty() && later.services.isEmpty()))
+        return true;
+
+    foreach (const QMailAccountId &accountId, later.accounts) {
+        if (earlier.accounts.contains(accountId))
+            return true;
+    }
+    foreach (QMailMessageService *service, later.services) {
+        if (earlier.services.contains(service))
+            return true;
+    }
+    return false;
+}
+
+}
+
+RequestScheduler::RequestScheduler(int deviceLimit, int processLimit)
+    : _deviceLimit(deviceLimit),
+      _processLimit(processLimit)
+{
+}
+
+RequestScheduler::Priority RequestScheduler::priority(QMailServerRequestType type)
+{
+    switch (type) {
+    case RetrieveMessagesRequestType:
+    case RetrieveMessagePartRequestType:
+    case RetrieveMessageRangeRequestType:
+    case RetrieveMessagePartRangeRequestType:
+    case SearchMessagesRequestType:
+    case CancelTransferRequestType:
+    case CancelSearchRequestType:
+    case ListActionsRequestType:
+        // The user is waiting for the outcome of these requests
+        return InteractivePriority;
+
+    case TransmitMessagesRequestType:
+    case CopyMessagesRequestType:
+    case MoveMessagesRequestType:
+    case FlagMessagesRequestType:
+    case DeleteMessagesRequestType:
+    case CreateFolderRequestType:
+    case RenameFolderRequestType:
+    case DeleteFolderRequestType:
+    case MoveFolderRequestType:
+        return TransmitPriority;
+
+    case RetrieveAllRequestType:
+    case AcknowledgeNewMessagesRequestType:
+    case ImportMailboxRequestType:
+    case ExportMailboxRequestType:
+        return MaintenancePriority;
+
+    default:
+        break;
+    }
+
+    return SynchronizationPriority;
+}
+
+int RequestScheduler::select(const QList<Entry> &queue, const QList<Entry> &active) const
+{
+    // A request may not overtake an earlier request of its process that uses the same
+    // accounts or services; the process's other requests are not held up by it
+    QList<int> candidates;
+    QMap<quint64, QList<int> > processRequests;
+    for (int i = 0; i < queue.count(); ++i) {
+        QList<int> &earlier(processRequests[actionProcess(queue.at(i).action)]);
+
+        bool blocked(false);
+        foreach (int j, earlier) {
+            if (ordered(queue.at(j), queue.at(i))) {
+                blocked = true;
+                break;
+            }
+        }
+        if (!blocked)
+            candidates.append(i);
+
+        earlier.append(i);
+    }
+
+    // Candidates are taken in order of priority, and in order of arrival within each priority
+    for (int priority = InteractivePriority; priority < PriorityCount; ++priority) {
+        foreach (int i, candidates) {
+            const Entry &request(queue.at(i));
+            if ((request.priority == priority) && request.ready && available(request, active))
+                return i;
+        }
+    }
+
+    return -1;
+}
+
+bool RequestScheduler::available(const Entry &request, const QList<Entry> &active) const
+{
+    // Only interactive requests may use the reserved slots of the shared limits
+    const int reserve(request.priority == InteractivePriority ? InteractiveReserve : 0);
+
+    // Limit number of concurrent actions serviced on the device
+    if (active.count() >= _deviceLimit + reserve)
+        return false;
+
+    const quint64 requestProcess(actionProcess(request.action));
+    int processCount = 0;
+    int maintenanceCount = 0;
+    QMap<QMailAccountId, int> accountCount;
+    QMap<QMailMessageService*, int> serviceCount;
+
+    foreach (const Entry &entry, active) {
+        if (actionProcess(entry.action) == requestProcess)
+            ++processCount;
+        if (entry.priority == MaintenancePriority)
+            ++maintenanceCount;
+        foreach (const QMailAccountId &accountId, entry.accounts)
+            ++accountCount[accountId];
+        foreach (QMailMessageService *service, entry.services)
+            ++serviceCount[service];
+    }
+
+    // Limit number of concurrent actions serviced per process, whatever their priority
+    if (processCount >= _processLimit)
+        return false;
+
+    if ((request.priority == MaintenancePriority) && (maintenanceCount >= MaximumMaintenanceActions))
+        return false;
+
+    foreach (const QMailAccountId &accountId, request.accounts) {
+        if (accountCount.value(accountId) >= MaximumActionsPerAccount + reserve)
+            return false;
+    }
+
+    foreach (QMailMessageService *service, request.services) {
+        if (serviceCount.value(service) >= MaximumActionsPerService + reserve)
+            return false;
+    }
+
+    return true;
+}
+
+void RequestScheduler::recordWait(QMailServerRequestType type, qint64 wait)
+{
+    Statistics &stats(_statistics[type]);
+    ++stats.count;
+    stats.totalWait += wait;
+    stats.maximumWait = qMax(stats.maximumWait, wait);
+}
+
+RequestScheduler::Statistics RequestScheduler::statistics(QMailServerRequestType type) const
+{
+    return _statistics.value(type);
+}
@@ -0,0 +1,116 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef REQUESTSCHEDULER_H
+#define REQUESTSCHEDULER_H
+
+#include <qmailaction.h>
+#include <qmailid.h>
+#include <QList>
+#include <QMap>
+#include <QSet>
+
+class QMailMessageService;
+
+/*
+    Chooses which queued request the message server dispatches next.  Each
+    request has a priority class derived from its type; the highest class is
+    served first, and arrival order within a class.  The requests of any one
+    process that share an account or a service are dispatched in the order
+    they were made, whatever their priority; a request waiting for its
+    services does not hold up the process's requests for other resources.
+
+    A request is dispatched only while the device, per-process, per-account,
+    per-service and maintenance limits allow it.  The device, account and
+    service limits are shared by all clients, and each holds one slot in
+    reserve for interactive requests, so that they are not left waiting for
+    long-running background actions to complete.
+*/
+class RequestScheduler
+{
+public:
+    // Priority classes, in descending order of precedence
+    enum Priority {
+        InteractivePriority = 0,
+        TransmitPriority,
+        SynchronizationPriority,
+        MaintenancePriority,
+        PriorityCount
+    };
+
+    // A queued or active request, and the resources it occupies
+    struct Entry
+    {
+        Entry() : action(0), priority(SynchronizationPriority), ready(true) {}
+
+        quint64 action;
+        Priority priority;
+        QSet<QMailAccountId> accounts;
+        QSet<QMailMessageService*> services;
+        bool ready; // Whether the services of a queued request can accept it
+    };
+
+    // Time spent queued by the requests of one type, in milliseconds
+    struct Statistics
+    {
+        Statistics() : count(0), totalWait(0), maximumWait(0) {}
+
+        int count;
+        qint64 totalWait;
+        qint64 maximumWait;
+    };
+
+    RequestScheduler(int deviceLimit, int processLimit);
+
+    static Priority priority(QMailServerRequestType type);
+
+    // Returns the index within queue of the request to dispatch next, or -1 if none can be
+    int select(const QList<Entry> &queue, const QList<Entry> &active) const;
+
+    void recordWait(QMailServerRequestType type, qint64 wait);
+    Statistics statistics(QMailServerRequestType type) const;
+
+    static const int MaximumActionsPerAccount = 2;
+    static const int MaximumActionsPerService = 2;
+    static const int MaximumMaintenanceActions = 1;
+    static const int InteractiveReserve = 1;
+
+private:
+    bool available(const Entry &request, const QList<Entry> &active) const;
+
+    int _deviceLimit;
+    int _processLimit;
+    QMap<QMailServerRequestType, Statistics> _statistics;
+};
+
+#endif
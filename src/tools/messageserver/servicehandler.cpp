@@ -33,6 +33,7 @@
 
 
 #include "servicehandler.h"
+#include "mailboxtransfer.h"
 #include <private/longstream_p.h>
 #include <QDataStream>
 #include <QIODevice>
@@ -395,9 +396,9 @@ bool messageBodyContainsText(const QMailMessage &message, const QString& text)
     return false;
 }
 
-QString requestsFileName()
+QString requestJournalPath()
 {
-    return QDir::tempPath() + "/qmf-messageserver-requests";
+    return QMail::dataPath() + "requests.journal";
 }
 
 QList<QString> obsoleteContentIdentifiers(QList<QMailMessageMetaData*> list)
@@ -528,7 +529,8 @@ QMailMessageIdList ServiceHandler::MessageSearch::takeBatch()
 
 ServiceHandler::ServiceHandler(QObject* parent)
     : QObject(parent),
-      _requestsFile(requestsFileName())
+      mScheduler(QMail::maximumConcurrentServiceActions(), QMail::maximumConcurrentServiceActionsPerProcess()),
+      _journal(requestJournalPath())
 {
     LongStream::cleanupTempFiles();
 
@@ -544,30 +546,7 @@ ServiceHandler::ServiceHandler(QObject* parent)
     }
 
     // See if there are any requests remaining from our previous run
-    if (_requestsFile.exists()) {
-        if (!_requestsFile.open(QIODevice::ReadOnly)) {
-            qWarning() << "Unable to open requests file for read!";
-        } else {
-            // Every request still in the file failed to complete
-            for (QByteArray line = _requestsFile.readLine(); !line.isEmpty(); line = _requestsFile.readLine()) {
-                if (quint64 action = line.trimmed().toULongLong()) {
-                    _failedRequests.append(action);
-                }
-            }
-
-            _requestsFile.close();
-        }
-    }
-
-    if (!_requestsFile.open(QIODevice::WriteOnly)) {
-        qWarning() << "Unable to open requests file for write!" << _requestsFile.fileName();
-    } else {
-        if (!_requestsFile.resize(0)) {
-            qWarning() << "Unable to truncate requests file!";
-        } else {
-            _requestsFile.flush();
-        }
-    }
+    recoverRequests();
 
     if (!_failedRequests.isEmpty()) {
         // Allow the clients some time to reconnect, then report our failures
@@ -956,6 +935,19 @@ bool ServiceHandler::serviceAvailable(QPointer<QMailMessageService> service) con
     return true;
 }
 
+QSet<QMailAccountId> ServiceHandler::serviceAccounts(const QSet<QPointer<QMailMessageService> > &services) const
+{
+    QSet<QMailAccountId> accounts;
+
+    QMap<QPair<QMailAccountId, QString>, QPointer<QMailMessageService> >::const_iterator it = serviceMap.begin(), end = serviceMap.end();
+    for ( ; it != end; ++it) {
+        if (services.contains(it.value()))
+            accounts.insert(it.key().first);
+    }
+
+    return accounts;
+}
+
 QSet<QMailMessageService*> ServiceHandler::sourceServiceSet(const QMailAccountId &id) const
 {
     QSet<QMailMessageService*> services;
@@ -1059,104 +1051,261 @@ void ServiceHandler::enqueueRequest(quint64 action, const QByteArray &data, cons
     req.servicer = servicer;
     req.completion = completion;
     req.description = description;
+    req.priority = RequestScheduler::priority(description);
 
-    mRequests.append(req);
+    enqueueRequest(req);
+}
 
-    // Add this request to the outstanding list
-    if (!_outstandingRequests.contains(action)) {
-        _outstandingRequests.insert(action);
+void ServiceHandler::enqueueRequest(const Request &req)
+{
+    // Record this request in the journal of outstanding requests
+    _journal.append(req.action, journalRecord(req));
 
-        QByteArray requestNumber(QByteArray::number(action));
-        _requestsFile.write(requestNumber.append('\n'));
-        _requestsFile.flush();
-    }
+    queueRequest(req);
+}
+
+void ServiceHandler::queueRequest(const Request &req)
+{
+    mRequests.append(req);
+    mRequests.last().queued.start();
 
     QTimer::singleShot(0, this, SLOT(dispatchRequest()));
 }
 
-namespace {
-const char* requestTypeNames[] =
-{
-    "AcknowledgeNewMessagesRequest",
-    "TransmitMessagesRequest",
-    "RetrieveFolderListRequest",
-    "RetrieveMessageListRequest",
-    "RetrieveNewMessagesRequest",
-    "RetrieveMessagesRequest",
-    "RetrieveMessagePartRequest",
-    "RetrieveMessageRangeRequest",
-    "RetrieveMessagePartRangeRequest",
-    "RetrieveAllRequest",
-    "ExportUpdatesRequest",
-    "SynchronizeRequest",
-    "CopyMessagesRequest",
-    "MoveMessagesRequest",
-    "FlagMessagesRequest",
-    "CreateFolderRequest",
-    "RenameFolderRequest",
-    "DeleteFolderRequest",
-    "CancelTransferRequest",
-    "DeleteMessagesRequest",
-    "SearchMessagesRequest",
-    "CancelSearchRequest",
-    "ListActionsRequest",
-    "ProtocolRequestRequestType"
+const ServiceHandler::ReplayableRequest ServiceHandler::replayableRequests[] =
+{
+    { "RetrieveFolderList", &ServiceHandler::dispatchRetrieveFolderListAccount, &ServiceHandler::retrievalCompleted },
+    { "RetrieveMessageList", &ServiceHandler::dispatchRetrieveMessageList, &ServiceHandler::retrievalCompleted },
+    { "RetrieveMessageLists", &ServiceHandler::dispatchRetrieveMessageLists, &ServiceHandler::retrievalCompleted },
+    { "RetrieveNewMessages", &ServiceHandler::dispatchRetrieveNewMessages, &ServiceHandler::retrievalCompleted },
+    { "RetrieveMessages", &ServiceHandler::dispatchRetrieveMessages, &ServiceHandler::retrievalCompleted },
+    { "RetrieveMessagePart", &ServiceHandler::dispatchRetrieveMessagePart, &ServiceHandler::retrievalCompleted },
+    { "RetrieveMessageRange", &ServiceHandler::dispatchRetrieveMessageRange, &ServiceHandler::retrievalCompleted },
+    { "RetrieveMessagePartRange", &ServiceHandler::dispatchRetrieveMessagePartRange, &ServiceHandler::retrievalCompleted },
+    { "RetrieveAll", &ServiceHandler::dispatchRetrieveAll, &ServiceHandler::retrievalCompleted },
+    { "ExportUpdates", &ServiceHandler::dispatchExportUpdates, &ServiceHandler::retrievalCompleted },
+    { "Synchronize", &ServiceHandler::dispatchSynchronize, &ServiceHandler::retrievalCompleted },
+    { "OnlineFlagMessages", &ServiceHandler::dispatchOnlineFlagMessagesAndMoveToStandardFolder, &ServiceHandler::storageActionCompleted },
+    { "OnlineDeleteMessages", &ServiceHandler::dispatchOnlineDeleteMessages, &ServiceHandler::storageActionCompleted },
+    { "ImportMailbox", &ServiceHandler::dispatchImportMailbox, &ServiceHandler::storageActionCompleted },
+    { "ExportMailbox", &ServiceHandler::dispatchExportMailbox, &ServiceHandler::storageActionCompleted },
+    { 0, 0, 0 }
 };
+
+QList<QPair<QMailAccountId, QString> > ServiceHandler::serviceKeys(const QSet<QPointer<QMailMessageService> > &services) const
+{
+    QList<QPair<QMailAccountId, QString> > keys;
+
+    QMap<QPair<QMailAccountId, QString>, QPointer<QMailMessageService> >::const_iterator it = serviceMap.begin(), end = serviceMap.end();
+    for ( ; it != end; ++it) {
+        if (services.contains(it.value()))
+            keys.append(it.key());
+    }
+
+    return keys;
 }
 
-void ServiceHandler::dispatchRequest()
+QByteArray ServiceHandler::journalRecord(const Request &req) const
 {
-    QList<Request>::iterator request(mRequests.begin());
-    while(request != mRequests.end())
-    {
-        if (!servicesAvailable(*request)) {
-            ++request;
-            continue;
+    // Requests that can't safely be repeated are recorded without a name, and will be reported as failed
+    QByteArray name;
+    for (const ReplayableRequest *replayable = replayableRequests; replayable->name; ++replayable) {
+        if ((replayable->servicer == req.servicer) && (replayable->completion == req.completion)) {
+            name = replayable->name;
+            break;
         }
+    }
 
-        // Limit number of concurrent actions serviced on the device 
-        if (mActiveActions.count() >= QMail::maximumConcurrentServiceActions())
-            return;
+    if (name.isEmpty())
+        return serialize(static_cast<int>(req.description), name);
 
-        // Limit number of concurrent actions serviced per process
-        const quint64 requestProcess = request->action >> 32;
-        int requestProcessCount = 1; // including the request
-        foreach(quint64 actionId, mActiveActions.keys()) {
-            if ((actionId >> 32) == requestProcess) {
-                if (++requestProcessCount > QMail::maximumConcurrentServiceActionsPerProcess()) {
-                    break;
-                }
+    return serialize(static_cast<int>(req.description), name, req.data, serviceKeys(req.services), serviceKeys(req.preconditions));
+}
+
+bool ServiceHandler::restoreRequest(quint64 action, const QByteArray &record, Request *req) const
+{
+    int description;
+    QByteArray name;
+    QByteArray data;
+    QList<QPair<QMailAccountId, QString> > services;
+    QList<QPair<QMailAccountId, QString> > preconditions;
+    deserialize(record, description, name, data, services, preconditions);
+
+    const ReplayableRequest *replayable = replayableRequests;
+    while (replayable->name && (name != replayable->name))
+        ++replayable;
+    if (!replayable->name)
+        return false;
+
+    // The services must still be available to perform the request; requests
+    // performed by the message server itself, such as mailbox transfers, have none
+    QSet<QPointer<QMailMessageService> > safeServices;
+    QSet<QPointer<QMailMessageService> > safePreconditions;
+    typedef QPair<QMailAccountId, QString> ServiceKey;
+    foreach (const ServiceKey &key, services) {
+        QPointer<QMailMessageService> service(serviceMap.value(key));
+        if (!service)
+            return false;
+        safeServices.insert(service);
+    }
+    foreach (const ServiceKey &key, preconditions) {
+        QPointer<QMailMessageService> service(serviceMap.value(key));
+        if (!service)
+            return false;
+        safePreconditions.insert(service);
+    }
+
+    req->action = action;
+    req->data = data;
+    req->services = safeServices;
+    req->preconditions = safePreconditions;
+    req->servicer = replayable->servicer;
+    req->completion = replayable->completion;
+    req->description = static_cast<QMailServerRequestType>(description);
+    req->priority = RequestScheduler::priority(req->description);
+    return true;
+}
+
+void ServiceHandler::recoverRequests()
+{
+    QList<RequestJournal::Record> records(_journal.open());
+
+    // Group the recorded requests by action, preserving their order
+    QList<quint64> actions;
+    QMap<quint64, QList<QByteArray> > actionRecords;
+    foreach (const RequestJournal::Record &record, records) {
+        if (!actionRecords.contains(record.first))
+            actions.append(record.first);
+        actionRecords[record.first].append(record.second);
+    }
+
+    foreach (quint64 action, actions) {
+        QList<Request> requests;
+        foreach (const QByteArray &record, actionRecords.value(action)) {
+            Request req;
+            if (!restoreRequest(action, record, &req)) {
+                requests.clear();
+                break;
             }
+            requests.append(req);
         }
 
-        if (requestProcessCount > QMail::maximumConcurrentServiceActionsPerProcess()) {
-            ++request;
-            continue;
+        if (requests.isEmpty()) {
+            // This request failed to complete, and can't be resumed
+            _failedRequests.append(action);
+        } else {
+            // The journal still records these requests
+            qMailLog(Messaging) << "Resuming action" << action << "interrupted in the previous run";
+            foreach (const Request &req, requests)
+                queueRequest(req);
         }
-    
+    }
+}
+
+namespace {
+const char* requestTypeNames[] =
+{
+    "AcknowledgeNewMessagesRequestType",
+    "TransmitMessagesRequestType",
+    "RetrieveFolderListRequestType",
+    "RetrieveMessageListRequestType",
+    "RetrieveNewMessagesRequestType",
+    "RetrieveMessagesRequestType",
+    "RetrieveMessagePartRequestType",
+    "RetrieveMessageRangeRequestType",
+    "RetrieveMessagePartRangeRequestType",
+    "RetrieveAllRequestType",
+    "ExportUpdatesRequestType",
+    "SynchronizeRequestType",
+    "CopyMessagesRequestType",
+    "MoveMessagesRequestType",
+    "FlagMessagesRequestType",
+    "CreateFolderRequestType",
+    "RenameFolderRequestType",
+    "DeleteFolderRequestType",
+    "CancelTransferRequestType",
+    "DeleteMessagesRequestType",
+    "SearchMessagesRequestType",
+    "CancelSearchRequestType",
+    "ListActionsRequestType",
+    "ProtocolRequestRequestType",
+    "MoveFolderRequestType",
+    "ImportMailboxRequestType",
+    "ExportMailboxRequestType"
+};
+}
+
+int ServiceHandler::nextRequest() const
+{
+    QList<RequestScheduler::Entry> queue;
+    foreach (const Request &request, mRequests) {
+        RequestScheduler::Entry entry;
+        entry.action = request.action;
+        entry.priority = request.priority;
+        entry.accounts = serviceAccounts(request.services);
+        foreach (QMailMessageService *service, request.services)
+            entry.services.insert(service);
+        entry.ready = servicesAvailable(request);
+        queue.append(entry);
+    }
+
+    QList<RequestScheduler::Entry> active;
+    QMap<quint64, ActionData>::const_iterator it = mActiveActions.begin(), end = mActiveActions.end();
+    for ( ; it != end; ++it) {
+        RequestScheduler::Entry entry;
+        entry.action = it.key();
+        entry.priority = it->priority;
+        entry.accounts = it->accounts;
+        foreach (QMailMessageService *service, it->services)
+            entry.services.insert(service);
+        active.append(entry);
+    }
+
+    return mScheduler.select(queue, active);
+}
+
+RequestScheduler::Statistics ServiceHandler::queueStatistics(QMailServerRequestType type) const
+{
+    return mScheduler.statistics(type);
+}
+
+void ServiceHandler::dispatchRequest()
+{
+    for (int index = nextRequest(); index != -1; index = nextRequest()) {
+        const Request request(mRequests.takeAt(index));
+
+        // Record how long this type of request has been kept waiting
+        const qint64 wait = request.queued.elapsed();
+        mScheduler.recordWait(request.description, wait);
+        const RequestScheduler::Statistics stats(mScheduler.statistics(request.description));
+
         // Associate the services with the action, so that signals are reported correctly
-        foreach (QMailMessageService *service, request->services)
-            mServiceAction.insert(service, request->action);
+        foreach (QMailMessageService *service, request.services)
+            mServiceAction.insert(service, request.action);
 
         // The services required for this request are available
         ActionData data;
-        data.services = request->services;
-        data.completion = request->completion;
+        data.services = request.services;
+        data.accounts = serviceAccounts(request.services);
+        data.completion = request.completion;
         data.unixTimeExpiry = QDateTime::currentDateTime().toTime_t() + ExpirySeconds;
         data.reported = false;
-        data.description = request->description;
+        data.description = request.description;
+        data.priority = request.priority;
         data.progressTotal = 0;
         data.progressCurrent = 0;
         data.status = QMailServiceAction::Status(QMailServiceAction::Status::ErrNoError, QString(), QMailAccountId(), QMailFolderId(), QMailMessageId());
 
-        mActiveActions.insert(request->action, data);
-        qMailLog(Messaging) << "Running action" << ::requestTypeNames[data.description] << request->action;
-        emit actionStarted(QMailActionData(request->action, request->description, 0, 0, 
+        mActiveActions.insert(request.action, data);
+        qMailLog(Messaging) << "Running action" << ::requestTypeNames[data.description] << request.action
+                            << "queued for" << wait << "ms, average" << (stats.totalWait / stats.count)
+                            << "ms, maximum" << stats.maximumWait << "ms over" << stats.count << "requests";
+        emit actionStarted(QMailActionData(request.action, request.description, 0, 0, 
                                            data.status.errorCode, data.status.text, 
                                            data.status.accountId, data.status.folderId, data.status.messageId));
-        emit activityChanged(request->action, QMailServiceAction::InProgress);
+        emit activityChanged(request.action, QMailServiceAction::InProgress);
 
-        if ((this->*request->servicer)(request->action, request->data)) {
+        if ((this->*request.servicer)(request.action, request.data)) {
             // This action is now underway
 
             if (mActionExpiry.isEmpty()) {
@@ -1164,18 +1313,17 @@ void ServiceHandler::dispatchRequest()
                 const int expiryMs = ExpirySeconds * 1000;
                 QTimer::singleShot(expiryMs + 50, this, SLOT(expireAction()));
             }
-            mActionExpiry.append(request->action);
+            mActionExpiry.append(request.action);
         } else {
-            mActiveActions.remove(request->action);
+            mActiveActions.remove(request.action);
 
-            qWarning() << "Unable to dispatch request:" << request->action << "to services:" << request->services;
-            emit activityChanged(request->action, QMailServiceAction::Failed);
+            qWarning() << "Unable to dispatch request:" << request.action << "to services:" << request.services;
+            emit activityChanged(request.action, QMailServiceAction::Failed);
+            _journal.complete(request.action);
 
-            foreach (QMailMessageService *service, request->services)
+            foreach (QMailMessageService *service, request.services)
                 mServiceAction.remove(service);
         }
-
-        request = mRequests.erase(request);
     }
 }
 
@@ -1282,7 +1430,18 @@ void ServiceHandler::expireAction()
 // Cancelled by user
 void ServiceHandler::cancelTransfer(quint64 action)
 {
+    // A cancelled request must not be resumed
+    _journal.complete(action);
+
     cancelLocalSearch(action);
+
+    // A cancelled mailbox transfer keeps its checkpoint, so that it can be resumed by a new request
+    if (MailboxTransfer *transfer = _mailboxTransfers.take(action)) {
+        transfer->cancel();
+        transfer->deleteLater();
+        reportFailure(action, QMailServiceAction::Status::ErrCancel, tr("Cancelled by user"));
+    }
+
     QMap<quint64, ActionData>::iterator it = mActiveActions.find(action);
     if (it != mActiveActions.end()) {
         bool retrievalSetModified(false);
@@ -2450,6 +2609,93 @@ void ServiceHandler::restoreToPreviousFolder(quint64 action, const QMailMessageK
     return;
 }
 
+void ServiceHandler::importMailbox(quint64 action, const QString &path, QMailStorageAction::MailboxFormat format, const QMailFolderId &folderId)
+{
+    enqueueRequest(action, serialize(path, format, folderId), QSet<QMailMessageService*>(), &ServiceHandler::dispatchImportMailbox, &ServiceHandler::storageActionCompleted, ImportMailboxRequestType);
+}
+
+bool ServiceHandler::dispatchImportMailbox(quint64 action, const QByteArray &data)
+{
+    QString path;
+    QMailStorageAction::MailboxFormat format;
+    QMailFolderId folderId;
+
+    deserialize(data, path, format, folderId);
+
+    return startMailboxTransfer(new MailboxImport(action, path, format, folderId, this));
+}
+
+void ServiceHandler::exportMailbox(quint64 action, const QMailMessageKey &key, const QString &path, QMailStorageAction::MailboxFormat format)
+{
+    enqueueRequest(action, serialize(key, path, format), QSet<QMailMessageService*>(), &ServiceHandler::dispatchExportMailbox, &ServiceHandler::storageActionCompleted, ExportMailboxRequestType);
+}
+
+bool ServiceHandler::dispatchExportMailbox(quint64 action, const QByteArray &data)
+{
+    QMailMessageKey key;
+    QString path;
+    QMailStorageAction::MailboxFormat format;
+
+    deserialize(data, key, path, format);
+
+    return startMailboxTransfer(new MailboxExport(action, key, path, format, this));
+}
+
+bool ServiceHandler::startMailboxTransfer(MailboxTransfer *transfer)
+{
+    const quint64 action(transfer->action());
+    if (!transfer->start()) {
+        qWarning() << "Unable to start mailbox transfer:" << transfer->status().text;
+        reportFailure(action, transfer->status());
+        delete transfer;
+        return false;
+    }
+
+    connect(transfer, SIGNAL(progressChanged(quint64, uint, uint)),
+            this, SLOT(mailboxTransferProgress(quint64, uint, uint)));
+    connect(transfer, SIGNAL(statusChanged(quint64, QMailServiceAction::Status)),
+            this, SIGNAL(statusChanged(quint64, QMailServiceAction::Status)));
+    connect(transfer, SIGNAL(messagesAdded(quint64, QMailMessageIdList)),
+            this, SIGNAL(messagesAdded(quint64, QMailMessageIdList)));
+    connect(transfer, SIGNAL(finished(quint64, QMailServiceAction::Status)),
+            this, SLOT(mailboxTransferFinished(quint64, QMailServiceAction::Status)));
+
+    _mailboxTransfers.insert(action, transfer);
+    return true;
+}
+
+void ServiceHandler::mailboxTransferProgress(quint64 action, uint progress, uint total)
+{
+    // A transfer that is making progress must not be expired
+    updateAction(action);
+
+    QMap<quint64, ActionData>::iterator it = mActiveActions.find(action);
+    if (it != mActiveActions.end()) {
+        it->progressCurrent = progress;
+        it->progressTotal = total;
+    }
+    emit progressChanged(action, progress, total);
+}
+
+void ServiceHandler::mailboxTransferFinished(quint64 action, const QMailServiceAction::Status &status)
+{
+    if (MailboxTransfer *transfer = _mailboxTransfers.take(action))
+        transfer->deleteLater();
+
+    if (status.errorCode == QMailServiceAction::Status::ErrNoError) {
+        emit storageActionCompleted(action);
+        emit activityChanged(action, QMailServiceAction::Successful);
+    } else {
+        reportFailure(action, status);
+    }
+
+    mActiveActions.remove(action);
+    _journal.complete(action);
+
+    QMailStore::instance()->flushIpcNotifications();
+    QTimer::singleShot(0, this, SLOT(dispatchRequest()));
+}
+
 void ServiceHandler::onlineCreateFolder(quint64 action, const QString &name, const QMailAccountId &accountId, const QMailFolderId &parentId)
 {
     if(accountId.isValid()) {
@@ -2852,17 +3098,8 @@ void ServiceHandler::actionCompleted(bool success, QMailMessageService *service,
         }
     }
 
-    if (_outstandingRequests.contains(action)) {
-        _outstandingRequests.remove(action);
-
-        // Ensure this request is no longer in the file
-        _requestsFile.resize(0);
-        foreach (quint64 req, _outstandingRequests) {
-            QByteArray requestNumber(QByteArray::number(req));
-            _requestsFile.write(requestNumber.append('\n'));
-        }
-        _requestsFile.flush();
-    }
+    // This request is no longer outstanding
+    _journal.complete(action);
 
     mServiceAction.remove(service);
 
@@ -3182,6 +3419,7 @@ void ServiceHandler::reportFailures()
     while (!_failedRequests.isEmpty()) {
         quint64 action(_failedRequests.takeFirst());
         reportFailure(action, QMailServiceAction::Status::ErrFrameworkFault, tr("Failed to perform requested action!"));
+        _journal.complete(action);
     }
 }
 
@@ -34,7 +34,10 @@
 #ifndef SERVICEHANDLER_H
 #define SERVICEHANDLER_H
 
+#include "requestjournal.h"
+#include "requestscheduler.h"
 #include <QByteArray>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QLinkedList>
 #include <QList>
@@ -47,6 +50,7 @@
 #include <QStringList>
 #include <QPointer>
 
+class MailboxTransfer;
 class QMailServiceConfiguration;
 
 class ServiceHandler : public QObject
@@ -57,6 +61,9 @@ public:
     ServiceHandler(QObject* parent);
     ~ServiceHandler();
 
+    // Returns the time spent queued by requests of the given type before being dispatched
+    RequestScheduler::Statistics queueStatistics(QMailServerRequestType type) const;
+
 public slots:
     void transmitMessages(quint64 action, const QMailAccountId &accountId);
     void transmitMessage(quint64, const QMailMessageId &messageId);
@@ -87,6 +94,8 @@ public slots:
     void moveToFolder(quint64 action, const QMailMessageIdList& ids, const QMailFolderId& folderId);
     void flagMessages(quint64 action, const QMailMessageIdList& ids, quint64 setMask, quint64 unsetMask);
     void restoreToPreviousFolder(quint64, const QMailMessageKey& key);
+    void importMailbox(quint64 action, const QString &path, QMailStorageAction::MailboxFormat format, const QMailFolderId &folderId);
+    void exportMailbox(quint64 action, const QMailMessageKey &key, const QString &path, QMailStorageAction::MailboxFormat format);
 
     void onlineCreateFolder(quint64 action, const QString &name, const QMailAccountId &accountId, const QMailFolderId &parentId);
     void onlineRenameFolder(quint64 action, const QMailFolderId &folderId, const QString &name);
@@ -190,6 +199,9 @@ private slots:
 
     void continueSearch();
 
+    void mailboxTransferProgress(quint64 action, uint progress, uint total);
+    void mailboxTransferFinished(quint64 action, const QMailServiceAction::Status &status);
+
     void dispatchRequest();
 
     void expireAction();
@@ -226,6 +238,9 @@ private:
     struct Request;
     bool servicesAvailable(const Request &services) const;
     bool serviceAvailable(QPointer<QMailMessageService> service) const;
+    int nextRequest() const;
+
+    QSet<QMailAccountId> serviceAccounts(const QSet<QPointer<QMailMessageService> > &services) const;
 
     QSet<QMailMessageService*> sourceServiceSet(const QMailAccountId &id) const;
     QSet<QMailMessageService*> sourceServiceSet(const QSet<QMailAccountId> &ids) const;
@@ -242,6 +257,14 @@ private:
     typedef void (ServiceHandler::*CompletionSignal)(quint64);
 
     void enqueueRequest(quint64 action, const QByteArray &data, const QSet<QMailMessageService*> &services, RequestServicer servicer, CompletionSignal completion, QMailServerRequestType description, const QSet<QMailMessageService*> &preconditions = QSet<QMailMessageService*>());
+    void enqueueRequest(const Request &req);
+    void queueRequest(const Request &req);
+
+    QByteArray journalRecord(const Request &req) const;
+    bool restoreRequest(quint64 action, const QByteArray &record, Request *req) const;
+    void recoverRequests();
+
+    QList<QPair<QMailAccountId, QString> > serviceKeys(const QSet<QPointer<QMailMessageService> > &services) const;
 
     bool dispatchPrepareMessages(quint64 action, const QByteArray& data);
     bool dispatchTransmitMessages(quint64 action, const QByteArray& data);
@@ -270,6 +293,9 @@ private:
     bool dispatchOnlineMoveFolder(quint64 action, const QByteArray &data);
     bool dispatchSearchMessages(quint64 action, const QByteArray &data);
     bool dispatchProtocolRequest(quint64 action, const QByteArray &data);
+    bool dispatchImportMailbox(quint64 action, const QByteArray &data);
+    bool dispatchExportMailbox(quint64 action, const QByteArray &data);
+    bool startMailboxTransfer(MailboxTransfer *transfer);
 
     void reportFailure(quint64, QMailServiceAction::Status::ErrorCode, const QString& = QString(), const QMailAccountId& = QMailAccountId(), const QMailFolderId& = QMailFolderId(), const QMailMessageId& = QMailMessageId());
     void reportFailure(quint64, const QMailServiceAction::Status);
@@ -293,7 +319,9 @@ private:
     {
     public:
         QMailServerRequestType description;
+        RequestScheduler::Priority priority;
         QSet<QPointer<QMailMessageService> > services;
+        QSet<QMailAccountId> accounts;
         CompletionSignal completion;
         uint unixTimeExpiry;
         bool reported;
@@ -319,9 +347,22 @@ private:
         RequestServicer servicer;
         CompletionSignal completion;
         QMailServerRequestType description;
+        RequestScheduler::Priority priority;
+        QElapsedTimer queued;
     };
 
     QList<Request> mRequests;
+    RequestScheduler mScheduler;
+
+    // Requests that can safely be performed again if the message server exits before completing them
+    struct ReplayableRequest
+    {
+        const char *name;
+        RequestServicer servicer;
+        CompletionSignal completion;
+    };
+
+    static const ReplayableRequest replayableRequests[];
 
     class MessageSearch
     {
@@ -355,10 +396,11 @@ private:
     QMailMessageIdList mMatchingIds;
     QMailMessageIdList mSentIds;
 
-    QFile _requestsFile;
-    QSet<quint64> _outstandingRequests;
+    RequestJournal _journal;
     QList<quint64> _failedRequests;
 
+    QMap<quint64, MailboxTransfer*> _mailboxTransfers;
+
     QSet<QMailAccountId> _retrievalAccountIds;
     QSet<QMailAccountId> _transmissionAccountIds;
 };
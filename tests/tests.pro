@@ -21,7 +21,11 @@ SUBDIRS = \
       tst_qmaildisconnected \
       tst_qmailnamespace \
       tst_locks \
-      tst_qmailthread
+      tst_qmailthread \
+      tst_requestjournal \
+      tst_mailboxtransfer \
+      tst_requestscheduler \
+      tst_integerregion
 
 exists(/usr/bin/gpgme-config) {
     SUBDIRS += tst_crypto
@@ -0,0 +1,318 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include <QObject>
+#include <QTest>
+#include "integerregion.h"
+
+class tst_IntegerRegion : public QObject
+{
+    Q_OBJECT
+
+public:
+    tst_IntegerRegion() {}
+    virtual ~tst_IntegerRegion() {}
+
+private slots:
+    void test_fromStringList();
+    void test_fromString_data();
+    void test_fromString();
+    void test_add();
+    void test_cardinality();
+    void test_isIntegerRegion();
+    void test_subtract_data();
+    void test_subtract();
+    void test_intersect_data();
+    void test_intersect();
+    void test_union_data();
+    void test_union();
+    void test_contains();
+    void test_mid();
+    void test_toStringList();
+};
+
+QTEST_MAIN(tst_IntegerRegion)
+#include "tst_integerregion.moc"
+
+void tst_IntegerRegion::test_fromStringList()
+{
+    QList<int> values;
+    values << 12 << 13 << 16 << 20 << 22 << 23 << 24 << 27 << 28 << 34;
+
+    QStringList list;
+    foreach (int value, values)
+        list << QString::number(value);
+
+    IntegerRegion ir(list);
+    QCOMPARE(ir.toString(), QString("12:13,16,20,22:24,27:28,34"));
+    QCOMPARE(IntegerRegion::toList(ir.toString()), values);
+    QCOMPARE(ir.rangeCount(), 6);
+    QCOMPARE(ir.minimum(), 12);
+    QCOMPARE(ir.maximum(), 34);
+
+    // Unordered and duplicated uids are accepted, others are ignored
+    list.clear();
+    list << "5" << "3" << "hippo" << "4" << "3" << "-1" << "9";
+    QCOMPARE(IntegerRegion(list).toString(), QString("3:5,9"));
+
+    QVERIFY(IntegerRegion(QStringList()).isEmpty());
+}
+
+void tst_IntegerRegion::test_fromString_data()
+{
+    QTest::addColumn<QString>("sequence");
+    QTest::addColumn<QString>("expected");
+
+    QTest::newRow("empty") << "" << "";
+    QTest::newRow("single") << "5" << "5";
+    QTest::newRow("range") << "1:3" << "1:3";
+    QTest::newRow("reversed range") << "3:1" << "1:3";
+    QTest::newRow("unordered") << "2:5,10:13,7,1,6,9,12:15" << "1:7,9:15";
+    QTest::newRow("adjacent ranges") << "1:3,4:6" << "1:6";
+    QTest::newRow("overlapping ranges") << "1:5,3:8,2" << "1:8";
+    QTest::newRow("duplicates") << "5,5,5" << "5";
+    QTest::newRow("invalid element") << "1,x,3" << "1,3";
+    QTest::newRow("wildcard") << "1:*,5" << "5";
+    QTest::newRow("largest") << "2147483646:2147483647" << "2147483646:2147483647";
+    QTest::newRow("overflow") << "2147483648,7" << "7";
+}
+
+void tst_IntegerRegion::test_fromString()
+{
+    QFETCH(QString, sequence);
+    QFETCH(QString, expected);
+
+    IntegerRegion ir(sequence);
+    QCOMPARE(ir.toString(), expected);
+    QCOMPARE(ir.isEmpty(), expected.isEmpty());
+
+    // Formatting and parsing again gives the same region
+    QCOMPARE(IntegerRegion(ir.toString()).toString(), expected);
+}
+
+void tst_IntegerRegion::test_add()
+{
+    IntegerRegion ir("12:13,16,20,22:24,27:28,34");
+
+    // Insert new region between existing regions
+    ir.add(31);
+    QCOMPARE(ir.toString(), QString("12:13,16,20,22:24,27:28,31,34"));
+
+    // Increment first region
+    ir.add(14);
+    QCOMPARE(ir.toString(), QString("12:14,16,20,22:24,27:28,31,34"));
+
+    // Already contained
+    ir.add(13);
+    QCOMPARE(ir.toString(), QString("12:14,16,20,22:24,27:28,31,34"));
+
+    // Decrement first region
+    ir.add(11);
+    QCOMPARE(ir.toString(), QString("11:14,16,20,22:24,27:28,31,34"));
+
+    // Decrement second region and coalesce
+    ir.add(15);
+    QCOMPARE(ir.toString(), QString("11:16,20,22:24,27:28,31,34"));
+
+    // Decrement lower bound
+    ir.add(26);
+    QCOMPARE(ir.toString(), QString("11:16,20,22:24,26:28,31,34"));
+
+    // Insert new region at start
+    ir.add(7);
+    QCOMPARE(ir.toString(), QString("7,11:16,20,22:24,26:28,31,34"));
+
+    // Insert new region at end
+    ir.add(42);
+    QCOMPARE(ir.toString(), QString("7,11:16,20,22:24,26:28,31,34,42"));
+
+    // Increment last region
+    ir.add(43);
+    QCOMPARE(ir.toString(), QString("7,11:16,20,22:24,26:28,31,34,42:43"));
+
+    // Coalesce again
+    ir.add(25);
+    QCOMPARE(ir.toString(), QString("7,11:16,20,22:28,31,34,42:43"));
+
+    IntegerRegion empty;
+    empty.add(0);
+    QCOMPARE(empty.toString(), QString("0"));
+}
+
+void tst_IntegerRegion::test_cardinality()
+{
+    IntegerRegion ir("7,11:16,20,22:28,31,34,42:43");
+    QCOMPARE(ir.cardinality(), 19u);
+    QCOMPARE(ir.rangeCount(), 7);
+
+    QList<int> values;
+    foreach (const QString &number, ir.toStringList())
+        values << number.toInt();
+    QCOMPARE(values.count(), 19);
+    QCOMPARE(IntegerRegion::toList(ir.toString()), values);
+
+    QCOMPARE(IntegerRegion().cardinality(), 0u);
+    QCOMPARE(IntegerRegion(5, 4).cardinality(), 0u);
+    QCOMPARE(IntegerRegion(1, 100000).cardinality(), 100000u);
+}
+
+void tst_IntegerRegion::test_isIntegerRegion()
+{
+    QVERIFY(IntegerRegion::isIntegerRegion(IntegerRegion("7,11:16,20").toStringList()));
+
+    QStringList hippo;
+    hippo << "1" << "3" << "hippo" << "7";
+    QVERIFY(!IntegerRegion::isIntegerRegion(hippo));
+}
+
+void tst_IntegerRegion::test_subtract_data()
+{
+    QTest::addColumn<QString>("a");
+    QTest::addColumn<QString>("b");
+    QTest::addColumn<QString>("expected");
+
+    QTest::newRow("interleaved")
+        << "4:5,8,11:12,15:17,19:20,22:23,25,29:30,34:35,37,40"
+        << "2,4:5,7:8,10:13,16,20,22,26,30:31,33:34,37"
+        << "15,17,19,23,25,29,35,40";
+    QTest::newRow("overlapping")
+        << "5:7,10:11,14:17,20:24,26:29,31:34,36:38,44:46,52:54,56:57,60"
+        << "2,5:7,9:11,13:18,21:23,28:29,31:32,39:41,46:48,50:52,56:57"
+        << "20,24,26:27,33:34,36:38,44:45,53:54,60";
+    QTest::newRow("gaps")
+        << "15555:15609"
+        << "15555:15559,15561:15563,15565:15567,15569,15573,15578:15582,15584,15586:15587,15590,15593,15595:15596,15599:15600,15602,15605:15607,15609"
+        << "15560,15564,15568,15570:15572,15574:15577,15583,15585,15588:15589,15591:15592,15594,15597:15598,15601,15603:15604,15608";
+    QTest::newRow("split range") << "1:10" << "5" << "1:4,6:10";
+    QTest::newRow("nothing subtracted") << "1:10" << "" << "1:10";
+    QTest::newRow("from empty") << "" << "1:10" << "";
+    QTest::newRow("itself") << "1:4,8:9" << "1:4,8:9" << "";
+    QTest::newRow("superset") << "3:4,8" << "1:10" << "";
+    QTest::newRow("disjoint") << "1:3" << "5:7" << "1:3";
+    QTest::newRow("bounds") << "1:10" << "1,10" << "2:9";
+}
+
+void tst_IntegerRegion::test_subtract()
+{
+    QFETCH(QString, a);
+    QFETCH(QString, b);
+    QFETCH(QString, expected);
+
+    QCOMPARE(IntegerRegion(a).subtract(IntegerRegion(b)).toString(), expected);
+}
+
+void tst_IntegerRegion::test_intersect_data()
+{
+    QTest::addColumn<QString>("a");
+    QTest::addColumn<QString>("b");
+    QTest::addColumn<QString>("expected");
+
+    QTest::newRow("overlapping") << "1:20" << "10:30" << "10:20";
+    QTest::newRow("disjoint") << "1:10" << "20:30" << "";
+    QTest::newRow("itself") << "1:10" << "1:10" << "1:10";
+    QTest::newRow("subset") << "1:4,6:8,9,10,30,1000,20000,30000" << "1:30000" << "1:4,6:10,30,1000,20000,30000";
+    QTest::newRow("sparse") << "1:4,6:8,9,10,30,1000,20000,30000" << "2,5,7,100:10000,25000,26000,27000,28000" << "2,7,1000";
+    QTest::newRow("adjacent") << "1:5" << "6:10" << "";
+    QTest::newRow("single point") << "1:5" << "5:10" << "5";
+    QTest::newRow("empty") << "1:10" << "" << "";
+}
+
+void tst_IntegerRegion::test_intersect()
+{
+    QFETCH(QString, a);
+    QFETCH(QString, b);
+    QFETCH(QString, expected);
+
+    QCOMPARE(IntegerRegion(a).intersect(IntegerRegion(b)).toString(), expected);
+    QCOMPARE(IntegerRegion(b).intersect(IntegerRegion(a)).toString(), expected);
+}
+
+void tst_IntegerRegion::test_union_data()
+{
+    QTest::addColumn<QString>("a");
+    QTest::addColumn<QString>("b");
+    QTest::addColumn<QString>("expected");
+
+    QTest::newRow("sparse") << "1:4,6:8,9,10,30,1000,20000,30000" << "2,5,7,100:10000,25000,26000,27000,28000"
+                            << "1:10,30,100:10000,20000,25000,26000,27000,28000,30000";
+    QTest::newRow("adjacent") << "1:5" << "6:10" << "1:10";
+    QTest::newRow("disjoint") << "1:3" << "5:7" << "1:3,5:7";
+    QTest::newRow("empty") << "1:3" << "" << "1:3";
+    QTest::newRow("both empty") << "" << "" << "";
+}
+
+void tst_IntegerRegion::test_union()
+{
+    QFETCH(QString, a);
+    QFETCH(QString, b);
+    QFETCH(QString, expected);
+
+    QCOMPARE(IntegerRegion(a).add(IntegerRegion(b)).toString(), expected);
+    QCOMPARE(IntegerRegion(b).add(IntegerRegion(a)).toString(), expected);
+}
+
+void tst_IntegerRegion::test_contains()
+{
+    IntegerRegion ir("3:5,9,20:30");
+
+    QVERIFY(!ir.contains(2));
+    QVERIFY(ir.contains(3));
+    QVERIFY(ir.contains(5));
+    QVERIFY(!ir.contains(6));
+    QVERIFY(ir.contains(9));
+    QVERIFY(ir.contains(25));
+    QVERIFY(!ir.contains(31));
+    QVERIFY(!IntegerRegion().contains(0));
+}
+
+void tst_IntegerRegion::test_mid()
+{
+    IntegerRegion ir("3:5,9,20:30");
+
+    QCOMPARE(ir.mid(0).toString(), QString("3:5,9,20:30"));
+    QCOMPARE(ir.mid(2).toString(), QString("5,9,20:30"));
+    QCOMPARE(ir.mid(3).toString(), QString("9,20:30"));
+    QCOMPARE(ir.mid(5).toString(), QString("21:30"));
+    QCOMPARE(ir.mid(15).toString(), QString());
+    QCOMPARE(ir.mid(100).toString(), QString());
+}
+
+void tst_IntegerRegion::test_toStringList()
+{
+    IntegerRegion ir("3:5,9");
+
+    QCOMPARE(ir.toStringList(), QStringList() << "3" << "4" << "5" << "9");
+    QCOMPARE(ir.toStringList("7|"), QStringList() << "7|3" << "7|4" << "7|5" << "7|9");
+    QCOMPARE(IntegerRegion().toStringList(), QStringList());
+}
@@ -0,0 +1,13 @@
+TEMPLATE = app
+TARGET = tst_integerregion
+CONFIG += qmfclient
+
+IMAP_PLUGIN = ../../src/plugins/messageservices/imap
+INCLUDEPATH += $$IMAP_PLUGIN
+
+HEADERS += $$IMAP_PLUGIN/integerregion.h
+
+SOURCES += tst_integerregion.cpp \
+           $$IMAP_PLUGIN/integerregion.cpp
+
+include(../tests.pri)
@@ -0,0 +1,344 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QObject>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QTest>
+#include <qmailstore.h>
+#include "mailboxtransfer.h"
+
+class tst_MailboxTransfer : public QObject
+{
+    Q_OBJECT
+
+public:
+    tst_MailboxTransfer() {}
+    virtual ~tst_MailboxTransfer() {}
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void test_mboxRoundTrip();
+    void test_maildirFlags();
+    void test_resumeImport();
+    void test_resumeExport();
+
+private:
+    QMailFolderId addFolder(const QString &name);
+    bool run(MailboxTransfer *transfer);
+    QMailMessageIdList folderMessages(const QMailFolderId &folderId) const;
+    void writeFile(const QString &path, const QByteArray &data);
+    QByteArray readFile(const QString &path);
+
+    QMailAccount account;
+    QTemporaryDir dir;
+    quint64 nextAction;
+};
+
+QTEST_MAIN(tst_MailboxTransfer)
+#include "tst_mailboxtransfer.moc"
+
+void tst_MailboxTransfer::initTestCase()
+{
+    nextAction = 1;
+
+    account.setName("Transfer account");
+    account.setMessageType(QMailMessage::Email);
+    account.setCustomField("transfer", "true");
+    QVERIFY(QMailStore::instance()->addAccount(&account, 0));
+    QVERIFY(dir.isValid());
+}
+
+void tst_MailboxTransfer::cleanupTestCase()
+{
+    QMailStore::instance()->removeAccounts(QMailAccountKey::customField("transfer"));
+}
+
+QMailFolderId tst_MailboxTransfer::addFolder(const QString &name)
+{
+    QMailFolder folder(name, QMailFolderId(), account.id());
+    QMailStore::instance()->addFolder(&folder);
+    return folder.id();
+}
+
+// Runs the transfer to completion, returning true if it succeeded
+bool tst_MailboxTransfer::run(MailboxTransfer *transfer)
+{
+    QScopedPointer<MailboxTransfer> owner(transfer);
+    QSignalSpy finished(transfer, SIGNAL(finished(quint64, QMailServiceAction::Status)));
+    if (!transfer->start())
+        return false;
+
+    for (int i = 0; (finished.count() == 0) && (i < 100); ++i)
+        finished.wait(100);
+
+    return (finished.count() == 1) && (transfer->status().errorCode == QMailServiceAction::Status::ErrNoError);
+}
+
+QMailMessageIdList tst_MailboxTransfer::folderMessages(const QMailFolderId &folderId) const
+{
+    return QMailStore::instance()->queryMessages(QMailMessageKey::parentFolderId(folderId), QMailMessageSortKey::id());
+}
+
+void tst_MailboxTransfer::writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    QCOMPARE(file.write(data), qint64(data.size()));
+}
+
+QByteArray tst_MailboxTransfer::readFile(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return file.readAll();
+}
+
+void tst_MailboxTransfer::test_mboxRoundTrip()
+{
+    // Lines that look like separators are quoted once more for each level (mboxrd),
+    // and the second message uses CRLF line endings throughout
+    const QByteArray mbox("From alice@example.org Mon Jun  1 12:00:00 2015\n"
+                          "From: alice@example.org\n"
+                          "To: bob@example.org\n"
+                          "Subject: Quoting\n"
+                          "Status: RO\n"
+                          "X-Status: AF\n"
+                          "\n"
+                          ">From here\n"
+                          ">>From there\n"
+                          "From nowhere, since this line is not preceded by an empty line\n"
+                          "\n"
+                          "From bob@example.org Mon Jun  1 12:05:00 2015\r\n"
+                          "From: bob@example.org\r\n"
+                          "To: alice@example.org\r\n"
+                          "Subject: Line endings\r\n"
+                          "\r\n"
+                          "First line\r\n"
+                          "\r\n"
+                          "Last line\r\n"
+                          "\r\n");
+    const QString source(dir.path() + QLatin1String("/source.mbox"));
+    writeFile(source, mbox);
+
+    const QMailFolderId imported(addFolder("Imported mbox"));
+    QVERIFY(run(new MailboxImport(nextAction++, source, QMailStorageAction::MboxFormat, imported)));
+
+    QMailMessageIdList ids(folderMessages(imported));
+    QCOMPARE(ids.count(), 2);
+
+    QMailMessage quoting(ids.at(0));
+    QCOMPARE(quoting.subject(), QString("Quoting"));
+    QVERIFY(quoting.status() & QMailMessage::Read);
+    QVERIFY(quoting.status() & QMailMessage::Replied);
+    QVERIFY(quoting.status() & QMailMessage::Important);
+    const QString quotingBody(quoting.body().data());
+    QVERIFY(quotingBody.contains(QLatin1String("\nFrom here")) || quotingBody.startsWith(QLatin1String("From here")));
+    QVERIFY(quotingBody.contains(QLatin1String("\n>From there")));
+    QVERIFY(!quotingBody.contains(QLatin1String(">>From")));
+
+    QMailMessage lineEndings(ids.at(1));
+    QCOMPARE(lineEndings.subject(), QString("Line endings"));
+    QVERIFY(!(lineEndings.status() & QMailMessage::Read));
+    const QString lineEndingsBody(lineEndings.body().data());
+    QVERIFY(lineEndingsBody.contains(QLatin1String("First line")));
+    QVERIFY(lineEndingsBody.contains(QLatin1String("Last line")));
+    QVERIFY(!lineEndingsBody.contains(QLatin1String("From bob")));
+
+    // Exported lines are quoted again, and use local line endings
+    const QString exported(dir.path() + QLatin1String("/exported.mbox"));
+    QVERIFY(run(new MailboxExport(nextAction++, QMailMessageKey::parentFolderId(imported), exported, QMailStorageAction::MboxFormat)));
+    QVERIFY(!QFile::exists(exported + QLatin1String(".qmf-export")));
+
+    const QByteArray output(readFile(exported));
+    QVERIFY(output.startsWith("From alice@example.org "));
+    QVERIFY(output.contains("\n>From here\n"));
+    QVERIFY(output.contains("\n>>From there\n"));
+    QVERIFY(output.contains("\n>From nowhere"));
+    QVERIFY(output.contains("\n\nFrom bob@example.org "));
+    QVERIFY(!output.contains('\r'));
+
+    // Importing the export again reproduces the original messages
+    const QMailFolderId reimported(addFolder("Reimported mbox"));
+    QVERIFY(run(new MailboxImport(nextAction++, exported, QMailStorageAction::MboxFormat, reimported)));
+
+    const QMailMessageIdList copies(folderMessages(reimported));
+    QCOMPARE(copies.count(), 2);
+    for (int i = 0; i < copies.count(); ++i) {
+        QMailMessage original(ids.at(i));
+        QMailMessage copy(copies.at(i));
+        QCOMPARE(copy.subject(), original.subject());
+        QCOMPARE(copy.body().data(), original.body().data());
+        QCOMPARE(copy.status() & (QMailMessage::Read | QMailMessage::Replied | QMailMessage::Important),
+                 original.status() & (QMailMessage::Read | QMailMessage::Replied | QMailMessage::Important));
+    }
+}
+
+void tst_MailboxTransfer::test_maildirFlags()
+{
+    const QString source(dir.path() + QLatin1String("/source.maildir"));
+    QDir maildir(source);
+    QVERIFY(maildir.mkpath(QLatin1String("cur")));
+    QVERIFY(maildir.mkpath(QLatin1String("new")));
+    QVERIFY(maildir.mkpath(QLatin1String("tmp")));
+
+    const QByteArray message("From: alice@example.org\nSubject: %1\n\nBody\n");
+    writeFile(maildir.filePath(QLatin1String("cur/1.a.host:2,FS")), QByteArray(message).replace("%1", "Flagged"));
+    writeFile(maildir.filePath(QLatin1String("cur/2.b.host:2,DPRT")), QByteArray(message).replace("%1", "Several"));
+    writeFile(maildir.filePath(QLatin1String("new/3.c.host")), QByteArray(message).replace("%1", "New"));
+
+    const QMailFolderId imported(addFolder("Imported Maildir"));
+    QVERIFY(run(new MailboxImport(nextAction++, source, QMailStorageAction::MaildirFormat, imported)));
+
+    const QMailMessageIdList ids(folderMessages(imported));
+    QCOMPARE(ids.count(), 3);
+
+    const quint64 flags(QMailMessage::Draft | QMailMessage::Important | QMailMessage::Forwarded |
+                        QMailMessage::Replied | QMailMessage::Read | QMailMessage::Trash);
+    QCOMPARE(QMailMessageMetaData(ids.at(0)).status() & flags, quint64(QMailMessage::Important | QMailMessage::Read));
+    QCOMPARE(QMailMessageMetaData(ids.at(1)).status() & flags,
+             quint64(QMailMessage::Draft | QMailMessage::Forwarded | QMailMessage::Replied | QMailMessage::Trash));
+    QCOMPARE(QMailMessageMetaData(ids.at(2)).status() & flags, quint64(0));
+
+    // Every exported message is delivered to cur, with its flags in ASCII order
+    const QString exported(dir.path() + QLatin1String("/exported.maildir"));
+    QVERIFY(run(new MailboxExport(nextAction++, QMailMessageKey::parentFolderId(imported), exported, QMailStorageAction::MaildirFormat)));
+
+    QStringList suffixes;
+    foreach (const QString &name, QDir(exported + QLatin1String("/cur")).entryList(QDir::Files, QDir::Name))
+        suffixes.append(name.section(QLatin1Char(':'), 1));
+    suffixes.sort();
+    QCOMPARE(suffixes, QStringList() << QLatin1String("2,") << QLatin1String("2,DPRT") << QLatin1String("2,FS"));
+    QVERIFY(QDir(exported + QLatin1String("/tmp")).entryList(QDir::Files).isEmpty());
+}
+
+void tst_MailboxTransfer::test_resumeImport()
+{
+    const QString source(dir.path() + QLatin1String("/resume.maildir"));
+    QDir maildir(source);
+    QVERIFY(maildir.mkpath(QLatin1String("cur")));
+    QVERIFY(maildir.mkpath(QLatin1String("new")));
+
+    const QByteArray message("From: alice@example.org\nSubject: %1\n\nBody\n");
+    writeFile(maildir.filePath(QLatin1String("cur/1.a.host:2,S")), QByteArray(message).replace("%1", "One"));
+    writeFile(maildir.filePath(QLatin1String("cur/3.c.host:2,S")), QByteArray(message).replace("%1", "Three"));
+
+    const QMailFolderId imported(addFolder("Resumed Maildir"));
+    QVERIFY(run(new MailboxImport(nextAction++, source, QMailStorageAction::MaildirFormat, imported)));
+    QCOMPARE(folderMessages(imported).count(), 2);
+
+    // Removing an imported message must not cause a later one to be skipped, and
+    // changing the flags of an imported message must not cause it to be repeated
+    QVERIFY(QFile::remove(maildir.filePath(QLatin1String("cur/1.a.host:2,S"))));
+    QVERIFY(QFile::rename(maildir.filePath(QLatin1String("cur/3.c.host:2,S")), maildir.filePath(QLatin1String("cur/3.c.host:2,RS"))));
+    writeFile(maildir.filePath(QLatin1String("new/4.d.host")), QByteArray(message).replace("%1", "Four"));
+
+    QVERIFY(run(new MailboxImport(nextAction++, source, QMailStorageAction::MaildirFormat, imported)));
+
+    const QMailMessageIdList ids(folderMessages(imported));
+    QCOMPARE(ids.count(), 3);
+    QCOMPARE(QMailMessageMetaData(ids.last()).subject(), QString("Four"));
+
+    // An mbox import resumes after the last complete message
+    const QString mbox(dir.path() + QLatin1String("/resume.mbox"));
+    const QByteArray first("From alice@example.org Mon Jun  1 12:00:00 2015\nSubject: First\n\nBody\n\n");
+    const QByteArray second("From alice@example.org Mon Jun  1 12:01:00 2015\nSubject: Second\n\nBody\n\n");
+    writeFile(mbox, first);
+
+    const QMailFolderId importedMbox(addFolder("Resumed mbox"));
+    QVERIFY(run(new MailboxImport(nextAction++, mbox, QMailStorageAction::MboxFormat, importedMbox)));
+    writeFile(mbox, first + second);
+    QVERIFY(run(new MailboxImport(nextAction++, mbox, QMailStorageAction::MboxFormat, importedMbox)));
+
+    const QMailMessageIdList mboxIds(folderMessages(importedMbox));
+    QCOMPARE(mboxIds.count(), 2);
+    QCOMPARE(QMailMessageMetaData(mboxIds.first()).subject(), QString("First"));
+    QCOMPARE(QMailMessageMetaData(mboxIds.last()).subject(), QString("Second"));
+}
+
+void tst_MailboxTransfer::test_resumeExport()
+{
+    const QMailFolderId folderId(addFolder("Export source"));
+    for (int i = 0; i < 3; ++i) {
+        QMailMessage message;
+        message.setMessageType(QMailMessage::Email);
+        message.setParentAccountId(account.id());
+        message.setParentFolderId(folderId);
+        message.setSubject(QString("Exported %1").arg(i));
+        message.setBody(QMailMessageBody::fromData(QString("Body %1").arg(i), QMailMessageContentType("text/plain"), QMailMessageBody::SevenBit));
+        QVERIFY(QMailStore::instance()->addMessage(&message));
+    }
+    const QMailMessageKey key(QMailMessageKey::parentFolderId(folderId));
+
+    // An export interrupted part way through a batch leaves incomplete output
+    // beyond the last checkpoint, which is discarded when it resumes
+    const QString path(dir.path() + QLatin1String("/resume.mbox"));
+    writeFile(path, "From existing@example.org Mon Jun  1 12:00:00 2015\nSubject: Existing\n\nBody\n\n");
+    const qint64 existing(QFileInfo(path).size());
+    {
+        MailboxExport interrupted(nextAction++, key, path, QMailStorageAction::MboxFormat);
+        QVERIFY(interrupted.start());
+    }
+    QVERIFY(QFile::exists(path + QLatin1String(".qmf-export")));
+    {
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Append));
+        file.write("From partial@example.org Mon Jun  1 12:00:00 2015\nSubject: Part");
+    }
+
+    QVERIFY(run(new MailboxExport(nextAction++, key, path, QMailStorageAction::MboxFormat)));
+    QByteArray output(readFile(path));
+    QVERIFY(output.size() > existing);
+    QVERIFY(!output.contains("partial@example.org"));
+    QCOMPARE(output.count("\nSubject: Exported "), 3);
+    QCOMPARE(output.count("\nSubject: Existing"), 1);
+
+    // If output covered by the checkpoint has been lost, the export starts again
+    {
+        MailboxExport interrupted(nextAction++, key, path, QMailStorageAction::MboxFormat);
+        QVERIFY(interrupted.start());
+    }
+    writeFile(path, QByteArray());
+
+    QVERIFY(run(new MailboxExport(nextAction++, key, path, QMailStorageAction::MboxFormat)));
+    output = readFile(path);
+    QVERIFY(output.startsWith("From "));
+    QCOMPARE(output.count("\nSubject: Exported "), 3);
+    QCOMPARE(output.count("\nSubject: Existing"), 0);
+}
@@ -0,0 +1,13 @@
+TEMPLATE = app
+TARGET = tst_mailboxtransfer
+CONFIG += qmfclient
+
+MESSAGE_SERVER = ../../src/tools/messageserver
+INCLUDEPATH += $$MESSAGE_SERVER
+
+HEADERS += $$MESSAGE_SERVER/mailboxtransfer.h
+
+SOURCES += tst_mailboxtransfer.cpp \
+           $$MESSAGE_SERVER/mailboxtransfer.cpp
+
+include(../tests.pri)
@@ -37,6 +37,7 @@
 #include <QSignalSpy>
 #include <QTimer>
 #include <QThread>
+#include <QElapsedTimer>
 
 #include <private/qcopserver_p.h>
 #include <private/qcopchannel_p.h>
@@ -65,6 +66,12 @@ private slots:
     void test_qcopclient();
     void test_qcopadaptor();
     void test_secondqcopserver();
+    void test_sharedTransport();
+    void test_sharedRingUnacknowledged();
+    void test_sharedDescriptorValidation();
+
+    void bench_transport_data();
+    void bench_transport();
 
 private:
     TestQCopServer *server;
@@ -265,3 +272,156 @@ void tst_QCop::test_secondqcopserver()
     client->handleRegistered(channel);
     delete server1;
 }
+
+void tst_QCop::test_sharedTransport()
+{
+    QString channel("testsharedchannel");
+    QCopChannel exact(channel);
+    QCopChannel wildcard("testshared*");
+    QSignalSpy exactSpy(&exact, SIGNAL(received(QString,QByteArray)));
+    QSignalSpy forwardedSpy(&wildcard, SIGNAL(forwarded(QString,QByteArray,QString)));
+    QVERIFY(QCopChannel::isRegistered(channel));
+
+    QCopClient *client = new QCopClient(true, this);
+    QVERIFY(client->isConnectionEstablished);
+
+    // The small payload is sent inline, the large one through the shared ring
+    QByteArray small(1024, 's');
+    QByteArray large(1024 * 1024, 'l');
+    client->send(channel, "small()", small);
+    client->send(channel, "large()", large);
+    client->flush();
+
+    QTRY_COMPARE(exactSpy.count(), 2);
+    QTRY_COMPARE(forwardedSpy.count(), 2);
+    QVERIFY(client->sharedRing != 0);
+
+    QCOMPARE(exactSpy.at(0).at(1).toByteArray(), small);
+    QCOMPARE(exactSpy.at(1).at(0).toString(), QString("large()"));
+    QCOMPARE(exactSpy.at(1).at(1).toByteArray(), large);
+    QCOMPARE(forwardedSpy.at(1).at(0).toString(), QString("large()"));
+    QCOMPARE(forwardedSpy.at(1).at(1).toByteArray(), large);
+    QCOMPARE(forwardedSpy.at(1).at(2).toString(), channel);
+
+    delete client;
+}
+
+void tst_QCop::test_sharedRingUnacknowledged()
+{
+    QCopSharedRing ring;
+    QVERIFY(ring.create());
+    ring.lease = 500;
+
+    const int size = 1024 * 1024;
+    int offset;
+    quint32 sequence;
+
+    // The first packet is never acknowledged by its recipient
+    char *held = ring.reserve(size, &offset, &sequence);
+    QVERIFY(held != 0);
+    const QByteArray heldDescriptor(QCopSharedRing::descriptor(ring.key(), offset, sequence));
+    QCopSharedSlot *heldSlot = QCopSharedRing::slot(heldDescriptor.constData(), heldDescriptor.length());
+    QVERIFY(heldSlot != 0);
+    const quint32 heldSequence = sequence;
+
+    // Later packets are reclaimed as they are released, around the held one
+    for (int i = 0; i < 32; ++i) {
+        char *buf = ring.reserve(size, &offset, &sequence);
+        QVERIFY(buf != 0);
+        QVERIFY(offset != 0);
+        QCopSharedSlot *slot = reinterpret_cast<QCopSharedSlot *>(buf) - 1;
+        QVERIFY(slot->adjustReferences(sequence, -1));
+    }
+
+    // Fill the ring with packets that are never acknowledged
+    QList<quint32> sequences;
+    while (ring.reserve(size, &offset, &sequence))
+        sequences.append(sequence);
+    QVERIFY(!sequences.isEmpty());
+    QVERIFY(ring.reserve(size, &offset, &sequence) == 0);
+
+    // Once the leases expire, the slots are freed and late references refused
+    QTest::qWait(ring.lease + 100);
+    QVERIFY(ring.reserve(size, &offset, &sequence) != 0);
+    QVERIFY(QCopSharedRing::slot(heldDescriptor.constData(), heldDescriptor.length()) == 0);
+    QVERIFY(!heldSlot->adjustReferences(heldSequence, -1));
+    QVERIFY(!heldSlot->adjustReferences(heldSequence, 1));
+}
+
+void tst_QCop::test_sharedDescriptorValidation()
+{
+    QCopSharedRing ring;
+    QVERIFY(ring.create());
+
+    const int size = 64 * 1024;
+    int offset;
+    quint32 sequence;
+    char *buf = ring.reserve(size, &offset, &sequence);
+    QVERIFY(buf != 0);
+    QCopSharedSlot *slot = reinterpret_cast<QCopSharedSlot *>(buf) - 1;
+
+    const QByteArray descriptor(QCopSharedRing::descriptor(ring.key(), offset, sequence));
+    QCOMPARE(QCopSharedRing::descriptorKey(descriptor.constData(), descriptor.length()), ring.key());
+    int length = 0;
+    QVERIFY(QCopSharedRing::slot(descriptor.constData(), descriptor.length(), 0, &length) == slot);
+    QCOMPARE(length, size);
+
+    // Truncated descriptors, and keys of segments that aren't rings, are refused
+    QVERIFY(QCopSharedRing::slot(descriptor.constData(), descriptor.length() - 2) == 0);
+    const QByteArray foreign(QCopSharedRing::descriptor(QString::fromLatin1("other-segment"), offset, sequence));
+    QVERIFY(QCopSharedRing::descriptorKey(foreign.constData(), foreign.length()).isEmpty());
+    QVERIFY(QCopSharedRing::slot(foreign.constData(), foreign.length()) == 0);
+
+    // Offsets and lengths beyond the segment are refused
+    const QByteArray outside(QCopSharedRing::descriptor(ring.key(), QCopSharedRing::capacity, sequence));
+    QVERIFY(QCopSharedRing::slot(outside.constData(), outside.length()) == 0);
+    slot->length = QCopSharedRing::capacity;
+    QVERIFY(QCopSharedRing::slot(descriptor.constData(), descriptor.length()) == 0);
+    slot->length = size;
+    QVERIFY(QCopSharedRing::slot(descriptor.constData(), descriptor.length()) == slot);
+    QVERIFY(slot->adjustReferences(sequence, -1));
+}
+
+void tst_QCop::bench_transport_data()
+{
+    QTest::addColumn<int>("payloadSize");
+    QTest::addColumn<int>("batch");
+
+    // Single messages measure latency; batches measure messages per second
+    QTest::newRow("1KB latency") << 1024 << 1;
+    QTest::newRow("1KB throughput") << 1024 << 100;
+    QTest::newRow("1MB latency") << 1024 * 1024 << 1;
+    QTest::newRow("1MB throughput") << 1024 * 1024 << 4;
+}
+
+void tst_QCop::bench_transport()
+{
+    QFETCH(int, payloadSize);
+    QFETCH(int, batch);
+
+    QString channel("testbenchchannel");
+    QCopChannel receiver(channel);
+    QSignalSpy spy(&receiver, SIGNAL(received(QString,QByteArray)));
+    QVERIFY(QCopChannel::isRegistered(channel));
+
+    QCopClient *client = new QCopClient(true, this);
+    QVERIFY(client->isConnectionEstablished);
+
+    const QByteArray payload(payloadSize, 'x');
+    QBENCHMARK {
+        spy.clear();
+        for (int i = 0; i < batch; ++i)
+            client->send(channel, "bench()", payload);
+        client->flush();
+
+        QElapsedTimer timer;
+        timer.start();
+        while (spy.count() < batch) {
+            if (timer.elapsed() > 10000)
+                QFAIL("Timed out waiting for QCop delivery");
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+        }
+    }
+
+    delete client;
+}
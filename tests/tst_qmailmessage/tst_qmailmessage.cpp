@@ -133,6 +133,9 @@ private slots:
     void copyAndAssign();
 
     void unterminatedDoubleQuote();
+
+    void preview_data();
+    void preview();
 };
 
 QTEST_MAIN(tst_QMailMessage)
@@ -1652,3 +1655,61 @@ void tst_QMailMessage::unterminatedDoubleQuote()
     QMailMessage m2(QMailMessage::fromRfc2822(m1.toRfc2822()));
     QCOMPARE( m2.subject(), testString );
 }
+
+Q_DECLARE_METATYPE(QMailMessageBody::TransferEncoding)
+
+void tst_QMailMessage::preview_data()
+{
+    QTest::addColumn<QByteArray>("type");
+    QTest::addColumn<QByteArray>("content");
+    QTest::addColumn<QMailMessageBody::TransferEncoding>("encoding");
+    QTest::addColumn<QString>("preview");
+
+    QTest::newRow("plain")
+        << QByteArray("text/plain; charset=UTF-8")
+        << QByteArray("Plain text body")
+        << QMailMessageBody::EightBit
+        << QString("Plain text body");
+
+    QTest::newRow("plain truncated")
+        << QByteArray("text/plain; charset=UTF-8")
+        << QByteArray(1000, 'x')
+        << QMailMessageBody::Base64
+        << QString(280, 'x');
+
+    QTest::newRow("html")
+        << QByteArray("text/html; charset=UTF-8")
+        << QByteArray("<html><head><title>Title</title><style>p { color: red }</style></head>"
+                      "<body><!-- <p>hidden</p> --><p>First&nbsp;&amp; <b>bold</b></p>"
+                      "<p>a &lt; b&#33; &#x41; &unknown; &</p><script>var x = '<p>';</script></body></html>")
+        << QMailMessageBody::QuotedPrintable
+        << QString("First & bold a < b! A &unknown; &");
+
+    QTest::newRow("html trailing entity")
+        << QByteArray("text/html; charset=UTF-8")
+        << QByteArray("<p>AT&T")
+        << QMailMessageBody::EightBit
+        << QString("AT&T");
+
+    QTest::newRow("html truncated")
+        << QByteArray("text/html; charset=UTF-8")
+        << (QByteArray("<html><body><p>") + QByteArray(100000, 'y') + QByteArray("</p></body></html>"))
+        << QMailMessageBody::Base64
+        << QString(280, 'y');
+}
+
+void tst_QMailMessage::preview()
+{
+    QFETCH(QByteArray, type);
+    QFETCH(QByteArray, content);
+    QFETCH(QMailMessageBody::TransferEncoding, encoding);
+    QFETCH(QString, preview);
+
+    QMailMessage message;
+    message.setBody(QMailMessageBody::fromData(content, QMailMessageContentType(type), encoding, QMailMessageBody::RequiresEncoding));
+    QCOMPARE(message.preview(), preview);
+
+    // The preview must survive encoding for transmission
+    QMailMessage parsed(QMailMessage::fromRfc2822(message.toRfc2822()));
+    QCOMPARE(parsed.preview(), preview);
+}
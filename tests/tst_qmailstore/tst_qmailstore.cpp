@@ -31,12 +31,17 @@
 **
 ****************************************************************************/
 
+#include <QDir>
+#include <QFile>
 #include <QObject>
 #include <QTest>
+#include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QSignalSpy>
+#include <QThread>
 #include <qmailstore.h>
 #include <QSettings>
+#include <qmailcontentmanager.h>
 #include <qmailnamespace.h>
 #include <private/qmailstoreimplementation_p.h>
 
@@ -78,6 +83,64 @@ private slots:
     void removeMessageWithInResponse();
     void message();
     void implementationbase();
+    void performMaintenance();
+    void incrementalVacuum();
+    void instrumentation();
+    void queryMessagePage();
+    void rebuildThreads();
+    void countMessagesGrouped();
+    void asynchronousOperations();
+    void sharedCache();
+    void sharedCacheReader();
+    void sharedCacheReattach();
+    void storeProfile();
+    void readSnapshot();
+    void concurrentWrites();
+};
+
+// Uses the store of the thread it is moved to, which has a connection of its own
+class SharedCacheReader : public QObject
+{
+    Q_OBJECT
+
+public:
+    QMailMessageId id;
+    QMailMessageKey::Properties properties;
+    QMailMessageMetaData result;
+    bool success;
+
+public slots:
+    void attach() { success = QMailStore::instance()->setSharedCacheAccess(QMailStore::SharedCacheReadAccess); }
+    void detach() { QMailStore::instance()->setSharedCacheAccess(QMailStore::NoSharedCacheAccess); }
+    void lookup() { result = QMailStore::instance()->messageMetaData(id, properties); }
+    void markRead() { success = QMailStore::instance()->updateMessagesMetaData(QMailMessageKey::id(id), QMailMessage::Read, true); }
+};
+
+// Adds messages through the store of its own thread, while the test thread writes too
+class ConcurrentWriter : public QThread
+{
+public:
+    QMailAccountId accountId;
+    QMailFolderId folderId;
+    int count;
+    int added;
+
+    ConcurrentWriter() : count(0), added(0) {}
+
+protected:
+    void run()
+    {
+        for (int i = 0; i < count; ++i) {
+            QMailMessageMetaData message;
+            message.setMessageType(QMailMessage::Email);
+            message.setParentAccountId(accountId);
+            message.setParentFolderId(folderId);
+            message.setSubject(QString("Worker message %1").arg(i));
+            if (QMailStore::instance()->addMessage(&message)
+                && QMailStore::instance()->updateMessagesMetaData(QMailMessageKey::id(message.id()), QMailMessage::Read, true))
+                ++added;
+        }
+    }
 };
 
 QTEST_MAIN(tst_QMailStore)
@@ -1783,3 +1846,798 @@ void tst_QMailStore::implementationbase()
     impl.notifyRetrievalInProgress(QMailAccountIdList()<<account1.id());
 
 }
+
+void tst_QMailStore::performMaintenance()
+{
+    QMailAccount account;
+    account.setName("Account 11");
+    QVERIFY(QMailStore::instance()->addAccount(&account, 0));
+
+    QMailFolder folder("Folder 11", QMailFolderId(), account.id());
+    QVERIFY(QMailStore::instance()->addFolder(&folder));
+
+    for (int i = 0; i < 250; ++i) {
+        QMailMessage message;
+        message.setMessageType(QMailMessage::Email);
+        message.setParentAccountId(account.id());
+        message.setParentFolderId(folder.id());
+        message.setSubject(QString("Message %1").arg(i));
+        message.setBody(QMailMessageBody::fromData(QString("Body %1").arg(i), QMailMessageContentType("text/plain"), QMailMessageBody::SevenBit));
+        QVERIFY(QMailStore::instance()->addMessage(&message));
+    }
+    QVERIFY(QMailStore::instance()->removeMessages(QMailMessageKey::parentFolderId(folder.id())));
+
+    // All maintenance tasks are due for a newly created store
+    QVERIFY(QMailStore::instance()->performMaintenance());
+    QCOMPARE(QMailStore::instance()->lastError(), QMailStore::NoError);
+
+    // Nothing remains to be done
+    QVERIFY(QMailStore::instance()->performMaintenance(0));
+    QCOMPARE(QMailStore::instance()->lastError(), QMailStore::NoError);
+
+    const QString directory(QMail::dataPath() + "tst_performMaintenance");
+    QVERIFY(QDir::root().mkpath(directory));
+
+    {
+        QSqlDatabase db(QSqlDatabase::addDatabase("QSQLITE", "tst_performMaintenance"));
+        db.setDatabaseName(QMail::dataPath() + "database/qmailstore.db");
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+
+        // Record far more obsolete content than a single batch removes
+        const int fileCount = 2000;
+        QVERIFY(db.transaction());
+        QVERIFY(query.prepare("INSERT INTO obsoletefiles (mailfile) VALUES (?)"));
+        for (int i = 0; i < fileCount; ++i) {
+            const QString path(directory + QString("/obsolete-%1").arg(i));
+            QFile file(path);
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            QVERIFY(file.write("Obsolete content") > 0);
+            file.close();
+
+            query.addBindValue(QMailContentManagerFactory::defaultScheme() + ':' + path);
+            QVERIFY(query.exec());
+        }
+        QVERIFY(db.commit());
+
+        // Make the purge due again
+        QVERIFY(query.exec("DELETE FROM maintenancerecord"));
+
+        // With almost no time to spare, each invocation performs little more than a single batch
+        bool partial = false;
+        int invocations = 0;
+        while (!QMailStore::instance()->performMaintenance(1)) {
+            QCOMPARE(QMailStore::instance()->lastError(), QMailStore::NoError);
+            QVERIFY(++invocations < fileCount);
+
+            QVERIFY(query.exec("SELECT COUNT(*) FROM obsoletefiles") && query.first());
+            const int rows(query.value(0).toInt());
+            const int files(QDir(directory).entryList(QDir::Files).count());
+
+            // Content is removed before the rows recording it
+            QVERIFY(files <= rows);
+            if ((rows > 0) && (rows < fileCount))
+                partial = true;
+        }
+        QCOMPARE(QMailStore::instance()->lastError(), QMailStore::NoError);
+        QVERIFY(partial);
+
+        // Every obsolete file and its record has been removed
+        QVERIFY(query.exec("SELECT COUNT(*) FROM obsoletefiles") && query.first());
+        QCOMPARE(query.value(0).toInt(), 0);
+        QCOMPARE(QDir(directory).entryList(QDir::Files).count(), 0);
+    }
+    QSqlDatabase::removeDatabase("tst_performMaintenance");
+
+    QVERIFY(QDir::root().rmdir(directory));
+}
+
+static int pragmaValue(QSqlQuery &query, const QString &name)
+{
+    if (!query.exec(QString("PRAGMA %1").arg(name)) || !query.first())
+        return -1;
+    return query.value(0).toInt();
+}
+
+static void addAndRemoveMessages(const QMailAccountId &accountId, const QMailFolderId &folderId)
+{
+    for (int i = 0; i < 250; ++i) {
+        QMailMessage message;
+        message.setMessageType(QMailMessage::Email);
+        message.setParentAccountId(accountId);
+        message.setParentFolderId(folderId);
+        message.setSubject(QString("Message %1 ").arg(i) + QString(200, QChar('s')));
+        QVERIFY(QMailStore::instance()->addMessage(&message));
+    }
+    QVERIFY(QMailStore::instance()->removeMessages(QMailMessageKey::parentFolderId(folderId)));
+}
+
+void tst_QMailStore::incrementalVacuum()
+{
+    QMailAccount account;
+    account.setName("Account 19");
+    QVERIFY(QMailStore::instance()->addAccount(&account, 0));
+
+    QMailFolder folder("Folder 19", QMailFolderId(), account.id());
+    QVERIFY(QMailStore::instance()->addFolder(&folder));
+
+    {
+        QSqlDatabase db(QSqlDatabase::addDatabase("QSQLITE", "tst_incrementalVacuum"));
+        db.setDatabaseName(QMail::dataPath() + "database/qmailstore.db");
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+
+        // Revert the store to the vacuum mode used by earlier versions
+        QVERIFY(query.exec("PRAGMA auto_vacuum=NONE"));
+        QVERIFY(query.exec("VACUUM"));
+        QCOMPARE(pragmaValue(query, "auto_vacuum"), 0);
+
+        addAndRemoveMessages(account.id(), folder.id());
+        QVERIFY(pragmaValue(query, "freelist_count") > 0);
+
+        // Maintenance never rebuilds the database to change its mode
+        QVERIFY(query.exec("DELETE FROM maintenancerecord"));
+        QVERIFY(QMailStore::instance()->performMaintenance());
+        QCOMPARE(pragmaValue(query, "auto_vacuum"), 0);
+        QVERIFY(pragmaValue(query, "freelist_count") > 0);
+
+        // The conversion is requested explicitly
+        QVERIFY(QMailStore::instance()->enableIncrementalVacuum());
+        QCOMPARE(QMailStore::instance()->lastError(), QMailStore::NoError);
+        QCOMPARE(pragmaValue(query, "auto_vacuum"), 2);
+        QCOMPARE(pragmaValue(query, "freelist_count"), 0);
+        QVERIFY(QMailStore::instance()->enableIncrementalVacuum());
+
+        // Space released afterwards is reclaimed by maintenance
+        addAndRemoveMessages(account.id(), folder.id());
+        QVERIFY(pragmaValue(query, "freelist_count") > 0);
+        QVERIFY(query.exec("DELETE FROM maintenancerecord"));
+        QVERIFY(QMailStore::instance()->performMaintenance());
+        QCOMPARE(pragmaValue(query, "freelist_count"), 0);
+    }
+    QSqlDatabase::removeDatabase("tst_incrementalVacuum");
+}
+
+void tst_QMailStore::instrumentation()
+{
+    QMailAccount account;
+    account.setName("Account 12");
+    QVERIFY(QMailStore::instance()->addAccount(&account, 0));
+
+    QMailFolder folder("Folder 12", QMailFolderId(), account.id());
+    QVERIFY(QMailStore::instance()->addFolder(&folder));
+
+    for (int i = 0; i < 5; ++i) {
+        QMailMessage message;
+        message.setMessageType(QMailMessage::Email);
+        message.setParentAccountId(account.id());
+        message.setParentFolderId(folder.id());
+        message.setSubject(QString("Message %1").arg(i));
+        QVERIFY(QMailStore::instance()->addMessage(&message));
+    }
+
+    QVERIFY(!QMailStore::instance()->instrumentationEnabled());
+    QMailStore::instance()->setInstrumentationEnabled(true);
+    QVERIFY(QMailStore::instance()->instrumentationEnabled());
+    QMailStore::instance()->resetStatistics();
+
+    // Counting the results must not disturb the results returned
+    for (int i = 0; i < 10; ++i)
+        QCOMPARE(QMailStore::instance()->countMessages(), 5);
+
+    QMailStore::QueryStatistics count;
+    foreach (const QMailStore::QueryStatistics &entry, QMailStore::instance()->queryStatistics()) {
+        if (entry.descriptor == QLatin1String("countMessages mailmessages query"))
+            count = entry;
+    }
+    QCOMPARE(count.executions, 10);
+    QCOMPARE(count.repeatedExecutions, 9);
+    QCOMPARE(count.rows, qint64(0));
+
+    // Write operations are performed in transactions
+    QVERIFY(QMailStore::instance()->updateMessagesMetaData(QMailMessageKey::parentFolderId(folder.id()), QMailMessage::Read, true));
+    QVERIFY(QMailStore::instance()->contentionStatistics().transactions > 0);
+
+    QMailStore::QueryStatistics update;
+    foreach (const QMailStore::QueryStatistics &entry, QMailStore::instance()->queryStatistics()) {
+        if (entry.descriptor == QLatin1String("updateMessagesMetaData status query"))
+            update = entry;
+    }
+    QCOMPARE(update.executions, 1);
+    QCOMPARE(update.rows, qint64(5));
+
+    QMailStore::instance()->resetStatistics();
+    QVERIFY(QMailStore::instance()->queryStatistics().isEmpty());
+    QCOMPARE(QMailStore::instance()->contentionStatistics().transactions, 0);
+
+    QMailStore::instance()->setInstrumentationEnabled(false);
+    QCOMPARE(QMailStore::instance()->countMessages(), 5);
+    QVERIFY(QMailStore::instance()->queryStatistics().isEmpty());
+}
+
+void tst_QMailStore::queryMessagePage()
+{
+    QMailAccount account;
+    account.setName("Account 13");
+    QVERIFY(QMailStore::instance()->addAccount(&account, 0));
+
+    QMailFolder folder("Folder 13", QMailFolderId(), account.id());
+    QVERIFY(QMailStore::instance()->addFolder(&folder));
+
+    // Several messages share each time stamp, so that the id must break ties
+    const QDateTime base(QDate(2015, 6, 1), QTime(12, 0), Qt::UTC);
+    for (int i = 0; i < 25; ++i) {
+        QMailMessage message;
+        message.setMessageType(QMailMessage::Email);
+        message.setParentAccountId(account.id());
+        message.setParentFolderId(folder.id());
+        message.setSubject(QString("Message %1").arg(i % 4));
+        message.setDate(QMailTimeStamp(base.addSecs((i % 7) * 60)));
+        QVERIFY(QMailStore::instance()->addMessage(&message));
+    }
+
+    const QMailMessageKey key(QMailMessageKey::parentFolderId(folder.id()));
+    QList<QMailMessageSortKey> sortKeys;
+    sortKeys << QMailMessageSortKey::timeStamp(Qt::DescendingOrder)
+             << QMailMessageSortKey::subject(Qt::AscendingOrder)
+             << (QMailMessageSortKey::subject(Qt::DescendingOrder) & QMailMessageSortKey::timeStamp(Qt::AscendingOrder))
+             << QMailMessageSortKey();
+
+    foreach (const QMailMessageSortKey &sortKey, sortKeys) {
+        // Pages follow the sort key, with ties broken by id in the direction of its last column
+        const bool idAscending(sortKey.arguments().isEmpty() || sortKey.arguments().last().order == Qt::AscendingOrder);
+        const QMailMessageSortKey idSortKey(QMailMessageSortKey::id(idAscending ? Qt::AscendingOrder : Qt::DescendingOrder));
+        const QMailMessageIdList expected(QMailStore::instance()->queryMessages(key, sortKey.isEmpty() ? idSortKey : (sortKey & idSortKey)));
+        QCOMPARE(expected.count(), 25);
+
+        QMailMessageIdList paged;
+        QByteArray continuation;
+        int pages = 0;
+        do {
+            const QMailMessageIdList page(QMailStore::instance()->queryMessagePage(key, sortKey, 10, &continuation));
+            QCOMPARE(QMailStore::instance()->lastError(), QMailStore::NoError);
+            QVERIFY(page.count() <= 10);
+            paged += page;
+            ++pages;
+        } while (!continuation.isEmpty() && pages < 10);
+
+        QCOMPARE(pages, 3);
+        QCOMPARE(paged, expected);
+    }
+
+    // Pages remain contiguous when messages are added between them
+    const QMailMessageSortKey sortKey(QMailMessageSortKey::timeStamp(Qt::DescendingOrder));
+    const QMailMessageIdList expected(QMailStore::instance()->queryMessages(key, sortKey & QMailMessageSortKey::id(Qt::DescendingOrder)));
+    QByteArray continuation;
+    QMailMessageIdList paged(QMailStore::instance()->queryMessagePage(key, sortKey, 10, &continuation));
+    QVERIFY(!continuation.isEmpty());
+
+    // A following page is read through a range of the folder and time stamp index, without sorting
+    const QStringList plan(QMailStore::instance()->messagePageQueryPlan(key, sortKey, continuation));
+    QVERIFY(!plan.isEmpty());
+    foreach (const QString &step, plan) {
+        QVERIFY2(step.contains(QLatin1String("parentfolderid_stamp_id_status_idx")), qPrintable(step));
+        QVERIFY2(!step.contains(QLatin1String("TEMP B-TREE")), qPrintable(step));
+    }
+    QVERIFY2(plan.first().contains(QLatin1String("stamp<")), qPrintable(plan.first()));
+
+    QMailMessage newest;
+    newest.setMessageType(QMailMessage::Email);
+    newest.setParentAccountId(account.id());
+    newest.setParentFolderId(folder.id());
+    newest.setDate(QMailTimeStamp(base.addDays(1)));
+    QVERIFY(QMailStore::instance()->addMessage(&newest));
+
+    while (!continuation.isEmpty())
+        paged += QMailStore::instance()->queryMessagePage(key, sortKey, 10, &continuation);
+    QCOMPARE(paged, expected);
+    QVERIFY(!paged.contains(newest.id()));
+
+    // A continuation is only valid for the key and sort key that produced it
+    continuation.clear();
+    QMailStore::instance()->queryMessagePage(key, sortKey, 10, &continuation);
+    QByteArray sameContinuation(continuation);
+    QVERIFY(QMailStore::instance()->queryMessagePage(key, QMailMessageSortKey::size(), 10, &continuation).isEmpty());
+    QVERIFY(QMailStore::instance()->lastError() != QMailStore::NoError);
+
+    const QMailMessageKey otherKey(QMailMessageKey::parentAccountId(account.id()));
+    QVERIFY(QMailStore::instance()->queryMessagePage(otherKey, sortKey, 10, &sameContinuation).isEmpty());
+    QVERIFY(QMailStore::instance()->lastError() != QMailStore::NoError);
+}
+
+void tst_QMailStore::rebuildThreads()
+{
+    QMailAccount account;
+    account.setName("Account 14");
+    QVERIFY(QMailStore::instance()->addAccount(&account, 0));
+
+    QMailFolder folder("Folder 14", QMailFolderId(), account.id());
+    QVERIFY(QMailStore::instance()->addFolder(&folder));
+
+    const QDateTime base(QDate(2015, 1, 1), QTime(12, 0), Qt::UTC);
+
+    QList<QMailMessage> messages;
+    for (int i = 0; i < 6; ++i) {
+        QMailMessage message;
+        message.setMessageType(QMailMessage::Email);
+        message.setParentAccountId(account.id());
+        message.setParentFolderId(folder.id());
+        message.setDate(QMailTimeStamp(base.addSecs(i * 60)));
+        message.setFrom(QMailAddress(QString("sender%1@example.org").arg(i)));
+        message.setHeaderField("Message-ID", QString("<%1.rebuild@example.org>").arg(i));
+        message.setStatus(QMailMessage::Read, (i % 2) == 0);
+
+        // Two conversations linked by references, and one linked only by subject
+        if (i < 3) {
+            message.setSubject("Conversation A");
+            if (i > 0)
+                message.setHeaderField("In-Reply-To", QString("<%1.rebuild@example.org>").arg(i - 1));
+        } else if (i < 5) {
+            message.setSubject("Conversation B");
+            if (i == 4)
+                message.setHeaderField("References", QString("<3.rebuild@example.org>"));
+        } else {
+            message.setSubject("Re: Conversation A");
+        }
+
+        QVERIFY(QMailStore::instance()->addMessage(&message));
+        messages.append(message);
+    }
+
+    QMailThreadKey threadKey(QMailThreadKey::parentAccountId(account.id()));
+    const int threadCount = QMailStore::instance()->countThreads(threadKey);
+    QCOMPARE(threadCount, 2);
+
+    QMap<int, QMailThreadId> before;
+    for (int i = 0; i < messages.count(); ++i)
+        before.insert(i, QMailMessageMetaData(messages.at(i).id()).parentThreadId());
+
+    QSignalSpy spy(QMailStore::instance(), SIGNAL(threadRebuildProgress(int, int)));
+
+    QVERIFY(QMailStore::instance()->rebuildThreads());
+    QCOMPARE(QMailStore::instance()->lastError(), QMailStore::NoError);
+
+    QVERIFY(!spy.isEmpty());
+    const QList<QVariant> last(spy.last());
+    QCOMPARE(last.at(0).toInt(), last.at(1).toInt());
+
+    // The rebuilt threads group the messages as they were grouped when added
+    QCOMPARE(QMailStore::instance()->countThreads(threadKey), threadCount);
+    QMap<int, QMailThreadId> after;
+    for (int i = 0; i < messages.count(); ++i)
+        after.insert(i, QMailMessageMetaData(messages.at(i).id()).parentThreadId());
+
+    for (int i = 0; i < messages.count(); ++i) {
+        QVERIFY(after.value(i).isValid());
+        for (int j = 0; j < messages.count(); ++j)
+            QCOMPARE(after.value(i) == after.value(j), before.value(i) == before.value(j));
+    }
+
+    // Threads whose messages are unchanged keep their identifiers
+    QCOMPARE(after, before);
+
+    QMailThread first(after.value(0));
+    QCOMPARE(first.messageCount(), 4);
+    QCOMPARE(first.unreadCount(), 2);
+
+    QMailThread second(after.value(3));
+    QCOMPARE(second.messageCount(), 2);
+    QCOMPARE(second.unreadCount(), 1);
+
+    QMailMessageMetaData reply(messages.at(1).id());
+    QCOMPARE(reply.inResponseTo(), messages.at(0).id());
+}
+
+void tst_QMailStore::countMessagesGrouped()
+{
+    QMailAccount account;
+    account.setName("Account 15");
+    QVERIFY(QMailStore::instance()->addAccount(&account, 0));
+
+    QMailFolder parent("Folder 15", QMailFolderId(), account.id());
+    QVERIFY(QMailStore::instance()->addFolder(&parent));
+
+    QMailFolder child("Folder 15/Child", parent.id(), account.id());
+    QVERIFY(QMailStore::instance()->addFolder(&child));
+
+    // Three messages in the parent folder and five in the child, of which every other one is read
+    for (int i = 0; i < 8; ++i) {
+        QMailMessage message;
+        message.setMessageType(QMailMessage::Email);
+        message.setParentAccountId(account.id());
+        message.setParentFolderId(i < 3 ? parent.id() : child.id());
+        message.setSubject(QString("Message %1").arg(i));
+        message.setSize(100 * (i + 1));
+        message.setStatus(QMailMessage::Read, (i % 2) == 0);
+        QVERIFY(QMailStore::instance()->addMessage(&message));
+    }
+
+    const QMailMessageKey accountKey(QMailMessageKey::parentAccountId(account.id()));
+    const QMailMessageKey readKey(QMailMessageKey::status(QMailMessage::Read, QMailDataComparator::Includes));
+    QList<QMailMessageKey> subsetKeys;
+    subsetKeys << QMailMessageKey() << readKey << ~readKey;
+
+    QMap<quint64, QMailStore::MessageGroupCounts> counts(QMailStore::instance()->countMessagesGrouped(accountKey, QMailStore::GroupByParentFolder, subsetKeys));
+    QCOMPARE(QMailStore::instance()->lastError(), QMailStore::NoError);
+    QCOMPARE(counts.count(), 2);
+
+    foreach (const QMailFolderId &id, QList<QMailFolderId>() << parent.id() << child.id()) {
+        const QMailMessageKey folderKey(accountKey & QMailMessageKey::parentFolderId(id));
+        const QMailStore::MessageGroupCounts &group(counts[id.toULongLong()]);
+        QCOMPARE(group.count, QMailStore::instance()->countMessages(folderKey));
+        QCOMPARE(group.size, qint64(QMailStore::instance()->sizeOfMessages(folderKey)));
+        QCOMPARE(group.subsetCounts.count(), 3);
+        QCOMPARE(group.subsetCounts.at(0), group.count);
+        QCOMPARE(group.subsetCounts.at(1), QMailStore::instance()->countMessages(folderKey & readKey));
+        QCOMPARE(group.subsetCounts.at(2), QMailStore::instance()->countMessages(folderKey & ~readKey));
+    }
+    QCOMPARE(counts[parent.id().toULongLong()].count, 3);
+    QCOMPARE(counts[child.id().toULongLong()].subsetCounts.at(1), 2);
+
+    // Ancestor grouping counts the messages beneath each folder, excluding its own
+    counts = QMailStore::instance()->countMessagesGrouped(accountKey, QMailStore::GroupByAncestorFolder, subsetKeys);
+    QCOMPARE(counts.count(), 1);
+    QCOMPARE(counts[parent.id().toULongLong()].count, QMailStore::instance()->countMessages(QMailMessageKey::ancestorFolderIds(parent.id(), QMailDataComparator::Includes)));
+    QCOMPARE(counts[parent.id().toULongLong()].count, 5);
+    QCOMPARE(counts[parent.id().toULongLong()].subsetCounts.at(2), 3);
+
+    // Counts can be refreshed for some folders only, by selecting just the messages beneath them
+    counts = QMailStore::instance()->countMessagesGrouped(QMailMessageKey::ancestorFolderIds(QMailFolderIdList() << parent.id()), QMailStore::GroupByAncestorFolder, subsetKeys);
+    QCOMPARE(counts[parent.id().toULongLong()].count, 5);
+    QCOMPARE(counts[parent.id().toULongLong()].subsetCounts.at(2), 3);
+
+    counts =QMailStore::instance()->countMessagesGrouped(accountKey & readKey, QMailStore::GroupByParentAccount);
+    QCOMPARE(counts.count(), 1);
+    QCOMPARE(counts[account.id().toULongLong()].count, 4);
+    QCOMPARE(counts[account.id().toULongLong()].size, qint64(100 + 300 + 500 + 700));
+    QVERIFY(counts[account.id().toULongLong()].subsetCounts.isEmpty());
+}
+
+void tst_QMailStore::asynchronousOperations()
+{
+    QMailAccount account;
+    account.setName("Account 16");
+    QVERIFY(QMailStore::instance()->addAccount(&account, 0));
+
+    QMailFolder folder("Folder 16", QMailFolderId(), account.id());
+    QVERIFY(QMailStore::instance()->addFolder(&folder));
+
+    for (int i = 0; i < 10; ++i) {
+        QMailMessage message;
+        message.setMessageType(QMailMessage::Email);
+        message.setParentAccountId(account.id());
+        message.setParentFolderId(folder.id());
+        message.setSubject(QString("Message %1").arg(i));
+        QVERIFY(QMailStore::instance()->addMessage(&message));
+    }
+
+    const QMailMessageKey key(QMailMessageKey::parentFolderId(folder.id()));
+    const QMailMessageSortKey sortKey(QMailMessageSortKey::subject());
+
+    QFuture<QMailMessageIdList> ids(QMailStore::instance()->queryMessagesAsync(key, sortKey));
+    QFuture<int> count(QMailStore::instance()->countMessagesAsync(key));
+    QFuture<QMailMessageMetaDataList> metaData(QMailStore::instance()->messagesMetaDataAsync(key, QMailMessageKey::Subject));
+
+    QTRY_VERIFY(metaData.isFinished());
+    QVERIFY(ids.isFinished() && count.isFinished());
+    QCOMPARE(ids.result(), QMailStore::instance()->queryMessages(key, sortKey));
+    QCOMPARE(count.result(), 10);
+    QCOMPARE(metaData.result().count(), 10);
+
+    // Changes made by the worker are reported by this store, before the result
+    QMailMessageMetaData first(ids.result().first());
+    QVERIFY((first.status() & QMailMessage::Read) == 0);
+
+    QSignalSpy statusSpy(QMailStore::instance(), SIGNAL(messageStatusUpdated(QMailMessageIdList,quint64,bool)));
+    QFuture<bool> update(QMailStore::instance()->updateMessagesMetaDataAsync(key, QMailMessage::Read, true));
+    QTRY_VERIFY(update.isFinished());
+    QVERIFY(update.result());
+    QCOMPARE(statusSpy.count(), 1);
+    QCOMPARE(statusSpy.first().at(0).value<QMailMessageIdList>().toSet(), ids.result().toSet());
+    QVERIFY((QMailMessageMetaData(first.id()).status() & QMailMessage::Read) != 0);
+
+    // A canceled request reports no result, and does not delay those that follow it
+    QFuture<QMailMessageIdList> canceled(QMailStore::instance()->queryMessagesAsync(key));
+    canceled.cancel();
+    QFuture<int> recount(QMailStore::instance()->countMessagesAsync(key));
+    QTRY_VERIFY(recount.isFinished());
+    QVERIFY(canceled.isFinished());
+    QCOMPARE(canceled.resultCount(), 0);
+    QCOMPARE(recount.result(), 10);
+
+    QSignalSpy removedSpy(QMailStore::instance(), SIGNAL(messagesRemoved(QMailMessageIdList)));
+    QFuture<bool> removal(QMailStore::instance()->removeMessagesAsync(key));
+    QTRY_VERIFY(removal.isFinished());
+    QVERIFY(removal.result());
+    QCOMPARE(removedSpy.count(), 1);
+    QCOMPARE(QMailStore::instance()->countMessages(key), 0);
+}
+
+void tst_QMailStore::sharedCache()
+{
+    QMailStore *store(QMailStore::instance());
+    if (!store->setSharedCacheAccess(QMailStore::SharedCacheWriteAccess))
+        QSKIP("Shared memory is not available");
+
+    QMailAccount account;
+    account.setName("Account 16");
+    QVERIFY(store->addAccount(&account, 0));
+
+    QMailFolder folder("Folder 16", QMailFolderId(), account.id());
+    QVERIFY(store->addFolder(&folder));
+
+    QMailMessageMetaData message;
+    message.setMessageType(QMailMessage::Email);
+    message.setParentAccountId(account.id());
+    message.setParentFolderId(folder.id());
+    message.setFrom(QMailAddress("Sender <sender@example.org>"));
+    message.setRecipients(QList<QMailAddress>() << QMailAddress("first@example.org") << QMailAddress("Second <second@example.org>"));
+    message.setSubject("Shared subject");
+    message.setDate(QMailTimeStamp(QDateTime(QDate(2015, 6, 1), QTime(12, 0), Qt::UTC)));
+    message.setSize(1234);
+    message.setStatus(QMailMessage::Incoming, true);
+    message.setServerUid("shared-1");
+    QVERIFY(store->addMessage(&message));
+
+    // Added messages are not in the local cache, so the lookup is answered by the shared cache
+    const QMailMessageKey::Properties properties(QMailMessageKey::Id | QMailMessageKey::Sender | QMailMessageKey::Recipients |
+                                                 QMailMessageKey::Subject | QMailMessageKey::TimeStamp | QMailMessageKey::Status);
+    QMailMessageMetaData cached(store->messageMetaData(message.id(), properties));
+    QCOMPARE(cached.id(), message.id());
+    QCOMPARE(cached.from(), message.from());
+    QCOMPARE(cached.recipients(), message.recipients());
+    QCOMPARE(cached.subject(), message.subject());
+    QCOMPARE(cached.date().toUTC(), message.date().toUTC());
+    QCOMPARE(cached.size(), message.size());
+    QCOMPARE(cached.parentFolderId(), folder.id());
+    QVERIFY(cached.status() & QMailMessage::Incoming);
+    QVERIFY(cached.status() & QMailMessage::UnloadedData);
+    QVERIFY(cached.serverUid().isEmpty());
+
+    // Properties not held in the shared cache require the complete record
+    QMailMessageMetaData complete(store->messageMetaData(message.id(), properties | QMailMessageKey::ServerUid));
+    QCOMPARE(complete.serverUid(), message.serverUid());
+    QVERIFY(!(complete.status() & QMailMessage::UnloadedData));
+
+    // Updates are reflected in the shared record
+    QVERIFY(store->updateMessagesMetaData(QMailMessageKey::id(message.id()), QMailMessage::Read, true));
+    cached = store->messageMetaData(message.id(), properties);
+    QVERIFY(cached.status() & QMailMessage::Read);
+
+    // Values too long to be held are never truncated
+    message.setSubject(QString(500, QChar('x')));
+    QVERIFY(store->updateMessage(&message));
+    cached = store->messageMetaData(message.id(), properties);
+    QCOMPARE(cached.subject(), message.subject());
+
+    QVERIFY(store->removeMessage(message.id()));
+    QVERIFY(!store->messageMetaData(message.id(), properties).id().isValid());
+
+    QVERIFY(store->setSharedCacheAccess(QMailStore::NoSharedCacheAccess));
+    QCOMPARE(store->sharedCacheAccess(), QMailStore::NoSharedCacheAccess);
+}
+
+void tst_QMailStore::sharedCacheReader()
+{
+    QMailStore *store(QMailStore::instance());
+    if (!store->setSharedCacheAccess(QMailStore::SharedCacheWriteAccess))
+        QSKIP("Shared memory is not available");
+
+    QMailAccount account;
+    account.setName("Account 18");
+    QVERIFY(store->addAccount(&account, 0));
+
+    QMailFolder folder("Folder 18", QMailFolderId(), account.id());
+    QVERIFY(store->addFolder(&folder));
+
+    QMailMessageMetaData message;
+    message.setMessageType(QMailMessage::Email);
+    message.setParentAccountId(account.id());
+    message.setParentFolderId(folder.id());
+    message.setSubject("Shared reader subject");
+    message.setStatus(QMailMessage::Incoming, true);
+    QVERIFY(store->addMessage(&message));
+
+    QThread thread;
+    SharedCacheReader reader;
+    reader.id = message.id();
+    reader.properties = QMailMessageKey::Id | QMailMessageKey::Subject | QMailMessageKey::Status;
+    reader.moveToThread(&thread);
+    thread.start();
+
+    QVERIFY(QMetaObject::invokeMethod(&reader, "attach", Qt::BlockingQueuedConnection));
+    QVERIFY(reader.success);
+
+    QVERIFY(QMetaObject::invokeMethod(&reader, "lookup", Qt::BlockingQueuedConnection));
+    QCOMPARE(reader.result.subject(), message.subject());
+    QVERIFY(reader.result.status() & QMailMessage::UnloadedData);
+    QVERIFY(!(reader.result.status() & QMailMessage::Read));
+
+    // A reader sees its own change, although no writer has updated the shared record yet
+    QVERIFY(QMetaObject::invokeMethod(&reader, "markRead", Qt::BlockingQueuedConnection));
+    QVERIFY(reader.success);
+    QVERIFY(QMetaObject::invokeMethod(&reader, "lookup", Qt::BlockingQueuedConnection));
+    QVERIFY(reader.result.status() & QMailMessage::Read);
+
+    // Once a writer has rewritten the record, it reflects both changes
+    QVERIFY(store->updateMessagesMetaData(QMailMessageKey::id(message.id()), QMailMessage::Important, true));
+    QVERIFY(QMetaObject::invokeMethod(&reader, "lookup", Qt::BlockingQueuedConnection));
+    QVERIFY(reader.result.status() & QMailMessage::Read);
+    QVERIFY(reader.result.status() & QMailMessage::Important);
+
+    QVERIFY(QMetaObject::invokeMethod(&reader, "detach", Qt::BlockingQueuedConnection));
+    thread.quit();
+    QVERIFY(thread.wait());
+
+    QVERIFY(store->setSharedCacheAccess(QMailStore::NoSharedCacheAccess));
+}
+
+void tst_QMailStore::sharedCacheReattach()
+{
+    QMailStore *store(QMailStore::instance());
+    if (!store->setSharedCacheAccess(QMailStore::SharedCacheWriteAccess))
+        QSKIP("Shared memory is not available");
+
+    QMailAccount account;
+    account.setName("Account 20");
+    QVERIFY(store->addAccount(&account, 0));
+
+    QMailFolder folder("Folder 20", QMailFolderId(), account.id());
+    QVERIFY(store->addFolder(&folder));
+
+    QMailMessage message;
+    message.setMessageType(QMailMessage::Email);
+    message.setParentAccountId(account.id());
+    message.setParentFolderId(folder.id());
+    message.setSubject("Original subject");
+    QVERIFY(store->addMessage(&message));
+
+    // The reader keeps the segment in existence while the writer is detached
+    QThread thread;
+    SharedCacheReader reader;
+    reader.id = message.id();
+    reader.properties = QMailMessageKey::Id | QMailMessageKey::Subject;
+    reader.moveToThread(&thread);
+    thread.start();
+    QVERIFY(QMetaObject::invokeMethod(&reader, "attach", Qt::BlockingQueuedConnection));
+    QVERIFY(reader.success);
+
+    QVERIFY(store->setSharedCacheAccess(QMailStore::NoSharedCacheAccess));
+    message.setSubject("Changed while detached");
+    QVERIFY(store->updateMessage(&message));
+
+    // A writer attaching to the existing segment can't trust the records it holds
+    QVERIFY(store->setSharedCacheAccess(QMailStore::SharedCacheWriteAccess));
+    QVERIFY(QMetaObject::invokeMethod(&reader, "lookup", Qt::BlockingQueuedConnection));
+    QCOMPARE(reader.result.subject(), message.subject());
+
+    QVERIFY(QMetaObject::invokeMethod(&reader, "detach", Qt::BlockingQueuedConnection));
+    thread.quit();
+    QVERIFY(thread.wait());
+
+    QVERIFY(store->setSharedCacheAccess(QMailStore::NoSharedCacheAccess));
+}
+
+void tst_QMailStore::storeProfile()
+{
+    QMailStore *store(QMailStore::instance());
+    const QMailStore::StoreProfile original(store->storeProfile());
+    QCOMPARE(original.connectionLifetime, QMailStore::roleProfile(QMailStore::DefaultRole).connectionLifetime);
+
+    QMailStore::StoreProfile profile(QMailStore::roleProfile(QMailStore::ClientRole));
+    QCOMPARE(profile.connectionLifetime, 0);
+    profile.cacheSize = 250;
+    profile.tempStore = QMailStore::MemoryTempStore;
+    store->setStoreProfile(profile);
+
+    QCOMPARE(store->storeProfile().cacheSize, 250);
+    QCOMPARE(store->storeProfile().tempStore, QMailStore::MemoryTempStore);
+
+    // The connection remains usable with the new settings applied
+    QMailAccount account;
+    account.setName("Account 17");
+    QVERIFY(store->addAccount(&account, 0));
+    QCOMPARE(store->countAccounts(QMailAccountKey::id(account.id())), 1);
+
+    store->setStoreProfile(original);
+    QCOMPARE(store->storeProfile().cacheSize, original.cacheSize);
+}
+
+void tst_QMailStore::readSnapshot()
+{
+    QMailAccount account;
+    account.setName("Account 17");
+    QVERIFY(QMailStore::instance()->addAccount(&account, 0));
+
+    QMailFolder folder("Folder 17", QMailFolderId(), account.id());
+    QVERIFY(QMailStore::instance()->addFolder(&folder));
+
+    for (int i = 0; i < 5; ++i) {
+        QMailMessage message;
+        message.setMessageType(QMailMessage::Email);
+        message.setParentAccountId(account.id());
+        message.setParentFolderId(folder.id());
+        message.setSubject(QString("Message %1").arg(i));
+        QVERIFY(QMailStore::instance()->addMessage(&message));
+    }
+
+    const QMailMessageKey key(QMailMessageKey::parentFolderId(folder.id()));
+
+    // Snapshots nest, and are taken by the first query they contain
+    QVERIFY(QMailStore::instance()->beginReadSnapshot());
+    QVERIFY(QMailStore::instance()->beginReadSnapshot());
+    QCOMPARE(QMailStore::instance()->countMessages(key), 5);
+
+    // Changes committed by another connection are not visible until the snapshot ends
+    QFuture<bool> removal(QMailStore::instance()->removeMessagesAsync(key));
+    QTRY_VERIFY(removal.isFinished());
+    QVERIFY(removal.result());
+    QCOMPARE(QMailStore::instance()->countMessages(key), 5);
+    QCOMPARE(QMailStore::instance()->queryMessages(key).count(), 5);
+
+    QMailStore::instance()->endReadSnapshot();
+    QCOMPARE(QMailStore::instance()->countMessages(key), 5);
+
+    QMailStore::instance()->endReadSnapshot();
+    QCOMPARE(QMailStore::instance()->countMessages(key), 0);
+
+    // Writing within a snapshot releases it
+    QVERIFY(QMailStore::instance()->beginReadSnapshot());
+    QCOMPARE(QMailStore::instance()->countMessages(key), 0);
+
+    QMailMessage message;
+    message.setMessageType(QMailMessage::Email);
+    message.setParentAccountId(account.id());
+    message.setParentFolderId(folder.id());
+    message.setSubject("Message 5");
+    QVERIFY(QMailStore::instance()->addMessage(&message));
+    QCOMPARE(QMailStore::instance()->countMessages(key), 1);
+
+    QMailStore::instance()->endReadSnapshot();
+    QCOMPARE(QMailStore::instance()->countMessages(key), 1);
+}
+
+void tst_QMailStore::concurrentWrites()
+{
+    QMailAccount account;
+    account.setName("Account 19");
+    QVERIFY(QMailStore::instance()->addAccount(&account, 0));
+
+    QMailFolder folder("Folder 19", QMailFolderId(), account.id());
+    QVERIFY(QMailStore::instance()->addFolder(&folder));
+
+    const int count = 50;
+
+    ConcurrentWriter writer;
+    writer.accountId = account.id();
+    writer.folderId = folder.id();
+    writer.count = count;
+    writer.start();
+
+    // Each thread must take the database mutex for its own transactions
+    int added = 0;
+    for (int i = 0; i < count; ++i) {
+        QMailMessageMetaData message;
+        message.setMessageType(QMailMessage::Email);
+        message.setParentAccountId(account.id());
+        message.setParentFolderId(folder.id());
+        message.setSubject(QString("Test message %1").arg(i));
+        if (QMailStore::instance()->addMessage(&message)
+            && QMailStore::instance()->updateMessagesMetaData(QMailMessageKey::id(message.id()), QMailMessage::Important, true))
+            ++added;
+    }
+
+    QVERIFY(writer.wait());
+    QCOMPARE(added, count);
+    QCOMPARE(writer.added, count);
+    QCOMPARE(QMailStore::instance()->lastError(), QMailStore::NoError);
+
+    const QMailMessageKey folderKey(QMailMessageKey::parentFolderId(folder.id()));
+    QCOMPARE(QMailStore::instance()->countMessages(folderKey), 2 * count);
+    QCOMPARE(QMailStore::instance()->countMessages(folderKey & QMailMessageKey::status(QMailMessage::Read, QMailDataComparator::Includes)), count);
+    QCOMPARE(QMailStore::instance()->countMessages(folderKey & QMailMessageKey::status(QMailMessage::Important, QMailDataComparator::Includes)), count);
+
+    // The mutex is released once both threads are done
+    QVERIFY(QMailStore::instance()->updateMessagesMetaData(folderKey, QMailMessage::Read, true));
+    QCOMPARE(QMailStore::instance()->countMessages(folderKey & QMailMessageKey::status(QMailMessage::Read, QMailDataComparator::Includes)), 2 * count);
+}
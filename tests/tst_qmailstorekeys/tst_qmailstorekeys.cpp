@@ -39,6 +39,7 @@
 #include <QSettings>
 #include <qmailnamespace.h>
 #include <private/locks_p.h>
+#include <private/qmailmessagekeymatcher_p.h>
 
 class tst_QMailStoreKeys : public QObject
 {
@@ -93,6 +94,14 @@ private slots:
     void listModel();
     void threadedModel();
 
+    void queryPlan_data();
+    void queryPlan();
+
+    void compiledKeys();
+    void bench_compiledKeys_data();
+    void bench_compiledKeys();
+    void bench_addMessages();
+
 private:
     // We only want to compare sets, disregarding ordering
     const QSet<QMailAccountId> accountSet(const QMailAccountKey &key) const
@@ -117,7 +126,23 @@ private:
 
     const QSet<QMailMessageId> messageSet(const QMailMessageKey &key) const
     {
-        return QMailStore::instance()->queryMessages(key).toSet();
+        QSet<QMailMessageId> result(QMailStore::instance()->queryMessages(key).toSet());
+
+        // Keys evaluable in memory must select exactly what the database selects
+        QMailMessageKeyMatcher matcher(key);
+        if (matcher.isLocal()) {
+            QSet<QMailMessageId> matched;
+            foreach (const QMailMessageId &id, QMailStore::instance()->queryMessages())
+                if (matcher.matches(QMailStore::instance()->messageMetaData(id)))
+                    matched.insert(id);
+
+            if (matched != result) {
+                qWarning() << "In-memory evaluation selected" << matched.count() << "messages, query selected" << result.count();
+                return matched;
+            }
+        }
+
+        return result;
     }
 
     QSet<QMailMessageId> messageSet() const 
@@ -2467,3 +2492,203 @@ void tst_QMailStoreKeys::threadedModel()
     QCOMPARE(model.idFromIndex(model.index(1, 0)), inboxMessage1);
     QCOMPARE(model.idFromIndex(model.index(0, 0, model.indexFromId(inboxMessage1))), inboxMessage2);
 }
+
+void tst_QMailStoreKeys::queryPlan_data()
+{
+    QTest::addColumn<QMailMessageKey>("key");
+    QTest::addColumn<QMailMessageSortKey>("sortKey");
+    QTest::addColumn<QString>("index");
+
+    const QMailMessageKey notRemoved(QMailMessageKey::status(QMailMessage::Removed, QMailDataComparator::Excludes));
+
+    // Message list models of a folder
+    QTest::newRow("folder by time stamp")
+        << (QMailMessageKey::parentFolderId(inboxId1) & notRemoved)
+        << QMailMessageSortKey::timeStamp(Qt::DescendingOrder)
+        << QString("parentfolderid_stamp_id_status_idx");
+
+    QTest::newRow("folder by reception time stamp")
+        << (QMailMessageKey::parentFolderId(inboxId1) & notRemoved)
+        << QMailMessageSortKey::receptionTimeStamp(Qt::DescendingOrder)
+        << QString("parentfolderid_receivedstamp_id_status_idx");
+
+    QTest::newRow("folder by size")
+        << QMailMessageKey::parentFolderId(inboxId1)
+        << QMailMessageSortKey::size(Qt::AscendingOrder)
+        << QString("parentfolderid_size_idx");
+
+    // Unread counts of QMailFolderMessageSet, which any of the folder indexes can serve
+    QTest::newRow("folder unread count")
+        << (QMailMessageKey::parentFolderId(inboxId1) & QMailMessageKey::status(QMailMessage::Read, QMailDataComparator::Excludes))
+        << QMailMessageSortKey()
+        << QString("parentfolderid_");
+
+    QTest::newRow("folder descendants")
+        << QMailMessageKey::ancestorFolderIds(inboxId1, QMailDataComparator::Includes)
+        << QMailMessageSortKey()
+        << QString("parentfolderid_");
+
+    // Message list models of an account
+    QTest::newRow("account by time stamp")
+        << QMailMessageKey::parentAccountId(accountId1)
+        << QMailMessageSortKey::timeStamp(Qt::DescendingOrder)
+        << QString("parentaccountid_stamp_idx");
+
+    QTest::newRow("account and type by reception time stamp")
+        << (QMailMessageKey::parentAccountId(accountId1) & QMailMessageKey::messageType(QMailMessage::Email))
+        << QMailMessageSortKey::receptionTimeStamp(Qt::DescendingOrder)
+        << QString("parentaccountid_type_receivedstamp_id_status_idx");
+
+    // Conversations loaded by QMailMessageThreadedModel
+    QTest::newRow("conversation")
+        << QMailMessageKey::conversation(QMailMessageKey::id(inboxMessage1))
+        << QMailMessageSortKey()
+        << QString("parentthreadid_idx");
+
+    QTest::newRow("responses")
+        << QMailMessageKey::inResponseTo(inboxMessage1)
+        << QMailMessageSortKey()
+        << QString("responseid_idx");
+}
+
+void tst_QMailStoreKeys::queryPlan()
+{
+    QFETCH(QMailMessageKey, key);
+    QFETCH(QMailMessageSortKey, sortKey);
+    QFETCH(QString, index);
+
+    const QStringList plan(QMailStore::instance()->messageQueryPlan(key, sortKey));
+    QVERIFY(!plan.isEmpty());
+
+    // Older SQLite versions describe a step as "SEARCH TABLE", newer ones as "SEARCH"
+    bool indexUsed(false);
+    foreach (const QString &step, plan) {
+        // The messages must be located through an index, and delivered in sorted order
+        if (step.contains(QLatin1String("mailmessages")) && !step.startsWith(QLatin1String("SEARCH"))) {
+            QFAIL(qPrintable(QString("Query scans the messages table: %1").arg(plan.join(QLatin1String("; ")))));
+        }
+        if (step.contains(QLatin1String("TEMP B-TREE FOR ORDER BY"))) {
+            QFAIL(qPrintable(QString("Query sorts the messages: %1").arg(plan.join(QLatin1String("; ")))));
+        }
+        if (step.contains(index)) {
+            indexUsed = true;
+        }
+    }
+
+    if (!indexUsed) {
+        QFAIL(qPrintable(QString("Query does not use %1: %2").arg(index).arg(plan.join(QLatin1String("; ")))));
+    }
+}
+
+void tst_QMailStoreKeys::compiledKeys()
+{
+    QMailStore *store(QMailStore::instance());
+
+    // Keys sharing a shape reuse one statement, and must still select by their own values
+    QCOMPARE(messageSet(QMailMessageKey::parentFolderId(inboxId1) & QMailMessageKey::status(QMailMessage::Incoming, Includes)),
+             messageSet() << inboxMessage1);
+    QCOMPARE(messageSet(QMailMessageKey::parentFolderId(inboxId2) & QMailMessageKey::status(QMailMessage::Incoming, Includes)),
+             messageSet() << inboxMessage2);
+    QCOMPARE(messageSet(QMailMessageKey::parentFolderId(QMailFolderKey::id(inboxId1))),
+             messageSet() << inboxMessage1);
+    QCOMPARE(messageSet(QMailMessageKey::parentFolderId(QMailFolderKey::id(inboxId2))),
+             messageSet() << inboxMessage2);
+
+    // Lists of three and five identifiers are padded to four and eight values
+    QMailMessageIdList ids;
+    ids << inboxMessage1 << archivedMessage1 << savedMessage2;
+    QCOMPARE(messageSet(QMailMessageKey::id(ids)), messageSet() << inboxMessage1 << archivedMessage1 << savedMessage2);
+    QCOMPARE(messageSet(QMailMessageKey::id(ids, Excludes)), messageSet() << smsMessage << inboxMessage2);
+    QCOMPARE(messageSet(QMailMessageKey::serverUid(QStringList() << "inboxMessage1" << "inboxMessage2" << "savedMessage2")),
+             messageSet() << inboxMessage1 << inboxMessage2 << savedMessage2);
+
+    ids << smsMessage << inboxMessage2;
+    QCOMPARE(messageSet(QMailMessageKey::id(ids)), allMessages);
+    QCOMPARE(messageSet(QMailMessageKey::id(ids, Excludes)), noMessages);
+
+    // Results are unchanged when every statement is built afresh
+    const QMailMessageKey keys[] = {
+        QMailMessageKey::parentAccountId(accountId1) & QMailMessageKey::messageType(QMailMessage::Email),
+        QMailMessageKey::id(ids.mid(0, 3)) | QMailMessageKey::inResponseTo(inboxMessage1),
+        ~QMailMessageKey::parentFolderId(QMailFolderIdList() << inboxId1 << inboxId2 << savedId1)
+    };
+
+    for (unsigned i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+        const QMailMessageIdList compiled(store->queryMessages(keys[i], QMailMessageSortKey::id()));
+        const int compiledCount(store->countMessages(keys[i]));
+
+        store->setKeyCompilationEnabled(false);
+        QCOMPARE(store->queryMessages(keys[i], QMailMessageSortKey::id()), compiled);
+        QCOMPARE(store->countMessages(keys[i]), compiledCount);
+        store->setKeyCompilationEnabled(true);
+    }
+}
+
+void tst_QMailStoreKeys::bench_compiledKeys_data()
+{
+    QTest::addColumn<bool>("compiled");
+    QTest::addColumn<bool>("count");
+
+    QTest::newRow("countMessages built") << false << true;
+    QTest::newRow("countMessages compiled") << true << true;
+    QTest::newRow("queryMessages built") << false << false;
+    QTest::newRow("queryMessages compiled") << true << false;
+}
+
+void tst_QMailStoreKeys::bench_compiledKeys()
+{
+    QFETCH(bool, compiled);
+    QFETCH(bool, count);
+
+    QMailStore *store(QMailStore::instance());
+    store->setKeyCompilationEnabled(compiled);
+
+    // The polling pattern of a folder model: one key shape, alternating folder values
+    const QMailFolderId folders[] = { inboxId1, inboxId2, savedId1, savedId2 };
+    const QMailMessageKey notRemoved(QMailMessageKey::status(QMailMessage::Removed, Excludes));
+    const QMailMessageSortKey sortKey(QMailMessageSortKey::timeStamp(Qt::DescendingOrder));
+
+    int iteration(0);
+    QBENCHMARK {
+        const QMailMessageKey key(QMailMessageKey::parentFolderId(folders[iteration++ % 4]) & notRemoved &
+                                  QMailMessageKey::parentAccountId(QMailAccountKey::status(QMailAccount::SynchronizationEnabled, Includes)));
+        if (count) {
+            store->countMessages(key);
+        } else {
+            store->queryMessages(key, sortKey);
+        }
+    }
+
+    store->setKeyCompilationEnabled(true);
+}
+
+void tst_QMailStoreKeys::bench_addMessages()
+{
+    QMailStore *store(QMailStore::instance());
+
+    // Every message index adds to the cost of insertion
+    int iteration(0);
+    QBENCHMARK {
+        QList<QMailMessage> messages;
+        for (int i = 0; i < 100; ++i) {
+            QMailMessage message;
+            message.setMessageType(QMailMessage::Email);
+            message.setParentAccountId(accountId1);
+            message.setParentFolderId(inboxId1);
+            message.setSubject(QString("Benchmark %1.%2").arg(iteration).arg(i));
+            message.setDate(QMailTimeStamp(QDateTime::currentDateTime().addSecs(-i)));
+            message.setReceivedDate(message.date());
+            message.setStatus(QMailMessage::Incoming, true);
+            message.setCustomField("benchmark", "true");
+            messages.append(message);
+        }
+        ++iteration;
+
+        QList<QMailMessage*> list;
+        for (int i = 0; i < messages.count(); ++i)
+            list.append(&messages[i]);
+        QVERIFY(store->addMessages(list));
+    }
+
+    QVERIFY(store->removeMessages(QMailMessageKey::customField("benchmark")));
+}
@@ -0,0 +1,207 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include <QObject>
+#include <QTest>
+#include <QTemporaryDir>
+#include <QFile>
+#include <QFileInfo>
+#include "requestjournal.h"
+
+class tst_RequestJournal : public QObject
+{
+    Q_OBJECT
+
+public:
+    tst_RequestJournal() {}
+    virtual ~tst_RequestJournal() {}
+
+private slots:
+    void init();
+
+    void test_replay();
+    void test_completion();
+    void test_reopen();
+    void test_damagedEntry();
+    void test_compaction();
+
+private:
+    QString journalPath() const { return dir.path() + QLatin1String("/requests.journal"); }
+
+    QTemporaryDir dir;
+};
+
+QTEST_MAIN(tst_RequestJournal)
+#include "tst_requestjournal.moc"
+
+void tst_RequestJournal::init()
+{
+    QFile::remove(journalPath());
+}
+
+void tst_RequestJournal::test_replay()
+{
+    {
+        RequestJournal journal(journalPath());
+        QVERIFY(journal.open().isEmpty());
+
+        journal.append(1, "first");
+        journal.append(2, "second");
+        journal.append(2, "second, continued");
+        QVERIFY(journal.contains(1));
+        QVERIFY(journal.contains(2));
+        QVERIFY(!journal.contains(3));
+        journal.commit();
+    }
+
+    // Outstanding requests are returned in the order they were recorded
+    RequestJournal journal(journalPath());
+    QList<RequestJournal::Record> records(journal.open());
+    QCOMPARE(records.count(), 3);
+    QCOMPARE(records.at(0), qMakePair(quint64(1), QByteArray("first")));
+    QCOMPARE(records.at(1), qMakePair(quint64(2), QByteArray("second")));
+    QCOMPARE(records.at(2), qMakePair(quint64(2), QByteArray("second, continued")));
+    QVERIFY(journal.contains(1));
+    QVERIFY(journal.contains(2));
+}
+
+void tst_RequestJournal::test_completion()
+{
+    {
+        RequestJournal journal(journalPath());
+        journal.open();
+
+        journal.append(1, "first");
+        journal.append(2, "second");
+        journal.append(2, "second, continued");
+        journal.complete(2);
+        QVERIFY(!journal.contains(2));
+
+        // Completing an unknown request is not recorded
+        journal.complete(3);
+        journal.commit();
+    }
+
+    RequestJournal journal(journalPath());
+    QList<RequestJournal::Record> records(journal.open());
+    QCOMPARE(records.count(), 1);
+    QCOMPARE(records.first().first, quint64(1));
+}
+
+void tst_RequestJournal::test_reopen()
+{
+    {
+        RequestJournal journal(journalPath());
+        journal.open();
+        journal.append(1, "first");
+        journal.append(2, "second");
+        journal.commit();
+    }
+
+    // Opening the journal keeps the outstanding requests without any further commit,
+    // so a crash before they are resumed loses nothing
+    {
+        RequestJournal journal(journalPath());
+        QCOMPARE(journal.open().count(), 2);
+    }
+    {
+        RequestJournal journal(journalPath());
+        QCOMPARE(journal.open().count(), 2);
+
+        // Requests resumed from the journal are completed like any other
+        journal.complete(1);
+        journal.commit();
+    }
+
+    RequestJournal journal(journalPath());
+    QList<RequestJournal::Record> records(journal.open());
+    QCOMPARE(records.count(), 1);
+    QCOMPARE(records.first(), qMakePair(quint64(2), QByteArray("second")));
+}
+
+void tst_RequestJournal::test_damagedEntry()
+{
+    {
+        RequestJournal journal(journalPath());
+        journal.open();
+        journal.append(1, "first");
+        journal.append(2, "second");
+        journal.commit();
+    }
+
+    // Damage the final entry, as a torn write would
+    QFile file(journalPath());
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QVERIFY(file.seek(file.size() - 1));
+    QVERIFY(file.putChar('X'));
+    file.close();
+
+    {
+        RequestJournal journal(journalPath());
+        QList<RequestJournal::Record> records(journal.open());
+        QCOMPARE(records.count(), 1);
+        QCOMPARE(records.first().first, quint64(1));
+    }
+
+    // The damaged entry is not carried into the rewritten journal
+    RequestJournal journal(journalPath());
+    QCOMPARE(journal.open().count(), 1);
+}
+
+void tst_RequestJournal::test_compaction()
+{
+    RequestJournal journal(journalPath());
+    journal.open();
+
+    journal.append(1, "outstanding");
+    for (quint64 action = 2; action < 1000; ++action) {
+        journal.append(action, QByteArray(64, 'x'));
+        journal.complete(action);
+    }
+    journal.commit();
+
+    const qint64 size = QFileInfo(journalPath()).size();
+    QVERIFY(QMetaObject::invokeMethod(&journal, "compact"));
+    QVERIFY(QFileInfo(journalPath()).size() < size);
+
+    // The journal is still appended to after compaction
+    journal.append(1000, "appended");
+    journal.commit();
+
+    RequestJournal reopened(journalPath());
+    QList<RequestJournal::Record> records(reopened.open());
+    QCOMPARE(records.count(), 2);
+    QCOMPARE(records.at(0), qMakePair(quint64(1), QByteArray("outstanding")));
+    QCOMPARE(records.at(1), qMakePair(quint64(1000), QByteArray("appended")));
+}
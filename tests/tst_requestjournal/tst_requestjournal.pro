@@ -0,0 +1,13 @@
+TEMPLATE = app
+TARGET = tst_requestjournal
+CONFIG += qmfclient
+
+MESSAGE_SERVER = ../../src/tools/messageserver
+INCLUDEPATH += $$MESSAGE_SERVER
+
+HEADERS += $$MESSAGE_SERVER/requestjournal.h
+
+SOURCES += tst_requestjournal.cpp \
+           $$MESSAGE_SERVER/requestjournal.cpp
+
+include(../tests.pri)
@@ -0,0 +1,268 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Messaging Framework.
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** As a special exception, The Qt Company gives you certain additional
+** rights. These rights are described in The Qt Company LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include <QObject>
+#include <QTest>
+#include "requestscheduler.h"
+
+typedef RequestScheduler::Entry Entry;
+
+class tst_RequestScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    tst_RequestScheduler() {}
+    virtual ~tst_RequestScheduler() {}
+
+private slots:
+    void test_priorityOrder();
+    void test_processOrder();
+    void test_deviceLimit();
+    void test_processLimit();
+    void test_accountLimit();
+    void test_serviceLimit();
+    void test_maintenanceLimit();
+    void test_unavailableServices();
+    void test_statistics();
+
+private:
+    static Entry entry(quint64 process, quint64 sequence, RequestScheduler::Priority priority,
+                       quint64 account = 1, quintptr service = 1);
+};
+
+QTEST_MAIN(tst_RequestScheduler)
+#include "tst_requestscheduler.moc"
+
+Entry tst_RequestScheduler::entry(quint64 process, quint64 sequence, RequestScheduler::Priority priority, quint64 account, quintptr service)
+{
+    Entry result;
+    result.action = (process << 32) | sequence;
+    result.priority = priority;
+    result.accounts.insert(QMailAccountId(account));
+    // Services are only compared, never dereferenced
+    result.services.insert(reinterpret_cast<QMailMessageService*>(service));
+    return result;
+}
+
+void tst_RequestScheduler::test_priorityOrder()
+{
+    RequestScheduler scheduler(2, 1);
+
+    // Between processes, the highest priority is taken first, then the earliest arrival
+    QList<Entry> queue;
+    queue << entry(1, 1, RequestScheduler::MaintenancePriority, 1)
+          << entry(2, 1, RequestScheduler::SynchronizationPriority, 2)
+          << entry(3, 1, RequestScheduler::InteractivePriority, 3)
+          << entry(4, 1, RequestScheduler::InteractivePriority, 4);
+    QCOMPARE(scheduler.select(queue, QList<Entry>()), 2);
+
+    queue.removeAt(2);
+    QCOMPARE(scheduler.select(queue, QList<Entry>()), 2);
+
+    queue.removeAt(2);
+    QCOMPARE(scheduler.select(queue, QList<Entry>()), 1);
+
+    queue.removeAt(1);
+    QCOMPARE(scheduler.select(queue, QList<Entry>()), 0);
+
+    QCOMPARE(scheduler.select(QList<Entry>(), QList<Entry>()), -1);
+
+    QCOMPARE(RequestScheduler::priority(RetrieveMessagesRequestType), RequestScheduler::InteractivePriority);
+    QCOMPARE(RequestScheduler::priority(TransmitMessagesRequestType), RequestScheduler::TransmitPriority);
+    QCOMPARE(RequestScheduler::priority(RetrieveMessageListRequestType), RequestScheduler::SynchronizationPriority);
+    QCOMPARE(RequestScheduler::priority(ExportMailboxRequestType), RequestScheduler::MaintenancePriority);
+}
+
+void tst_RequestScheduler::test_processOrder()
+{
+    RequestScheduler scheduler(2, 1);
+
+    // A process's requests for the same resources are dispatched in the order it made them,
+    // whatever their priority
+    QList<Entry> queue;
+    queue << entry(1, 1, RequestScheduler::SynchronizationPriority)
+          << entry(1, 2, RequestScheduler::InteractivePriority);
+    QCOMPARE(scheduler.select(queue, QList<Entry>()), 0);
+
+    // Even while the earlier request is waiting for its services
+    queue[0].ready = false;
+    QCOMPARE(scheduler.select(queue, QList<Entry>()), -1);
+
+    // Sharing only the service is enough to keep them in order
+    queue[1].accounts = QSet<QMailAccountId>() << QMailAccountId(2);
+    QCOMPARE(scheduler.select(queue, QList<Entry>()), -1);
+
+    // The process's requests for other accounts and services are not held up
+    queue << entry(1, 3, RequestScheduler::TransmitPriority, 3, 3);
+    QCOMPARE(scheduler.select(queue, QList<Entry>()), 2);
+
+    // Nor are other processes
+    queue << entry(2, 1, RequestScheduler::InteractivePriority, 4, 4);
+    QCOMPARE(scheduler.select(queue, QList<Entry>()), 3);
+
+    // A request naming no resources keeps its place among all of the process's requests
+    queue.clear();
+    queue << entry(1, 1, RequestScheduler::SynchronizationPriority, 1, 1)
+          << entry(1, 2, RequestScheduler::InteractivePriority, 2, 2);
+    queue[0].accounts.clear();
+    queue[0].services.clear();
+    queue[0].ready = false;
+    QCOMPARE(scheduler.select(queue, QList<Entry>()), -1);
+}
+
+void tst_RequestScheduler::test_deviceLimit()
+{
+    RequestScheduler scheduler(2, 1);
+
+    QList<Entry> active;
+    active << entry(1, 1, RequestScheduler::SynchronizationPriority, 1, 1)
+           << entry(2, 1, RequestScheduler::SynchronizationPriority, 2, 2);
+
+    QList<Entry> queue;
+    queue << entry(3, 1, RequestScheduler::TransmitPriority, 3, 3)
+          << entry(4, 1, RequestScheduler::InteractivePriority, 4, 4);
+
+    // Only an interactive request may use the slot held in reserve
+    QCOMPARE(scheduler.select(queue, active), 1);
+
+    active << queue.takeAt(1);
+    QCOMPARE(scheduler.select(queue, active), -1);
+
+    queue << entry(5, 1, RequestScheduler::InteractivePriority, 5, 5);
+    QCOMPARE(scheduler.select(queue, active), -1);
+}
+
+void tst_RequestScheduler::test_processLimit()
+{
+    RequestScheduler scheduler(2, 1);
+
+    // The reserve does not extend the per-process limit
+    QList<Entry> active;
+    active << entry(1, 1, RequestScheduler::SynchronizationPriority, 1, 1);
+
+    QList<Entry> queue;
+    queue << entry(1, 2, RequestScheduler::InteractivePriority, 2, 2);
+    QCOMPARE(scheduler.select(queue, active), -1);
+
+    queue << entry(2, 1, RequestScheduler::SynchronizationPriority, 3, 3);
+    QCOMPARE(scheduler.select(queue, active), 1);
+}
+
+void tst_RequestScheduler::test_accountLimit()
+{
+    RequestScheduler scheduler(10, 10);
+
+    QList<Entry> active;
+    active << entry(1, 1, RequestScheduler::SynchronizationPriority, 1, 1)
+           << entry(2, 1, RequestScheduler::SynchronizationPriority, 1, 2);
+
+    QList<Entry> queue;
+    queue << entry(3, 1, RequestScheduler::SynchronizationPriority, 1, 3);
+    QCOMPARE(scheduler.select(queue, active), -1);
+
+    queue << entry(4, 1, RequestScheduler::InteractivePriority, 1, 4);
+    QCOMPARE(scheduler.select(queue, active), 1);
+
+    active << queue.takeAt(1);
+    queue << entry(5, 1, RequestScheduler::InteractivePriority, 1, 5);
+    QCOMPARE(scheduler.select(queue, active), -1);
+}
+
+void tst_RequestScheduler::test_serviceLimit()
+{
+    RequestScheduler scheduler(10, 10);
+
+    QList<Entry> active;
+    active << entry(1, 1, RequestScheduler::SynchronizationPriority, 1, 7)
+           << entry(2, 1, RequestScheduler::SynchronizationPriority, 2, 7);
+
+    QList<Entry> queue;
+    queue << entry(3, 1, RequestScheduler::TransmitPriority, 3, 7)
+          << entry(4, 1, RequestScheduler::TransmitPriority, 4, 8);
+    QCOMPARE(scheduler.select(queue, active), 1);
+}
+
+void tst_RequestScheduler::test_maintenanceLimit()
+{
+    RequestScheduler scheduler(10, 10);
+
+    QList<Entry> active;
+    active << entry(1, 1, RequestScheduler::MaintenancePriority, 1, 1);
+
+    QList<Entry> queue;
+    queue << entry(2, 1, RequestScheduler::MaintenancePriority, 2, 2)
+          << entry(3, 1, RequestScheduler::SynchronizationPriority, 3, 3);
+    QCOMPARE(scheduler.select(queue, active), 1);
+
+    active.clear();
+    QCOMPARE(scheduler.select(queue, active), 1);
+    queue.removeAt(1);
+    QCOMPARE(scheduler.select(queue, active), 0);
+}
+
+void tst_RequestScheduler::test_unavailableServices()
+{
+    RequestScheduler scheduler(2, 1);
+
+    QList<Entry> queue;
+    queue << entry(1, 1, RequestScheduler::InteractivePriority, 1, 1)
+          << entry(2, 1, RequestScheduler::MaintenancePriority, 2, 2);
+    queue[0].ready = false;
+    QCOMPARE(scheduler.select(queue, QList<Entry>()), 1);
+
+    queue[1].ready = false;
+    QCOMPARE(scheduler.select(queue, QList<Entry>()), -1);
+}
+
+void tst_RequestScheduler::test_statistics()
+{
+    RequestScheduler scheduler(2, 1);
+
+    RequestScheduler::Statistics stats(scheduler.statistics(RetrieveMessagesRequestType));
+    QCOMPARE(stats.count, 0);
+    QCOMPARE(stats.totalWait, qint64(0));
+
+    scheduler.recordWait(RetrieveMessagesRequestType, 10);
+    scheduler.recordWait(RetrieveMessagesRequestType, 30);
+    scheduler.recordWait(SynchronizeRequestType, 500);
+
+    stats = scheduler.statistics(RetrieveMessagesRequestType);
+    QCOMPARE(stats.count, 2);
+    QCOMPARE(stats.totalWait, qint64(40));
+    QCOMPARE(stats.maximumWait, qint64(30));
+
+    stats = scheduler.statistics(SynchronizeRequestType);
+    QCOMPARE(stats.count, 1);
+    QCOMPARE(stats.maximumWait, qint64(500));
+}
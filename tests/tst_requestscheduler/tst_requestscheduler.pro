@@ -0,0 +1,13 @@
+TEMPLATE = app
+TARGET = tst_requestscheduler
+CONFIG += qmfclient
+
+MESSAGE_SERVER = ../../src/tools/messageserver
+INCLUDEPATH += $$MESSAGE_SERVER
+
+HEADERS += $$MESSAGE_SERVER/requestscheduler.h
+
+SOURCES += tst_requestscheduler.cpp \
+           $$MESSAGE_SERVER/requestscheduler.cpp
+
+include(../tests.pri)
@@ -31,6 +31,8 @@
 **
 ****************************************************************************/
 
+#include <QDirIterator>
+#include <QFileInfo>
 #include <QObject>
 #include <QTest>
 #include <ctype.h>
@@ -53,9 +55,16 @@ private slots:
     void test_add();
     void test_remove();
     void test_update();
+    void test_sharedParts();
+    void test_shardedLayout();
+    void test_removeBatch();
+    void bench_durableAdd_data();
+    void bench_durableAdd();
 
 private:
     QMailAccountConfiguration makeConfig(const QString &accountName);
+    QMailMessage makePartsMessage(const QMailAccountId &accountId, const QString &serverUid, const QByteArray &text, const QByteArray &attachment);
+    void setSharedParts(const QMailAccountId &accountId, bool enabled);
     QMailAccount account1;
     QMailAccount account2;
 
@@ -262,3 +271,194 @@ void tst_StorageManager::test_update()
 
 }
 
+// A message with a text part and a binary attachment, each stored in its own part file
+QMailMessage tst_StorageManager::makePartsMessage(const QMailAccountId &accountId, const QString &serverUid, const QByteArray &text, const QByteArray &attachment)
+{
+    QMailMessage message;
+    message.setMessageType(QMailMessage::Email);
+    message.setParentAccountId(accountId);
+    message.setParentFolderId(QMailFolder::LocalStorageFolderId);
+    message.setFrom(QMailAddress("newguy@example.org"));
+    message.setTo(QMailAddress("old@example.org"));
+    message.setSubject("message parts test");
+    message.setServerUid(serverUid);
+    message.setCustomField("present", "true");
+    message.setMultipartType(QMailMessagePartContainer::MultipartMixed);
+
+    QMailMessageContentDisposition inlineDisposition(QMailMessageContentDisposition::Inline);
+    message.appendPart(QMailMessagePart::fromData(text, inlineDisposition, QMailMessageContentType("text/plain; charset=us-ascii"), QMailMessageBody::QuotedPrintable));
+
+    QMailMessageContentDisposition attached(QMailMessageContentDisposition::Attachment);
+    attached.setFilename("data.bin");
+    message.appendPart(QMailMessagePart::fromData(attachment, attached, QMailMessageContentType("application/octet-stream"), QMailMessageBody::Base64));
+
+    return message;
+}
+
+void tst_StorageManager::setSharedParts(const QMailAccountId &accountId, bool enabled)
+{
+    QMailAccountConfiguration config(accountId);
+    if (!config.services().contains("qmfstoragemanager")) {
+        config.addServiceConfiguration("qmfstoragemanager");
+        config.serviceConfiguration("qmfstoragemanager").setValue("servicetype", "storage");
+    }
+    config.serviceConfiguration("qmfstoragemanager").setValue("sharedParts", enabled ? "true" : "false");
+    QVERIFY(QMailStore::instance()->updateAccountConfiguration(&config));
+}
+
+static int countFiles(const QString &path)
+{
+    int count = 0;
+    QDirIterator it(path, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        ++count;
+    }
+    return count;
+}
+
+void tst_StorageManager::test_sharedParts()
+{
+#if !defined(Q_OS_UNIX)
+    QSKIP("Shared part content requires hard links");
+#endif
+    setSharedParts(account2.id(), true);
+
+    QByteArray text;
+    // Larger than a single compression chunk
+    while (text.size() < 64 * 1024)
+        text.append("Identical text content is stored only once, in compressed form.\n");
+    QByteArray attachment;
+    for (int i = 0; i < 2048; ++i)
+        attachment.append(char(i * 7 % 251));
+
+    QMailMessage first(makePartsMessage(account2.id(), "shared-parts-1", text, attachment));
+    QMailMessage second(makePartsMessage(account2.id(), "shared-parts-2", text, attachment));
+    QVERIFY(QMailStore::instance()->addMessage(&first));
+    QVERIFY(QMailStore::instance()->addMessage(&second));
+
+    // Blobs are shared by all the shards beneath the base path
+    const QString blobs(QFileInfo(QFileInfo(first.contentIdentifier()).absolutePath()).absolutePath() + "/blobs");
+    QCOMPARE(countFiles(blobs), 2);
+
+    // The compressed text part must be smaller than its content
+    const QString textPath(first.contentIdentifier() + "-parts/" + first.partAt(0).location().toString(false));
+    QVERIFY(QFileInfo(textPath).size() < text.size());
+
+    // Streamed compression keeps the qCompress() format
+    QFile textFile(textPath);
+    QVERIFY(textFile.open(QIODevice::ReadOnly));
+    QCOMPARE(qUncompress(textFile.readAll()), text);
+
+    QMailMessage loaded(first.id());
+    QCOMPARE(loaded.partAt(0).body().data(QMailMessageBody::Decoded), text);
+    QCOMPARE(loaded.partAt(1).body().data(QMailMessageBody::Decoded), attachment);
+
+    // Content is retained while any message still refers to it
+    QVERIFY(QMailStore::instance()->removeMessage(first.id()));
+    QCOMPARE(countFiles(blobs), 2);
+    loaded = QMailMessage(second.id());
+    QCOMPARE(loaded.partAt(0).body().data(QMailMessageBody::Decoded), text);
+    QCOMPARE(loaded.partAt(1).body().data(QMailMessageBody::Decoded), attachment);
+
+    // Compressed content remains readable once sharing is disabled
+    setSharedParts(account2.id(), false);
+    loaded = QMailMessage(second.id());
+    QCOMPARE(loaded.partAt(0).body().data(QMailMessageBody::Decoded), text);
+
+    // Removed content is purged after the removal has been committed
+    QVERIFY(QMailStore::instance()->removeMessage(second.id()));
+    QTRY_COMPARE(countFiles(blobs), 0);
+}
+
+void tst_StorageManager::test_shardedLayout()
+{
+    QMailContentManager *mgr = QMailContentManagerFactory::create(QMailContentManagerFactory::defaultScheme());
+    QVERIFY(mgr);
+
+    QMailMessage message(makePartsMessage(account1.id(), "sharded", "Sharded content", QByteArray(64, 'y')));
+    QCOMPARE(mgr->add(&message, QMailContentManager::EnsureDurability), QMailStore::NoError);
+
+    // New content is placed in a two character shard directory
+    const QFileInfo sharded(message.contentIdentifier());
+    const QString shard(sharded.absoluteDir().dirName());
+    QCOMPARE(shard.length(), 2);
+    QVERIFY(QFile::exists(sharded.absoluteFilePath() + "-parts"));
+
+    // Move the content back to the flat layout used by earlier versions
+    const QString base(QFileInfo(sharded.absolutePath()).absolutePath());
+    const QString flat(base + '/' + sharded.fileName());
+    QVERIFY(QFile::rename(sharded.absoluteFilePath(), flat));
+    QVERIFY(QDir::root().rename(sharded.absoluteFilePath() + "-parts", flat + "-parts"));
+
+    // Content in the flat layout is loaded where it is, since other processes may be reading it
+    QMailMessage loaded;
+    QCOMPARE(mgr->load(flat, &loaded), QMailStore::NoError);
+    QCOMPARE(loaded.partAt(0).body().data(), QString("Sharded content"));
+    QCOMPARE(loaded.partAt(1).body().data(QMailMessageBody::Decoded), QByteArray(64, 'y'));
+    QVERIFY(QFile::exists(flat));
+    QVERIFY(QFile::exists(flat + "-parts"));
+    QVERIFY(!QFile::exists(sharded.absoluteFilePath()));
+
+    QCOMPARE(mgr->remove(flat), QMailStore::NoError);
+    QVERIFY(!QFile::exists(flat));
+    QVERIFY(!QFile::exists(flat + "-parts"));
+}
+
+void tst_StorageManager::test_removeBatch()
+{
+    QMailContentManager *mgr = QMailContentManagerFactory::create(QMailContentManagerFactory::defaultScheme());
+    QVERIFY(mgr);
+    QVERIFY(dynamic_cast<QMailConcurrentRemovalInterface*>(mgr));
+
+    QStringList identifiers;
+    for (int i = 0; i < 20; ++i) {
+        QMailMessage message(makePartsMessage(account1.id(), QString("batch-%1").arg(i), "Batch content", QByteArray(64, 'z')));
+        QCOMPARE(mgr->add(&message, QMailContentManager::NoDurability), QMailStore::NoError);
+        QVERIFY(QFile::exists(message.contentIdentifier() + "-parts"));
+        identifiers.append(message.contentIdentifier());
+    }
+
+    // Content files and their parts are all removed together
+    QCOMPARE(mgr->remove(identifiers), QMailStore::NoError);
+    foreach (const QString &identifier, identifiers) {
+        QVERIFY(!QFile::exists(identifier));
+        QVERIFY(!QFile::exists(identifier + "-parts"));
+    }
+
+    // Content that has already been removed is not an error
+    QCOMPARE(mgr->remove(identifiers), QMailStore::NoError);
+}
+
+void tst_StorageManager::bench_durableAdd_data()
+{
+    QTest::addColumn<bool>("groupCommit");
+
+    QTest::newRow("per message") << false;
+    QTest::newRow("group commit") << true;
+}
+
+void tst_StorageManager::bench_durableAdd()
+{
+    QFETCH(bool, groupCommit);
+
+    QMailContentManager *mgr = QMailContentManagerFactory::create(QMailContentManagerFactory::defaultScheme());
+    QVERIFY(mgr);
+
+    const int count = 100;
+    QByteArray attachment(8192, 'x');
+    QStringList identifiers;
+
+    QBENCHMARK {
+        for (int i = 0; i < count; ++i) {
+            QMailMessage message(makePartsMessage(account1.id(), QString("durable-%1").arg(i), "Durable content", attachment));
+            QCOMPARE(mgr->add(&message, groupCommit ? QMailContentManager::DeferDurability : QMailContentManager::EnsureDurability), QMailStore::NoError);
+            identifiers.append(message.contentIdentifier());
+        }
+        if (groupCommit)
+            QCOMPARE(mgr->ensureDurability(), QMailStore::NoError);
+    }
+
+    foreach (const QString &identifier, identifiers)
+        mgr->remove(identifier);
+}